@@ -1,10 +1,14 @@
+#include <filesystem>
 #include <iostream>
 #include <optional>
 #include <boost/program_options.hpp>
 
 #include <Service/NuRaftLogSnapshot.h>
 #include <Service/ZooKeeperDataReader.h>
+#include <Service/ZooKeeperLogTailer.h>
+#include <Common/Stopwatch.h>
 #include <Common/TerminalSize.h>
+#include <Common/getNumberOfPhysicalCPUCores.h>
 #include <Poco/ConsoleChannel.h>
 #include <Poco/AutoPtr.h>
 #include <Poco/Logger.h>
@@ -22,6 +26,11 @@ int mainEntryRaftKeeperConverter(int argc, char ** argv)
         ("zookeeper-logs-dir", po::value<std::string>(), "Path to directory with ZooKeeper logs")
         ("zookeeper-snapshots-dir", po::value<std::string>(), "Path to directory with ZooKeeper snapshots")
         ("output-dir", po::value<std::string>(), "Directory to place output raftkeeper snapshot")
+        ("threads", po::value<size_t>()->default_value(getNumberOfPhysicalCPUCores()), "Number of threads decoding ZooKeeper logs")
+        ("snapshot-compression-level", po::value<UInt32>()->default_value(0), "Compression level of output snapshot, 0 means no compression")
+        ("follow", "Keep applying ZooKeeper logs as they are written until stop file appears, then do the final catch up and write snapshot")
+        ("follow-interval-ms", po::value<UInt64>()->default_value(1000), "How often to check ZooKeeper logs for new transactions in follow mode")
+        ("stop-file", po::value<std::string>(), "Follow mode stops when this file exists, create it after ZooKeeper stops accepting writes")
     ;
     po::variables_map options;
     po::store(po::command_line_parser(argc, argv).options(desc).run(), options);
@@ -42,12 +51,36 @@ int mainEntryRaftKeeperConverter(int argc, char ** argv)
         RK::KeeperStore store(500);
 
         RK::deserializeKeeperStoreFromSnapshotsDir(store, options["zookeeper-snapshots-dir"].as<std::string>(), logger);
-        RK::deserializeLogsAndApplyToStore(store, options["zookeeper-logs-dir"].as<std::string>(), logger);
+        RK::deserializeLogsAndApplyToStore(
+            store, options["zookeeper-logs-dir"].as<std::string>(), logger, options["threads"].as<size_t>());
+
+        if (options.count("follow"))
+        {
+            if (!options.count("stop-file"))
+            {
+                std::cerr << "Option --stop-file is required in follow mode" << std::endl;
+                return 1;
+            }
+
+            std::string stop_file = options["stop-file"].as<std::string>();
+            LOG_INFO(logger, "Following ZooKeeper logs, create {} to finish", stop_file);
+
+            RK::ZooKeeperLogTailer tailer(store, options["zookeeper-logs-dir"].as<std::string>(), logger);
+            tailer.run([&] { return std::filesystem::exists(stop_file); }, options["follow-interval-ms"].as<UInt64>());
+        }
+
         std::cout << "storage.container.size():" << store.container.size() << std::endl;
         nuraft::ptr<snapshot> new_snapshot
             ( nuraft::cs_new<snapshot>(store.zxid, 1, std::make_shared<nuraft::cluster_config>()) ); // TODO 1 ?
-        nuraft::ptr<KeeperSnapshotManager> snap_mgr = nuraft::cs_new<KeeperSnapshotManager>(options["output-dir"].as<std::string>(), 3600 * 1, KeeperSnapshotStore::MAX_OBJECT_NODE_SIZE);
+        nuraft::ptr<KeeperSnapshotManager> snap_mgr = nuraft::cs_new<KeeperSnapshotManager>(
+            options["output-dir"].as<std::string>(),
+            3600 * 1,
+            KeeperSnapshotStore::MAX_OBJECT_NODE_SIZE,
+            options["snapshot-compression-level"].as<UInt32>());
+
+        Stopwatch watch;
         snap_mgr->createSnapshot(*new_snapshot, store);
+        LOG_INFO(logger, "Serialized {} nodes to snapshot in {} ms", store.container.size(), watch.elapsedMilliseconds());
         std::cout << "Snapshot serialized to path:" << options["output-dir"].as<std::string>() << std::endl;
     }
     catch (...)
@@ -0,0 +1,556 @@
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <boost/program_options.hpp>
+
+#include <Service/NuRaftLogSegment.h>
+#include <Service/NuRaftLogSnapshot.h>
+#include <Common/Exception.h>
+#include <Common/TerminalSize.h>
+#include <Common/ThreadPool.h>
+#include <Common/getNumberOfPhysicalCPUCores.h>
+#include <Poco/AutoPtr.h>
+#include <Poco/ConsoleChannel.h>
+#include <Poco/File.h>
+#include <Poco/Logger.h>
+#include <common/logger_useful.h>
+#include <fmt/format.h>
+
+#ifdef __clang__
+#    pragma clang diagnostic ignored "-Wformat-nonliteral"
+#endif
+
+namespace RK::ErrorCodes
+{
+    extern const int CORRUPTED_DATA;
+}
+
+/// Offline inspection of raft log segments and snapshots. Nothing is modified and the data tree
+/// is never loaded as a whole: objects and segments are verified one by one in parallel, and
+/// snapshots are compared by small digests of nodes one partition of paths at a time, so that
+/// only digests of the partition are in memory. Every partition reads all objects again.
+
+namespace
+{
+
+using namespace RK;
+
+/// Keep the `top` heaviest items in a min heap
+template <typename T>
+void pushTop(std::vector<std::pair<UInt64, T>> & heap, UInt64 weight, const T & item, size_t top)
+{
+    if (heap.size() < top)
+    {
+        heap.emplace_back(weight, item);
+        std::push_heap(heap.begin(), heap.end(), std::greater<>());
+    }
+    else if (top > 0 && weight > heap.front().first)
+    {
+        std::pop_heap(heap.begin(), heap.end(), std::greater<>());
+        heap.back() = {weight, item};
+        std::push_heap(heap.begin(), heap.end(), std::greater<>());
+    }
+}
+
+template <typename T>
+std::vector<std::pair<UInt64, T>> sortedTop(std::vector<std::pair<UInt64, T>> heap)
+{
+    std::sort(heap.begin(), heap.end(), std::greater<>());
+    return heap;
+}
+
+struct SegmentFile
+{
+    String path;
+    String name;
+    UInt64 first_index = 0;
+    /// 0 for open segment
+    UInt64 last_index = 0;
+    bool is_open = false;
+};
+
+bool verifyLogs(const String & log_dir, size_t threads)
+{
+    std::vector<String> files;
+    Poco::File(log_dir).list(files);
+
+    std::vector<SegmentFile> segments;
+    for (const auto & file : files)
+    {
+        SegmentFile segment{log_dir + "/" + file, file};
+        char create_time[128];
+        if (sscanf(file.c_str(), NuRaftLogSegment::LOG_FINISH_FILE_NAME, &segment.first_index, &segment.last_index, create_time) == 3)
+            segments.push_back(segment);
+        else if (sscanf(file.c_str(), NuRaftLogSegment::LOG_OPEN_FILE_NAME, &segment.first_index, create_time) == 2)
+        {
+            segment.is_open = true;
+            segments.push_back(segment);
+        }
+    }
+    std::sort(segments.begin(), segments.end(), [](const auto & a, const auto & b) { return a.first_index < b.first_index; });
+
+    std::vector<LogSegmentVerifyResult> results(segments.size());
+    std::vector<String> errors(segments.size());
+
+    ThreadPool pool(threads);
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        pool.scheduleOrThrowOnError([&, i] {
+            try
+            {
+                if (!NuRaftLogSegment::verifyFile(segments[i].path, results[i]))
+                    errors[i] = fmt::format("corrupted entry at offset {}", results[i].corrupted_offset);
+                else if (results[i].truncated && !segments[i].is_open)
+                    errors[i] = "last entry is truncated";
+                else if (!segments[i].is_open && results[i].entries && results[i].last_index != segments[i].last_index)
+                    errors[i] = fmt::format("last index {} does not match file name", results[i].last_index);
+                else if (results[i].entries && results[i].first_index != segments[i].first_index)
+                    errors[i] = fmt::format("first index {} does not match file name", results[i].first_index);
+            }
+            catch (...)
+            {
+                errors[i] = getCurrentExceptionMessage(false);
+            }
+        });
+    }
+    pool.wait();
+
+    bool ok = true;
+    UInt64 total_entries = 0;
+    UInt64 total_bytes = 0;
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        const auto & result = results[i];
+        if (i > 0 && results[i - 1].entries && result.entries && result.first_index != results[i - 1].last_index + 1)
+            errors[i] += fmt::format("{}gap after index {}", errors[i].empty() ? "" : ", ", results[i - 1].last_index);
+
+        std::cout << segments[i].name << "\tversion " << static_cast<int>(result.version) << "\tentries " << result.entries << "\tindex ["
+                  << result.first_index << ", " << result.last_index << "]\tbytes " << result.file_size
+                  << (result.truncated ? "\ttruncated tail" : "") << "\t" << (errors[i].empty() ? "OK" : "ERROR: " + errors[i])
+                  << std::endl;
+
+        ok &= errors[i].empty();
+        total_entries += result.entries;
+        total_bytes += result.file_size;
+    }
+
+    std::cout << "Log segments " << segments.size() << ", entries " << total_entries << ", bytes " << total_bytes << ", "
+              << (ok ? "all OK" : "CORRUPTED") << std::endl;
+    return ok;
+}
+
+struct ObjectStats
+{
+    UInt64 file_size = 0;
+    UInt64 nodes = 0;
+    UInt64 deleted_paths = 0;
+    UInt64 data_bytes = 0;
+    UInt64 ephemeral_nodes = 0;
+    /// Number of batches in the footer index, objects before V3 have no index
+    std::optional<int> indexed_batches;
+    std::vector<std::pair<UInt64, String>> largest_nodes;
+    std::unordered_map<int64_t, UInt64> ephemeral_owners;
+    String error;
+};
+
+bool inspectSnapshot(KeeperSnapshotStore & snapshot, size_t threads, size_t top)
+{
+    /// Snapshot received from leader is stored with the delta snapshots it is made of,
+    /// nodes changed by deltas are counted apart from nodes of the full snapshot.
+    auto layers = snapshot.getObjectLayers();
+    std::vector<String> paths;
+    std::vector<bool> is_delta;
+    for (const auto & layer : layers)
+    {
+        paths.insert(paths.end(), layer.paths.begin(), layer.paths.end());
+        is_delta.resize(paths.size(), layer.is_delta);
+    }
+
+    std::vector<ObjectStats> stats(paths.size());
+    ThreadPool pool(threads);
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        pool.scheduleOrThrowOnError([&, i] {
+            auto & object = stats[i];
+            try
+            {
+                object.file_size = Poco::File(paths[i]).getSize();
+                SnapshotIndexPB index;
+                if (snapshot.loadObjectIndex(paths[i], index))
+                    object.indexed_batches = index.batches_size();
+                bool ok = snapshot.scanObject(paths[i], [&](const String & path, const KeeperNode * node) {
+                    if (!node)
+                    {
+                        ++object.deleted_paths;
+                        return;
+                    }
+                    ++object.nodes;
+                    object.data_bytes += node->getData().size();
+                    pushTop(object.largest_nodes, node->getData().size(), path, top);
+                    if (Coordination::isSessionEphemeralOwner(node->stat.ephemeralOwner))
+                    {
+                        ++object.ephemeral_nodes;
+                        ++object.ephemeral_owners[node->stat.ephemeralOwner];
+                    }
+                });
+                if (!ok)
+                    object.error = "corrupted batch";
+            }
+            catch (...)
+            {
+                object.error = getCurrentExceptionMessage(false);
+            }
+        });
+    }
+    pool.wait();
+
+    ObjectStats total;
+    UInt64 delta_nodes = 0;
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        const auto & object = stats[i];
+        std::cout << paths[i] << "\tbytes " << object.file_size << "\tnodes " << object.nodes << "\tdeleted " << object.deleted_paths
+                  << "\tdata bytes " << object.data_bytes << "\tephemerals " << object.ephemeral_nodes << "\tindexed batches "
+                  << (object.indexed_batches ? std::to_string(*object.indexed_batches) : "-") << "\t"
+                  << (object.error.empty() ? "OK" : "ERROR: " + object.error) << std::endl;
+
+        total.file_size += object.file_size;
+        (is_delta[i] ? delta_nodes : total.nodes) += object.nodes;
+        total.deleted_paths += object.deleted_paths;
+        total.data_bytes += object.data_bytes;
+        total.ephemeral_nodes += object.ephemeral_nodes;
+        for (const auto & [size, path] : object.largest_nodes)
+            pushTop(total.largest_nodes, size, path, top);
+        for (const auto & [owner, count] : object.ephemeral_owners)
+            total.ephemeral_owners[owner] += count;
+        if (!object.error.empty())
+            total.error = "CORRUPTED";
+    }
+
+    auto meta = snapshot.getSnapshot();
+    std::cout << "Snapshot last log index " << meta->get_last_log_idx() << ", base log index " << snapshot.getBaseLogIndex()
+              << ", objects " << paths.size() << ", bytes " << total.file_size << ", nodes " << total.nodes;
+    if (layers.size() > 1)
+        std::cout << ", delta snapshots " << layers.size() - 1 << ", changed by them " << delta_nodes;
+    std::cout << ", deleted " << total.deleted_paths << ", data bytes " << total.data_bytes << ", ephemerals " << total.ephemeral_nodes
+              << ", " << (total.error.empty() ? "all OK" : total.error) << std::endl;
+
+    if (top > 0)
+    {
+        std::cout << "Largest nodes:" << std::endl;
+        for (const auto & [size, path] : sortedTop(total.largest_nodes))
+            std::cout << "\t" << size << "\t" << path << std::endl;
+
+        std::vector<std::pair<UInt64, int64_t>> owners;
+        for (const auto & [owner, count] : total.ephemeral_owners)
+            pushTop(owners, count, owner, top);
+        std::cout << "Ephemeral owners:" << std::endl;
+        for (const auto & [count, owner] : sortedTop(owners))
+            std::cout << "\t0x" << std::hex << owner << std::dec << "\t" << count << std::endl;
+    }
+
+    return total.error.empty();
+}
+
+struct NodeDigest
+{
+    size_t data_hash;
+    UInt64 acl_id;
+    Coordination::Stat stat;
+
+    bool operator==(const NodeDigest & other) const
+    {
+        const auto & a = stat;
+        const auto & b = other.stat;
+        return data_hash == other.data_hash && acl_id == other.acl_id && a.czxid == b.czxid && a.mzxid == b.mzxid
+            && a.ctime == b.ctime && a.mtime == b.mtime && a.version == b.version && a.cversion == b.cversion
+            && a.aversion == b.aversion && a.ephemeralOwner == b.ephemeralOwner && a.dataLength == b.dataLength
+            && a.numChildren == b.numChildren && a.pzxid == b.pzxid;
+    }
+};
+
+using NodeDigests = std::unordered_map<String, NodeDigest>;
+
+/// Digests sharded by path hash, so that objects are scanned and shards are compared concurrently.
+struct ShardedDigests
+{
+    explicit ShardedDigests(size_t shards_) : shards(shards_), mutexes(shards_) { }
+
+    std::vector<NodeDigests> shards;
+    std::vector<std::mutex> mutexes;
+};
+
+/// Scan every object of the chain and put digests of nodes of the partition into shards by path hash.
+/// Snapshots and layers of delta snapshots they are made of are applied in order, so that the later one
+/// wins. A path is in at most one object of a layer, objects of a layer are scanned in parallel.
+void collectDigests(
+    const std::vector<ptr<KeeperSnapshotStore>> & chain, size_t threads, size_t partition, size_t partitions, ShardedDigests & digests)
+{
+    std::hash<String> hasher;
+    for (const auto & snapshot : chain)
+    {
+        for (const auto & layer : snapshot->getObjectLayers())
+        {
+            const auto & obj_paths = layer.paths;
+            std::vector<String> errors(obj_paths.size());
+            ThreadPool pool(threads);
+            for (size_t i = 0; i < obj_paths.size(); ++i)
+            {
+                pool.scheduleOrThrowOnError([&, i] {
+                    try
+                    {
+                        bool ok = snapshot->scanObject(obj_paths[i], [&](const String & path, const KeeperNode * node) {
+                            size_t hash = hasher(path);
+                            if (hash % partitions != partition)
+                                return;
+                            size_t shard = hash / partitions % digests.shards.size();
+                            std::lock_guard lock(digests.mutexes[shard]);
+                            if (node)
+                                digests.shards[shard][path] = NodeDigest{hasher(node->getData()), node->acl_id, node->stat};
+                            else
+                                digests.shards[shard].erase(path);
+                        });
+                        if (!ok)
+                            errors[i] = "corrupted batch";
+                    }
+                    catch (...)
+                    {
+                        errors[i] = getCurrentExceptionMessage(false);
+                    }
+                });
+            }
+            pool.wait();
+
+            for (size_t i = 0; i < obj_paths.size(); ++i)
+                if (!errors[i].empty())
+                    throw Exception(ErrorCodes::CORRUPTED_DATA, "Snapshot object {} is corrupted: {}", obj_paths[i], errors[i]);
+        }
+    }
+}
+
+std::vector<ptr<KeeperSnapshotStore>> getChain(KeeperSnapshotManager & manager, UInt64 last_log_index, const String & dir)
+{
+    if (last_log_index == 0)
+    {
+        if (manager.getSnapshots().empty())
+            throw Exception(ErrorCodes::CORRUPTED_DATA, "No snapshot in {}", dir);
+        last_log_index = manager.getSnapshots().rbegin()->first;
+    }
+    auto chain = manager.getSnapshotChain(last_log_index);
+    if (chain.empty())
+        throw Exception(ErrorCodes::CORRUPTED_DATA, "Snapshot {} in {} is missing or its chain is broken", last_log_index, dir);
+    return chain;
+}
+
+/// Look up the path by batch index of objects without loading the snapshot, later snapshot of the chain wins.
+/// Return false if the path does not exist.
+bool printNode(const std::vector<ptr<KeeperSnapshotStore>> & chain, const String & path)
+{
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+    {
+        std::shared_ptr<KeeperNode> node;
+        if (!(*it)->findNode(path, node))
+            continue;
+
+        auto last_log_index = (*it)->getSnapshot()->get_last_log_idx();
+        if (!node)
+        {
+            std::cout << path << " is removed in snapshot " << last_log_index << std::endl;
+            return false;
+        }
+
+        const auto & stat = node->stat;
+        std::cout << path << " found in snapshot " << last_log_index << std::endl
+                  << "\tczxid " << stat.czxid << "\tmzxid " << stat.mzxid << "\tpzxid " << stat.pzxid << std::endl
+                  << "\tctime " << stat.ctime << "\tmtime " << stat.mtime << std::endl
+                  << "\tversion " << stat.version << "\tcversion " << stat.cversion << "\taversion " << stat.aversion << std::endl
+                  << "\tephemeralOwner 0x" << std::hex << stat.ephemeralOwner << std::dec << "\tnumChildren " << stat.numChildren
+                  << "\tacl id " << node->acl_id << std::endl
+                  << "\tdata length " << node->getData().size() << std::endl;
+        return true;
+    }
+    std::cout << path << " is not found" << std::endl;
+    return false;
+}
+
+/// Return false if snapshots differ
+bool diffSnapshots(
+    const std::vector<ptr<KeeperSnapshotStore>> & left,
+    const std::vector<ptr<KeeperSnapshotStore>> & right,
+    size_t threads,
+    size_t partitions,
+    size_t max_diff)
+{
+    std::vector<String> all_diffs;
+    std::atomic<UInt64> only_left{0};
+    std::atomic<UInt64> only_right{0};
+    std::atomic<UInt64> changed{0};
+
+    /// Only digests of one partition are in memory, every partition reads all objects again.
+    for (size_t partition = 0; partition < partitions; ++partition)
+    {
+        ShardedDigests left_digests(threads);
+        ShardedDigests right_digests(threads);
+        collectDigests(left, threads, partition, partitions, left_digests);
+        collectDigests(right, threads, partition, partitions, right_digests);
+
+        std::vector<std::vector<String>> diffs(threads);
+        std::vector<String> errors(threads);
+
+        ThreadPool pool(threads);
+        for (size_t shard = 0; shard < threads; ++shard)
+        {
+            pool.scheduleOrThrowOnError([&, shard] {
+                try
+                {
+                    const auto & left_shard = left_digests.shards[shard];
+                    const auto & right_shard = right_digests.shards[shard];
+
+                    auto & shard_diffs = diffs[shard];
+                    for (const auto & [path, digest] : left_shard)
+                    {
+                        auto it = right_shard.find(path);
+                        if (it == right_shard.end())
+                        {
+                            ++only_left;
+                            if (shard_diffs.size() < max_diff)
+                                shard_diffs.push_back("-\t" + path);
+                        }
+                        else if (!(it->second == digest))
+                        {
+                            ++changed;
+                            if (shard_diffs.size() < max_diff)
+                                shard_diffs.push_back("~\t" + path);
+                        }
+                    }
+                    for (const auto & [path, _] : right_shard)
+                    {
+                        if (!left_shard.contains(path))
+                        {
+                            ++only_right;
+                            if (shard_diffs.size() < max_diff)
+                                shard_diffs.push_back("+\t" + path);
+                        }
+                    }
+                }
+                catch (...)
+                {
+                    errors[shard] = getCurrentExceptionMessage(false);
+                }
+            });
+        }
+        pool.wait();
+
+        for (const auto & error : errors)
+            if (!error.empty())
+                throw Exception(ErrorCodes::CORRUPTED_DATA, "Cannot diff snapshots: {}", error);
+
+        for (auto & shard_diffs : diffs)
+            all_diffs.insert(all_diffs.end(), shard_diffs.begin(), shard_diffs.end());
+        std::sort(all_diffs.begin(), all_diffs.end(), [](const String & a, const String & b) { return a.substr(2) < b.substr(2); });
+        if (all_diffs.size() > max_diff)
+            all_diffs.resize(max_diff);
+    }
+
+    for (const auto & diff : all_diffs)
+        std::cout << diff << std::endl;
+
+    std::cout << "Only in left " << only_left.load() << ", only in right " << only_right.load() << ", changed " << changed.load()
+              << std::endl;
+    return only_left == 0 && only_right == 0 && changed == 0;
+}
+
+}
+
+int mainEntryRaftKeeperInspector(int argc, char ** argv)
+{
+    using namespace RK;
+    namespace po = boost::program_options;
+
+    po::options_description desc = createOptionsDescription("Allowed options", getTerminalWidth());
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("log-dir", po::value<std::string>(), "Verify all raft log segments in the directory")
+        ("snapshot-dir", po::value<std::string>(), "Verify snapshots in the directory and print statistics of their objects")
+        ("snapshot-index", po::value<UInt64>()->default_value(0), "Last log index of snapshot to inspect, 0 means all snapshots, or the latest one for diff")
+        ("path", po::value<std::string>(), "Print stat of the node in snapshot of --snapshot-dir, located by batch index of objects")
+        ("diff-snapshot-dir", po::value<std::string>(), "Compare snapshot of --snapshot-dir with snapshot in this directory")
+        ("diff-snapshot-index", po::value<UInt64>()->default_value(0), "Last log index of snapshot to compare with, 0 means the latest one")
+        ("diff-partitions", po::value<size_t>()->default_value(4), "Snapshots are compared one partition of paths by hash at a time, more partitions use less memory but read objects more times")
+        ("max-diff", po::value<size_t>()->default_value(100), "Max number of different paths to print")
+        ("top", po::value<size_t>()->default_value(10), "Number of largest nodes and ephemeral owners to print")
+        ("threads", po::value<size_t>()->default_value(getNumberOfPhysicalCPUCores()), "Number of threads")
+    ;
+    po::variables_map options;
+    po::store(po::command_line_parser(argc, argv).options(desc).run(), options);
+    Poco::AutoPtr<Poco::ConsoleChannel> console_channel(new Poco::ConsoleChannel);
+
+    Poco::Logger * logger = &Poco::Logger::get("RaftKeeperInspector");
+    logger->setChannel(console_channel);
+    /// Keep output of the tool readable
+    Poco::Logger::root().setLevel("warning");
+
+    if (options.count("help") || (!options.count("log-dir") && !options.count("snapshot-dir")))
+    {
+        std::cout << "Usage: " << argv[0] << " --log-dir /var/lib/raftkeeper/data/log --snapshot-dir /var/lib/raftkeeper/data/snapshot" << std::endl;
+        std::cout << "Exit code is 1 if any corruption is found, 2 if compared snapshots differ or the path is not found" << std::endl;
+        std::cout << desc << std::endl;
+        return 0;
+    }
+
+    size_t threads = std::max(options["threads"].as<size_t>(), size_t(1));
+    size_t top = options["top"].as<size_t>();
+    bool ok = true;
+
+    try
+    {
+        if (options.count("log-dir"))
+            ok &= verifyLogs(options["log-dir"].as<std::string>(), threads);
+
+        if (options.count("snapshot-dir"))
+        {
+            auto snapshot_dir = options["snapshot-dir"].as<std::string>();
+            KeeperSnapshotManager manager(snapshot_dir, 0, KeeperSnapshotStore::MAX_OBJECT_NODE_SIZE);
+            manager.loadSnapshotMetas();
+
+            UInt64 snapshot_index = options["snapshot-index"].as<UInt64>();
+
+            if (options.count("path"))
+            {
+                auto chain = getChain(manager, snapshot_index, snapshot_dir);
+                if (!printNode(chain, options["path"].as<std::string>()))
+                    return ok ? 2 : 1;
+            }
+            else if (options.count("diff-snapshot-dir"))
+            {
+                auto diff_snapshot_dir = options["diff-snapshot-dir"].as<std::string>();
+                KeeperSnapshotManager diff_manager(diff_snapshot_dir, 0, KeeperSnapshotStore::MAX_OBJECT_NODE_SIZE);
+                diff_manager.loadSnapshotMetas();
+
+                auto left = getChain(manager, snapshot_index, snapshot_dir);
+                auto right = getChain(diff_manager, options["diff-snapshot-index"].as<UInt64>(), diff_snapshot_dir);
+                std::cout << "Compare snapshot " << left.back()->getSnapshot()->get_last_log_idx() << " with "
+                          << right.back()->getSnapshot()->get_last_log_idx() << std::endl;
+
+                size_t partitions = std::max(options["diff-partitions"].as<size_t>(), size_t(1));
+                if (!diffSnapshots(left, right, threads, partitions, options["max-diff"].as<size_t>()))
+                    return ok ? 2 : 1;
+            }
+            else
+            {
+                for (const auto & [last_log_index, snapshot] : manager.getSnapshots())
+                    if (snapshot_index == 0 || snapshot_index == last_log_index)
+                        ok &= inspectSnapshot(*snapshot, threads, top);
+            }
+        }
+    }
+    catch (...)
+    {
+        std::cerr << getCurrentExceptionMessage(true) << '\n';
+        return 1;
+    }
+
+    return ok ? 0 : 1;
+}
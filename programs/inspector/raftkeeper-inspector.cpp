@@ -0,0 +1,2 @@
+int mainEntryRaftKeeperInspector(int argc, char ** argv);
+int main(int argc_, char ** argv_) { return mainEntryRaftKeeperInspector(argc_, argv_); }
@@ -19,6 +19,7 @@
 
 int mainEntryRaftKeeperServer(int argc, char ** argv);
 int mainEntryRaftKeeperConverter(int argc, char ** argv);
+int mainEntryRaftKeeperInspector(int argc, char ** argv);
 
 
 #define ARRAY_SIZE(a) (sizeof(a)/sizeof((a)[0]))
@@ -34,6 +35,7 @@ std::pair<const char *, MainFunc> raftkeeper_applications[] =
 {
     {"server", mainEntryRaftKeeperServer},
     {"converter", mainEntryRaftKeeperConverter},
+    {"inspector", mainEntryRaftKeeperInspector},
 };
 
 
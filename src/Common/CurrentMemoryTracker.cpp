@@ -20,6 +20,11 @@ MemoryTracker * getMemoryTracker()
     return nullptr;
 }
 
+#ifndef NDEBUG
+/// For tests only, not counted in release builds to keep allocation cheap
+thread_local UInt64 thread_allocations = 0;
+#endif
+
 }
 
 namespace CurrentMemoryTracker
@@ -29,6 +34,10 @@ using RK::current_thread;
 
 void alloc(Int64 size)
 {
+#ifndef NDEBUG
+    ++thread_allocations;
+#endif
+
     if (auto * memory_tracker = getMemoryTracker())
     {
         if (current_thread)
@@ -51,6 +60,15 @@ void alloc(Int64 size)
     }
 }
 
+UInt64 getThreadAllocations()
+{
+#ifndef NDEBUG
+    return thread_allocations;
+#else
+    return 0;
+#endif
+}
+
 void realloc(Int64 old_size, Int64 new_size)
 {
     Int64 addition = new_size - old_size;
@@ -8,4 +8,8 @@ namespace CurrentMemoryTracker
     void alloc(Int64 size);
     void realloc(Int64 old_size, Int64 new_size);
     void free(Int64 size);
+
+    /// Number of allocations made by the current thread so far, for tests. Counted in debug builds
+    /// only, allocations by operator new only if it is replaced by the one from new_delete.cpp.
+    UInt64 getThreadAllocations();
 }
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <Common/SmallObjectPool.h>
+#include <common/defines.h>
+#include <common/unaligned.h>
+
+
+namespace RK
+{
+
+/// SmallObjectPool which can be shared by threads. Objects are moved in batches
+/// linked through their first bytes, so threads rarely take the lock.
+class ConcurrentSmallObjectPool
+{
+public:
+    explicit ConcurrentSmallObjectPool(size_t object_size_) : pool(object_size_) { }
+
+    /// Returns a list of `count` objects.
+    char * allocBatch(size_t count)
+    {
+        std::lock_guard lock(mutex);
+        char * head = nullptr;
+        for (size_t i = 0; i < count; ++i)
+        {
+            char * ptr = pool.alloc();
+            unalignedStore<char *>(ptr, head);
+            head = ptr;
+        }
+        return head;
+    }
+
+    /// Takes back the first `count` objects of the list and returns the rest of it.
+    char * freeBatch(char * head, size_t count)
+    {
+        std::lock_guard lock(mutex);
+        for (size_t i = 0; i < count && head; ++i)
+        {
+            char * next = unalignedLoad<char *>(head);
+            pool.free(head);
+            head = next;
+        }
+        return head;
+    }
+
+    /// The size of the allocated pool in bytes
+    size_t size() const
+    {
+        std::lock_guard lock(mutex);
+        return pool.size();
+    }
+
+private:
+    mutable std::mutex mutex;
+    SmallObjectPool pool;
+};
+
+
+/** STL allocator which takes single objects of type T from a pool shared by all
+  * objects of the type, and returns them to the pool rather than to the heap.
+  * Arrays fall back to operator new.
+  *
+  * Every thread keeps its own free list in front of the shared pool. It is
+  * refilled by BATCH_SIZE objects and gives BATCH_SIZE objects back once it holds
+  * MAX_THREAD_OBJECTS, so objects allocated by one thread and freed by another
+  * (e.g. responses) return to the shared pool. The list is given back on thread exit.
+  *
+  * Used with std::allocate_shared, T is the control block holding the object,
+  * so every object type gets its own free list. The memory of a pool is never
+  * released, it is kept at the peak number of live objects of the type.
+  */
+template <typename T>
+class PooledAllocator
+{
+public:
+    using value_type = T;
+
+    static constexpr size_t BATCH_SIZE = 64;
+    static constexpr size_t MAX_THREAD_OBJECTS = 2 * BATCH_SIZE;
+
+    PooledAllocator() = default;
+
+    template <typename U>
+    PooledAllocator(const PooledAllocator<U> &) noexcept { } /// NOLINT
+
+    T * allocate(size_t n)
+    {
+        if (n != 1)
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+
+        auto & cache = thread_cache;
+        if (unlikely(!cache.head))
+        {
+            if (unlikely(cache.exited))
+                return reinterpret_cast<T *>(getPool().allocBatch(1));
+            registerThreadCache();
+            cache.head = getPool().allocBatch(BATCH_SIZE);
+            cache.size = BATCH_SIZE;
+        }
+
+        char * res = cache.head;
+        cache.head = unalignedLoad<char *>(res);
+        --cache.size;
+        return reinterpret_cast<T *>(res);
+    }
+
+    void deallocate(T * ptr, size_t n) noexcept
+    {
+        if (n != 1)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+
+        auto & cache = thread_cache;
+        if (unlikely(cache.exited))
+        {
+            getPool().freeBatch(reinterpret_cast<char *>(ptr), 1);
+            return;
+        }
+
+        if (unlikely(!cache.head))
+            registerThreadCache();
+
+        unalignedStore<char *>(ptr, cache.head);
+        cache.head = reinterpret_cast<char *>(ptr);
+        if (unlikely(++cache.size >= MAX_THREAD_OBJECTS))
+        {
+            cache.head = getPool().freeBatch(cache.head, BATCH_SIZE);
+            cache.size -= BATCH_SIZE;
+        }
+    }
+
+    static ConcurrentSmallObjectPool & getPool()
+    {
+        /// Arena chunks are aligned by 16 bytes, keep every object in the chunk aligned as well.
+        static_assert(alignof(T) <= alignof(std::max_align_t), "Over-aligned types are not supported by PooledAllocator");
+        static constexpr size_t object_size = (sizeof(T) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+        /// Leaked intentionally, objects may be returned to it during static destruction.
+        static auto * pool = new ConcurrentSmallObjectPool(object_size);
+        return *pool;
+    }
+
+    template <typename U>
+    bool operator==(const PooledAllocator<U> &) const noexcept { return true; }
+
+    template <typename U>
+    bool operator!=(const PooledAllocator<U> &) const noexcept { return false; }
+
+private:
+    /// Trivially destructible, so it stays usable after the destructor of ThreadCacheReturner,
+    /// objects may be freed by destructors of other thread locals.
+    struct ThreadCache
+    {
+        char * head = nullptr;
+        size_t size = 0;
+        bool exited = false;
+    };
+
+    /// Gives the free list of the thread back to the shared pool on thread exit.
+    struct ThreadCacheReturner
+    {
+        ~ThreadCacheReturner()
+        {
+            auto & cache = thread_cache;
+            getPool().freeBatch(cache.head, cache.size);
+            cache.head = nullptr;
+            cache.size = 0;
+            cache.exited = true;
+        }
+    };
+
+    static void registerThreadCache()
+    {
+        /// Constructed on first use only, keeps the hot path free of the thread local guard.
+        static thread_local ThreadCacheReturner returner;
+        (void)returner;
+    }
+
+    static inline thread_local ThreadCache thread_cache;
+};
+
+/// Like std::make_shared, but the object and its control block are taken from the pool of the type.
+template <typename T, typename... Args>
+std::shared_ptr<T> makePooled(Args &&... args)
+{
+    return std::allocate_shared<T>(PooledAllocator<T>(), std::forward<Args>(args)...);
+}
+
+}
@@ -110,6 +110,8 @@ const char * errorMessage(Error code)
         case Error::ZCLOSING:                 return "ZooKeeper is closing";
         case Error::ZNOTHING:                 return "(not error) no server responses to process";
         case Error::ZSESSIONMOVED:            return "Session moved to another server, so operation is ignored";
+        case Error::ZNOWATCHER:               return "No watcher";
+        case Error::ZQUOTAEXCEEDED:           return "Quota exceeded";
     }
 
     __builtin_unreachable();
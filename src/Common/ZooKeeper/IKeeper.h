@@ -130,7 +130,9 @@ enum class Error : int32_t
     ZAUTHFAILED = -115,                 /// Client authentication failed
     ZCLOSING = -116,                    /// ZooKeeper is closing
     ZNOTHING = -117,                    /// (not error) no server responses to process
-    ZSESSIONMOVED = -118                /// Session moved to another server, so operation is ignored
+    ZSESSIONMOVED = -118,               /// Session moved to another server, so operation is ignored
+    ZNOWATCHER = -121,                  /// The watcher couldn't be found
+    ZQUOTAEXCEEDED = -125               /// Exceeded the quota that was set on the path
 };
 
 /// Network errors and similar. You should reinitialize ZooKeeper session in case of these errors
@@ -4,6 +4,7 @@
 #include <IO/WriteBufferFromString.h>
 #include <IO/Operators.h>
 #include <IO/ReadHelpers.h>
+#include <Common/PooledAllocator.h>
 #include <common/logger_useful.h>
 #include <array>
 
@@ -13,13 +14,18 @@ namespace Coordination
 
 using namespace RK;
 
+void ZooKeeperResponse::writeHeader(WriteBuffer & out) const
+{
+    Coordination::write(xid, out);
+    Coordination::write(zxid, out);
+    Coordination::write(error, out);
+}
+
 void ZooKeeperResponse::write(WriteBuffer & out) const
 {
     /// Excessive copy to calculate length.
     WriteBufferFromOwnString buf;
-    Coordination::write(xid, buf);
-    Coordination::write(zxid, buf);
-    Coordination::write(error, buf);
+    writeHeader(buf);
     if (error == Error::ZOK)
         writeImpl(buf);
     Coordination::write(buf.str(), out);
@@ -78,6 +84,73 @@ void ZooKeeperWatchResponse::write(WriteBuffer & out) const
     /// skip bad responses for watches
 }
 
+std::shared_ptr<const String> ZooKeeperWatchResponse::getSerialized() const
+{
+    std::call_once(serialize_once, [this]
+    {
+        WriteBufferFromOwnString buf;
+        write(buf);
+        serialized = std::make_shared<const String>(std::move(buf.str()));
+    });
+    return serialized;
+}
+
+void ZooKeeperAddWatchRequest::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(path, out);
+    Coordination::write(mode, out);
+}
+
+void ZooKeeperAddWatchRequest::readImpl(ReadBuffer & in)
+{
+    Coordination::read(path, in);
+    Coordination::read(mode, in);
+}
+
+void ZooKeeperAddWatchResponse::readImpl(ReadBuffer & in)
+{
+    int32_t error_read;
+    Coordination::read(error_read, in);
+}
+
+void ZooKeeperAddWatchResponse::writeImpl(WriteBuffer & out) const
+{
+    int32_t error_write = 0;
+    Coordination::write(error_write, out);
+}
+
+void ZooKeeperRemoveWatchesRequest::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(path, out);
+    Coordination::write(type, out);
+}
+
+void ZooKeeperRemoveWatchesRequest::readImpl(ReadBuffer & in)
+{
+    Coordination::read(path, in);
+    Coordination::read(type, in);
+}
+
+void ZooKeeperGetAllChildrenNumberRequest::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(path, out);
+}
+
+void ZooKeeperGetAllChildrenNumberRequest::readImpl(ReadBuffer & in)
+{
+    Coordination::read(path, in);
+}
+
+void ZooKeeperGetAllChildrenNumberResponse::readImpl(ReadBuffer & in)
+{
+    Coordination::read(total_number, in);
+}
+
+void ZooKeeperGetAllChildrenNumberResponse::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(total_number, out);
+}
+
 void ZooKeeperAuthRequest::writeImpl(WriteBuffer & out) const
 {
     Coordination::write(type, out);
@@ -100,10 +173,17 @@ void ZooKeeperCreateRequest::writeImpl(WriteBuffer & out) const
 
     int32_t flags = 0;
 
-    if (is_ephemeral)
-        flags |= 1;
-    if (is_sequential)
-        flags |= 2;
+    if (is_ttl)
+        flags = is_sequential ? 6 : 5;
+    else if (is_container)
+        flags = 4;
+    else
+    {
+        if (is_ephemeral)
+            flags |= 1;
+        if (is_sequential)
+            flags |= 2;
+    }
 
     Coordination::write(flags, out);
 }
@@ -117,10 +197,23 @@ void ZooKeeperCreateRequest::readImpl(ReadBuffer & in)
     int32_t flags = 0;
     Coordination::read(flags, in);
 
-    if (flags & 1)
-        is_ephemeral = true;
-    if (flags & 2)
-        is_sequential = true;
+    /// The same as ZooKeeper CreateMode, 4 is container, 5 and 6 are persistent and persistent sequential with TTL
+    is_ephemeral = flags == 1 || flags == 3;
+    is_sequential = flags == 2 || flags == 3 || flags == 6;
+    is_container = flags == 4;
+    is_ttl = flags == 5 || flags == 6;
+}
+
+void ZooKeeperCreateTTLRequest::writeImpl(WriteBuffer & out) const
+{
+    ZooKeeperCreateRequest::writeImpl(out);
+    Coordination::write(ttl, out);
+}
+
+void ZooKeeperCreateTTLRequest::readImpl(ReadBuffer & in)
+{
+    ZooKeeperCreateRequest::readImpl(in);
+    Coordination::read(ttl, in);
 }
 
 void ZooKeeperCreateResponse::readImpl(ReadBuffer & in)
@@ -133,6 +226,28 @@ void ZooKeeperCreateResponse::writeImpl(WriteBuffer & out) const
     Coordination::write(path_created, out);
 }
 
+void ZooKeeperCreate2Response::readImpl(ReadBuffer & in)
+{
+    Coordination::read(path_created, in);
+    Coordination::read(stat, in);
+}
+
+void ZooKeeperCreate2Response::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(path_created, out);
+    Coordination::write(stat, out);
+}
+
+void ZooKeeperDeleteContainerRequest::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(path, out);
+}
+
+void ZooKeeperDeleteContainerRequest::readImpl(ReadBuffer & in)
+{
+    Coordination::read(path, in);
+}
+
 void ZooKeeperRemoveRequest::writeImpl(WriteBuffer & out) const
 {
     Coordination::write(path, out);
@@ -187,10 +302,27 @@ void ZooKeeperGetResponse::readImpl(ReadBuffer & in)
 
 void ZooKeeperGetResponse::writeImpl(WriteBuffer & out) const
 {
-    Coordination::write(data, out);
+    Coordination::write(getData(), out);
     Coordination::write(stat, out);
 }
 
+void ZooKeeperGetResponse::writeAroundData(WriteBuffer & head, WriteBuffer & tail) const
+{
+    const auto & payload = getData();
+
+    WriteBufferFromOwnString stat_buf;
+    Coordination::write(stat, stat_buf);
+
+    /// Same as write: length, header, then data written as a string, and stat.
+    WriteBufferFromOwnString header;
+    writeHeader(header);
+    Coordination::write(static_cast<int32_t>(payload.size()), header);
+
+    Coordination::write(static_cast<int32_t>(header.str().size() + payload.size() + stat_buf.str().size()), head);
+    head.write(header.str().data(), header.str().size());
+    tail.write(stat_buf.str().data(), stat_buf.str().size());
+}
+
 void ZooKeeperSetRequest::writeImpl(WriteBuffer & out) const
 {
     Coordination::write(path, out);
@@ -239,6 +371,34 @@ void ZooKeeperListResponse::writeImpl(WriteBuffer & out) const
     Coordination::write(stat, out);
 }
 
+void ZooKeeperPagedListRequest::writeImpl(WriteBuffer & out) const
+{
+    ZooKeeperListRequest::writeImpl(out);
+    Coordination::write(start_after, out);
+    Coordination::write(max_count, out);
+    Coordination::write(prefix, out);
+}
+
+void ZooKeeperPagedListRequest::readImpl(ReadBuffer & in)
+{
+    ZooKeeperListRequest::readImpl(in);
+    Coordination::read(start_after, in);
+    Coordination::read(max_count, in);
+    Coordination::read(prefix, in);
+}
+
+void ZooKeeperPagedListResponse::readImpl(ReadBuffer & in)
+{
+    ZooKeeperListResponse::readImpl(in);
+    Coordination::read(continuation, in);
+}
+
+void ZooKeeperPagedListResponse::writeImpl(WriteBuffer & out) const
+{
+    ZooKeeperListResponse::writeImpl(out);
+    Coordination::write(continuation, out);
+}
+
 void ZooKeeperSetACLRequest::writeImpl(WriteBuffer & out) const
 {
     Coordination::write(path, out);
@@ -322,22 +482,22 @@ ZooKeeperMultiRequest::ZooKeeperMultiRequest(const Requests & generic_requests,
     {
         if (const auto * concrete_request_create = dynamic_cast<const CreateRequest *>(generic_request.get()))
         {
-            auto create = std::make_shared<ZooKeeperCreateRequest>(*concrete_request_create);
+            auto create = makePooled<ZooKeeperCreateRequest>(*concrete_request_create);
             if (create->acls.empty())
                 create->acls = default_acls;
             requests.push_back(create);
         }
         else if (const auto * concrete_request_remove = dynamic_cast<const RemoveRequest *>(generic_request.get()))
         {
-            requests.push_back(std::make_shared<ZooKeeperRemoveRequest>(*concrete_request_remove));
+            requests.push_back(makePooled<ZooKeeperRemoveRequest>(*concrete_request_remove));
         }
         else if (const auto * concrete_request_set = dynamic_cast<const SetRequest *>(generic_request.get()))
         {
-            requests.push_back(std::make_shared<ZooKeeperSetRequest>(*concrete_request_set));
+            requests.push_back(makePooled<ZooKeeperSetRequest>(*concrete_request_set));
         }
         else if (const auto * concrete_request_check = dynamic_cast<const CheckRequest *>(generic_request.get()))
         {
-            requests.push_back(std::make_shared<ZooKeeperCheckRequest>(*concrete_request_check));
+            requests.push_back(makePooled<ZooKeeperCheckRequest>(*concrete_request_check));
         }
         else
             throw Exception("Illegal command as part of multi ZooKeeper request", Error::ZBADARGUMENTS);
@@ -390,6 +550,9 @@ void ZooKeeperMultiRequest::readImpl(ReadBuffer & in)
             break;
         }
 
+        if (op_num == OpNum::DeleteContainer)
+            throw Exception("Illegal command as part of multi ZooKeeper request", Error::ZBADARGUMENTS);
+
         ZooKeeperRequestPtr request = ZooKeeperRequestFactory::instance().get(op_num);
         request->readImpl(in);
         requests.push_back(request);
@@ -424,7 +587,7 @@ void ZooKeeperMultiResponse::readImpl(ReadBuffer & in)
         /// For unknown reason, error code is duplicated in header and in response body.
 
         if (op_num == OpNum::Error)
-            response = std::make_shared<ZooKeeperErrorResponse>();
+            response = makePooled<ZooKeeperErrorResponse>();
 
         if (op_error != Error::ZOK)
         {
@@ -516,25 +679,49 @@ void ZooKeeperSetWatchesRequest::readImpl(ReadBuffer & in)
     Coordination::read(list_watches, in);
 }
 
+void ZooKeeperSetWatches2Request::writeImpl(WriteBuffer & out) const
+{
+    ZooKeeperSetWatchesRequest::writeImpl(out);
+    Coordination::write(persistent_watches, out);
+    Coordination::write(persistent_recursive_watches, out);
+}
+
+void ZooKeeperSetWatches2Request::readImpl(ReadBuffer & in)
+{
+    ZooKeeperSetWatchesRequest::readImpl(in);
+    Coordination::read(persistent_watches, in);
+    Coordination::read(persistent_recursive_watches, in);
+}
+
 
 
 
-ZooKeeperResponsePtr ZooKeeperHeartbeatRequest::makeResponse() const { return std::make_shared<ZooKeeperHeartbeatResponse>(); }
-ZooKeeperResponsePtr ZooKeeperSetWatchesRequest::makeResponse() const { return std::make_shared<ZooKeeperSetWatchesResponse>(); }
-ZooKeeperResponsePtr ZooKeeperSyncRequest::makeResponse() const { return std::make_shared<ZooKeeperSyncResponse>(); }
-ZooKeeperResponsePtr ZooKeeperAuthRequest::makeResponse() const { return std::make_shared<ZooKeeperAuthResponse>(); }
-ZooKeeperResponsePtr ZooKeeperCreateRequest::makeResponse() const { return std::make_shared<ZooKeeperCreateResponse>(); }
-ZooKeeperResponsePtr ZooKeeperRemoveRequest::makeResponse() const { return std::make_shared<ZooKeeperRemoveResponse>(); }
-ZooKeeperResponsePtr ZooKeeperExistsRequest::makeResponse() const { return std::make_shared<ZooKeeperExistsResponse>(); }
-ZooKeeperResponsePtr ZooKeeperGetRequest::makeResponse() const { return std::make_shared<ZooKeeperGetResponse>(); }
-ZooKeeperResponsePtr ZooKeeperSetRequest::makeResponse() const { return std::make_shared<ZooKeeperSetResponse>(); }
-ZooKeeperResponsePtr ZooKeeperListRequest::makeResponse() const { return std::make_shared<ZooKeeperListResponse>(); }
-ZooKeeperResponsePtr ZooKeeperCheckRequest::makeResponse() const { return std::make_shared<ZooKeeperCheckResponse>(); }
-ZooKeeperResponsePtr ZooKeeperMultiRequest::makeResponse() const { return std::make_shared<ZooKeeperMultiResponse>(requests); }
-ZooKeeperResponsePtr ZooKeeperCloseRequest::makeResponse() const { return std::make_shared<ZooKeeperCloseResponse>(); }
-ZooKeeperResponsePtr ZooKeeperSetSeqNumRequest::makeResponse() const { return std::make_shared<ZooKeeperSetSeqNumResponse>(); }
-ZooKeeperResponsePtr ZooKeeperSetACLRequest::makeResponse() const { return std::make_shared<ZooKeeperSetACLResponse>(); }
-ZooKeeperResponsePtr ZooKeeperGetACLRequest::makeResponse() const { return std::make_shared<ZooKeeperGetACLResponse>(); }
+ZooKeeperResponsePtr ZooKeeperHeartbeatRequest::makeResponse() const { return makePooled<ZooKeeperHeartbeatResponse>(); }
+ZooKeeperResponsePtr ZooKeeperSetWatchesRequest::makeResponse() const { return makePooled<ZooKeeperSetWatchesResponse>(); }
+ZooKeeperResponsePtr ZooKeeperSyncRequest::makeResponse() const { return makePooled<ZooKeeperSyncResponse>(); }
+ZooKeeperResponsePtr ZooKeeperAuthRequest::makeResponse() const { return makePooled<ZooKeeperAuthResponse>(); }
+ZooKeeperResponsePtr ZooKeeperCreateRequest::makeResponse() const { return makePooled<ZooKeeperCreateResponse>(); }
+ZooKeeperResponsePtr ZooKeeperCreate2Request::makeResponse() const { return makePooled<ZooKeeperCreate2Response>(); }
+ZooKeeperResponsePtr ZooKeeperDeleteContainerRequest::makeResponse() const { return makePooled<ZooKeeperDeleteContainerResponse>(); }
+ZooKeeperResponsePtr ZooKeeperRemoveRequest::makeResponse() const { return makePooled<ZooKeeperRemoveResponse>(); }
+ZooKeeperResponsePtr ZooKeeperExistsRequest::makeResponse() const { return makePooled<ZooKeeperExistsResponse>(); }
+ZooKeeperResponsePtr ZooKeeperGetRequest::makeResponse() const { return makePooled<ZooKeeperGetResponse>(); }
+ZooKeeperResponsePtr ZooKeeperSetRequest::makeResponse() const { return makePooled<ZooKeeperSetResponse>(); }
+ZooKeeperResponsePtr ZooKeeperListRequest::makeResponse() const { return makePooled<ZooKeeperListResponse>(); }
+ZooKeeperResponsePtr ZooKeeperPagedListRequest::makeResponse() const { return makePooled<ZooKeeperPagedListResponse>(); }
+ZooKeeperResponsePtr ZooKeeperCheckRequest::makeResponse() const { return makePooled<ZooKeeperCheckResponse>(); }
+ZooKeeperResponsePtr ZooKeeperMultiRequest::makeResponse() const { return makePooled<ZooKeeperMultiResponse>(requests); }
+ZooKeeperResponsePtr ZooKeeperMultiReadRequest::makeResponse() const { return makePooled<ZooKeeperMultiReadResponse>(requests); }
+ZooKeeperResponsePtr ZooKeeperCloseRequest::makeResponse() const { return makePooled<ZooKeeperCloseResponse>(); }
+ZooKeeperResponsePtr ZooKeeperSetSeqNumRequest::makeResponse() const { return makePooled<ZooKeeperSetSeqNumResponse>(); }
+ZooKeeperResponsePtr ZooKeeperSetACLRequest::makeResponse() const { return makePooled<ZooKeeperSetACLResponse>(); }
+ZooKeeperResponsePtr ZooKeeperGetACLRequest::makeResponse() const { return makePooled<ZooKeeperGetACLResponse>(); }
+ZooKeeperResponsePtr ZooKeeperAddWatchRequest::makeResponse() const { return makePooled<ZooKeeperAddWatchResponse>(); }
+ZooKeeperResponsePtr ZooKeeperRemoveWatchesRequest::makeResponse() const { return makePooled<ZooKeeperRemoveWatchesResponse>(); }
+ZooKeeperResponsePtr ZooKeeperGetAllChildrenNumberRequest::makeResponse() const
+{
+    return makePooled<ZooKeeperGetAllChildrenNumberResponse>();
+}
 
 void ZooKeeperSessionIDRequest::writeImpl(WriteBuffer & out) const
 {
@@ -552,7 +739,7 @@ void ZooKeeperSessionIDRequest::readImpl(ReadBuffer & in)
 
 Coordination::ZooKeeperResponsePtr ZooKeeperSessionIDRequest::makeResponse() const
 {
-    return std::make_shared<ZooKeeperSessionIDResponse>();
+    return makePooled<ZooKeeperSessionIDResponse>();
 }
 
 void ZooKeeperSessionIDResponse::readImpl(ReadBuffer & in)
@@ -607,7 +794,7 @@ ZooKeeperRequestFactory & ZooKeeperRequestFactory::instance()
 template<OpNum num, typename RequestT>
 void registerZooKeeperRequest(ZooKeeperRequestFactory & factory)
 {
-    factory.registerRequest(num, [] { return std::make_shared<RequestT>(); });
+    factory.registerRequest(num, [] { return makePooled<RequestT>(); });
 }
 
 ZooKeeperRequestFactory::ZooKeeperRequestFactory()
@@ -623,13 +810,23 @@ ZooKeeperRequestFactory::ZooKeeperRequestFactory()
     registerZooKeeperRequest<OpNum::Set, ZooKeeperSetRequest>(*this);
     registerZooKeeperRequest<OpNum::SimpleList, ZooKeeperSimpleListRequest>(*this);
     registerZooKeeperRequest<OpNum::List, ZooKeeperListRequest>(*this);
+    registerZooKeeperRequest<OpNum::PagedList, ZooKeeperPagedListRequest>(*this);
     registerZooKeeperRequest<OpNum::Check, ZooKeeperCheckRequest>(*this);
     registerZooKeeperRequest<OpNum::Multi, ZooKeeperMultiRequest>(*this);
+    registerZooKeeperRequest<OpNum::MultiRead, ZooKeeperMultiReadRequest>(*this);
     registerZooKeeperRequest<OpNum::SetSeqNum, ZooKeeperSetSeqNumRequest>(*this);
     registerZooKeeperRequest<OpNum::SessionID, ZooKeeperSessionIDRequest>(*this);
     registerZooKeeperRequest<OpNum::SetWatches, ZooKeeperSetWatchesRequest>(*this);
+    registerZooKeeperRequest<OpNum::SetWatches2, ZooKeeperSetWatches2Request>(*this);
     registerZooKeeperRequest<OpNum::GetACL, ZooKeeperGetACLRequest>(*this);
     registerZooKeeperRequest<OpNum::SetACL, ZooKeeperSetACLRequest>(*this);
+    registerZooKeeperRequest<OpNum::AddWatch, ZooKeeperAddWatchRequest>(*this);
+    registerZooKeeperRequest<OpNum::RemoveWatches, ZooKeeperRemoveWatchesRequest>(*this);
+    registerZooKeeperRequest<OpNum::GetAllChildrenNumber, ZooKeeperGetAllChildrenNumberRequest>(*this);
+    registerZooKeeperRequest<OpNum::Create2, ZooKeeperCreate2Request>(*this);
+    registerZooKeeperRequest<OpNum::CreateTTL, ZooKeeperCreateTTLRequest>(*this);
+    registerZooKeeperRequest<OpNum::CreateContainer, ZooKeeperCreateContainerRequest>(*this);
+    registerZooKeeperRequest<OpNum::DeleteContainer, ZooKeeperDeleteContainerRequest>(*this);
 }
 
 }
@@ -36,6 +36,9 @@ struct ZooKeeperResponse : virtual Response
     virtual void write(WriteBuffer & out) const;
     virtual OpNum getOpNum() const = 0;
 
+    /// xid, zxid and error, written by write() before the body
+    void writeHeader(WriteBuffer & out) const;
+
     virtual bool operator== (const ZooKeeperResponse & response) const
     {
         if (const ZooKeeperResponse * zk_response = dynamic_cast<const ZooKeeperResponse *>(&response))
@@ -111,7 +114,7 @@ struct ZooKeeperHeartbeatResponse final : ZooKeeperResponse
 
 /** Internal request.
  */
-struct ZooKeeperSetWatchesRequest final : ZooKeeperRequest
+struct ZooKeeperSetWatchesRequest : ZooKeeperRequest
 {
     using Watches = std::vector<String>;
 
@@ -132,6 +135,17 @@ struct ZooKeeperSetWatchesRequest final : ZooKeeperRequest
     }
 };
 
+/// Sent by clients on reconnect, also restores persistent and persistent recursive watches.
+struct ZooKeeperSetWatches2Request final : ZooKeeperSetWatchesRequest
+{
+    Watches persistent_watches;
+    Watches persistent_recursive_watches;
+
+    OpNum getOpNum() const override { return OpNum::SetWatches2; }
+    void writeImpl(WriteBuffer &) const override;
+    void readImpl(ReadBuffer &) override;
+};
+
 struct ZooKeeperSetWatchesResponse final : ZooKeeperResponse
 {
     void readImpl(ReadBuffer &) override {}
@@ -162,6 +176,100 @@ struct ZooKeeperSyncResponse final : ZooKeeperResponse
     OpNum getOpNum() const override { return OpNum::Sync; }
 };
 
+/// Modes of AddWatch request, the same as ZooKeeper AddWatchMode.
+enum class AddWatchMode : int32_t
+{
+    /// Triggered on data change, creation, deletion and children change of the path,
+    /// but not removed after triggering.
+    PERSISTENT = 0,
+    /// Like PERSISTENT, but also applies to all descendants of the path.
+    /// Children change events are not sent.
+    PERSISTENT_RECURSIVE = 1,
+};
+
+struct ZooKeeperAddWatchRequest final : ZooKeeperRequest
+{
+    String path;
+    int32_t mode = static_cast<int32_t>(AddWatchMode::PERSISTENT);
+
+    String getPath() const override { return path; }
+    OpNum getOpNum() const override { return OpNum::AddWatch; }
+    void writeImpl(WriteBuffer & out) const override;
+    void readImpl(ReadBuffer & in) override;
+    ZooKeeperResponsePtr makeResponse() const override;
+    bool isReadRequest() const override { return true; }
+    String toString() const override
+    {
+        return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", path " + path + ", mode " + std::to_string(mode);
+    }
+};
+
+struct ZooKeeperAddWatchResponse final : ZooKeeperResponse
+{
+    void readImpl(ReadBuffer & in) override;
+    /// ZooKeeper answers AddWatch with an ErrorResponse whose body is error code 0
+    void writeImpl(WriteBuffer & out) const override;
+    OpNum getOpNum() const override { return OpNum::AddWatch; }
+};
+
+/// Watcher types of RemoveWatches request, the same as ZooKeeper WatcherType.
+enum class WatcherType : int32_t
+{
+    CHILDREN = 1,
+    DATA = 2,
+    ANY = 3,
+};
+
+struct ZooKeeperRemoveWatchesRequest final : ZooKeeperRequest
+{
+    String path;
+    int32_t type = static_cast<int32_t>(WatcherType::ANY);
+
+    String getPath() const override { return path; }
+    OpNum getOpNum() const override { return OpNum::RemoveWatches; }
+    void writeImpl(WriteBuffer & out) const override;
+    void readImpl(ReadBuffer & in) override;
+    ZooKeeperResponsePtr makeResponse() const override;
+    bool isReadRequest() const override { return true; }
+    String toString() const override
+    {
+        return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", path " + path + ", type " + std::to_string(type);
+    }
+};
+
+struct ZooKeeperRemoveWatchesResponse final : ZooKeeperResponse
+{
+    void readImpl(ReadBuffer &) override {}
+    void writeImpl(WriteBuffer &) const override {}
+    OpNum getOpNum() const override { return OpNum::RemoveWatches; }
+};
+
+/// Number of all descendants of the path, the same as ZooKeeper getAllChildrenNumber.
+struct ZooKeeperGetAllChildrenNumberRequest final : ZooKeeperRequest
+{
+    String path;
+
+    String getPath() const override { return path; }
+    OpNum getOpNum() const override { return OpNum::GetAllChildrenNumber; }
+    void writeImpl(WriteBuffer & out) const override;
+    void readImpl(ReadBuffer & in) override;
+    ZooKeeperResponsePtr makeResponse() const override;
+    bool isReadRequest() const override { return true; }
+    String toString() const override
+    {
+        return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", path " + path;
+    }
+};
+
+struct ZooKeeperGetAllChildrenNumberResponse final : ZooKeeperResponse
+{
+    int32_t total_number = 0;
+
+    void readImpl(ReadBuffer & in) override;
+    void writeImpl(WriteBuffer & out) const override;
+    OpNum getOpNum() const override { return OpNum::GetAllChildrenNumber; }
+};
+
 struct ZooKeeperWatchResponse final : WatchResponse, ZooKeeperResponse
 {
     void readImpl(ReadBuffer & in) override;
@@ -170,10 +278,19 @@ struct ZooKeeperWatchResponse final : WatchResponse, ZooKeeperResponse
 
     void write(WriteBuffer & out) const override;
 
+    /// Bytes written by write(), serialized on first call. One event is shared by
+    /// all its watchers, so it is written once whatever thread delivers it.
+    /// The response must not be changed after that.
+    std::shared_ptr<const String> getSerialized() const;
+
     OpNum getOpNum() const override
     {
         throw Exception("OpNum for watch response doesn't exist", Error::ZRUNTIMEINCONSISTENCY);
     }
+
+private:
+    mutable std::once_flag serialize_once;
+    mutable std::shared_ptr<const String> serialized;
 };
 
 struct ZooKeeperAuthRequest final : ZooKeeperRequest
@@ -230,11 +347,17 @@ struct ZooKeeperCloseResponse final : ZooKeeperResponse
     OpNum getOpNum() const override { return OpNum::Close; }
 };
 
-struct ZooKeeperCreateRequest final : public CreateRequest, ZooKeeperRequest
+struct ZooKeeperCreateRequest : public CreateRequest, ZooKeeperRequest
 {
     /// used only during restore from zookeeper log
     int32_t parent_cversion = -1;
 
+    /// Node is removed after it has no children and is not modified for ttl milliseconds, only valid for CreateTTL
+    bool is_ttl = false;
+    int64_t ttl = 0;
+    /// Node is removed after its last child is removed, only valid for CreateContainer
+    bool is_container = false;
+
     ZooKeeperCreateRequest() = default;
     explicit ZooKeeperCreateRequest(const CreateRequest & base) : CreateRequest(base) {}
 
@@ -251,11 +374,33 @@ struct ZooKeeperCreateRequest final : public CreateRequest, ZooKeeperRequest
         //    bool is_ephemeral = false;
         //    bool is_sequential = false;
         return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", path " + path + ", data " + data + ", is_ephemeral "
-            + std::to_string(is_ephemeral) + ", is_sequential " + std::to_string(is_sequential);
+            + std::to_string(is_ephemeral) + ", is_sequential " + std::to_string(is_sequential)
+            + (is_ttl ? ", ttl " + std::to_string(ttl) : "") + (is_container ? ", is_container 1" : "");
     }
 };
 
-struct ZooKeeperCreateResponse final : CreateResponse, ZooKeeperResponse
+/// Same as Create, but the response contains stat of the created node.
+struct ZooKeeperCreate2Request : ZooKeeperCreateRequest
+{
+    using ZooKeeperCreateRequest::ZooKeeperCreateRequest;
+
+    OpNum getOpNum() const override { return OpNum::Create2; }
+    ZooKeeperResponsePtr makeResponse() const override;
+};
+
+struct ZooKeeperCreateTTLRequest final : ZooKeeperCreate2Request
+{
+    OpNum getOpNum() const override { return OpNum::CreateTTL; }
+    void writeImpl(WriteBuffer & out) const override;
+    void readImpl(ReadBuffer & in) override;
+};
+
+struct ZooKeeperCreateContainerRequest final : ZooKeeperCreate2Request
+{
+    OpNum getOpNum() const override { return OpNum::CreateContainer; }
+};
+
+struct ZooKeeperCreateResponse : CreateResponse, ZooKeeperResponse
 {
     void readImpl(ReadBuffer & in) override;
 
@@ -278,6 +423,41 @@ struct ZooKeeperCreateResponse final : CreateResponse, ZooKeeperResponse
     }
 };
 
+/// Response of Create2, CreateTTL and CreateContainer, ZooKeeper answers all of them with create2 type in multi response.
+struct ZooKeeperCreate2Response final : ZooKeeperCreateResponse
+{
+    Stat stat;
+
+    void readImpl(ReadBuffer & in) override;
+    void writeImpl(WriteBuffer & out) const override;
+    OpNum getOpNum() const override { return OpNum::Create2; }
+};
+
+/// Issued by the leader to remove an expired TTL node or an empty container node, the same as ZooKeeper
+/// deleteContainer. The node is removed only if it can still be removed when the request is applied.
+struct ZooKeeperDeleteContainerRequest final : ZooKeeperRequest
+{
+    String path;
+
+    String getPath() const override { return path; }
+    OpNum getOpNum() const override { return OpNum::DeleteContainer; }
+    void writeImpl(WriteBuffer & out) const override;
+    void readImpl(ReadBuffer & in) override;
+    ZooKeeperResponsePtr makeResponse() const override;
+    bool isReadRequest() const override { return false; }
+    String toString() const override
+    {
+        return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", path " + path;
+    }
+};
+
+struct ZooKeeperDeleteContainerResponse final : ZooKeeperResponse
+{
+    void readImpl(ReadBuffer &) override {}
+    void writeImpl(WriteBuffer &) const override {}
+    OpNum getOpNum() const override { return OpNum::DeleteContainer; }
+};
+
 struct ZooKeeperRemoveRequest final : RemoveRequest, ZooKeeperRequest
 {
     ZooKeeperRemoveRequest() = default;
@@ -360,15 +540,25 @@ struct ZooKeeperGetRequest final : GetRequest, ZooKeeperRequest
 
 struct ZooKeeperGetResponse final : GetResponse, ZooKeeperResponse
 {
+    /// Server side keeps a reference to the immutable node payload instead of copying it
+    /// into `data`, connection handler sends it straight from the shared buffer.
+    std::shared_ptr<const String> shared_data;
+
+    const String & getData() const { return shared_data ? *shared_data : data; }
+
     void readImpl(ReadBuffer & in) override;
     void writeImpl(WriteBuffer & out) const override;
     OpNum getOpNum() const override { return OpNum::Get; }
 
+    /// Write the same bytes as write() except the data itself, which should be sent between
+    /// `head` and `tail`. Only for successful response.
+    void writeAroundData(WriteBuffer & head, WriteBuffer & tail) const;
+
     bool operator== (const ZooKeeperResponse & response) const override
     {
         if (const ZooKeeperGetResponse * get_response = dynamic_cast<const ZooKeeperGetResponse *>(&response))
         {
-            return ZooKeeperResponse::operator==(response) && get_response->stat == stat && get_response->data == data;
+            return ZooKeeperResponse::operator==(response) && get_response->stat == stat && get_response->getData() == getData();
         }
         return false;
     }
@@ -376,7 +566,7 @@ struct ZooKeeperGetResponse final : GetResponse, ZooKeeperResponse
     String toString() const override
     {
 
-        return "GetResponse " + ZooKeeperResponse::toString() + ", stat " + stat.toString() + ", data " + data;
+        return "GetResponse " + ZooKeeperResponse::toString() + ", stat " + stat.toString() + ", data " + getData();
     }
 };
 
@@ -477,6 +667,38 @@ struct ZooKeeperSimpleListResponse final : ZooKeeperListResponse
     OpNum getOpNum() const override { return OpNum::SimpleList; }
 };
 
+/// List at most max_count children whose names are greater than start_after and
+/// start with prefix, in lexicographical order. Pass continuation of the response
+/// as start_after of the next request to get the next page.
+struct ZooKeeperPagedListRequest final : ZooKeeperListRequest
+{
+    /// Empty means from the first child
+    String start_after;
+    int32_t max_count = MAX_PAGED_LIST_COUNT;
+    String prefix;
+
+    OpNum getOpNum() const override { return OpNum::PagedList; }
+    void writeImpl(WriteBuffer & out) const override;
+    void readImpl(ReadBuffer & in) override;
+    ZooKeeperResponsePtr makeResponse() const override;
+    bool isReadRequest() const override { return true; }
+    String toString() const override
+    {
+        return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", path " + path + ", start_after " + start_after
+            + ", max_count " + std::to_string(max_count) + ", prefix " + prefix;
+    }
+};
+
+struct ZooKeeperPagedListResponse final : ZooKeeperListResponse
+{
+    /// Name of the last returned child if there are more, otherwise empty
+    String continuation;
+
+    void readImpl(ReadBuffer & in) override;
+    void writeImpl(WriteBuffer & out) const override;
+    OpNum getOpNum() const override { return OpNum::PagedList; }
+};
+
 struct ZooKeeperCheckRequest final : CheckRequest, ZooKeeperRequest
 {
     ZooKeeperCheckRequest() = default;
@@ -546,7 +768,7 @@ struct ZooKeeperGetACLResponse final : GetACLResponse, ZooKeeperResponse
     OpNum getOpNum() const override { return OpNum::GetACL; }
 };
 
-struct ZooKeeperMultiRequest final : MultiRequest, ZooKeeperRequest
+struct ZooKeeperMultiRequest : MultiRequest, ZooKeeperRequest
 {
     OpNum getOpNum() const override { return OpNum::Multi; }
     ZooKeeperMultiRequest() = default;
@@ -567,7 +789,7 @@ struct ZooKeeperMultiRequest final : MultiRequest, ZooKeeperRequest
     }
 };
 
-struct ZooKeeperMultiResponse final : MultiResponse, ZooKeeperResponse
+struct ZooKeeperMultiResponse : MultiResponse, ZooKeeperResponse
 {
     OpNum getOpNum() const override { return OpNum::Multi; }
 
@@ -619,6 +841,21 @@ struct ZooKeeperMultiResponse final : MultiResponse, ZooKeeperResponse
     }
 };
 
+/// Multi of Get, Exists and List, the same as ZooKeeper multiRead. It is a read request, so it is processed
+/// locally without Raft, every sub-request has its own result and failure of one does not affect others.
+struct ZooKeeperMultiReadRequest final : ZooKeeperMultiRequest
+{
+    OpNum getOpNum() const override { return OpNum::MultiRead; }
+    ZooKeeperResponsePtr makeResponse() const override;
+    bool isReadRequest() const override { return true; }
+};
+
+struct ZooKeeperMultiReadResponse final : ZooKeeperMultiResponse
+{
+    using ZooKeeperMultiResponse::ZooKeeperMultiResponse;
+    OpNum getOpNum() const override { return OpNum::MultiRead; }
+};
+
 /// Fake internal coordination (keeper) response. Never received from client
 /// and never send to client.
 struct ZooKeeperSessionIDRequest final : ZooKeeperRequest
@@ -24,8 +24,18 @@ static const std::unordered_set<int32_t> VALID_OPERATIONS =
     static_cast<int32_t>(OpNum::SetSeqNum),
     static_cast<int32_t>(OpNum::SessionID),
     static_cast<int32_t>(OpNum::SetWatches),
+    static_cast<int32_t>(OpNum::SetWatches2),
     static_cast<int32_t>(OpNum::SetACL),
     static_cast<int32_t>(OpNum::GetACL),
+    static_cast<int32_t>(OpNum::AddWatch),
+    static_cast<int32_t>(OpNum::RemoveWatches),
+    static_cast<int32_t>(OpNum::PagedList),
+    static_cast<int32_t>(OpNum::GetAllChildrenNumber),
+    static_cast<int32_t>(OpNum::Create2),
+    static_cast<int32_t>(OpNum::CreateTTL),
+    static_cast<int32_t>(OpNum::CreateContainer),
+    static_cast<int32_t>(OpNum::DeleteContainer),
+    static_cast<int32_t>(OpNum::MultiRead),
 };
 
 std::string toString(OpNum op_num)
@@ -56,6 +66,8 @@ std::string toString(OpNum op_num)
             return "Check";
         case OpNum::Multi:
             return "Multi";
+        case OpNum::MultiRead:
+            return "MultiRead";
         case OpNum::Heartbeat:
             return "Heartbeat";
         case OpNum::Auth:
@@ -66,10 +78,28 @@ std::string toString(OpNum op_num)
             return "SessionID";
         case OpNum::SetWatches:
             return "SetWatches";
+        case OpNum::SetWatches2:
+            return "SetWatches2";
         case OpNum::SetACL:
             return "SetACL";
         case OpNum::GetACL:
             return "GetACL";
+        case OpNum::AddWatch:
+            return "AddWatch";
+        case OpNum::RemoveWatches:
+            return "RemoveWatches";
+        case OpNum::PagedList:
+            return "PagedList";
+        case OpNum::GetAllChildrenNumber:
+            return "GetAllChildrenNumber";
+        case OpNum::Create2:
+            return "Create2";
+        case OpNum::CreateTTL:
+            return "CreateTTL";
+        case OpNum::CreateContainer:
+            return "CreateContainer";
+        case OpNum::DeleteContainer:
+            return "DeleteContainer";
     }
     int32_t raw_op = static_cast<int32_t>(op_num);
     throw Exception("Operation " + std::to_string(raw_op) + " is unknown", Error::ZUNIMPLEMENTED);
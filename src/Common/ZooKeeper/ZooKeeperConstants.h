@@ -2,6 +2,7 @@
 
 #include <string>
 #include <cstdint>
+#include <limits>
 
 
 namespace Coordination
@@ -31,9 +32,19 @@ enum class OpNum : int32_t
     List = 12,
     Check = 13,
     Multi = 14,
+    Create2 = 15,
+    RemoveWatches = 18,
+    CreateContainer = 19,
+    DeleteContainer = 20, /// Issued by leader to remove expired TTL nodes and empty container nodes
+    CreateTTL = 21,
+    MultiRead = 22,
     Auth = 100,
     SetWatches = 101,
+    GetAllChildrenNumber = 104,
+    SetWatches2 = 105,
+    AddWatch = 106,
     SetSeqNum = 200, /// Special internal request
+    PagedList = 501, /// RaftKeeper extension, list children page by page
     SessionID = 997, /// Special internal request
 };
 
@@ -51,6 +62,29 @@ static constexpr int32_t PASSWORD_LENGTH = 16;
 /// but it can be raised up, so we have a slightly larger limit on our side.
 static constexpr int32_t MAX_STRING_OR_ARRAY_SIZE = 1 << 28;  /// 256 MiB
 static constexpr int32_t DEFAULT_SESSION_TIMEOUT_MS = 30000;
+/// Max children returned by one PagedList request
+static constexpr int32_t MAX_PAGED_LIST_COUNT = 10000;
 static constexpr int32_t DEFAULT_OPERATION_TIMEOUT_MS = 20000;
 
+/// TTL nodes are marked in the ephemeralOwner of stat, the same as ZooKeeper EphemeralType:
+/// the highest byte is 0xff and the lowest 40 bits are TTL in milliseconds.
+static constexpr int64_t TTL_EPHEMERAL_OWNER_MASK = static_cast<int64_t>(0xff00000000000000ULL);
+static constexpr int64_t MAX_TTL_MS = 0x000000ffffffffffLL;
+
+inline bool isTTLEphemeralOwner(int64_t ephemeral_owner)
+{
+    return (ephemeral_owner & TTL_EPHEMERAL_OWNER_MASK) == TTL_EPHEMERAL_OWNER_MASK;
+}
+inline int64_t ttlToEphemeralOwner(int64_t ttl_ms) { return TTL_EPHEMERAL_OWNER_MASK | ttl_ms; }
+inline int64_t ttlFromEphemeralOwner(int64_t ephemeral_owner) { return ephemeral_owner & MAX_TTL_MS; }
+
+/// Container nodes are marked in the same way as ZooKeeper, with the minimum of int64.
+static constexpr int64_t CONTAINER_EPHEMERAL_OWNER = std::numeric_limits<int64_t>::min();
+
+/// Whether ephemeralOwner is a session, rather than a marker of TTL or container node.
+inline bool isSessionEphemeralOwner(int64_t ephemeral_owner)
+{
+    return ephemeral_owner != 0 && ephemeral_owner != CONTAINER_EPHEMERAL_OWNER && !isTTLEphemeralOwner(ephemeral_owner);
+}
+
 }
@@ -71,23 +71,86 @@ uint64_t ACLMap::convertACLs(const Coordination::ACLs & acls)
 
     acl_to_num[acls] = index;
     num_to_acl[index] = acls;
+    publishChange(index, &acls);
 
     return index;
 }
 
 Coordination::ACLs ACLMap::convertNumber(uint64_t acls_id) const
 {
-    std::lock_guard lock(acl_mutex);
+    return *getACLs(acls_id);
+}
+
+ACLMap::ACLsPtr ACLMap::getACLs(uint64_t acls_id) const
+{
+    /// default acl is 'world,'anyone : cdrwa
+    static const ACLsPtr default_acls
+        = std::make_shared<const Coordination::ACLs>(Coordination::ACLs{Coordination::ACL{Coordination::ACL::All, "world", "anyone"}});
+
+    if (acls_id == 0)
+        return default_acls;
 
-    if (acls_id == 0) /// default acl is 'world,'anyone : cdrwa
+    if (auto table = std::atomic_load(&published))
     {
-        return Coordination::ACLs{Coordination::ACL{Coordination::ACL::All, "world", "anyone"}};
+        auto it = table->find(acls_id);
+        if (it != table->end())
+            return it->second;
     }
 
-    if (!num_to_acl.count(acls_id))
+    /// Table was dropped by loading snapshot or the id is unknown
+    std::lock_guard lock(acl_mutex);
+    auto table = std::atomic_load(&published);
+    if (!table)
+    {
+        publish();
+        table = std::atomic_load(&published);
+    }
+
+    auto it = table->find(acls_id);
+    if (it == table->end())
         throw Exception(ErrorCodes::LOGICAL_ERROR, "Unknown ACL id {}. It's a bug", acls_id);
 
-    return num_to_acl.at(acls_id);
+    return it->second;
+}
+
+void ACLMap::publish() const
+{
+    auto old_table = std::atomic_load(&published);
+    auto new_table = std::make_shared<PublishedACLs>();
+    new_table->reserve(num_to_acl.size());
+
+    for (const auto & [acls_id, acls] : num_to_acl)
+    {
+        /// Keep the same objects for known ids, they may be referenced by readers
+        if (old_table)
+        {
+            auto it = old_table->find(acls_id);
+            if (it != old_table->end())
+            {
+                new_table->emplace(acls_id, it->second);
+                continue;
+            }
+        }
+        new_table->emplace(acls_id, std::make_shared<const Coordination::ACLs>(acls));
+    }
+
+    std::atomic_store(&published, PublishedACLsPtr(std::move(new_table)));
+}
+
+void ACLMap::publishChange(uint64_t acls_id, const Coordination::ACLs * acls)
+{
+    auto old_table = std::atomic_load(&published);
+    /// Not published yet, will be rebuilt by the first reader
+    if (!old_table)
+        return;
+
+    auto new_table = std::make_shared<PublishedACLs>(*old_table);
+    if (acls)
+        new_table->insert_or_assign(acls_id, std::make_shared<const Coordination::ACLs>(*acls));
+    else
+        new_table->erase(acls_id);
+
+    std::atomic_store(&published, PublishedACLsPtr(std::move(new_table)));
 }
 
 void ACLMap::addMapping(uint64_t acls_id, const Coordination::ACLs & acls)
@@ -96,6 +159,8 @@ void ACLMap::addMapping(uint64_t acls_id, const Coordination::ACLs & acls)
     num_to_acl[acls_id] = acls;
     acl_to_num[acls] = acls_id;
     max_acl_id = std::max(acls_id + 1, max_acl_id); /// max_acl_id pointer next slot
+    /// Id may be overwritten while loading snapshot, drop published table entirely
+    std::atomic_store(&published, PublishedACLsPtr{});
 }
 
 void ACLMap::addUsage(uint64_t acl_id, uint64_t count)
@@ -120,6 +185,7 @@ void ACLMap::removeUsage(uint64_t acl_id)
         num_to_acl.erase(acl_id);
         acl_to_num.erase(acls);
         usage_counter.erase(acl_id);
+        publishChange(acl_id, nullptr);
     }
 }
 bool ACLMap::operator==(const ACLMap & rhs) const
@@ -1,6 +1,8 @@
 #pragma once
 #include <Common/ZooKeeper/ZooKeeperCommon.h>
 #include <Common/ZooKeeper/IKeeper.h>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 
 
@@ -9,8 +11,16 @@ namespace RK
 
 /// Simple mapping of different ACLs to sequentially growing numbers
 /// Allows to store single number instead of vector of ACLs on disk and in memory.
+///
+/// ACLs of an id never change, so readers resolve ids through an immutable table
+/// published with RCU semantics and do not take any lock. Adding or removing an
+/// id copies the table, which is cheap as ACLs are far less than nodes. Loading
+/// a snapshot drops the table, it is rebuilt once by the first reader.
 class ACLMap
 {
+public:
+    using ACLsPtr = std::shared_ptr<const Coordination::ACLs>;
+
 private:
     struct ACLsHash
     {
@@ -28,11 +38,22 @@ private:
 
     using UsageCounter = std::unordered_map<uint64_t, uint64_t>;
 
+    using PublishedACLs = std::unordered_map<uint64_t, ACLsPtr>;
+    using PublishedACLsPtr = std::shared_ptr<const PublishedACLs>;
+
     ACLToNumMap acl_to_num;
     NumToACLMap num_to_acl;
     UsageCounter usage_counter;
     mutable std::recursive_mutex acl_mutex;
     uint64_t max_acl_id{1};
+
+    /// Immutable copy of num_to_acl, accessed with std::atomic_load / std::atomic_store.
+    mutable PublishedACLsPtr published;
+    /// Rebuild the table from num_to_acl. Should be called under acl_mutex.
+    void publish() const;
+    /// Copy the table with acls_id added or removed (acls == nullptr). Should be called under acl_mutex.
+    void publishChange(uint64_t acls_id, const Coordination::ACLs * acls);
+
 public:
 
     /// Convert ACL to number. If it's new ACL than adds it to map
@@ -42,6 +63,9 @@ public:
     /// Convert number to ACL vector. If number is unknown for map
     /// than throws LOGICAL ERROR
     Coordination::ACLs convertNumber(uint64_t acls_id) const;
+
+    /// The same as convertNumber, but without copying and, in common case, without locking.
+    ACLsPtr getACLs(uint64_t acls_id) const;
     /// Mapping from numbers to ACLs vectors. Used during serialization.
     NumToACLMap getMapping() const
     {
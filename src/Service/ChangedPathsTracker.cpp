@@ -0,0 +1,58 @@
+#include <algorithm>
+#include <Service/ChangedPathsTracker.h>
+
+namespace RK
+{
+
+void ChangedPathsTracker::add(const String & path)
+{
+    if (!isEnabled())
+        return;
+
+    auto & shard = shards[hasher(path) % NUM_SHARDS];
+    std::lock_guard lock(shard.mutex);
+    shard.paths.emplace(path);
+}
+
+ChangedPathsTracker::PathsPtr ChangedPathsTracker::fetch()
+{
+    if (!isEnabled())
+        return nullptr;
+
+    auto result = std::make_shared<Paths>();
+    for (auto & shard : shards)
+    {
+        std::unordered_set<String> paths;
+        {
+            std::lock_guard lock(shard.mutex);
+            paths.swap(shard.paths);
+        }
+        result->reserve(result->size() + paths.size());
+        while (!paths.empty())
+            result->emplace_back(std::move(paths.extract(paths.begin()).value()));
+    }
+    std::sort(result->begin(), result->end());
+    return result;
+}
+
+void ChangedPathsTracker::clear()
+{
+    for (auto & shard : shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        shard.paths.clear();
+    }
+}
+
+size_t ChangedPathsTracker::size() const
+{
+    size_t ret = 0;
+    for (const auto & shard : shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        ret += shard.paths.size();
+    }
+    return ret;
+}
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+#include <common/types.h>
+
+namespace RK
+{
+
+/// Records paths of nodes created, changed or removed since the last snapshot,
+/// so that the next snapshot can be a delta which only contains these nodes.
+///
+/// Paths are sharded like KeeperStore::Container, see KeeperStore::MAP_BLOCK_NUM.
+/// Nothing is recorded until the tracker is enabled.
+class ChangedPathsTracker
+{
+public:
+    static constexpr size_t NUM_SHARDS = 16;
+
+    using Paths = std::vector<String>;
+    using PathsPtr = std::shared_ptr<Paths>;
+
+    void enable() { enabled.store(true, std::memory_order_relaxed); }
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    void add(const String & path);
+
+    /// Return changed paths sorted in lexicographical order, in which parent is
+    /// always before its children, and start tracking from scratch.
+    /// Return nullptr if tracking is not enabled.
+    PathsPtr fetch();
+
+    void clear();
+    size_t size() const;
+
+private:
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        std::unordered_set<String> paths;
+    };
+
+    std::array<Shard, NUM_SHARDS> shards;
+    std::hash<String> hasher;
+    std::atomic<bool> enabled{false};
+};
+
+}
@@ -7,6 +7,7 @@
 #    include <Common/ZooKeeper/ZooKeeperCommon.h>
 #    include <Common/ZooKeeper/ZooKeeperIO.h>
 #    include <Common/setThreadName.h>
+#    include <sys/socket.h>
 
 namespace RK
 {
@@ -19,6 +20,7 @@ namespace ErrorCodes
     extern const int TIMEOUT_EXCEEDED;
     extern const int READONLY;
     extern const int RAFT_ERROR;
+    extern const int CANNOT_WRITE_TO_SOCKET;
 }
 
 using Poco::NObserver;
@@ -73,7 +75,6 @@ ConnectionHandler::ConnectionHandler(Context & global_context_, StreamSocket & s
           global_context.getConfigRef().getUInt(
               "keeper.raft_settings.session_timeout_ms", Coordination::DEFAULT_SESSION_TIMEOUT_MS)
               * 1000)
-    , responses(std::make_unique<ThreadSafeResponseQueue>())
     , last_op(std::make_unique<LastOp>(EMPTY_LAST_OP))
 {
     LOG_DEBUG(log, "New connection from {}", socket_.peerAddress().toString());
@@ -218,7 +219,8 @@ void ConnectionHandler::onSocketReadable(const AutoPtr<ReadableNotification> & /
                 }
 
                 /// register session response callback
-                auto response_callback = [this](const Coordination::ZooKeeperResponsePtr & response) { sendResponse(response); };
+                auto response_callback = [this](const Coordination::ZooKeeperResponsePtr & response, const std::shared_ptr<const String> & serialized)
+                { return sendResponse(response, serialized); };
                 keeper_dispatcher->registerSession(session_id, response_callback, handshake_result.is_reconnected);
 
                 /// start session timeout timer
@@ -280,70 +282,68 @@ void ConnectionHandler::onSocketWritable(const AutoPtr<WritableNotification> &)
     {
         LOG_TRACE(log, "session {} socket writable", toHexString(session_id));
 
-        if (responses->size() == 0 && send_buf.used() == 0)
-            return;
-
-        /// TODO use zero copy buffer
-        size_t size_to_sent = 0;
+        serializePendingResponses();
 
-        /// 1. accumulate data into tmp_buf
-        responses->forEach([&size_to_sent, this](const auto & resp) -> bool {
-            if (resp == is_close)
-                return false;
-
-            if (size_to_sent + resp->used() < SENT_BUFFER_SIZE)
-            {
-                /// add whole resp to send_buf
-                send_buf.write(resp->begin(), resp->used());
-                size_to_sent += resp->used();
-            }
-            else if (size_to_sent + resp->used() == SENT_BUFFER_SIZE)
-            {
-                /// add whole resp to send_buf
-                send_buf.write(resp->begin(), resp->used());
-                size_to_sent += resp->used();
-            }
-            else
+        /// Send as many parts as possible straight from their buffers.
+        while (!responses.empty() && !responses.front().isClose())
+        {
+            iovec iov[MAX_SEND_PARTS];
+            size_t iov_count = 0;
+            size_t size_to_sent = 0;
+            for (auto it = responses.begin(); it != responses.end() && !it->isClose() && iov_count < MAX_SEND_PARTS; ++it)
             {
-                /// add part of resp to send_buf
-                send_buf.write(resp->begin(), SENT_BUFFER_SIZE - size_to_sent);
+                iov[iov_count].iov_base = const_cast<char *>(it->data());
+                iov[iov_count].iov_len = it->size();
+                size_to_sent += it->size();
+                ++iov_count;
             }
-            return size_to_sent < SENT_BUFFER_SIZE;
-        });
-
-        /// 2. send data
-        size_t sent = socket_.sendBytes(send_buf);
 
-        /// 3. remove sent responses
-
-        ptr<FIFOBuffer> resp;
-        while (responses->peek(resp) && sent > 0)
-        {
-            if (sent >= resp->used())
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iov_count;
+            ssize_t sent = ::sendmsg(socket_.impl()->sockfd(), &msg, MSG_NOSIGNAL);
+            if (sent < 0)
             {
-                sent -= resp->used();
-                responses->remove();
-                /// package sent
-                packageSent();
-                LOG_TRACE(log, "sent response to {}", toHexString(session_id));
+                /// Socket buffer is full, continue in next writable event.
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    break;
+                throwFromErrno("Cannot send response to session " + toHexString(session_id), ErrorCodes::CANNOT_WRITE_TO_SOCKET);
             }
-            else
+
+            /// Remove sent parts
+            size_t remaining = sent;
+            while (remaining > 0)
             {
-                resp->drain(sent);
-                /// move data to begin
-                resp->begin();
-                sent = 0;
+                auto & part = responses.front();
+                if (remaining >= part.size())
+                {
+                    remaining -= part.size();
+                    if (part.is_last)
+                    {
+                        packageSent();
+                        LOG_TRACE(log, "sent response to {}", toHexString(session_id));
+                    }
+                    responses.pop_front();
+                }
+                else
+                {
+                    part.offset += remaining;
+                    remaining = 0;
+                }
             }
+
+            if (static_cast<size_t>(sent) < size_to_sent)
+                break;
         }
 
-        if (responses->peek(resp) && resp == is_close)
+        if (!responses.empty() && responses.front().isClose())
         {
             destroyMe();
             return;
         }
 
         /// If all sent unregister writable event.
-        if (responses->size() == 0 && send_buf.used() == 0)
+        if (responses.empty() && pending_responses.empty())
         {
             LOG_DEBUG(log, "Remove socket writable event handler - session {}", socket_.peerAddress().toString());
             reactor_.removeEventHandler(
@@ -621,6 +621,11 @@ std::pair<Coordination::OpNum, Coordination::XID> ConnectionHandler::receiveRequ
             length,
             Coordination::toString(opnum));
 
+    /// Only the leader removes expired TTL nodes and empty containers
+    if (opnum == Coordination::OpNum::DeleteContainer)
+        throw Exception(
+            ErrorCodes::UNEXPECTED_PACKET_FROM_CLIENT, "Session {} sent internal request {}", toHexString(session_id), Coordination::toString(opnum));
+
     Coordination::ZooKeeperRequestPtr request = Coordination::ZooKeeperRequestFactory::instance().get(opnum);
     request->xid = xid;
     request->readImpl(body);
@@ -630,38 +635,67 @@ std::pair<Coordination::OpNum, Coordination::XID> ConnectionHandler::receiveRequ
     return std::make_pair(opnum, xid);
 }
 
-void ConnectionHandler::sendResponse(const Coordination::ZooKeeperResponsePtr & response)
+SocketReactor * ConnectionHandler::sendResponse(const Coordination::ZooKeeperResponsePtr & response, const std::shared_ptr<const String> & serialized)
 {
     LOG_TRACE(log, "Dispatch response to conn handler session {}", toHexString(session_id));
 
     /// TODO should invoked after response sent to client.
     updateStats(response);
 
-    if (response->xid != Coordination::WATCH_XID && response->getOpNum() == Coordination::OpNum::Close)
-    {
-        responses->push(ptr<FIFOBuffer>());
-    }
-    else
-    {
-        WriteBufferFromFiFoBuffer buf;
-        response->write(buf);
-
-        /// TODO handle timeout
-        responses->push(buf.getBuffer());
-    }
+    pending_responses.push({response, serialized});
 
     LOG_TRACE(log, "Add socket writable event handler - session {}", toHexString(session_id));
-    /// Trigger socket writable event
+    /// Trigger socket writable event, the caller must wake up reactor to interrupt it's sleeping.
     reactor_.addEventHandler(
         socket_, NObserver<ConnectionHandler, WritableNotification>(*this, &ConnectionHandler::onSocketWritable));
-    /// We must wake up reactor to interrupt it's sleeping.
-    LOG_TRACE(
-        log,
-        "Poll trigger wakeup-- poco thread name {}, actually thread name {}",
-        Poco::Thread::current() ? Poco::Thread::current()->name() : "main",
-        getThreadName());
-
-    reactor_.wakeUp();
+
+    return &reactor_;
+}
+
+void ConnectionHandler::serializePendingResponses()
+{
+    pending_batch.clear();
+    if (!pending_responses.tryPopBatch(pending_batch, pending_batch.max_size()))
+        return;
+
+    for (const auto & [response, serialized] : pending_batch)
+    {
+        if (response->xid != Coordination::WATCH_XID && response->getOpNum() == Coordination::OpNum::Close)
+        {
+            responses.push_back(ResponsePart{});
+        }
+        else if (serialized)
+        {
+            /// Every connection keeps its own offset, so shared bytes are not copied.
+            responses.push_back(ResponsePart{nullptr, serialized});
+        }
+        else if (const auto * get_response = dynamic_cast<const Coordination::ZooKeeperGetResponse *>(response.get());
+                 get_response && get_response->error == Coordination::Error::ZOK && get_response->shared_data
+                 && get_response->shared_data->size() >= SHARED_PAYLOAD_MIN_SIZE)
+        {
+            pushGetResponse(*get_response);
+        }
+        else
+        {
+            WriteBufferFromFiFoBuffer buf;
+            response->write(buf);
+
+            /// TODO handle timeout
+            responses.push_back(ResponsePart{buf.getBuffer()});
+        }
+    }
+    pending_batch.clear();
+}
+
+void ConnectionHandler::pushGetResponse(const Coordination::ZooKeeperGetResponse & response)
+{
+    WriteBufferFromFiFoBuffer head;
+    WriteBufferFromFiFoBuffer tail;
+    response.writeAroundData(head, tail);
+
+    responses.push_back(ResponsePart{head.getBuffer(), nullptr, 0, false});
+    responses.push_back(ResponsePart{nullptr, response.shared_data, 0, false});
+    responses.push_back(ResponsePart{tail.getBuffer()});
 }
 
 void ConnectionHandler::packageSent()
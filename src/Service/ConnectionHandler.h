@@ -14,6 +14,7 @@
 #include <Poco/Util/OptionSet.h>
 #include <Poco/Util/ServerApplication.h>
 
+#include <deque>
 #include <unordered_set>
 #include <Service/ConnCommon.h>
 #include <Service/SvsSocketAcceptor.h>
@@ -75,7 +76,15 @@ private:
 
     std::pair<Coordination::OpNum, Coordination::XID> receiveRequest(int32_t length);
 
-    void sendResponse(const Coordination::ZooKeeperResponsePtr& resp);
+    /// Queue response for sending and register writable event handler. `serialized` is the
+    /// already written response or null. Return the reactor which the caller should wake up.
+    SocketReactor * sendResponse(const Coordination::ZooKeeperResponsePtr & resp, const std::shared_ptr<const String> & serialized);
+
+    /// Serialize responses queued by sendResponse into `responses`, invoked in reactor thread.
+    void serializePendingResponses();
+
+    /// Queue Get response whose big payload is sent straight from the node buffer.
+    void pushGetResponse(const Coordination::ZooKeeperGetResponse & response);
 
     void packageSent();
     void packageReceived();
@@ -85,10 +94,27 @@ private:
     /// destroy connection
     void destroyMe();
 
-    static constexpr size_t SENT_BUFFER_SIZE = 1024;
-    FIFOBuffer send_buf = FIFOBuffer(SENT_BUFFER_SIZE);
+    /// Max number of response parts sent by one sendmsg
+    static constexpr size_t MAX_SEND_PARTS = 64;
+    /// Get response payload not less than it is not copied into the serialized response
+    static constexpr size_t SHARED_PAYLOAD_MIN_SIZE = 4096;
 
-    std::shared_ptr<FIFOBuffer> is_close = nullptr;
+    /// A piece of response waiting to be sent. Bytes are either owned by `buffer` or shared
+    /// (node payload of Get response, watch event serialized once for all watchers) and sent
+    /// straight from the shared buffer. A part without bytes means closing the connection.
+    struct ResponsePart
+    {
+        std::shared_ptr<FIFOBuffer> buffer;
+        std::shared_ptr<const String> shared;
+        /// bytes already sent
+        size_t offset = 0;
+        /// whether it is the last part of a response
+        bool is_last = true;
+
+        bool isClose() const { return !buffer && !shared; }
+        const char * data() const { return (buffer ? buffer->begin() : shared->data()) + offset; }
+        size_t size() const { return (buffer ? buffer->used() : shared->size()) - offset; }
+    };
 
     Logger * log;
 
@@ -113,7 +139,17 @@ private:
     int64_t session_id{-1};
 
     Stopwatch session_stopwatch;
-    ThreadSafeResponseQueuePtr responses;
+    /// Only accessed in reactor thread
+    std::deque<ResponsePart> responses;
+
+    struct PendingResponse
+    {
+        Coordination::ZooKeeperResponsePtr response;
+        std::shared_ptr<const String> serialized;
+    };
+    /// Responses dispatched to the connection but not serialized yet
+    ThreadSafeQueue<PendingResponse> pending_responses;
+    std::vector<PendingResponse> pending_batch;
 
     Coordination::XID close_xid = Coordination::CLOSE_XID;
     Poco::Timestamp established;
@@ -143,6 +143,9 @@ void FourLetterCommandFactory::registerCommands(KeeperDispatcher & keeper_dispat
         FourLetterCommandPtr request_leader_command = std::make_shared<RequestLeaderCommand>(keeper_dispatcher);
         factory.registerCommand(request_leader_command);
 
+        FourLetterCommandPtr heaviest_subtrees_command = std::make_shared<HeaviestSubtreesCommand>(keeper_dispatcher);
+        factory.registerCommand(heaviest_subtrees_command);
+
         factory.initializeWhiteList(keeper_dispatcher);
         factory.setInitialize(true);
     }
@@ -241,11 +244,26 @@ ConnectionStats stats = keeper_dispatcher.getKeeperConnectionStats();
     print(ret, "znode_count", state_machine.getNodesCount());
     print(ret, "watch_count", state_machine.getTotalWatchesCount());
     print(ret, "ephemerals_count", state_machine.getTotalEphemeralNodesCount());
+    print(ret, "ttl_nodes_count", state_machine.getTTLNodesCount());
+    print(ret, "empty_containers_count", state_machine.getEmptyContainersCount());
     print(ret, "approximate_data_size", state_machine.getApproximateDataSize());
     print(ret, "snap_count", state_machine.getSnapshotCount());
     print(ret, "snap_time_ms", state_machine.getSnapshotTimeMs());
     print(ret, "in_snapshot", state_machine.getSnapshoting());
 
+    const auto & snapshot_write_limiter = state_machine.getSnapshotWriteLimiter();
+    print(ret, "snap_write_bytes", snapshot_write_limiter.getWrittenBytes());
+    print(ret, "snap_write_bytes_per_second", snapshot_write_limiter.getBytesPerSecond());
+    print(ret, "snap_write_stall_ms", snapshot_write_limiter.getStallMicroseconds() / 1000);
+
+    for (const auto & usage : state_machine.getQuotaUsages())
+    {
+        print(ret, "quota_nodes_limit_" + usage.path, usage.quota.max_nodes);
+        print(ret, "quota_nodes_usage_" + usage.path, usage.nodes);
+        print(ret, "quota_bytes_limit_" + usage.path, usage.quota.max_bytes);
+        print(ret, "quota_bytes_usage_" + usage.path, usage.bytes);
+    }
+
 #if defined(__linux__) || defined(__APPLE__)
     print(ret, "open_file_descriptor_count", getCurrentProcessFDCount());
     print(ret, "max_file_descriptor_count", getMaxFileDescriptorCount());
@@ -395,6 +413,14 @@ String DumpCommand::run()
     return buf.str();
 }
 
+String HeaviestSubtreesCommand::run()
+{
+    StringBuffer buf;
+    const auto & state_machine = keeper_dispatcher.getStateMachine();
+    state_machine.dumpHeaviestSubtrees(buf, TOP_N);
+    return buf.str();
+}
+
 String EnviCommand::run()
 {
     using Poco::Environment;
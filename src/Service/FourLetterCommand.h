@@ -352,4 +352,20 @@ struct RequestLeaderCommand : public IFourLetterCommand
     ~RequestLeaderCommand() override = default;
 };
 
+/// Lists the top subtrees with the most bytes: path, bytes and nodes of the subtree.
+/// Note, it scans all nodes, use it carefully on large data set.
+struct HeaviestSubtreesCommand : public IFourLetterCommand
+{
+    static constexpr size_t TOP_N = 10;
+
+    explicit HeaviestSubtreesCommand(KeeperDispatcher & keeper_dispatcher_)
+        : IFourLetterCommand(keeper_dispatcher_)
+    {
+    }
+
+    String name() override { return "hsub"; }
+    String run() override;
+    ~HeaviestSubtreesCommand() override = default;
+};
+
 }
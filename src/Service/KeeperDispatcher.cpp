@@ -1,9 +1,12 @@
 #include <Service/KeeperDispatcher.h>
+#include <Service/SocketReactor.h>
 #include <Service/WriteBufferFromFiFoBuffer.h>
 #include <Service/formatHex.h>
+#include <unordered_set>
 #include <Poco/NumberFormatter.h>
 #include <Common/DNSResolver.h>
 #include <Common/checkStackSize.h>
+#include <Common/getNumberOfPhysicalCPUCores.h>
 #include <Common/isLocalAddress.h>
 #include <Common/setThreadName.h>
 
@@ -22,11 +25,15 @@ using Poco::NumberFormatter;
 
 KeeperDispatcher::KeeperDispatcher()
     : configuration_and_settings(std::make_shared<Settings>())
+    , responses_queue(getNumberOfPhysicalCPUCores())
     , log(&Poco::Logger::get("KeeperDispatcher"))
     , request_processor(std::make_shared<RequestProcessor>(responses_queue))
     , request_accumulator(request_processor)
     , request_forwarder(request_processor)
 {
+    session_to_response_callback.resize(responses_queue.shardCount());
+    for (auto & shard : session_to_response_callback)
+        shard = std::make_unique<ResponseCallbacksShard>();
 }
 
 void KeeperDispatcher::requestThreadFakeZk(size_t thread_index)
@@ -64,7 +71,9 @@ void KeeperDispatcher::requestThreadFakeZk(size_t thread_index)
                         request_for_session.request->getOpNum());
                     request_processor->push(request_for_session);
                 }
-                else if (!request_for_session.isForwardRequest())
+                else if (!request_for_session.isForwardRequest()
+                         && !(request_for_session.request->getOpNum() == Coordination::OpNum::DeleteContainer
+                              && request_for_session.session_id == 0))
                 {
                     LOG_WARNING(log, "not local session {}", toHexString(request_for_session.session_id));
                 }
@@ -120,43 +129,80 @@ void KeeperDispatcher::requestThread()
     }
 }
 
-void KeeperDispatcher::responseThread()
+void KeeperDispatcher::responseThread(size_t shard_id)
 {
-    setThreadName("KeeperRspT");
+    setThreadName(("KeeperRspT#" + std::to_string(shard_id)).c_str());
 
-    KeeperStore::ResponseForSession response_for_session;
+    KeeperStore::ResponsesForSessions responses;
     UInt64 max_wait = configuration_and_settings->raft_settings->operation_timeout_ms;
 
     while (!shutdown_called)
     {
-        if (responses_queue.tryPop(response_for_session, std::min(max_wait, static_cast<UInt64>(1000))))
+        try
         {
-            if (shutdown_called)
-                break;
+            deliverResponses(shard_id, responses, std::min(max_wait, static_cast<UInt64>(1000)));
+        }
+        catch (...)
+        {
+            tryLogCurrentException(__PRETTY_FUNCTION__);
+        }
+    }
+}
+
+bool KeeperDispatcher::deliverResponses(size_t shard_id, KeeperStore::ResponsesForSessions & responses, UInt64 max_wait_ms)
+{
+    responses.clear();
+    if (!responses_queue.tryPopBatch(shard_id, responses, MAX_RESPONSES_BATCH_SIZE, max_wait_ms) || shutdown_called)
+        return false;
+
+    setResponses(shard_id, responses);
+    return true;
+}
+
+void KeeperDispatcher::setResponse(int64_t session_id, const Coordination::ZooKeeperResponsePtr & response)
+{
+    setResponses(static_cast<uint64_t>(session_id) % responses_queue.shardCount(), {{session_id, response}});
+}
+
+void KeeperDispatcher::setResponses(size_t shard_id, const KeeperStore::ResponsesForSessions & responses)
+{
+    /// One watch event fanned out to many sessions is the same response object,
+    /// it keeps its bytes and every connection copies them. Other responses
+    /// are serialized by connections in their IO threads.
+    std::unordered_set<SocketReactor *> reactors_to_wake_up;
+
+    auto & shard = *session_to_response_callback[shard_id];
+    {
+        std::lock_guard lock(shard.mutex);
+        for (const auto & [session_id, response] : responses)
+        {
+            auto session_writer = shard.callbacks.find(session_id);
+            if (session_writer == shard.callbacks.end())
+                continue;
 
             try
             {
-                setResponse(response_for_session.session_id, response_for_session.response);
+                std::shared_ptr<const String> serialized;
+                if (const auto * watch_response = dynamic_cast<const Coordination::ZooKeeperWatchResponse *>(response.get()))
+                    serialized = watch_response->getSerialized();
+
+                if (auto * reactor = session_writer->second(response, serialized))
+                    reactors_to_wake_up.insert(reactor);
             }
             catch (...)
             {
-                tryLogCurrentException(__PRETTY_FUNCTION__);
+                tryLogCurrentException(log, "Failed to deliver response to session " + toHexString(session_id));
             }
+
+            /// Session closed, no more writes
+            if (response->xid != Coordination::WATCH_XID && response->getOpNum() == Coordination::OpNum::Close)
+                shard.callbacks.erase(session_writer);
         }
     }
-}
 
-void KeeperDispatcher::setResponse(int64_t session_id, const Coordination::ZooKeeperResponsePtr & response)
-{
-    std::lock_guard lock(session_to_response_callback_mutex);
-    auto session_writer = session_to_response_callback.find(session_id);
-    if (session_writer == session_to_response_callback.end())
-        return;
-
-    session_writer->second(response);
-    /// Session closed, no more writes
-    if (response->xid != Coordination::WATCH_XID && response->getOpNum() == Coordination::OpNum::Close)
-        session_to_response_callback.erase(session_writer);
+    /// Interrupt reactors sleeping, connections will flush all pending responses in one writable event.
+    for (auto * reactor : reactors_to_wake_up)
+        reactor->wakeUp();
 }
 
 void KeeperDispatcher::sendAppendEntryResponse(int32_t server_id, int32_t client_id, const ForwardResponse & response)
@@ -189,8 +235,9 @@ void KeeperDispatcher::unRegisterForward(int32_t server_id, int32_t client_id)
 bool KeeperDispatcher::putRequest(const Coordination::ZooKeeperRequestPtr & request, int64_t session_id)
 {
     {
-        std::lock_guard lock(session_to_response_callback_mutex);
-        if (session_to_response_callback.count(session_id) == 0)
+        auto & shard = responseCallbacksShardFor(session_id);
+        std::lock_guard lock(shard.mutex);
+        if (!shard.callbacks.contains(session_id))
             return false;
     }
 
@@ -311,7 +358,7 @@ void KeeperDispatcher::initialize(const Poco::Util::AbstractConfiguration & conf
     }
 
     request_thread = std::make_shared<ThreadPool>(thread_count);
-    responses_thread = std::make_shared<ThreadPool>(1);
+    responses_thread = std::make_shared<ThreadPool>(responses_queue.shardCount());
     for (size_t i = 0; i < thread_count; i++)
     {
         if (session_consistent)
@@ -323,7 +370,8 @@ void KeeperDispatcher::initialize(const Poco::Util::AbstractConfiguration & conf
             request_thread->trySchedule([this] { requestThread(); });
         }
     }
-    responses_thread->trySchedule([this] { responseThread(); });
+    for (size_t i = 0; i < responses_queue.shardCount(); i++)
+        responses_thread->trySchedule([this, i] { responseThread(i); });
 
     session_cleaner_thread = ThreadFromGlobalPool([this] { sessionCleanerTask(); });
     update_configuration_thread = ThreadFromGlobalPool([this] { updateConfigurationThread(); });
@@ -378,7 +426,11 @@ void KeeperDispatcher::shutdown()
             response->error = Coordination::Error::ZSESSIONEXPIRED;
             setResponse(request_for_session.session_id, response);
         }
-        session_to_response_callback.clear();
+        for (auto & shard : session_to_response_callback)
+        {
+            std::lock_guard lock(shard->mutex);
+            shard->callbacks.clear();
+        }
     }
     catch (...)
     {
@@ -390,8 +442,9 @@ void KeeperDispatcher::shutdown()
 
 void KeeperDispatcher::registerSession(int64_t session_id, ZooKeeperResponseCallback callback, bool is_reconnected)
 {
-    std::lock_guard lock(session_to_response_callback_mutex);
-    if (!session_to_response_callback.try_emplace(session_id, callback).second && !is_reconnected)
+    auto & shard = responseCallbacksShardFor(session_id);
+    std::lock_guard lock(shard.mutex);
+    if (!shard.callbacks.try_emplace(session_id, callback).second && !is_reconnected)
         throw Exception(RK::ErrorCodes::LOGICAL_ERROR, "Session with id {} already registered in dispatcher", toHexString(session_id));
 }
 
@@ -446,6 +499,9 @@ void KeeperDispatcher::sessionCleanerTask()
                     finishSession(dead_session);
                     LOG_INFO(log, "Dead session close request pushed");
                 }
+
+                cleanExpiredTTLNodes();
+                cleanEmptyContainers();
             }
             else
             {
@@ -463,6 +519,65 @@ void KeeperDispatcher::sessionCleanerTask()
 }
 
 
+void KeeperDispatcher::cleanExpiredTTLNodes()
+{
+    /// Bound proposals per round, so that a burst of expired nodes does not flood the log.
+    static constexpr size_t MAX_TTL_NODES_PER_ROUND = 1000;
+
+    using namespace std::chrono;
+    int64_t now = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+
+    auto expired_nodes = server->getExpiredTTLNodes(now, MAX_TTL_NODES_PER_ROUND);
+    if (expired_nodes.empty())
+        return;
+
+    LOG_DEBUG(log, "Found expired TTL nodes {}, will try to remove them", expired_nodes.size());
+    proposeDeleteContainers(expired_nodes, now);
+}
+
+void KeeperDispatcher::cleanEmptyContainers()
+{
+    const auto & raft_settings = configuration_and_settings->raft_settings;
+    if (raft_settings->max_container_deletes_per_minute == 0)
+        return;
+
+    /// Spread deletes over rounds, a rate lower than one delete per round is accumulated.
+    double deletes_per_round
+        = static_cast<double>(raft_settings->max_container_deletes_per_minute) * raft_settings->dead_session_check_period_ms / 60000;
+    container_deletes_allowance = std::min(container_deletes_allowance + deletes_per_round, std::max(deletes_per_round, 1.0));
+    if (container_deletes_allowance < 1)
+        return;
+
+    auto empty_containers = server->getEmptyContainers(static_cast<size_t>(container_deletes_allowance));
+    if (empty_containers.empty())
+        return;
+
+    container_deletes_allowance -= empty_containers.size();
+    LOG_DEBUG(log, "Found empty containers {}, will try to remove them", empty_containers.size());
+
+    using namespace std::chrono;
+    proposeDeleteContainers(empty_containers, duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count());
+}
+
+void KeeperDispatcher::proposeDeleteContainers(std::vector<String> & paths, int64_t now)
+{
+    for (auto & path : paths)
+    {
+        auto request = std::make_shared<Coordination::ZooKeeperDeleteContainerRequest>();
+        request->path = std::move(path);
+        KeeperStore::RequestForSession request_info;
+        request_info.request = request;
+        /// Belongs to no session, there is no one to respond to.
+        request_info.session_id = 0;
+        request_info.create_time = now;
+        {
+            std::lock_guard lock(push_request_mutex);
+            if (!requests_queue->push(std::move(request_info)))
+                throw Exception("Cannot push request to queue", ErrorCodes::SYSTEM_ERROR);
+        }
+    }
+}
+
 void KeeperDispatcher::updateConfigurationThread()
 {
     setThreadName("UpdateConfig");
@@ -519,26 +634,24 @@ void KeeperDispatcher::updateConfigurationThread()
 void KeeperDispatcher::finishSession(int64_t session_id)
 {
     LOG_TRACE(log, "finish session {}", toHexString(session_id));
-    std::lock_guard lock(session_to_response_callback_mutex);
-    auto session_it = session_to_response_callback.find(session_id);
-    if (session_it != session_to_response_callback.end())
-        session_to_response_callback.erase(session_it);
+    auto & shard = responseCallbacksShardFor(session_id);
+    std::lock_guard lock(shard.mutex);
+    shard.callbacks.erase(session_id);
 }
 
 bool KeeperDispatcher::isLocalSession(int64_t session_id)
 {
     LOG_TRACE(log, "contains session {}", toHexString(session_id));
-    std::lock_guard lock(session_to_response_callback_mutex);
-    auto session_it = session_to_response_callback.find(session_id);
-    return session_it != session_to_response_callback.end();
+    auto & shard = responseCallbacksShardFor(session_id);
+    std::lock_guard lock(shard.mutex);
+    return shard.callbacks.contains(session_id);
 }
 
 void KeeperDispatcher::filterLocalSessions(std::unordered_map<int64_t, int64_t> & session_to_expiration_time)
 {
-    std::lock_guard lock(session_to_response_callback_mutex);
     for (auto it = session_to_expiration_time.begin(); it != session_to_expiration_time.end();)
     {
-        if (!session_to_response_callback.contains(it->first))
+        if (!isLocalSession(it->first))
         {
             LOG_TRACE(log, "Not local session {}", it->first);
             it = session_to_expiration_time.erase(it);
@@ -620,9 +733,11 @@ Keeper4LWInfo KeeperDispatcher::getKeeper4LWInfo()
         std::lock_guard lock(push_request_mutex);
         result.outstanding_requests_count = requests_queue->size();
     }
+    result.alive_connections_count = 0;
+    for (auto & shard : session_to_response_callback)
     {
-        std::lock_guard lock(session_to_response_callback_mutex);
-        result.alive_connections_count = session_to_response_callback.size();
+        std::lock_guard lock(shard->mutex);
+        result.alive_connections_count += shard->callbacks.size();
     }
     if (result.is_leader)
     {
@@ -24,7 +24,15 @@
 
 namespace RK
 {
-using ZooKeeperResponseCallback = std::function<void(const Coordination::ZooKeeperResponsePtr & response)>;
+class SocketReactor;
+
+/// Deliver response to client connection. `serialized` is not null if the response
+/// was already serialized by dispatcher, this is done for watch responses which are
+/// shared by many sessions, other responses are serialized by the connection in its
+/// IO thread. Callback must not wake up the reactor, it returns the reactor to be
+/// woken up after the whole batch of responses is delivered.
+using ZooKeeperResponseCallback = std::function<SocketReactor *(
+    const Coordination::ZooKeeperResponsePtr & response, const std::shared_ptr<const String> & serialized)>;
 using ForwardResponseCallback = std::function<void(const ForwardResponse & response)>;
 
 class KeeperDispatcher : public std::enable_shared_from_this<KeeperDispatcher>
@@ -34,12 +42,23 @@ private:
 
     std::mutex push_request_mutex;
     ptr<RequestsQueue> requests_queue;
-    ThreadSafeQueue<KeeperStore::ResponseForSession> responses_queue;
+    /// Responses are sharded by session, every shard is delivered by its own response thread.
+    KeeperStore::KeeperResponsesQueue responses_queue;
     std::atomic<bool> shutdown_called{false};
     using SessionToResponseCallback = std::unordered_map<int64_t, ZooKeeperResponseCallback>;
 
-    std::mutex session_to_response_callback_mutex;
-    SessionToResponseCallback session_to_response_callback;
+    /// Response callbacks of sessions in the same shard as responses_queue.
+    struct ResponseCallbacksShard
+    {
+        std::mutex mutex;
+        SessionToResponseCallback callbacks;
+    };
+    std::vector<std::unique_ptr<ResponseCallbacksShard>> session_to_response_callback;
+
+    ResponseCallbacksShard & responseCallbacksShardFor(int64_t session_id)
+    {
+        return *session_to_response_callback[static_cast<uint64_t>(session_id) % session_to_response_callback.size()];
+    }
 
     std::mutex forward_to_response_callback_mutex;
 
@@ -66,6 +85,8 @@ private:
     ThreadPoolPtr responses_thread;
 
     ThreadFromGlobalPool session_cleaner_thread;
+    /// Empty containers session cleaner thread can remove now, refilled every round
+    double container_deletes_allowance = 0;
 
     /// Apply or wait for configuration changes
     ThreadFromGlobalPool update_configuration_thread;
@@ -91,9 +112,19 @@ private:
 
     void requestThread();
     void requestThreadFakeZk(size_t thread_index);
-    void responseThread();
+    void responseThread(size_t shard_id);
     void sessionCleanerTask();
+    /// Propose to remove expired TTL nodes and empty container nodes, only invoked on leader.
+    void cleanExpiredTTLNodes();
+    void cleanEmptyContainers();
+    void proposeDeleteContainers(std::vector<String> & paths, int64_t now);
     void setResponse(int64_t session_id, const Coordination::ZooKeeperResponsePtr & response);
+    /// Deliver a batch of responses of one shard taking the shard lock once,
+    /// serializing every watch response once and waking up every reactor once.
+    void setResponses(size_t shard_id, const KeeperStore::ResponsesForSessions & responses);
+
+    /// Max responses delivered in one batch by responseThread
+    static constexpr size_t MAX_RESPONSES_BATCH_SIZE = 1024;
 
 public:
     KeeperDispatcher();
@@ -119,6 +150,12 @@ public:
     void unRegisterForward(int32_t server_id, int32_t client_id);
 
     void registerSession(int64_t session_id, ZooKeeperResponseCallback callback, bool is_reconnected = false);
+
+    /// Responses of processed requests, delivered to sessions by response threads
+    KeeperStore::KeeperResponsesQueue & getResponsesQueue() { return responses_queue; }
+    /// Pop a batch of responses of the shard and deliver it. Return false if there
+    /// is no response in max_wait_ms. One iteration of response thread.
+    bool deliverResponses(size_t shard_id, KeeperStore::ResponsesForSessions & responses, UInt64 max_wait_ms);
     /// Call if we don't need any responses for this session no more (session was expired)
     void finishSession(int64_t session_id);
 
@@ -420,6 +420,16 @@ std::vector<int64_t> KeeperServer::getDeadSessions()
     return state_machine->getDeadSessions();
 }
 
+std::vector<String> KeeperServer::getExpiredTTLNodes(int64_t now, size_t max_count)
+{
+    return state_machine->getExpiredTTLNodes(now, max_count);
+}
+
+std::vector<String> KeeperServer::getEmptyContainers(size_t max_count)
+{
+    return state_machine->getEmptyContainers(max_count);
+}
+
 ConfigUpdateActions KeeperServer::getConfigurationDiff(const Poco::Util::AbstractConfiguration & config_)
 {
     return state_manager->getConfigurationDiff(config_);
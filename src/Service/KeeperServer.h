@@ -75,6 +75,11 @@ public:
 
     std::vector<int64_t> getDeadSessions();
 
+    /// Expired TTL nodes which can be removed, used by leader
+    std::vector<String> getExpiredTTLNodes(int64_t now, size_t max_count);
+    /// Empty container nodes which can be removed, used by leader
+    std::vector<String> getEmptyContainers(size_t max_count);
+
     void handleRemoteSession(int64_t session_id, int64_t expiration_time);
 
     int64_t getSessionTimeout(int64_t session_id);
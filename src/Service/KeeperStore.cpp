@@ -1,9 +1,14 @@
+#include <algorithm>
+#include <charconv>
 #include <functional>
 #include <iomanip>
+#include <queue>
 #include <Service/KeeperStore.h>
 #include <boost/algorithm/string.hpp>
 #include <Poco/Base64Encoder.h>
 #include <Poco/SHA1Engine.h>
+#include <Common/PooledAllocator.h>
+#include <Common/Stopwatch.h>
 #include <Common/StringUtils/StringUtils.h>
 #include <Common/ZooKeeper/IKeeper.h>
 
@@ -16,28 +21,25 @@ namespace ErrorCodes
 }
 
 static inline void set_response(
-    ThreadSafeQueue<KeeperStore::ResponseForSession> & responses_queue,
+    KeeperStore::KeeperResponsesQueue & responses_queue,
     const KeeperStore::ResponsesForSessions & responses,
     bool ignore_response)
 {
     if (!ignore_response)
-    {
-        for (const auto & response : responses)
-            responses_queue.push(response);
-    }
+        responses_queue.pushBatch(responses);
 }
 
 static inline void set_response(
-    ThreadSafeQueue<KeeperStore::ResponseForSession> & responses_queue,
+    KeeperStore::KeeperResponsesQueue & responses_queue,
     const KeeperStore::ResponseForSession & response,
     bool ignore_response)
 {
-    KeeperStore::ResponsesForSessions responses;
-    responses.push_back(response);
-    set_response(responses_queue, responses, ignore_response);
+    if (!ignore_response)
+        responses_queue.push(response);
 }
 
-static String parentPath(const String & path)
+/// Both return a view into path, so the path must outlive the result.
+static std::string_view parentPath(std::string_view path)
 {
     auto rslash_pos = path.rfind('/');
     if (rslash_pos > 0)
@@ -45,10 +47,9 @@ static String parentPath(const String & path)
     return "/";
 }
 
-static std::string getBaseName(const String & path)
+static std::string_view getBaseName(std::string_view path)
 {
-    size_t basename_start = path.rfind('/');
-    return std::string{&path[basename_start + 1], path.length() - basename_start - 1};
+    return path.substr(path.rfind('/') + 1);
 }
 
 static String base64Encode(const String & decoded)
@@ -171,63 +172,75 @@ static bool fixupACL(
     return valid_found;
 }
 
-static KeeperStore::ResponsesForSessions processWatchesImpl(
-    const String & path, KeeperStore::Watches & watches, KeeperStore::Watches & list_watches, Coordination::Event event_type)
+static std::shared_ptr<Coordination::ZooKeeperWatchResponse> makeWatchResponse(const String & path, Coordination::Event event_type)
+{
+    std::shared_ptr<Coordination::ZooKeeperWatchResponse> watch_response = makePooled<Coordination::ZooKeeperWatchResponse>();
+    watch_response->path = path;
+    watch_response->xid = Coordination::WATCH_XID;
+    watch_response->zxid = -1;
+    watch_response->type = event_type;
+    watch_response->state = Coordination::State::CONNECTED;
+    return watch_response;
+}
+
+/// Collect watchers of the event on path and make one response per session.
+/// One response object is shared by all watchers of the event, a session
+/// watching the path in several ways gets the event only once.
+static void addWatchResponses(
+    KeeperStore::ResponsesForSessions & result,
+    WatchManager::SessionIDs & watcher_sessions,
+    const String & path,
+    Coordination::Event event_type)
 {
     static auto * log = &(Poco::Logger::get("KeeperStore"));
-    KeeperStore::ResponsesForSessions result;
-    auto it = watches.find(path);
-    if (it != watches.end())
+    if (watcher_sessions.empty())
+        return;
+
+    if (watcher_sessions.size() > 1)
     {
-        std::shared_ptr<Coordination::ZooKeeperWatchResponse> watch_response = std::make_shared<Coordination::ZooKeeperWatchResponse>();
-        watch_response->path = path;
-        watch_response->xid = Coordination::WATCH_XID;
-        watch_response->zxid = -1;
-        watch_response->type = event_type;
-        watch_response->state = Coordination::State::CONNECTED;
-        for (auto watcher_session : it->second)
-        {
-            result.push_back(KeeperStore::ResponseForSession{watcher_session, watch_response});
-            LOG_TRACE(log, "Watch triggered path {}, watcher session {}", path, watcher_session);
-        }
-        watches.erase(it);
+        std::sort(watcher_sessions.begin(), watcher_sessions.end());
+        watcher_sessions.erase(std::unique(watcher_sessions.begin(), watcher_sessions.end()), watcher_sessions.end());
     }
 
-    auto parent_path = parentPath(path);
-
-    Strings paths_to_check_for_list_watches;
-    if (event_type == Coordination::Event::CREATED)
+    auto watch_response = makeWatchResponse(path, event_type);
+    for (auto watcher_session : watcher_sessions)
     {
-        paths_to_check_for_list_watches.push_back(parent_path); /// Trigger list watches for parent
+        result.push_back(KeeperStore::ResponseForSession{watcher_session, watch_response});
+        LOG_TRACE(log, "Watch triggered path {}, type {}, watcher session {}", path, event_type, toHexString(watcher_session));
     }
-    else if (event_type == Coordination::Event::DELETED)
+}
+
+static KeeperStore::ResponsesForSessions processWatchesImpl(
+    const String & path, WatchManager & watch_manager, Coordination::Event event_type)
+{
+    KeeperStore::ResponsesForSessions result;
+
+    /// Watchers of the path itself
+    auto watcher_sessions = watch_manager.fetchAndRemoveWatches(path, WatchType::DATA);
+    if (event_type == Coordination::Event::DELETED)
     {
-        paths_to_check_for_list_watches.push_back(path); /// Trigger both list watches for this path
-        paths_to_check_for_list_watches.push_back(parent_path); /// And for parent path
+        /// Trigger list watches for this path too
+        auto list_watcher_sessions = watch_manager.fetchAndRemoveWatches(path, WatchType::LIST);
+        watcher_sessions.insert(watcher_sessions.end(), list_watcher_sessions.begin(), list_watcher_sessions.end());
     }
+    watch_manager.collectPersistentWatches(path, watcher_sessions);
+    /// Persistent recursive watches never get CHILD events
+    if (event_type != Coordination::Event::CHILD)
+        watch_manager.collectRecursiveWatches(path, watcher_sessions);
+
+    addWatchResponses(result, watcher_sessions, path, event_type);
+
     /// CHANGED event never trigger list wathes
+    if (event_type != Coordination::Event::CREATED && event_type != Coordination::Event::DELETED)
+        return result;
 
-    for (const auto & path_to_check : paths_to_check_for_list_watches)
-    {
-        it = list_watches.find(path_to_check);
-        if (it != list_watches.end())
-        {
-            std::shared_ptr<Coordination::ZooKeeperWatchResponse> watch_list_response = std::make_shared<Coordination::ZooKeeperWatchResponse>();
-            watch_list_response->path = path_to_check;
-            watch_list_response->xid = Coordination::WATCH_XID;
-            watch_list_response->zxid = -1;
-            if (path_to_check == parent_path)
-                watch_list_response->type = Coordination::Event::CHILD;
-            else
-                watch_list_response->type = Coordination::Event::DELETED;
+    /// And for parent path
+    String parent_path(parentPath(path));
+    auto parent_watcher_sessions = watch_manager.fetchAndRemoveWatches(parent_path, WatchType::LIST);
+    watch_manager.collectPersistentWatches(parent_path, parent_watcher_sessions);
 
-            watch_list_response->state = Coordination::State::CONNECTED;
-            for (auto watcher_session : it->second)
-                result.push_back(KeeperStore::ResponseForSession{watcher_session, watch_list_response});
+    addWatchResponses(result, parent_watcher_sessions, parent_path, Coordination::Event::CHILD);
 
-            list_watches.erase(it);
-        }
-    }
     return result;
 }
 
@@ -235,16 +248,29 @@ static KeeperStore::ResponsesForSessions processWatchesImpl(
  */
 static bool shouldIncreaseZxid(const Coordination::ZooKeeperRequestPtr & zk_request)
 {
-    return !(dynamic_cast<Coordination::ZooKeeperGetRequest *>(zk_request.get())
-        || dynamic_cast<Coordination::ZooKeeperSetWatchesRequest *>(zk_request.get())
-        || dynamic_cast<Coordination::ZooKeeperExistsRequest *>(zk_request.get())
-        || dynamic_cast<Coordination::ZooKeeperAuthRequest *>(zk_request.get())
-        || dynamic_cast<Coordination::ZooKeeperHeartbeatRequest *>(zk_request.get())
-        || dynamic_cast<Coordination::ZooKeeperListRequest *>(zk_request.get())
-        || dynamic_cast<Coordination::ZooKeeperSimpleListRequest *>(zk_request.get()));
+    switch (zk_request->getOpNum())
+    {
+        case Coordination::OpNum::Get:
+        case Coordination::OpNum::SetWatches:
+        case Coordination::OpNum::SetWatches2:
+        case Coordination::OpNum::Exists:
+        case Coordination::OpNum::Auth:
+        case Coordination::OpNum::Heartbeat:
+        case Coordination::OpNum::List:
+        case Coordination::OpNum::SimpleList:
+        case Coordination::OpNum::PagedList:
+        case Coordination::OpNum::GetAllChildrenNumber:
+        case Coordination::OpNum::AddWatch:
+        case Coordination::OpNum::RemoveWatches:
+        case Coordination::OpNum::MultiRead:
+            return false;
+        default:
+            return true;
+    }
 }
 
-KeeperStore::KeeperStore(int64_t tick_time_ms, const String & super_digest_) : session_expiry_queue(tick_time_ms), super_digest(super_digest_)
+KeeperStore::KeeperStore(int64_t tick_time_ms, const String & super_digest_)
+    : session_expiry_queue(tick_time_ms), ttl_expiry_queue(tick_time_ms), super_digest(super_digest_)
 {
     log = &(Poco::Logger::get("KeeperStore"));
     container.emplace("/", std::make_shared<KeeperNode>());
@@ -263,13 +289,44 @@ struct StoreRequest
         int64_t time) const = 0;
     virtual bool checkAuth(KeeperStore & /*storage*/, int64_t /*session_id*/) const { return true; }
 
-    virtual KeeperStore::ResponsesForSessions
-    processWatches(KeeperStore::Watches & /*watches*/, KeeperStore::Watches & /*list_watches*/) const
+    virtual KeeperStore::ResponsesForSessions processWatches(WatchManager & /*watch_manager*/) const { return {}; }
+
+    /// Forget nodes looked up so far, they may be changed by preceding sub-requests of multi.
+    void resetResolvedNodes() const { resolved = {}; }
+
+    virtual ~StoreRequest() = default;
+
+protected:
+    /// Node of the request path and its parent are looked up at most once and shared by checkAuth and process.
+    const KeeperStore::Container::SharedElement & getNode(KeeperStore & store) const
     {
-        return {};
+        if (!resolved.node_resolved)
+        {
+            resolved.node = store.container.get(zk_request->getPath());
+            resolved.node_resolved = true;
+        }
+        return resolved.node;
     }
 
-    virtual ~StoreRequest() = default;
+    const KeeperStore::Container::SharedElement & getParent(KeeperStore & store) const
+    {
+        if (!resolved.parent_resolved)
+        {
+            resolved.parent = store.container.get(parentPath(zk_request->getPath()));
+            resolved.parent_resolved = true;
+        }
+        return resolved.parent;
+    }
+
+private:
+    struct ResolvedNodes
+    {
+        KeeperStore::Container::SharedElement node;
+        KeeperStore::Container::SharedElement parent;
+        bool node_resolved = false;
+        bool parent_resolved = false;
+    };
+    mutable ResolvedNodes resolved;
 };
 
 struct SvsKeeperStorageHeartbeatRequest final : public StoreRequest
@@ -295,10 +352,65 @@ struct SvsKeeperStorageSetWatchesRequest final : public StoreRequest
         return {zk_request->makeResponse(), {}};
     }
 
-    KeeperStore::ResponsesForSessions
-    processWatches(KeeperStore::Watches & /*watches*/, KeeperStore::Watches & /*list_watches*/) const override
+    KeeperStore::ResponsesForSessions processWatches(WatchManager & /*watch_manager*/) const override { return {}; }
+};
+
+/// Watch registration itself is done in KeeperStore::processRequest, so that
+/// registration and pushing response are atomic.
+struct SvsKeeperStorageAddWatchRequest final : public StoreRequest
+{
+    using StoreRequest::StoreRequest;
+    std::pair<Coordination::ZooKeeperResponsePtr, Undo> process(KeeperStore & /* store */,
+        int64_t /* zxid */,
+        int64_t /* session_id */,
+        int64_t /* time */) const override
+    {
+        auto response = zk_request->makeResponse();
+        auto & request = dynamic_cast<Coordination::ZooKeeperAddWatchRequest &>(*zk_request);
+        if (request.mode != static_cast<int32_t>(Coordination::AddWatchMode::PERSISTENT)
+            && request.mode != static_cast<int32_t>(Coordination::AddWatchMode::PERSISTENT_RECURSIVE))
+            response->error = Coordination::Error::ZBADARGUMENTS;
+        return {response, {}};
+    }
+};
+
+struct SvsKeeperStorageRemoveWatchesRequest final : public StoreRequest
+{
+    using StoreRequest::StoreRequest;
+    std::pair<Coordination::ZooKeeperResponsePtr, Undo> process(KeeperStore & store,
+        int64_t /* zxid */,
+        int64_t session_id,
+        int64_t /* time */) const override
     {
-        return {};
+        auto response = zk_request->makeResponse();
+        auto & request = dynamic_cast<Coordination::ZooKeeperRemoveWatchesRequest &>(*zk_request);
+
+        /// Same as ZooKeeper: persistent watches are both data and children watches,
+        /// recursive ones are data watches only.
+        std::vector<WatchType> types;
+        switch (static_cast<Coordination::WatcherType>(request.type))
+        {
+            case Coordination::WatcherType::CHILDREN:
+                types = {WatchType::LIST, WatchType::PERSISTENT};
+                break;
+            case Coordination::WatcherType::DATA:
+                types = {WatchType::DATA, WatchType::PERSISTENT, WatchType::PERSISTENT_RECURSIVE};
+                break;
+            case Coordination::WatcherType::ANY:
+                types = {WatchType::DATA, WatchType::LIST, WatchType::PERSISTENT, WatchType::PERSISTENT_RECURSIVE};
+                break;
+            default:
+                response->error = Coordination::Error::ZBADARGUMENTS;
+                return {response, {}};
+        }
+
+        bool removed = false;
+        for (auto type : types)
+            removed |= store.watch_manager.removeWatch(request.path, session_id, type);
+
+        if (!removed)
+            response->error = Coordination::Error::ZNOWATCHER;
+        return {response, {}};
     }
 };
 
@@ -342,38 +454,18 @@ struct SvsKeeperStorageCreateRequest final : public StoreRequest
 {
     using StoreRequest::StoreRequest;
 
-    KeeperStore::ResponsesForSessions
-    processWatches(KeeperStore::Watches & watches, KeeperStore::Watches & list_watches) const override
+    KeeperStore::ResponsesForSessions processWatches(WatchManager & watch_manager) const override
     {
-        return processWatchesImpl(zk_request->getPath(), watches, list_watches, Coordination::Event::CREATED);
+        return processWatchesImpl(zk_request->getPath(), watch_manager, Coordination::Event::CREATED);
     }
 
     bool checkAuth(KeeperStore & store, int64_t session_id) const override
     {
-        auto & container = store.container;
-        auto parent_path = parentPath(zk_request->getPath());
-
-        auto parent = container.get(parent_path);
+        const auto & parent = getParent(store);
         if (parent == nullptr)
             return true;
 
-        const auto & node_acls = store.acl_map.convertNumber(parent->acl_id);
-        if (node_acls.empty())
-            return true;
-
-        std::shared_lock r_lock(store.auth_mutex);
-        auto it = store.session_and_auth.find(session_id);
-        if (it != store.session_and_auth.end())
-        {
-            const auto & session_auths = it->second;
-            /// LOL, GetACL require more permissions, then SetACL...
-            return checkACL(Coordination::ACL::Create, node_acls, session_auths);
-        }
-        else
-        {
-            std::vector<Coordination::AuthID> empty_auth_ids;
-            return checkACL(Coordination::ACL::Create, node_acls, empty_auth_ids);
-        }
+        return store.checkPermission(session_id, parent->acl_id, Coordination::ACL::Create);
     }
 
     std::pair<Coordination::ZooKeeperResponsePtr, Undo> process(KeeperStore & store,
@@ -381,14 +473,24 @@ struct SvsKeeperStorageCreateRequest final : public StoreRequest
         int64_t session_id,
         int64_t time) const override
     {
-        Poco::Logger * log = &(Poco::Logger::get("SvsKeeperStorageCreateRequest"));
+        static Poco::Logger * log = &(Poco::Logger::get("SvsKeeperStorageCreateRequest"));
 
         Coordination::ZooKeeperResponsePtr response_ptr = zk_request->makeResponse();
         Undo undo;
         Coordination::ZooKeeperCreateResponse & response = dynamic_cast<Coordination::ZooKeeperCreateResponse &>(*response_ptr);
         Coordination::ZooKeeperCreateRequest & request = dynamic_cast<Coordination::ZooKeeperCreateRequest &>(*zk_request);
 
-        auto parent = store.container.get(parentPath(request.path));
+        /// TTL flags are only accepted by CreateTTL, and CreateTTL must have a valid ttl, the same for container
+        bool is_ttl_op = request.getOpNum() == Coordination::OpNum::CreateTTL;
+        bool is_container_op = request.getOpNum() == Coordination::OpNum::CreateContainer;
+        if (request.is_ttl != is_ttl_op || (is_ttl_op && (request.ttl <= 0 || request.ttl > Coordination::MAX_TTL_MS))
+            || request.is_container != is_container_op)
+        {
+            response.error = Coordination::Error::ZBADARGUMENTS;
+            return {response_ptr, undo};
+        }
+
+        const auto & parent = getParent(store);
         if (parent == nullptr)
         {
             LOG_TRACE(log, "Create no parent {}, path {}", parentPath(request.path), request.path);
@@ -417,12 +519,17 @@ struct SvsKeeperStorageCreateRequest final : public StoreRequest
             response.error = Coordination::Error::ZNODEEXISTS;
             return {response_ptr, undo};
         }
-        String child_path = getBaseName(path_created);
+        String child_path(getBaseName(path_created));
         if (child_path.empty())
         {
             response.error = Coordination::Error::ZBADARGUMENTS;
             return {response_ptr, undo};
         }
+        if (!store.checkQuota(path_created, 1, request.data.length()))
+        {
+            response.error = Coordination::Error::ZQUOTAEXCEEDED;
+            return {response_ptr, undo};
+        }
         std::shared_ptr<KeeperNode> created_node = std::make_shared<KeeperNode>();
 
         Coordination::ACLs node_acls;
@@ -452,10 +559,16 @@ struct SvsKeeperStorageCreateRequest final : public StoreRequest
         created_node->stat.mtime = created_node->stat.ctime;
         created_node->stat.numChildren = 0;
         created_node->stat.dataLength = request.data.length();
-        created_node->data = request.data;
+        created_node->setData(request.data);
+        int64_t data_size = request.data.length();
+        created_node->subtree_bytes = data_size;
         created_node->is_ephemeral = request.is_ephemeral;
         if (request.is_ephemeral)
             created_node->stat.ephemeralOwner = session_id;
+        else if (request.is_ttl)
+            created_node->stat.ephemeralOwner = Coordination::ttlToEphemeralOwner(request.ttl);
+        else if (request.is_container)
+            created_node->stat.ephemeralOwner = Coordination::CONTAINER_EPHEMERAL_OWNER;
         created_node->is_sequental = request.is_sequential;
 
         int64_t pzxid;
@@ -474,23 +587,36 @@ struct SvsKeeperStorageCreateRequest final : public StoreRequest
             parent->stat.pzxid = zxid;
         }
 
+        if (auto * create2_response = dynamic_cast<Coordination::ZooKeeperCreate2Response *>(&response))
+            create2_response->stat = created_node->statForResponse();
+
         store.container.emplace(path_created, std::move(created_node));
+        store.updateAncestorsStats(path_created, 1, data_size);
+        store.changed_paths.add(path_created);
+        store.changed_paths.add(String(parentPath(path_created)));
+        store.onChildAdded(String(parentPath(path_created)), *parent);
 
         if (request.is_ephemeral)
         {
             std::lock_guard w_lock(store.ephemerals_mutex);
             store.ephemerals[session_id].emplace(path_created);
         }
+        else if (request.is_ttl)
+        {
+            store.addTTLNode(path_created, time + request.ttl);
+        }
 
         undo = [&store,
                 session_id,
                 path_created,
                 pzxid,
                 is_ephemeral = request.is_ephemeral,
-                parent_path = parentPath(request.path),
-                child_path, acl_id] {
+                is_ttl = request.is_ttl,
+                parent_path = String(parentPath(request.path)),
+                child_path, acl_id, data_size] {
             {
                 store.container.erase(path_created);
+                store.updateAncestorsStats(path_created, -1, -data_size);
                 store.acl_map.removeUsage(acl_id);
             }
             if (is_ephemeral)
@@ -498,6 +624,10 @@ struct SvsKeeperStorageCreateRequest final : public StoreRequest
                 std::lock_guard w_lock(store.ephemerals_mutex);
                 store.ephemerals[session_id].erase(path_created);
             }
+            else if (is_ttl)
+            {
+                store.removeTTLNode(path_created);
+            }
             auto undo_parent = store.container.at(parent_path);
             {
                 std::lock_guard parent_lock(undo_parent->mutex);
@@ -506,6 +636,7 @@ struct SvsKeeperStorageCreateRequest final : public StoreRequest
                 undo_parent->stat.pzxid = pzxid;
                 undo_parent->children.erase(child_path);
             }
+            store.onChildRemoved(parent_path, *undo_parent);
         };
 
         response.error = Coordination::Error::ZOK;
@@ -518,30 +649,11 @@ struct SvsKeeperStorageGetRequest final : public StoreRequest
 {
     bool checkAuth(KeeperStore & store, int64_t session_id) const override
     {
-        Poco::Logger * log = &(Poco::Logger::get("SvsKeeperStorageGetRequest"));
-        auto & container = store.container;
-        auto node = container.get(zk_request->getPath());
+        const auto & node = getNode(store);
         if (node == nullptr)
             return true;
 
-        const auto & node_acls = store.acl_map.convertNumber(node->acl_id);
-        LOG_TRACE(log, "path {}, acl_id {}, node_acls {}", zk_request->getPath(), node->acl_id, toString(node_acls));
-        if (node_acls.empty())
-            return true;
-
-        std::shared_lock r_lock(store.auth_mutex);
-        auto it = store.session_and_auth.find(session_id);
-        if (it != store.session_and_auth.end())
-        {
-            const auto & session_auths = it->second;
-            /// LOL, GetACL require more permissions, then SetACL...
-            return checkACL(Coordination::ACL::Read, node_acls, session_auths);
-        }
-        else
-        {
-            std::vector<Coordination::AuthID> empty_auth_ids;
-            return checkACL(Coordination::ACL::Read, node_acls, empty_auth_ids);
-        }
+        return store.checkPermission(session_id, node->acl_id, Coordination::ACL::Read);
     }
 
     using StoreRequest::StoreRequest;
@@ -552,9 +664,8 @@ struct SvsKeeperStorageGetRequest final : public StoreRequest
     {
         Coordination::ZooKeeperResponsePtr response_ptr = zk_request->makeResponse();
         Coordination::ZooKeeperGetResponse & response = dynamic_cast<Coordination::ZooKeeperGetResponse &>(*response_ptr);
-        Coordination::ZooKeeperGetRequest & request = dynamic_cast<Coordination::ZooKeeperGetRequest &>(*zk_request);
 
-        auto node = store.container.get(request.path);
+        const auto & node = getNode(store);
         if (node == nullptr)
         {
             response.error = Coordination::Error::ZNONODE;
@@ -564,7 +675,7 @@ struct SvsKeeperStorageGetRequest final : public StoreRequest
             {
                 std::shared_lock r_lock(node->mutex);
                 response.stat = node->statForResponse();
-                response.data = node->data;
+                response.shared_data = node->data;
             }
             response.error = Coordination::Error::ZOK;
         }
@@ -573,32 +684,82 @@ struct SvsKeeperStorageGetRequest final : public StoreRequest
     }
 };
 
-struct SvsKeeperStorageRemoveRequest final : public StoreRequest
+/// Remove a node without children from store, shared by Remove and DeleteContainer.
+static Undo removeNode(
+    KeeperStore & store,
+    const String & path,
+    const KeeperStore::Container::SharedElement & node,
+    const KeeperStore::Container::SharedElement & parent,
+    int64_t zxid)
 {
-    bool checkAuth(KeeperStore & store, int64_t session_id) const override
+    int64_t pzxid;
+    auto prev_node = node->clone();
+    String child_basename(getBaseName(path));
+
     {
-        auto & container = store.container;
-        auto parent = container.get(parentPath(zk_request->getPath()));
-        if (parent == nullptr)
-            return true;
+        std::lock_guard parent_lock(parent->mutex);
+        --parent->stat.numChildren;
+        pzxid = parent->stat.pzxid;
+        parent->stat.pzxid = zxid;
+        parent->children.erase(child_basename);
+    }
+    store.onChildRemoved(String(parentPath(path)), *parent);
+    store.onNodeRemoved(path, *prev_node);
 
-        const auto & node_acls = store.acl_map.convertNumber(parent->acl_id);
-        if (node_acls.empty())
-            return true;
+    store.acl_map.removeUsage(prev_node->acl_id);
+    store.container.erase(path);
+    store.updateAncestorsStats(path, -(1 + prev_node->descendants), -prev_node->subtree_bytes);
+    store.changed_paths.add(path);
+    store.changed_paths.add(String(parentPath(path)));
+
+    int64_t ephemeral_owner{};
+
+    if (prev_node->is_ephemeral)
+    {
+        ephemeral_owner = prev_node->stat.ephemeralOwner;
+        std::lock_guard w_lock(store.ephemerals_mutex);
+        store.ephemerals[ephemeral_owner].erase(path);
+    }
+    else if (prev_node->isTTL())
+    {
+        store.removeTTLNode(path);
+    }
 
-        std::shared_lock r_lock(store.auth_mutex);
-        auto it = store.session_and_auth.find(session_id);
-        if (it != store.session_and_auth.end())
+    return [prev_node, &store, ephemeral_owner, path, pzxid, child_basename] {
+        if (prev_node->is_ephemeral)
         {
-            const auto & session_auths = it->second;
-            /// LOL, GetACL require more permissions, then SetACL...
-            return checkACL(Coordination::ACL::Delete, node_acls, session_auths);
+            std::lock_guard w_lock(store.ephemerals_mutex);
+            store.ephemerals[ephemeral_owner].emplace(path);
         }
-        else
+        else if (prev_node->isTTL())
+        {
+            store.addTTLNode(path, prev_node->ttlExpirationTime());
+        }
+        store.acl_map.addUsage(prev_node->acl_id);
+
+        store.container.emplace(path, prev_node);
+        store.updateAncestorsStats(path, 1 + prev_node->descendants, prev_node->subtree_bytes);
+        auto undo_parent = store.container.at(parentPath(path));
         {
-            std::vector<Coordination::AuthID> empty_auth_ids;
-            return checkACL(Coordination::ACL::Delete, node_acls, empty_auth_ids);
+            std::lock_guard parent_lock(undo_parent->mutex);
+            ++(undo_parent->stat.numChildren);
+            undo_parent->stat.pzxid = pzxid;
+            undo_parent->children.insert(child_basename);
         }
+        store.onChildAdded(String(parentPath(path)), *undo_parent);
+        store.onChildRemoved(path, *prev_node);
+    };
+}
+
+struct SvsKeeperStorageRemoveRequest final : public StoreRequest
+{
+    bool checkAuth(KeeperStore & store, int64_t session_id) const override
+    {
+        const auto & parent = getParent(store);
+        if (parent == nullptr)
+            return true;
+
+        return store.checkPermission(session_id, parent->acl_id, Coordination::ACL::Delete);
     }
 
 
@@ -613,8 +774,8 @@ struct SvsKeeperStorageRemoveRequest final : public StoreRequest
         Coordination::ZooKeeperRemoveRequest & request = dynamic_cast<Coordination::ZooKeeperRemoveRequest &>(*zk_request);
         Undo undo;
 
-        Poco::Logger * log = &(Poco::Logger::get("SvsKeeperStorageRemoveRequest"));
-        KeeperStore::Container::SharedElement node = store.container.get(request.path);
+        static Poco::Logger * log = &(Poco::Logger::get("SvsKeeperStorageRemoveRequest"));
+        const auto & node = getNode(store);
         if (node == nullptr)
         {
             response.error = Coordination::Error::ZNONODE;
@@ -631,58 +792,81 @@ struct SvsKeeperStorageRemoveRequest final : public StoreRequest
         else
         {
             response.error = Coordination::Error::ZOK;
+            undo = removeNode(store, request.path, node, getParent(store), zxid);
+        }
 
-            int64_t pzxid;
-            auto prev_node = node->clone();
-            auto child_basename = getBaseName(request.path);
-
-            auto parent = store.container.at(parentPath(request.path));
-            {
-                std::lock_guard parent_lock(parent->mutex);
-                --parent->stat.numChildren;
-                pzxid = parent->stat.pzxid;
-                parent->stat.pzxid = zxid;
-                parent->children.erase(child_basename);
-            }
-
-            store.acl_map.removeUsage(prev_node->acl_id);
-            store.container.erase(request.path);
-
-            int64_t ephemeral_owner{};
+        return {response_ptr, undo};
+    }
 
-            if (prev_node->is_ephemeral)
-            {
-                ephemeral_owner = prev_node->stat.ephemeralOwner;
-                std::lock_guard w_lock(store.ephemerals_mutex);
-                store.ephemerals[ephemeral_owner].erase(request.path);
-            }
+    KeeperStore::ResponsesForSessions processWatches(WatchManager & watch_manager) const override
+    {
+        return processWatchesImpl(zk_request->getPath(), watch_manager, Coordination::Event::DELETED);
+    }
+};
 
-            undo = [prev_node, &store, ephemeral_owner, path = request.path, pzxid, child_basename] {
-                if (prev_node->is_ephemeral)
-                {
-                    std::lock_guard w_lock(store.ephemerals_mutex);
-                    store.ephemerals[ephemeral_owner].emplace(path);
-                }
-                store.acl_map.addUsage(prev_node->acl_id);
+/// Issued by the leader to remove an expired TTL node or an empty container node. Whether the node
+/// can be removed is checked again with the time of the request, so that all replicas make the same decision.
+/// It belongs to no session, the one sent by a client (e.g. as a part of multi) is refused.
+/// Transaction restored from ZooKeeper log was already decided by ZooKeeper, it only needs the node to be empty.
+struct SvsKeeperStorageDeleteContainerRequest final : public StoreRequest
+{
+    using StoreRequest::StoreRequest;
+    std::pair<Coordination::ZooKeeperResponsePtr, Undo> process(KeeperStore & store,
+        int64_t zxid,
+        int64_t session_id,
+        int64_t time) const override
+    {
+        Coordination::ZooKeeperResponsePtr response_ptr = zk_request->makeResponse();
+        Coordination::ZooKeeperDeleteContainerResponse & response
+            = dynamic_cast<Coordination::ZooKeeperDeleteContainerResponse &>(*response_ptr);
+        Undo undo;
+        static Poco::Logger * log = &(Poco::Logger::get("SvsKeeperStorageDeleteContainerRequest"));
 
-                store.container.emplace(path, prev_node);
-                auto undo_parent = store.container.at(parentPath(path));
-                {
-                    std::lock_guard parent_lock(undo_parent->mutex);
-                    ++(undo_parent->stat.numChildren);
-                    undo_parent->stat.pzxid = pzxid;
-                    undo_parent->children.insert(child_basename);
-                }
-            };
+        const auto & node = getNode(store);
+        if (session_id != 0)
+        {
+            LOG_WARNING(log, "Session {} is not allowed to delete container {}", toHexString(session_id), zk_request->getPath());
+            response.error = Coordination::Error::ZBADARGUMENTS;
+        }
+        else if (node == nullptr)
+        {
+            response.error = Coordination::Error::ZNONODE;
+        }
+        else if (!node->isTTL() && !node->isContainer())
+        {
+            response.error = Coordination::Error::ZBADARGUMENTS;
+        }
+        else if (!node->children.empty())
+        {
+            response.error = Coordination::Error::ZNOTEMPTY;
+        }
+        else if (zk_request->restored_from_zookeeper_log)
+        {
+            response.error = Coordination::Error::ZOK;
+            undo = removeNode(store, zk_request->getPath(), node, getParent(store), zxid);
+        }
+        else if (node->isTTL() && node->ttlExpirationTime() >= time)
+        {
+            /// Modified after the leader found it expired
+            response.error = Coordination::Error::ZBADVERSION;
+        }
+        else if (node->isContainer() && node->stat.cversion == 0)
+        {
+            /// Container which never had children is kept, the same as ZooKeeper
+            response.error = Coordination::Error::ZBADVERSION;
+        }
+        else
+        {
+            response.error = Coordination::Error::ZOK;
+            undo = removeNode(store, zk_request->getPath(), node, getParent(store), zxid);
         }
 
         return {response_ptr, undo};
     }
 
-    KeeperStore::ResponsesForSessions
-    processWatches(KeeperStore::Watches & watches, KeeperStore::Watches & list_watches) const override
+    KeeperStore::ResponsesForSessions processWatches(WatchManager & watch_manager) const override
     {
-        return processWatchesImpl(zk_request->getPath(), watches, list_watches, Coordination::Event::DELETED);
+        return processWatchesImpl(zk_request->getPath(), watch_manager, Coordination::Event::DELETED);
     }
 };
 
@@ -696,9 +880,8 @@ struct SvsKeeperStorageExistsRequest final : public StoreRequest
     {
         Coordination::ZooKeeperResponsePtr response_ptr = zk_request->makeResponse();
         Coordination::ZooKeeperExistsResponse & response = dynamic_cast<Coordination::ZooKeeperExistsResponse &>(*response_ptr);
-        Coordination::ZooKeeperExistsRequest & request = dynamic_cast<Coordination::ZooKeeperExistsRequest &>(*zk_request);
 
-        auto node = store.container.get(request.path);
+        const auto & node = getNode(store);
         if (node != nullptr)
         {
             {
@@ -720,28 +903,11 @@ struct SvsKeeperStorageSetRequest final : public StoreRequest
 {
     bool checkAuth(KeeperStore & store, int64_t session_id) const override
     {
-        auto & container = store.container;
-        auto node = container.get(zk_request->getPath());
+        const auto & node = getNode(store);
         if (node == nullptr)
             return true;
 
-        const auto & node_acls = store.acl_map.convertNumber(node->acl_id);
-        if (node_acls.empty())
-            return true;
-
-        std::shared_lock r_lock(store.auth_mutex);
-        auto it = store.session_and_auth.find(session_id);
-        if (it != store.session_and_auth.end())
-        {
-            const auto & session_auths = it->second;
-            /// LOL, GetACL require more permissions, then SetACL...
-            return checkACL(Coordination::ACL::Write, node_acls, session_auths);
-        }
-        else
-        {
-            std::vector<Coordination::AuthID> empty_auth_ids;
-            return checkACL(Coordination::ACL::Write, node_acls, empty_auth_ids);
-        }
+        return store.checkPermission(session_id, node->acl_id, Coordination::ACL::Write);
     }
 
     using StoreRequest::StoreRequest;
@@ -755,13 +921,20 @@ struct SvsKeeperStorageSetRequest final : public StoreRequest
         Coordination::ZooKeeperSetRequest & request = dynamic_cast<Coordination::ZooKeeperSetRequest &>(*zk_request);
         Undo undo;
 
-        auto node = store.container.get(request.path);
+        const auto & node = getNode(store);
         if (node == nullptr)
         {
             response.error = Coordination::Error::ZNONODE;
         }
         else if (request.version == -1 || request.version == node->stat.version)
         {
+            int64_t bytes_delta = static_cast<int64_t>(request.data.length()) - static_cast<int64_t>(node->getData().length());
+            if (!store.checkQuota(request.path, 0, bytes_delta))
+            {
+                response.error = Coordination::Error::ZQUOTAEXCEEDED;
+                return {response_ptr, undo};
+            }
+
             auto prev_node = node->clone();
             {
                 std::lock_guard node_lock(node->mutex);
@@ -769,15 +942,24 @@ struct SvsKeeperStorageSetRequest final : public StoreRequest
                 node->stat.mzxid = zxid;
                 node->stat.mtime = time;
                 node->stat.dataLength = request.data.length();
-                node->data = request.data;
+                node->setData(request.data);
             }
+            node->subtree_bytes += bytes_delta;
+            store.updateAncestorsStats(request.path, 0, bytes_delta);
+            store.changed_paths.add(request.path);
+
+            /// TTL is counted from the last modification
+            if (node->isTTL())
+                store.addTTLNode(request.path, node->ttlExpirationTime());
 
-            auto parent = store.container.at(parentPath(request.path));
             response.stat = node->statForResponse();
             response.error = Coordination::Error::ZOK;
 
-            undo = [prev_node, &store, path = request.path] {
+            undo = [prev_node, &store, path = request.path, bytes_delta] {
                 store.container.emplace(path, prev_node);
+                store.updateAncestorsStats(path, 0, -bytes_delta);
+                if (prev_node->isTTL())
+                    store.addTTLNode(path, prev_node->ttlExpirationTime());
             };
         }
         else
@@ -788,10 +970,9 @@ struct SvsKeeperStorageSetRequest final : public StoreRequest
         return {response_ptr, undo};
     }
 
-    KeeperStore::ResponsesForSessions
-    processWatches(KeeperStore::Watches & watches, KeeperStore::Watches & list_watches) const override
+    KeeperStore::ResponsesForSessions processWatches(WatchManager & watch_manager) const override
     {
-        return processWatchesImpl(zk_request->getPath(), watches, list_watches, Coordination::Event::CHANGED);
+        return processWatchesImpl(zk_request->getPath(), watch_manager, Coordination::Event::CHANGED);
     }
 };
 
@@ -799,28 +980,11 @@ struct SvsKeeperStorageListRequest final : public StoreRequest
 {
     bool checkAuth(KeeperStore & store, int64_t session_id) const override
     {
-        auto & container = store.container;
-        auto node = container.get(zk_request->getPath());
+        const auto & node = getNode(store);
         if (node == nullptr)
             return true;
 
-        const auto & node_acls = store.acl_map.convertNumber(node->acl_id);
-        if (node_acls.empty())
-            return true;
-
-        std::shared_lock r_lock(store.auth_mutex);
-        auto it = store.session_and_auth.find(session_id);
-        if (it != store.session_and_auth.end())
-        {
-            const auto & session_auths = it->second;
-            /// LOL, GetACL require more permissions, then SetACL...
-            return checkACL(Coordination::ACL::Read, node_acls, session_auths);
-        }
-        else
-        {
-            std::vector<Coordination::AuthID> empty_auth_ids;
-            return checkACL(Coordination::ACL::Read, node_acls, empty_auth_ids);
-        }
+        return store.checkPermission(session_id, node->acl_id, Coordination::ACL::Read);
     }
 
     using StoreRequest::StoreRequest;
@@ -833,55 +997,38 @@ struct SvsKeeperStorageListRequest final : public StoreRequest
         Coordination::ZooKeeperListResponse & response = dynamic_cast<Coordination::ZooKeeperListResponse &>(*response_ptr);
         Coordination::ZooKeeperListRequest & request = dynamic_cast<Coordination::ZooKeeperListRequest &>(*zk_request);
 
-        auto node = store.container.get(request.path);
+        const auto & node = getNode(store);
         if (node == nullptr)
         {
             response.error = Coordination::Error::ZNONODE;
         }
         else
         {
-            auto path_prefix = request.path;
-            if (path_prefix.empty())
+            if (request.path.empty())
                 throw RK::Exception("Logical error: path cannot be empty", ErrorCodes::LOGICAL_ERROR);
 
             {
                 std::shared_lock r_lock(node->mutex);
-                response.names.insert(response.names.end(), node->children.begin(), node->children.end());
+                response.names.reserve(node->children.size());
+                response.names.assign(node->children.begin(), node->children.end());
                 response.stat = node->statForResponse();
             }
-            std::sort(response.names.begin(), response.names.end());
             response.error = Coordination::Error::ZOK;
         }
         return {response_ptr, {}};
     }
 };
 
-struct SvsKeeperStorageCheckRequest final : public StoreRequest
+/// Seek in ordered children index, so a page costs O(log n + page size) instead of O(n).
+struct SvsKeeperStoragePagedListRequest final : public StoreRequest
 {
     bool checkAuth(KeeperStore & store, int64_t session_id) const override
     {
-        auto & container = store.container;
-        auto node = container.get(zk_request->getPath());
+        const auto & node = getNode(store);
         if (node == nullptr)
             return true;
 
-        const auto & node_acls = store.acl_map.convertNumber(node->acl_id);
-        if (node_acls.empty())
-            return true;
-
-        std::shared_lock r_lock(store.auth_mutex);
-        auto it = store.session_and_auth.find(session_id);
-        if (it != store.session_and_auth.end())
-        {
-            const auto & session_auths = it->second;
-            /// LOL, GetACL require more permissions, then SetACL...
-            return checkACL(Coordination::ACL::Read, node_acls, session_auths);
-        }
-        else
-        {
-            std::vector<Coordination::AuthID> empty_auth_ids;
-            return checkACL(Coordination::ACL::Read, node_acls, empty_auth_ids);
-        }
+        return store.checkPermission(session_id, node->acl_id, Coordination::ACL::Read);
     }
 
     using StoreRequest::StoreRequest;
@@ -891,79 +1038,157 @@ struct SvsKeeperStorageCheckRequest final : public StoreRequest
         int64_t /* time */) const override
     {
         Coordination::ZooKeeperResponsePtr response_ptr = zk_request->makeResponse();
-        Coordination::ZooKeeperCheckResponse & response = dynamic_cast<Coordination::ZooKeeperCheckResponse &>(*response_ptr);
-        Coordination::ZooKeeperCheckRequest & request = dynamic_cast<Coordination::ZooKeeperCheckRequest &>(*zk_request);
+        Coordination::ZooKeeperPagedListResponse & response = dynamic_cast<Coordination::ZooKeeperPagedListResponse &>(*response_ptr);
+        Coordination::ZooKeeperPagedListRequest & request = dynamic_cast<Coordination::ZooKeeperPagedListRequest &>(*zk_request);
 
-        auto node = store.container.get(request.path);
-        if (node == nullptr)
+        if (request.max_count <= 0)
         {
-            response.error = Coordination::Error::ZNONODE;
+            response.error = Coordination::Error::ZBADARGUMENTS;
+            return {response_ptr, {}};
         }
-        else if (request.version != -1 && request.version != node->stat.version) /// don't need lock
+        size_t max_count = std::min(request.max_count, Coordination::MAX_PAGED_LIST_COUNT);
+
+        const auto & node = getNode(store);
+        if (node == nullptr)
         {
-            response.error = Coordination::Error::ZBADVERSION;
+            response.error = Coordination::Error::ZNONODE;
+            return {response_ptr, {}};
         }
-        else
+
+        std::shared_lock r_lock(node->mutex);
+        const auto & children = node->children;
+
+        /// The first name may be returned is the smallest one greater than start_after and not less than prefix
+        auto it = children.begin();
+        if (!request.start_after.empty())
+            it = children.upper_bound(request.start_after);
+        if (!request.prefix.empty() && (it == children.end() || *it < request.prefix))
+            it = children.lower_bound(request.prefix);
+
+        for (; it != children.end() && response.names.size() < max_count; ++it)
         {
-            response.error = Coordination::Error::ZOK;
+            if (!it->starts_with(request.prefix))
+                break;
+            response.names.push_back(*it);
         }
+
+        if (it != children.end() && it->starts_with(request.prefix) && !response.names.empty())
+            response.continuation = response.names.back();
+
+        response.stat = node->statForResponse();
+        response.error = Coordination::Error::ZOK;
         return {response_ptr, {}};
     }
 };
 
-struct SvsKeeperStorageSetACLRequest final : public StoreRequest
+/// Served from subtree counters of the node without traversing it.
+struct SvsKeeperStorageGetAllChildrenNumberRequest final : public StoreRequest
 {
     bool checkAuth(KeeperStore & store, int64_t session_id) const override
     {
-        auto & container = store.container;
-        auto node = container.get(zk_request->getPath());
+        const auto & node = getNode(store);
         if (node == nullptr)
             return true;
 
-        const auto & node_acls = store.acl_map.convertNumber(node->acl_id);
-        if (node_acls.empty())
-            return true;
-
-        std::shared_lock r_lock(store.auth_mutex);
-        auto it = store.session_and_auth.find(session_id);
-        if (it != store.session_and_auth.end())
-        {
-            const auto & session_auths = it->second;
-            return checkACL(Coordination::ACL::Admin, node_acls, session_auths);
-        }
-        else
-        {
-            std::vector<Coordination::AuthID> empty_auth_ids;
-            return checkACL(Coordination::ACL::Admin, node_acls, empty_auth_ids);
-        }
+        return store.checkPermission(session_id, node->acl_id, Coordination::ACL::Read);
     }
 
     using StoreRequest::StoreRequest;
-    std::pair<Coordination::ZooKeeperResponsePtr, Undo> process(KeeperStore & store, int64_t /*zxid*/, int64_t session_id,
-                                                                int64_t /* time */) const override
+    std::pair<Coordination::ZooKeeperResponsePtr, Undo> process(KeeperStore & store,
+        int64_t /*zxid*/,
+        int64_t /*session_id*/,
+        int64_t /* time */) const override
     {
-        auto & container = store.container;
-
         Coordination::ZooKeeperResponsePtr response_ptr = zk_request->makeResponse();
-        Coordination::ZooKeeperSetACLResponse & response = dynamic_cast<Coordination::ZooKeeperSetACLResponse &>(*response_ptr);
-        Coordination::ZooKeeperSetACLRequest & request = dynamic_cast<Coordination::ZooKeeperSetACLRequest &>(*zk_request);
-        auto node = container.get(request.path);
+        Coordination::ZooKeeperGetAllChildrenNumberResponse & response
+            = dynamic_cast<Coordination::ZooKeeperGetAllChildrenNumberResponse &>(*response_ptr);
+
+        const auto & node = getNode(store);
         if (node == nullptr)
         {
             response.error = Coordination::Error::ZNONODE;
+            return {response_ptr, {}};
         }
-        else if (request.version != -1 && request.version != node->stat.aversion)
-        {
-            response.error = Coordination::Error::ZBADVERSION;
-        }
-        else
-        {
-            Coordination::ACLs node_acls;
-            {
-                std::lock_guard lock(store.auth_mutex);
-                auto & session_auth_ids = store.session_and_auth[session_id];
 
-                if (!fixupACL(request.acls, session_auth_ids, node_acls))
+        response.total_number = static_cast<int32_t>(node->descendants.load(std::memory_order_relaxed));
+        response.error = Coordination::Error::ZOK;
+        return {response_ptr, {}};
+    }
+};
+
+struct SvsKeeperStorageCheckRequest final : public StoreRequest
+{
+    bool checkAuth(KeeperStore & store, int64_t session_id) const override
+    {
+        const auto & node = getNode(store);
+        if (node == nullptr)
+            return true;
+
+        return store.checkPermission(session_id, node->acl_id, Coordination::ACL::Read);
+    }
+
+    using StoreRequest::StoreRequest;
+    std::pair<Coordination::ZooKeeperResponsePtr, Undo> process(KeeperStore & store,
+        int64_t /*zxid*/,
+        int64_t /*session_id*/,
+        int64_t /* time */) const override
+    {
+        Coordination::ZooKeeperResponsePtr response_ptr = zk_request->makeResponse();
+        Coordination::ZooKeeperCheckResponse & response = dynamic_cast<Coordination::ZooKeeperCheckResponse &>(*response_ptr);
+        Coordination::ZooKeeperCheckRequest & request = dynamic_cast<Coordination::ZooKeeperCheckRequest &>(*zk_request);
+
+        const auto & node = getNode(store);
+        if (node == nullptr)
+        {
+            response.error = Coordination::Error::ZNONODE;
+        }
+        else if (request.version != -1 && request.version != node->stat.version) /// don't need lock
+        {
+            response.error = Coordination::Error::ZBADVERSION;
+        }
+        else
+        {
+            response.error = Coordination::Error::ZOK;
+        }
+        return {response_ptr, {}};
+    }
+};
+
+struct SvsKeeperStorageSetACLRequest final : public StoreRequest
+{
+    bool checkAuth(KeeperStore & store, int64_t session_id) const override
+    {
+        const auto & node = getNode(store);
+        if (node == nullptr)
+            return true;
+
+        return store.checkPermission(session_id, node->acl_id, Coordination::ACL::Admin);
+    }
+
+    using StoreRequest::StoreRequest;
+    std::pair<Coordination::ZooKeeperResponsePtr, Undo> process(KeeperStore & store, int64_t /*zxid*/, int64_t session_id,
+                                                                int64_t /* time */) const override
+    {
+        Coordination::ZooKeeperResponsePtr response_ptr = zk_request->makeResponse();
+        Coordination::ZooKeeperSetACLResponse & response = dynamic_cast<Coordination::ZooKeeperSetACLResponse &>(*response_ptr);
+        Coordination::ZooKeeperSetACLRequest & request = dynamic_cast<Coordination::ZooKeeperSetACLRequest &>(*zk_request);
+        const auto & node = getNode(store);
+        if (node == nullptr)
+        {
+            response.error = Coordination::Error::ZNONODE;
+        }
+        else if (request.version != -1 && request.version != node->stat.aversion)
+        {
+            response.error = Coordination::Error::ZBADVERSION;
+        }
+        else
+        {
+            Coordination::ACLs node_acls;
+            {
+                std::lock_guard lock(store.auth_mutex);
+                auto & session_auth_ids = store.session_and_auth[session_id];
+
+                if (!fixupACL(request.acls, session_auth_ids, node_acls))
                 {
                     response.error = Coordination::Error::ZINVALIDACL;
                     return {response_ptr, {}};
@@ -976,6 +1201,7 @@ struct SvsKeeperStorageSetACLRequest final : public StoreRequest
             std::lock_guard node_lock(node->mutex);
             node->acl_id = acl_id;
             ++node->stat.aversion;
+            store.changed_paths.add(request.path);
 
             response.stat = node->stat;
             response.error = Coordination::Error::ZOK;
@@ -990,28 +1216,12 @@ struct SvsKeeperStorageGetACLRequest final : public StoreRequest
 {
     bool checkAuth(KeeperStore & store, int64_t session_id) const override
     {
-        auto & container = store.container;
-        auto node = container.get(zk_request->getPath());
+        const auto & node = getNode(store);
         if (node == nullptr)
             return true;
 
-        const auto & node_acls = store.acl_map.convertNumber(node->acl_id);
-        if (node_acls.empty())
-            return true;
-
-        std::shared_lock r_lock(store.auth_mutex);
-        auto it = store.session_and_auth.find(session_id);
-        if (it != store.session_and_auth.end())
-        {
-            const auto & session_auths = it->second;
-            /// LOL, GetACL require more permissions, then SetACL...
-            return checkACL(Coordination::ACL::Admin | Coordination::ACL::Read, node_acls, session_auths);
-        }
-        else
-        {
-            std::vector<Coordination::AuthID> empty_auth_ids;
-            return checkACL(Coordination::ACL::Admin | Coordination::ACL::Read, node_acls, empty_auth_ids);
-        }
+        /// LOL, GetACL require more permissions, then SetACL...
+        return store.checkPermission(session_id, node->acl_id, Coordination::ACL::Admin | Coordination::ACL::Read);
     }
 
     using StoreRequest::StoreRequest;
@@ -1021,9 +1231,7 @@ struct SvsKeeperStorageGetACLRequest final : public StoreRequest
     {
         Coordination::ZooKeeperResponsePtr response_ptr = zk_request->makeResponse();
         Coordination::ZooKeeperGetACLResponse & response = dynamic_cast<Coordination::ZooKeeperGetACLResponse &>(*response_ptr);
-        Coordination::ZooKeeperGetACLRequest & request = dynamic_cast<Coordination::ZooKeeperGetACLRequest &>(*zk_request);
-        auto & container = store.container;
-        auto node = container.get(request.path);
+        const auto & node = getNode(store);
         if (node == nullptr)
         {
             response.error = Coordination::Error::ZNONODE;
@@ -1063,6 +1271,7 @@ struct SvsKeeperStorageAuthRequest final : public StoreRequest
 
                 std::lock_guard w_lock(store.auth_mutex);
                 sessions_and_auth[session_id].emplace_back(auth);
+                store.permission_cache.invalidate(session_id);
             }
             else
             {
@@ -1071,7 +1280,10 @@ struct SvsKeeperStorageAuthRequest final : public StoreRequest
                 std::lock_guard w_lock(store.auth_mutex);
                 auto & session_ids = sessions_and_auth[session_id];
                 if (std::find(session_ids.begin(), session_ids.end(), auth) == session_ids.end())
+                {
                     sessions_and_auth[session_id].emplace_back(auth);
+                    store.permission_cache.invalidate(session_id);
+                }
             }
 
         }
@@ -1100,21 +1312,23 @@ struct SvsKeeperStorageMultiRequest final : public StoreRequest
         for (const auto & sub_request : request.requests)
         {
             auto sub_zk_request = std::dynamic_pointer_cast<Coordination::ZooKeeperRequest>(sub_request);
-            if (sub_zk_request->getOpNum() == Coordination::OpNum::Create)
+            if (sub_zk_request->getOpNum() == Coordination::OpNum::Create || sub_zk_request->getOpNum() == Coordination::OpNum::Create2
+                || sub_zk_request->getOpNum() == Coordination::OpNum::CreateTTL
+                || sub_zk_request->getOpNum() == Coordination::OpNum::CreateContainer)
             {
-                concrete_requests.push_back(std::make_shared<SvsKeeperStorageCreateRequest>(sub_zk_request));
+                concrete_requests.push_back(makePooled<SvsKeeperStorageCreateRequest>(sub_zk_request));
             }
             else if (sub_zk_request->getOpNum() == Coordination::OpNum::Remove)
             {
-                concrete_requests.push_back(std::make_shared<SvsKeeperStorageRemoveRequest>(sub_zk_request));
+                concrete_requests.push_back(makePooled<SvsKeeperStorageRemoveRequest>(sub_zk_request));
             }
             else if (sub_zk_request->getOpNum() == Coordination::OpNum::Set)
             {
-                concrete_requests.push_back(std::make_shared<SvsKeeperStorageSetRequest>(sub_zk_request));
+                concrete_requests.push_back(makePooled<SvsKeeperStorageSetRequest>(sub_zk_request));
             }
             else if (sub_zk_request->getOpNum() == Coordination::OpNum::Check)
             {
-                concrete_requests.push_back(std::make_shared<SvsKeeperStorageCheckRequest>(sub_zk_request));
+                concrete_requests.push_back(makePooled<SvsKeeperStorageCheckRequest>(sub_zk_request));
             }
             else
                 throw RK::Exception(
@@ -1136,6 +1350,9 @@ struct SvsKeeperStorageMultiRequest final : public StoreRequest
             size_t i = 0;
             for (const auto & concrete_request : concrete_requests)
             {
+                /// Nodes looked up by checkAuth are only valid for the first sub-request
+                if (i > 0)
+                    concrete_request->resetResolvedNodes();
                 auto [cur_response, undo_action] = concrete_request->process(store, zxid, session_id, time);
 
                 response.responses[i] = cur_response;
@@ -1144,13 +1361,13 @@ struct SvsKeeperStorageMultiRequest final : public StoreRequest
                     for (size_t j = 0; j <= i; ++j)
                     {
                         auto response_error = response.responses[j]->error;
-                        response.responses[j] = std::make_shared<Coordination::ZooKeeperErrorResponse>();
+                        response.responses[j] = makePooled<Coordination::ZooKeeperErrorResponse>();
                         response.responses[j]->error = response_error;
                     }
 
                     for (size_t j = i + 1; j < response.responses.size(); ++j)
                     {
-                        response.responses[j] = std::make_shared<Coordination::ZooKeeperErrorResponse>();
+                        response.responses[j] = makePooled<Coordination::ZooKeeperErrorResponse>();
                         response.responses[j]->error = Coordination::Error::ZRUNTIMEINCONSISTENCY;
                     }
 
@@ -1178,19 +1395,87 @@ struct SvsKeeperStorageMultiRequest final : public StoreRequest
         }
     }
 
-    KeeperStore::ResponsesForSessions
-    processWatches(KeeperStore::Watches & watches, KeeperStore::Watches & list_watches) const override
+    KeeperStore::ResponsesForSessions processWatches(WatchManager & watch_manager) const override
     {
         KeeperStore::ResponsesForSessions result;
         for (const auto & generic_request : concrete_requests)
         {
-            auto responses = generic_request->processWatches(watches, list_watches);
+            auto responses = generic_request->processWatches(watch_manager);
             result.insert(result.end(), responses.begin(), responses.end());
         }
         return result;
     }
 };
 
+/// Sub-requests are processed one by one in the same read batch, no write is applied between them,
+/// so they see the same state. Unlike multi, a failed sub-request does not affect others.
+struct SvsKeeperStorageMultiReadRequest final : public StoreRequest
+{
+    std::vector<StoreRequestPtr> concrete_requests;
+    explicit SvsKeeperStorageMultiReadRequest(const Coordination::ZooKeeperRequestPtr & zk_request_) : StoreRequest(zk_request_)
+    {
+        Coordination::ZooKeeperMultiRequest & request = dynamic_cast<Coordination::ZooKeeperMultiRequest &>(*zk_request);
+        concrete_requests.reserve(request.requests.size());
+
+        for (const auto & sub_request : request.requests)
+        {
+            auto sub_zk_request = std::dynamic_pointer_cast<Coordination::ZooKeeperRequest>(sub_request);
+            if (sub_zk_request->getOpNum() == Coordination::OpNum::Get)
+            {
+                concrete_requests.push_back(makePooled<SvsKeeperStorageGetRequest>(sub_zk_request));
+            }
+            else if (sub_zk_request->getOpNum() == Coordination::OpNum::Exists)
+            {
+                concrete_requests.push_back(makePooled<SvsKeeperStorageExistsRequest>(sub_zk_request));
+            }
+            else if (sub_zk_request->getOpNum() == Coordination::OpNum::List || sub_zk_request->getOpNum() == Coordination::OpNum::SimpleList)
+            {
+                concrete_requests.push_back(makePooled<SvsKeeperStorageListRequest>(sub_zk_request));
+            }
+            else
+                throw RK::Exception(
+                    ErrorCodes::BAD_ARGUMENTS, "Illegal command as part of multi read ZooKeeper request {}", sub_zk_request->getOpNum());
+        }
+    }
+
+    /// ACL is checked for every sub-request, the same as ZooKeeper
+    bool checkAuth(KeeperStore & /*store*/, int64_t /*session_id*/) const override { return true; }
+
+    std::pair<Coordination::ZooKeeperResponsePtr, Undo> process(KeeperStore & store,
+        int64_t zxid,
+        int64_t session_id,
+        int64_t time) const override
+    {
+        Coordination::ZooKeeperResponsePtr response_ptr = zk_request->makeResponse();
+        Coordination::ZooKeeperMultiResponse & response = dynamic_cast<Coordination::ZooKeeperMultiResponse &>(*response_ptr);
+
+        for (size_t i = 0; i < concrete_requests.size(); ++i)
+        {
+            Coordination::ZooKeeperResponsePtr cur_response;
+            if (!concrete_requests[i]->checkAuth(store, session_id))
+            {
+                cur_response = makePooled<Coordination::ZooKeeperErrorResponse>();
+                cur_response->error = Coordination::Error::ZNOAUTH;
+            }
+            else
+            {
+                cur_response = concrete_requests[i]->process(store, zxid, session_id, time).first;
+                /// Failed sub-request is answered with an error result, the same as multi
+                if (cur_response->error != Coordination::Error::ZOK)
+                {
+                    auto response_error = cur_response->error;
+                    cur_response = makePooled<Coordination::ZooKeeperErrorResponse>();
+                    cur_response->error = response_error;
+                }
+            }
+            response.responses[i] = cur_response;
+        }
+
+        response.error = Coordination::Error::ZOK;
+        return {response_ptr, {}};
+    }
+};
+
 struct SvsKeeperStorageCloseRequest final : public StoreRequest
 {
     using StoreRequest::StoreRequest;
@@ -1216,8 +1501,10 @@ void KeeperStore::finalize()
             {
                 std::lock_guard parent_lock(parent->mutex);
                 --parent->stat.numChildren;
-                parent->children.erase(getBaseName(ephemeral_path));
+                parent->children.erase(String(getBaseName(ephemeral_path)));
             }
+            if (auto node = container.get(ephemeral_path))
+                updateAncestorsStats(ephemeral_path, -(1 + node->descendants), -node->subtree_bytes);
             container.erase(ephemeral_path);
         }
 
@@ -1226,18 +1513,26 @@ void KeeperStore::finalize()
         ephemerals.clear();
     }
 
+    {
+        std::lock_guard lock(ttl_mutex);
+        ttl_expiry_queue.clear();
+    }
+
+    {
+        std::lock_guard lock(empty_containers_mutex);
+        empty_containers.clear();
+    }
+
     {
         std::lock_guard session_lock(session_mutex);
-        std::lock_guard watch_lock(watch_mutex);
-        watches.clear();
-        list_watches.clear();
-        sessions_and_watchers.clear();
+        watch_manager.clear();
         session_expiry_queue.clear();
         session_and_timeout.clear();
     }
     {
         std::lock_guard auth_lock(auth_mutex);
         session_and_auth.clear();
+        permission_cache.clear();
     }
 }
 
@@ -1277,7 +1572,7 @@ template <Coordination::OpNum num, typename RequestT>
 void registerNuKeeperRequestWrapper(NuKeeperWrapperFactory & factory)
 {
     factory.registerRequest(
-        num, [](const Coordination::ZooKeeperRequestPtr & zk_request) { return std::make_shared<RequestT>(zk_request); });
+        num, [](const Coordination::ZooKeeperRequestPtr & zk_request) { return makePooled<RequestT>(zk_request); });
 }
 
 
@@ -1285,26 +1580,36 @@ NuKeeperWrapperFactory::NuKeeperWrapperFactory()
 {
     registerNuKeeperRequestWrapper<Coordination::OpNum::Heartbeat, SvsKeeperStorageHeartbeatRequest>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::SetWatches, SvsKeeperStorageSetWatchesRequest>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::SetWatches2, SvsKeeperStorageSetWatchesRequest>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Sync, SvsKeeperStorageSyncRequest>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Auth, SvsKeeperStorageAuthRequest>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Close, SvsKeeperStorageCloseRequest>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Create, SvsKeeperStorageCreateRequest>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Remove, SvsKeeperStorageRemoveRequest>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::Create2, SvsKeeperStorageCreateRequest>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::CreateTTL, SvsKeeperStorageCreateRequest>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::CreateContainer, SvsKeeperStorageCreateRequest>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::DeleteContainer, SvsKeeperStorageDeleteContainerRequest>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Exists, SvsKeeperStorageExistsRequest>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Get, SvsKeeperStorageGetRequest>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Set, SvsKeeperStorageSetRequest>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::List, SvsKeeperStorageListRequest>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::SimpleList, SvsKeeperStorageListRequest>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::PagedList, SvsKeeperStoragePagedListRequest>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::GetAllChildrenNumber, SvsKeeperStorageGetAllChildrenNumberRequest>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Check, SvsKeeperStorageCheckRequest>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Multi, SvsKeeperStorageMultiRequest>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::MultiRead, SvsKeeperStorageMultiReadRequest>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::SetSeqNum, SvsKeeperStorageSetSeqNumRequest>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::SetACL, SvsKeeperStorageSetACLRequest>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::GetACL, SvsKeeperStorageGetACLRequest>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::AddWatch, SvsKeeperStorageAddWatchRequest>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::RemoveWatches, SvsKeeperStorageRemoveWatchesRequest>(*this);
 }
 
 
 void KeeperStore::processRequest(
-    ThreadSafeQueue<ResponseForSession> & responses_queue,
+    KeeperResponsesQueue & responses_queue,
     const Coordination::ZooKeeperRequestPtr & zk_request,
     int64_t session_id,
     int64_t time,
@@ -1343,14 +1648,20 @@ void KeeperStore::processRequest(
                     }
                     else
                     {
-                        std::lock_guard parent_lock(parent->mutex);
-                        --parent->stat.numChildren;
-                        parent->children.erase(getBaseName(ephemeral_path));
+                        {
+                            std::lock_guard parent_lock(parent->mutex);
+                            --parent->stat.numChildren;
+                            parent->children.erase(String(getBaseName(ephemeral_path)));
+                        }
+                        onChildRemoved(String(parentPath(ephemeral_path)), *parent);
                     }
+                    if (auto node = container.get(ephemeral_path))
+                        updateAncestorsStats(ephemeral_path, -(1 + node->descendants), -node->subtree_bytes);
                     container.erase(ephemeral_path);
+                    changed_paths.add(ephemeral_path);
+                    changed_paths.add(String(parentPath(ephemeral_path)));
 
-                    std::lock_guard watch_lock(watch_mutex);
-                    auto responses = processWatchesImpl(ephemeral_path, watches, list_watches, Coordination::Event::DELETED);
+                    auto responses = processWatchesImpl(ephemeral_path, watch_manager, Coordination::Event::DELETED);
                     set_response(responses_queue, responses, ignore_response);
                 }
                 ephemerals.erase(it);
@@ -1363,7 +1674,7 @@ void KeeperStore::processRequest(
         }
 
         /// Finish connection
-        auto response = std::make_shared<Coordination::ZooKeeperCloseResponse>();
+        auto response = makePooled<Coordination::ZooKeeperCloseResponse>();
         response->xid = zk_request->xid;
         response->zxid = new_last_zxid ? zxid.load() : getZXID();
         {
@@ -1376,13 +1687,16 @@ void KeeperStore::processRequest(
         {
             std::lock_guard lock(auth_mutex);
             session_and_auth.erase(session_id);
+            permission_cache.invalidate(session_id);
         }
 
         set_response(responses_queue, ResponseForSession{session_id, response}, ignore_response);
         return;
     }
 
-    /// ZooKeeper update sessions expiry for each request, not only for heartbeats
+    /// ZooKeeper update sessions expiry for each request, not only for heartbeats.
+    /// DeleteContainer is issued by the leader itself and belongs to no session.
+    if (zk_request->getOpNum() != Coordination::OpNum::DeleteContainer || session_id != 0)
     {
         std::lock_guard lock(session_mutex);
         if (!session_and_timeout.contains(session_id) && !new_last_zxid)
@@ -1407,7 +1721,7 @@ void KeeperStore::processRequest(
         response->zxid = zxid;
         set_response(responses_queue, ResponseForSession{session_id, response}, ignore_response);
     }
-    else if (zk_request->getOpNum() == Coordination::OpNum::SetWatches)
+    else if (zk_request->getOpNum() == Coordination::OpNum::SetWatches || zk_request->getOpNum() == Coordination::OpNum::SetWatches2)
     {
         StoreRequestPtr store_request = NuKeeperWrapperFactory::instance().get(zk_request);
         auto [response, _] = store_request->process(*this, zxid, session_id, time);
@@ -1417,68 +1731,63 @@ void KeeperStore::processRequest(
 
         auto * request = dynamic_cast<Coordination::ZooKeeperSetWatchesRequest *>(zk_request.get());
 
-        std::lock_guard lock(watch_mutex);
-        for (String & path : request->data_watches)
+        /// Same as ZooKeeper, a watch which missed an event while the session was disconnected is not
+        /// registered, the event is sent to this session only. Watches of other sessions are not touched.
+        auto trigger_or_register = [&](const String & path, WatchType type, std::optional<Coordination::Event> missed_event)
         {
-            LOG_TRACE(log, "Register data_watches for session {}, path {}, xid", toHexString(session_id), path, request->xid);
-            /// register watches
-            watches[path].emplace_back(session_id);
-            sessions_and_watchers[session_id].emplace(path);
+            if (!missed_event)
+            {
+                watch_manager.addWatch(path, session_id, type);
+                return;
+            }
 
-            /// trigger watches
+            LOG_TRACE(
+                log, "Trigger watch when processing SetWatch operation for session {}, path {}, type {}", toHexString(session_id), path, *missed_event);
+            /// One-shot watch of the session registered before is fired by the event as well
+            watch_manager.removeWatch(path, session_id, type);
+            set_response(responses_queue, ResponseForSession{session_id, makeWatchResponse(path, *missed_event)}, ignore_response);
+        };
+
+        for (const String & path : request->data_watches)
+        {
+            LOG_TRACE(log, "Register data_watches for session {}, path {}, xid {}", toHexString(session_id), path, request->xid);
             auto node = container.get(path);
             if (!node)
-            {
-                LOG_TRACE(log, "Trigger data_watches when processing SetWatch operation for session {}, path {}", toHexString(session_id), path);
-                auto watch_responses = processWatchesImpl(path, watches, list_watches, Coordination::Event::DELETED);
-                set_response(responses_queue, watch_responses, ignore_response);
-            }
+                trigger_or_register(path, WatchType::DATA, Coordination::Event::DELETED);
             else if (node->stat.mzxid > request->relative_zxid)
-            {
-                LOG_TRACE(log, "Trigger data_watches when processing SetWatch operation for session {}, path {}", toHexString(session_id), path);
-                auto watch_responses = processWatchesImpl(path, watches, list_watches, Coordination::Event::CHANGED);
-                set_response(responses_queue, watch_responses, ignore_response);
-            }
+                trigger_or_register(path, WatchType::DATA, Coordination::Event::CHANGED);
+            else
+                trigger_or_register(path, WatchType::DATA, std::nullopt);
         }
 
-        for (String & path : request->exist_watches)
+        for (const String & path : request->exist_watches)
         {
-            LOG_TRACE(log, "Register exist_watches for session {}, path {}, xid", toHexString(session_id), path, request->xid);
-            /// register watches
-            watches[path].emplace_back(session_id);
-            sessions_and_watchers[session_id].emplace(path);
-
-            /// trigger watches
-            auto node = container.get(path);
-            if (node)
-            {
-                LOG_TRACE(log, "Trigger exist_watches when processing SetWatch operation for session {}, path {}", toHexString(session_id), path);
-                auto watch_responses = processWatchesImpl(path, watches, list_watches, Coordination::Event::CREATED);
-                set_response(responses_queue, watch_responses, ignore_response);
-            }
+            LOG_TRACE(log, "Register exist_watches for session {}, path {}, xid {}", toHexString(session_id), path, request->xid);
+            if (container.get(path))
+                trigger_or_register(path, WatchType::DATA, Coordination::Event::CREATED);
+            else
+                trigger_or_register(path, WatchType::DATA, std::nullopt);
         }
 
-        for (String & path : request->list_watches)
+        for (const String & path : request->list_watches)
         {
-            LOG_TRACE(log, "Register list_watches for session {}, path {}, xid", toHexString(session_id), path, request->xid);
-            /// register watches
-            list_watches[path].emplace_back(session_id);
-            sessions_and_watchers[session_id].emplace(path);
-
-            /// trigger watches
+            LOG_TRACE(log, "Register list_watches for session {}, path {}, xid {}", toHexString(session_id), path, request->xid);
             auto node = container.get(path);
-            if (node == nullptr)
-            {
-                LOG_TRACE(log, "Trigger list_watches when processing SetWatch operation for session {}, path {}", toHexString(session_id), path);
-                auto watch_responses = processWatchesImpl(path, watches, list_watches, Coordination::Event::DELETED);
-                set_response(responses_queue, watch_responses, ignore_response);
-            }
+            if (!node)
+                trigger_or_register(path, WatchType::LIST, Coordination::Event::DELETED);
             else if (node->stat.pzxid > request->relative_zxid)
-            {
-                LOG_TRACE(log, "Trigger list_watches when processing SetWatch operation for session {}, path {}", toHexString(session_id), path);
-                auto watch_responses = processWatchesImpl(path, watches, list_watches, Coordination::Event::CHILD);
-                set_response(responses_queue, watch_responses, ignore_response);
-            }
+                trigger_or_register(path, WatchType::LIST, Coordination::Event::CHILD);
+            else
+                trigger_or_register(path, WatchType::LIST, std::nullopt);
+        }
+
+        /// Same as ZooKeeper, persistent watches are only registered and never triggered here.
+        if (auto * request2 = dynamic_cast<Coordination::ZooKeeperSetWatches2Request *>(zk_request.get()))
+        {
+            for (const String & path : request2->persistent_watches)
+                watch_manager.addWatch(path, session_id, WatchType::PERSISTENT);
+            for (const String & path : request2->persistent_recursive_watches)
+                watch_manager.addWatch(path, session_id, WatchType::PERSISTENT_RECURSIVE);
         }
 
         /// no response for SetWatches request
@@ -1530,35 +1839,59 @@ void KeeperStore::processRequest(
 
         if (zk_request->isReadRequest())
         {
-            if (zk_request->has_watch)
+            bool is_add_watch = zk_request->getOpNum() == Coordination::OpNum::AddWatch;
+            if (zk_request->getOpNum() == Coordination::OpNum::MultiRead)
             {
-                std::lock_guard lock(watch_mutex);
-
-                /// handle watch register, below 1 and 2 must be atomic
-                if (response->error == Coordination::Error::ZOK
-                    || (response->error == Coordination::Error::ZNONODE && zk_request->getOpNum() == Coordination::OpNum::Exists))
+                /// Register watches of sub-requests before pushing the response
+                const auto & multi_request = dynamic_cast<const Coordination::ZooKeeperMultiRequest &>(*zk_request);
+                const auto & multi_response = dynamic_cast<const Coordination::ZooKeeperMultiResponse &>(*response);
+                for (size_t i = 0; i < multi_request.requests.size(); ++i)
                 {
-                    /// 1. register watch
-                    auto & watches_type
-                    = zk_request->getOpNum() == Coordination::OpNum::List || zk_request->getOpNum() == Coordination::OpNum::SimpleList
-                        ? list_watches
-                        : watches;
-                    watches_type[zk_request->getPath()].emplace_back(session_id);
-                    sessions_and_watchers[session_id].emplace(zk_request->getPath());
-
-                    LOG_TRACE(
-                        log,
-                        "Register watch, session {}, path {}, opnum {}, xid {}, error no {}, msg {}",
-                        toHexString(session_id),
-                        zk_request->getPath(),
-                        Coordination::toString(zk_request->getOpNum()),
-                        zk_request->xid,
-                        response->error,
-                        Coordination::errorMessage(response->error));
+                    const auto & sub_request = dynamic_cast<const Coordination::ZooKeeperRequest &>(*multi_request.requests[i]);
+                    auto sub_error = multi_response.responses[i]->error;
+                    if (sub_request.has_watch
+                        && (sub_error == Coordination::Error::ZOK
+                            || (sub_error == Coordination::Error::ZNONODE && sub_request.getOpNum() == Coordination::OpNum::Exists)))
+                    {
+                        bool is_list = sub_request.getOpNum() == Coordination::OpNum::List
+                            || sub_request.getOpNum() == Coordination::OpNum::SimpleList;
+                        watch_manager.addWatch(sub_request.getPath(), session_id, is_list ? WatchType::LIST : WatchType::DATA);
+                    }
                 }
-                /// 2. push response to queue
                 set_response(responses_queue, ResponseForSession{session_id, response}, ignore_response);
             }
+            else if ((zk_request->has_watch || is_add_watch)
+                && (response->error == Coordination::Error::ZOK
+                    || (response->error == Coordination::Error::ZNONODE && zk_request->getOpNum() == Coordination::OpNum::Exists)))
+            {
+                WatchType watch_type;
+                if (is_add_watch)
+                    watch_type = dynamic_cast<Coordination::ZooKeeperAddWatchRequest &>(*zk_request).mode
+                            == static_cast<int32_t>(Coordination::AddWatchMode::PERSISTENT_RECURSIVE)
+                        ? WatchType::PERSISTENT_RECURSIVE
+                        : WatchType::PERSISTENT;
+                else if (zk_request->getOpNum() == Coordination::OpNum::List || zk_request->getOpNum() == Coordination::OpNum::SimpleList
+                         || zk_request->getOpNum() == Coordination::OpNum::PagedList)
+                    watch_type = WatchType::LIST;
+                else
+                    watch_type = WatchType::DATA;
+
+                /// handle watch register, 1. register watch and 2. push response to queue must be atomic
+                watch_manager.addWatch(zk_request->getPath(), session_id, watch_type, [&]
+                {
+                    set_response(responses_queue, ResponseForSession{session_id, response}, ignore_response);
+                });
+
+                LOG_TRACE(
+                    log,
+                    "Register watch, session {}, path {}, opnum {}, xid {}, error no {}, msg {}",
+                    toHexString(session_id),
+                    zk_request->getPath(),
+                    Coordination::toString(zk_request->getOpNum()),
+                    zk_request->xid,
+                    response->error,
+                    Coordination::errorMessage(response->error));
+            }
             else
             {
                 /// push response to queue
@@ -1567,34 +1900,26 @@ void KeeperStore::processRequest(
         }
         else
         {
+            if (response->error == Coordination::Error::ZOK)
             {
-                std::lock_guard lock(watch_mutex);
+                /// 1. trigger watch
+                auto watch_responses = store_request->processWatches(watch_manager);
 
-                /// handle watch trigger, below 1 and 2 must be atomic
-                if (watches.contains(zk_request->getPath()) || list_watches.contains(parentPath(zk_request->getPath())))
-                {
-                    if (response->error == Coordination::Error::ZOK)
-                    {
-                        /// 1. trigger watch
-                        auto watch_responses = store_request->processWatches(watches, list_watches);
-
-                        /// 2. push watch response to queue
-                        set_response(responses_queue, watch_responses, ignore_response);
+                /// 2. push watch response to queue
+                set_response(responses_queue, watch_responses, ignore_response);
 
-                        for (auto & session_id_response : watch_responses)
-                        {
-                            auto * watch_response
-                                = dynamic_cast<Coordination::ZooKeeperWatchResponse *>(session_id_response.response.get());
-                            LOG_TRACE(
-                                log,
-                                "Processed watch, session {}, path {}, type {}, xid {} zxid {}",
-                                toHexString(session_id_response.session_id),
-                                watch_response->path,
-                                watch_response->type,
-                                watch_response->xid,
-                                watch_response->zxid);
-                        }
-                    }
+                for (auto & session_id_response : watch_responses)
+                {
+                    auto * watch_response
+                        = dynamic_cast<Coordination::ZooKeeperWatchResponse *>(session_id_response.response.get());
+                    LOG_TRACE(
+                        log,
+                        "Processed watch, session {}, path {}, type {}, xid {} zxid {}",
+                        toHexString(session_id_response.session_id),
+                        watch_response->path,
+                        watch_response->type,
+                        watch_response->xid,
+                        watch_response->zxid);
                 }
             }
 
@@ -1621,112 +1946,455 @@ bool KeeperStore::updateSessionTimeout(int64_t session_id, int64_t /*session_tim
 void KeeperStore::buildPathChildren(bool from_zk_snapshot)
 {
     LOG_INFO(log, "build path children in keeper storage {}", container.size());
-    /// build children
-    for (UInt32 block_idx = 0; block_idx < container.getBlockNum(); block_idx++)
+    Stopwatch watch;
+
+    /// Children are linked to parents in two phases, every block is processed by its own thread:
+    /// 1. group nodes of the block by the block of their parent,
+    /// 2. link children grouped to the block into the parents in it.
+    /// Every children set is only modified by one thread, so no lock is needed.
+    using ChildPaths = std::vector<const String *>;
+    std::vector<std::array<ChildPaths, MAP_BLOCK_NUM>> grouped_paths(MAP_BLOCK_NUM);
+    /// TTL nodes found in every block, the expiry index is rebuilt from them.
+    std::vector<std::vector<std::pair<const String *, int64_t>>> ttl_nodes(MAP_BLOCK_NUM);
+    /// Container nodes found in every block, empty ones are tracked after children are linked.
+    std::vector<std::vector<std::pair<const String *, const KeeperNode *>>> container_nodes(MAP_BLOCK_NUM);
+
+    ThreadPool thread_pool(MAP_BLOCK_NUM);
+    for (UInt32 block_idx = 0; block_idx < MAP_BLOCK_NUM; block_idx++)
+    {
+        thread_pool.scheduleOrThrowOnError([this, block_idx, &grouped_paths, &ttl_nodes, &container_nodes] {
+            /// Same as hash of Container, std::hash of string_view equals to that of string.
+            std::hash<std::string_view> hasher;
+            for (const auto & [path, node] : container.getMap(block_idx).getMap())
+            {
+                if (path == "/")
+                    continue;
+
+                if (node->isTTL())
+                    ttl_nodes[block_idx].emplace_back(&path, node->ttlExpirationTime());
+                else if (node->isContainer())
+                    container_nodes[block_idx].emplace_back(&path, node.get());
+
+                auto rslash_pos = path.rfind('/');
+                std::string_view parent_path = rslash_pos > 0 ? std::string_view(path).substr(0, rslash_pos) : "/";
+                grouped_paths[block_idx][hasher(parent_path) % MAP_BLOCK_NUM].push_back(&path);
+            }
+        });
+    }
+    thread_pool.wait();
+
+    for (UInt32 block_idx = 0; block_idx < MAP_BLOCK_NUM; block_idx++)
+    {
+        thread_pool.scheduleOrThrowOnError([this, block_idx, from_zk_snapshot, &grouped_paths] {
+            auto & parents = container.getMap(block_idx).getMap();
+            String parent_path;
+            for (auto & block_paths : grouped_paths)
+            {
+                for (const String * path : block_paths[block_idx])
+                {
+                    auto rslash_pos = path->rfind('/');
+                    parent_path.assign(*path, 0, rslash_pos > 0 ? rslash_pos : 1);
+
+                    auto it = parents.find(parent_path);
+                    if (it == parents.end())
+                        throw RK::Exception("Logical error: Build : can not find parent node " + *path, ErrorCodes::LOGICAL_ERROR);
+
+                    auto & parent = it->second;
+                    parent->children.emplace(path->data() + rslash_pos + 1, path->size() - rslash_pos - 1);
+                    if (from_zk_snapshot)
+                        parent->stat.numChildren++;
+                }
+            }
+        });
+    }
+    thread_pool.wait();
+
+    {
+        std::lock_guard lock(ttl_mutex);
+        ttl_expiry_queue.clear();
+        for (const auto & block_ttl_nodes : ttl_nodes)
+            for (const auto & [path, expiration_time] : block_ttl_nodes)
+                ttl_expiry_queue.addOrUpdate(*path, expiration_time);
+    }
+
+    {
+        std::lock_guard lock(empty_containers_mutex);
+        empty_containers.clear();
+        for (const auto & block_container_nodes : container_nodes)
+            for (const auto & [path, node] : block_container_nodes)
+                if (node->children.empty() && node->stat.cversion > 0)
+                    empty_containers.insert(*path);
+    }
+
+    LOG_INFO(log, "build path children done, {} ms, {} TTL nodes", watch.elapsedMilliseconds(), ttl_expiry_queue.size());
+
+    buildSubtreeStats();
+}
+
+/// Fill subtree counters of node and all its descendants, return them.
+static std::pair<int64_t, int64_t> buildSubtreeStatsImpl(KeeperStore::Container & container, const String & path, KeeperNode & node)
+{
+    int64_t descendants = 0;
+    int64_t subtree_bytes = node.getData().length();
+
+    String child_path = path == "/" ? path : path + "/";
+    size_t prefix_size = child_path.size();
+    for (const auto & child : node.children)
+    {
+        child_path.resize(prefix_size);
+        child_path += child;
+        auto child_node = container.get(child_path);
+        if (!child_node)
+            continue;
+
+        auto [child_descendants, child_bytes] = buildSubtreeStatsImpl(container, child_path, *child_node);
+        descendants += 1 + child_descendants;
+        subtree_bytes += child_bytes;
+    }
+
+    node.descendants.store(descendants, std::memory_order_relaxed);
+    node.subtree_bytes.store(subtree_bytes, std::memory_order_relaxed);
+    return {descendants, subtree_bytes};
+}
+
+void KeeperStore::buildSubtreeStats()
+{
+    Stopwatch watch;
+    auto root = container.get("/");
+    if (!root)
+        return;
+
+    /// Subtrees of the children of root are processed in parallel, then summed up into root.
+    std::vector<String> top_paths;
+    top_paths.reserve(root->children.size());
+    for (const auto & child : root->children)
+        top_paths.push_back("/" + child);
+
+    std::vector<std::pair<int64_t, int64_t>> top_stats(top_paths.size());
+    std::atomic<size_t> next_idx{0};
+
+    ThreadPool thread_pool(MAP_BLOCK_NUM);
+    for (UInt32 thread_idx = 0; thread_idx < MAP_BLOCK_NUM; thread_idx++)
+    {
+        thread_pool.scheduleOrThrowOnError([this, &top_paths, &top_stats, &next_idx] {
+            for (size_t idx = next_idx++; idx < top_paths.size(); idx = next_idx++)
+            {
+                if (auto node = container.get(top_paths[idx]))
+                    top_stats[idx] = buildSubtreeStatsImpl(container, top_paths[idx], *node);
+            }
+        });
+    }
+    thread_pool.wait();
+
+    int64_t descendants = 0;
+    int64_t subtree_bytes = root->getData().length();
+    for (const auto & [child_descendants, child_bytes] : top_stats)
+    {
+        descendants += 1 + child_descendants;
+        subtree_bytes += child_bytes;
+    }
+    root->descendants = descendants;
+    root->subtree_bytes = subtree_bytes;
+
+    LOG_INFO(log, "build subtree stats done, {} nodes {} bytes, {} ms", descendants + 1, subtree_bytes, watch.elapsedMilliseconds());
+}
+
+KeeperStore::ZNodeQuota KeeperStore::parseQuota(std::string_view limits)
+{
+    ZNodeQuota quota;
+    while (!limits.empty())
+    {
+        auto item = limits.substr(0, limits.find(','));
+        limits.remove_prefix(std::min(item.size() + 1, limits.size()));
+
+        auto eq_pos = item.find('=');
+        if (eq_pos == std::string_view::npos)
+            continue;
+        auto key = item.substr(0, eq_pos);
+        auto value_str = item.substr(eq_pos + 1);
+
+        /// Negative or malformed value means unlimited
+        UInt64 value = 0;
+        std::from_chars(value_str.data(), value_str.data() + value_str.size(), value);
+
+        if (key == "countHardLimit")
+            quota.max_nodes = value;
+        else if (key == "byteHardLimit")
+            quota.max_bytes = value;
+    }
+    return quota;
+}
+
+bool KeeperStore::checkQuota(std::string_view path, int64_t nodes_delta, int64_t bytes_delta) const
+{
+    if (nodes_delta <= 0 && bytes_delta <= 0)
+        return true;
+
+    /// System nodes, quota nodes included, are not limited
+    constexpr std::string_view system_path = "/zookeeper";
+    if (path.starts_with(system_path) && (path.size() == system_path.size() || path[system_path.size()] == '/'))
+        return true;
+
+    auto quota_root = container.get(QUOTA_ROOT);
+    if (!quota_root || quota_root->stat.numChildren == 0)
+        return true;
+
+    String limits_path(QUOTA_ROOT);
+    for (size_t pos = path.find('/', 1);; pos = path.find('/', pos + 1))
     {
-        for (const auto& it : container.getMap(block_idx).getMap())
+        auto subtree_path = path.substr(0, pos);
+
+        limits_path.resize(QUOTA_ROOT.size());
+        limits_path.append(subtree_path).append("/").append(QUOTA_LIMITS_NODE);
+
+        if (auto limits_node = container.get(limits_path))
         {
-            if (it.first == "/")
-               continue;
+            auto quota = parseQuota(limits_node->getData());
+            auto subtree_node = container.get(subtree_path);
 
-            auto parent_path = parentPath(it.first);
-            auto child_path = getBaseName(it.first);
-            auto parent = container.get(parent_path);
-            if (parent == nullptr)
+            if (subtree_node && quota.max_nodes && nodes_delta > 0
+                && subtree_node->descendants.load(std::memory_order_relaxed) + 1 + nodes_delta > static_cast<int64_t>(quota.max_nodes))
             {
-                throw RK::Exception("Logical error: Build : can not find parent node " + it.first, ErrorCodes::LOGICAL_ERROR);
+                LOG_DEBUG(log, "Node count quota of {} exceeded by {}", subtree_path, path);
+                return false;
             }
-            else
+
+            if (subtree_node && quota.max_bytes && bytes_delta > 0
+                && subtree_node->subtree_bytes.load(std::memory_order_relaxed) + bytes_delta > static_cast<int64_t>(quota.max_bytes))
             {
-                parent->children.insert(child_path);
-                if (from_zk_snapshot)
-                    parent->stat.numChildren++;
+                LOG_DEBUG(log, "Data size quota of {} exceeded by {}", subtree_path, path);
+                return false;
             }
         }
-    }
 
+        if (pos == std::string_view::npos)
+            break;
+    }
+    return true;
 }
 
-void KeeperStore::clearDeadWatches(int64_t session_id)
+std::vector<KeeperStore::QuotaUsage> KeeperStore::getQuotaUsages() const
 {
-    LOG_DEBUG(log, "Clear dead watches, session {}", toHexString(session_id));
-    //    std::lock_guard session_lock(session_mutex);
-    std::lock_guard watch_lock(watch_mutex);
-    auto watches_it = sessions_and_watchers.find(session_id);
-    if (watches_it != sessions_and_watchers.end())
+    std::vector<QuotaUsage> usages;
+
+    /// Quota tree is small, walk it to find all limits nodes
+    std::vector<String> paths{String(QUOTA_ROOT)};
+    while (!paths.empty())
     {
-        for (const auto & watch_path : watches_it->second)
+        String path = std::move(paths.back());
+        paths.pop_back();
+
+        auto node = container.get(path);
+        if (!node)
+            continue;
+
+        std::vector<String> children;
+        {
+            std::shared_lock r_lock(node->mutex);
+            children.assign(node->children.begin(), node->children.end());
+        }
+
+        for (const auto & child : children)
         {
-            auto watch = watches.find(watch_path);
-            if (watch != watches.end())
+            if (child != QUOTA_LIMITS_NODE)
             {
-                auto & watches_for_path = watch->second;
-                for (auto w_it = watches_for_path.begin(); w_it != watches_for_path.end();)
-                {
-                    if (*w_it == session_id)
-                        w_it = watches_for_path.erase(w_it);
-                    else
-                        ++w_it;
-                }
-                if (watches_for_path.empty())
-                    watches.erase(watch);
+                paths.push_back(path + "/" + child);
+                continue;
             }
 
-            auto list_watch = list_watches.find(watch_path);
-            if (list_watch != list_watches.end())
+            auto limits_node = container.get(path + "/" + child);
+            if (!limits_node || path.size() == QUOTA_ROOT.size())
+                continue;
+
+            QuotaUsage usage{path.substr(QUOTA_ROOT.size()), parseQuota(limits_node->getData()), 0, 0};
+            if (auto subtree_node = container.get(usage.path))
             {
-                auto & list_watches_for_path = list_watch->second;
-                for (auto w_it = list_watches_for_path.begin(); w_it != list_watches_for_path.end();)
-                {
-                    if (*w_it == session_id)
-                        w_it = list_watches_for_path.erase(w_it);
-                    else
-                        ++w_it;
-                }
-                if (list_watches_for_path.empty())
-                    list_watches.erase(list_watch);
+                usage.nodes = subtree_node->descendants.load(std::memory_order_relaxed) + 1;
+                usage.bytes = subtree_node->subtree_bytes.load(std::memory_order_relaxed);
             }
+            usages.push_back(std::move(usage));
         }
-        sessions_and_watchers.erase(watches_it);
     }
+
+    std::sort(usages.begin(), usages.end(), [](const auto & a, const auto & b) { return a.path < b.path; });
+    return usages;
 }
 
-void KeeperStore::dumpWatches(WriteBufferFromOwnString & buf) const
+void KeeperStore::updateAncestorsStats(std::string_view path, int64_t descendants_delta, int64_t bytes_delta)
 {
-//    std::lock_guard session_lock(session_mutex);
-    std::lock_guard lock(watch_mutex);
-    for (const auto & [session_id, watches_paths] : sessions_and_watchers)
+    if (descendants_delta == 0 && bytes_delta == 0)
+        return;
+
+    while (path != "/")
     {
-        buf << toHexString(session_id) << "\n";
-        for (const String & path : watches_paths)
-            buf << "\t" << path << "\n";
+        path = parentPath(path);
+        auto ancestor = container.get(path);
+        if (!ancestor)
+            break;
+        ancestor->descendants.fetch_add(descendants_delta, std::memory_order_relaxed);
+        ancestor->subtree_bytes.fetch_add(bytes_delta, std::memory_order_relaxed);
     }
 }
 
-void KeeperStore::dumpWatchesByPath(WriteBufferFromOwnString & buf) const
+void KeeperStore::applyNodeFromDeltaSnapshot(const String & path, std::shared_ptr<KeeperNode> node)
 {
-    auto write_int_vec = [&buf](const std::vector<int64_t> & session_ids)
+    auto old_node = container.get(path);
+    int64_t data_size = node->getData().length();
+    if (old_node)
     {
-        for (int64_t session_id : session_ids)
+        node->children = std::move(old_node->children);
+        node->descendants = old_node->descendants.load();
+        node->subtree_bytes = old_node->subtree_bytes - static_cast<int64_t>(old_node->getData().length()) + data_size;
+        updateAncestorsStats(path, 0, node->subtree_bytes - old_node->subtree_bytes);
+        acl_map.removeUsage(old_node->acl_id);
+        if (old_node->is_ephemeral)
         {
-            buf << "\t" << toHexString(session_id) << "\n";
+            std::lock_guard lock(ephemerals_mutex);
+            ephemerals[old_node->stat.ephemeralOwner].erase(path);
         }
-    };
+        else if (old_node->isTTL())
+        {
+            removeTTLNode(path);
+        }
+    }
+    else if (path != "/")
+    {
+        auto parent = container.get(parentPath(path));
+        if (parent == nullptr)
+        {
+            /// Parent is created while creating the fuzzy snapshot, the node will be created again when replaying logs.
+            LOG_WARNING(log, "Apply delta snapshot can not find parent node of {}, skip it", path);
+            acl_map.removeUsage(node->acl_id);
+            return;
+        }
+        parent->children.emplace(getBaseName(path));
+        onChildAdded(String(parentPath(path)), *parent);
+        node->subtree_bytes = data_size;
+        updateAncestorsStats(path, 1, data_size);
+    }
+
+    auto ephemeral_owner = node->is_ephemeral ? node->stat.ephemeralOwner : 0;
+    if (node->isTTL())
+        addTTLNode(path, node->ttlExpirationTime());
+    container.emplace(path, std::move(node));
 
-    std::lock_guard lock(watch_mutex);
-    for (const auto & [watch_path, sessions] : watches)
+    if (ephemeral_owner != 0)
     {
-        buf << watch_path << "\n";
-        write_int_vec(sessions);
+        std::lock_guard lock(ephemerals_mutex);
+        ephemerals[ephemeral_owner].emplace(path);
     }
+}
+
+void KeeperStore::removeNodeFromDeltaSnapshot(const String & path)
+{
+    auto node = container.get(path);
+    if (node == nullptr)
+        return;
 
-    for (const auto & [watch_path, sessions] : list_watches)
+    auto parent = container.get(parentPath(path));
+    if (parent != nullptr)
     {
-        buf << watch_path << "\n";
-        write_int_vec(sessions);
+        parent->children.erase(String(getBaseName(path)));
+        onChildRemoved(String(parentPath(path)), *parent);
+    }
+    updateAncestorsStats(path, -(1 + node->descendants), -node->subtree_bytes);
+
+    /// Removals of children may be in an earlier delta snapshot than the removal of their parent
+    /// in a fuzzy snapshot, nodes left from the base snapshot are removed with the whole subtree.
+    std::vector<std::pair<String, std::shared_ptr<KeeperNode>>> to_remove{{path, node}};
+    while (!to_remove.empty())
+    {
+        auto [current_path, current] = std::move(to_remove.back());
+        to_remove.pop_back();
+
+        for (const auto & child : current->children)
+        {
+            String child_path = current_path == "/" ? "/" + child : current_path + "/" + child;
+            if (auto child_node = container.get(child_path))
+                to_remove.emplace_back(std::move(child_path), std::move(child_node));
+        }
+
+        onNodeRemoved(current_path, *current);
+        acl_map.removeUsage(current->acl_id);
+        if (current->isTTL())
+            removeTTLNode(current_path);
+        else if (current->is_ephemeral)
+        {
+            std::lock_guard lock(ephemerals_mutex);
+            auto it = ephemerals.find(current->stat.ephemeralOwner);
+            if (it != ephemerals.end())
+            {
+                it->second.erase(current_path);
+                if (it->second.empty())
+                    ephemerals.erase(it);
+            }
+        }
+        container.erase(current_path);
+    }
+}
+
+void KeeperStore::clearSessionsForDeltaSnapshot()
+{
+    {
+        std::lock_guard lock(session_mutex);
+        session_expiry_queue.clear();
+        session_and_timeout.clear();
+    }
+    {
+        std::lock_guard lock(auth_mutex);
+        session_and_auth.clear();
+        permission_cache.clear();
     }
 }
 
+void KeeperStore::clearDeadWatches(int64_t session_id)
+{
+    LOG_DEBUG(log, "Clear dead watches, session {}", toHexString(session_id));
+    watch_manager.removeSessionWatches(session_id);
+}
+
+bool KeeperStore::checkPermission(int64_t session_id, uint64_t acl_id, int32_t permission) const
+{
+    /// Default ACL is 'world,'anyone : cdrwa
+    if (acl_id == 0)
+        return true;
+
+    /// A hit only takes the shared lock of one cache shard. Decisions are made and cached
+    /// under auth_mutex, which is exclusively held while invalidating them, so a decision
+    /// made with outdated auth ids is never cached.
+    if (auto allowed = permission_cache.get(session_id, acl_id, permission))
+        return *allowed;
+
+    bool allowed;
+    {
+        std::shared_lock r_lock(auth_mutex);
+
+        static const std::vector<Coordination::AuthID> empty_auth_ids;
+        auto it = session_and_auth.find(session_id);
+        const auto & session_auths = it != session_and_auth.end() ? it->second : empty_auth_ids;
+
+        allowed = checkACL(permission, *acl_map.getACLs(acl_id), session_auths);
+        permission_cache.set(session_id, acl_id, permission, allowed);
+    }
+
+    /// Closing session is removed from sessions before its decisions are invalidated, so decisions
+    /// cached after the invalidation are dropped here. Checked out of auth_mutex, which is locked
+    /// after session_mutex elsewhere.
+    if (!containsSession(session_id))
+        permission_cache.invalidate(session_id);
+    return allowed;
+}
+
+void KeeperStore::dumpWatches(WriteBufferFromOwnString & buf) const
+{
+    watch_manager.dumpWatches(buf);
+}
+
+void KeeperStore::dumpWatchesByPath(WriteBufferFromOwnString & buf) const
+{
+    watch_manager.dumpWatchesByPath(buf);
+}
+
 void KeeperStore::dumpSessionsAndEphemerals(WriteBufferFromOwnString & buf) const
 {
     auto write_str_set = [&buf](const std::unordered_set<String> & ephemeral_paths)
@@ -1747,7 +2415,7 @@ void KeeperStore::dumpSessionsAndEphemerals(WriteBufferFromOwnString & buf) cons
     }
 
     std::lock_guard lock(ephemerals_mutex);
-    buf << "Sessions with Ephemerals (" << getSessionWithEphemeralNodesCount() << "):\n";
+    buf << "Sessions with Ephemerals (" << ephemerals.size() << "):\n";
     for (const auto & [session_id, ephemeral_paths] : ephemerals)
     {
         buf << toHexString(session_id) << "\n";
@@ -1755,30 +2423,41 @@ void KeeperStore::dumpSessionsAndEphemerals(WriteBufferFromOwnString & buf) cons
     }
 }
 
-uint64_t KeeperStore::getTotalWatchesCount() const
+void KeeperStore::dumpHeaviestSubtrees(WriteBufferFromOwnString & buf, size_t top_n) const
 {
-    std::lock_guard lock(watch_mutex);
-    uint64_t ret = 0;
-    for (const auto & [path, subscribed_sessions] : watches)
-        ret += subscribed_sessions.size();
-
-    for (const auto & [path, subscribed_sessions] : list_watches)
-        ret += subscribed_sessions.size();
+    if (top_n == 0)
+        return;
 
-    return ret;
-}
+    using Entry = std::tuple<int64_t, int64_t, String>;
+    /// min-heap on bytes, keep the heaviest top_n
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<>> heaviest;
 
-uint64_t KeeperStore::getSessionsWithWatchesCount() const
-{
-    std::lock_guard lock(watch_mutex);
-    std::unordered_set<int64_t> counter;
-    for (const auto & [path, subscribed_sessions] : watches)
-        counter.insert(subscribed_sessions.begin(), subscribed_sessions.end());
+    for (UInt32 block_idx = 0; block_idx < MAP_BLOCK_NUM; block_idx++)
+    {
+        container.getMap(block_idx).forEach([&](const String & path, const Container::SharedElement & node)
+        {
+            if (path == "/")
+                return;
+            int64_t bytes = node->subtree_bytes.load(std::memory_order_relaxed);
+            if (heaviest.size() == top_n && bytes <= std::get<0>(heaviest.top()))
+                return;
+            heaviest.emplace(bytes, node->descendants.load(std::memory_order_relaxed) + 1, path);
+            if (heaviest.size() > top_n)
+                heaviest.pop();
+        });
+    }
 
-    for (const auto & [path, subscribed_sessions] : list_watches)
-        counter.insert(subscribed_sessions.begin(), subscribed_sessions.end());
+    std::vector<Entry> sorted;
+    sorted.reserve(heaviest.size());
+    while (!heaviest.empty())
+    {
+        sorted.push_back(heaviest.top());
+        heaviest.pop();
+    }
 
-    return counter.size();
+    buf << "Heaviest subtrees (" << sorted.size() << "):\n";
+    for (auto it = sorted.rbegin(); it != sorted.rend(); ++it)
+        buf << std::get<2>(*it) << "\t" << std::get<0>(*it) << "\t" << std::get<1>(*it) << "\n";
 }
 
 uint64_t KeeperStore::getTotalEphemeralNodesCount() const
@@ -1797,4 +2476,109 @@ bool KeeperStore::containsSession(int64_t session_id) const
     return session_and_timeout.contains(session_id);
 }
 
+void KeeperStore::addTTLNode(const String & path, int64_t expiration_time)
+{
+    std::lock_guard lock(ttl_mutex);
+    ttl_expiry_queue.addOrUpdate(path, expiration_time);
+}
+
+void KeeperStore::removeTTLNode(const String & path)
+{
+    std::lock_guard lock(ttl_mutex);
+    ttl_expiry_queue.remove(path);
+}
+
+std::vector<String> KeeperStore::getExpiredTTLNodes(int64_t now, size_t max_count)
+{
+    /// How long to wait before checking an expired node again
+    static constexpr int64_t TTL_RECHECK_INTERVAL_MS = 60000;
+
+    std::vector<String> result;
+    std::lock_guard lock(ttl_mutex);
+    for (auto & path : ttl_expiry_queue.getExpiredPaths(now, max_count))
+    {
+        auto node = container.get(path);
+        if (!node || !node->isTTL())
+        {
+            ttl_expiry_queue.remove(path);
+            continue;
+        }
+
+        int64_t ttl;
+        bool has_children;
+        {
+            std::shared_lock r_lock(node->mutex);
+            ttl = Coordination::ttlFromEphemeralOwner(node->stat.ephemeralOwner);
+            has_children = !node->children.empty();
+        }
+
+        /// Node with children is checked again later. Proposed node is postponed too, if it is
+        /// removed the index is updated when applying, otherwise it is checked again.
+        ttl_expiry_queue.addOrUpdate(path, now + std::min(ttl, TTL_RECHECK_INTERVAL_MS));
+        if (!has_children)
+            result.push_back(std::move(path));
+    }
+    return result;
+}
+
+uint64_t KeeperStore::getTTLNodesCount() const
+{
+    std::lock_guard lock(ttl_mutex);
+    return ttl_expiry_queue.size();
+}
+
+void KeeperStore::onChildRemoved(const String & parent_path, const KeeperNode & parent)
+{
+    if (!parent.isContainer() || !parent.children.empty() || parent.stat.cversion == 0)
+        return;
+
+    std::lock_guard lock(empty_containers_mutex);
+    empty_containers.insert(parent_path);
+}
+
+void KeeperStore::onChildAdded(const String & parent_path, const KeeperNode & parent)
+{
+    if (!parent.isContainer())
+        return;
+
+    std::lock_guard lock(empty_containers_mutex);
+    empty_containers.erase(parent_path);
+}
+
+void KeeperStore::onNodeRemoved(const String & path, const KeeperNode & node)
+{
+    if (!node.isContainer())
+        return;
+
+    std::lock_guard lock(empty_containers_mutex);
+    empty_containers.erase(path);
+}
+
+std::vector<String> KeeperStore::getEmptyContainers(size_t max_count)
+{
+    std::vector<String> result;
+    std::lock_guard lock(empty_containers_mutex);
+    for (auto it = empty_containers.begin(); it != empty_containers.end() && result.size() < max_count;)
+    {
+        bool removable = false;
+        if (auto node = container.get(*it); node && node->isContainer())
+        {
+            std::shared_lock r_lock(node->mutex);
+            removable = node->children.empty() && node->stat.cversion > 0;
+        }
+
+        /// Both returned and stale paths are not tracked any more
+        if (removable)
+            result.push_back(*it);
+        it = empty_containers.erase(it);
+    }
+    return result;
+}
+
+uint64_t KeeperStore::getEmptyContainersCount() const
+{
+    std::lock_guard lock(empty_containers_mutex);
+    return empty_containers.size();
+}
+
 }
@@ -4,15 +4,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <IO/MMapReadBufferFromFile.h>
 #include <Service/Crc32.h>
 #include <Service/KeeperCommon.h>
 #include <Service/LogEntry.h>
 #include <Service/NuRaftLogSegment.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <Poco/File.h>
 #include <Common/ThreadPool.h>
+#include <common/unaligned.h>
 
 #ifdef __clang__
 #    pragma clang diagnostic push
@@ -333,6 +336,62 @@ off_t NuRaftLogSegment::loadVersion()
     }
 }
 
+bool NuRaftLogSegment::verifyFile(const std::string & path, LogSegmentVerifyResult & result)
+{
+    MMapReadBufferFromFile mapped_file(path, 0);
+    const char * file_data = mapped_file.buffer().begin();
+    size_t file_size = mapped_file.buffer().size();
+    if (file_size)
+        madvise(const_cast<char *>(file_data), file_size, MADV_SEQUENTIAL);
+
+    result = {};
+    result.file_size = file_size;
+
+    /// "RaftLog" + version, see loadVersion
+    static constexpr char magic[8] = {0, 'R', 'a', 'f', 't', 'L', 'o', 'g'};
+    size_t offset = 0;
+    if (file_size >= sizeof(magic) + 1 && memcmp(file_data, magic, sizeof(magic)) == 0)
+    {
+        result.version = LogVersion(file_data[sizeof(magic)]);
+        offset = sizeof(magic) + 1;
+    }
+
+    while (offset < file_size)
+    {
+        if (offset + LogEntryHeader::HEADER_SIZE > file_size)
+        {
+            result.truncated = true;
+            break;
+        }
+
+        /// LogEntryHeader is written as is, see appendEntry
+        UInt64 index = unalignedLoad<UInt64>(file_data + offset + sizeof(UInt64));
+        UInt32 data_length = unalignedLoad<UInt32>(file_data + offset + 2 * sizeof(UInt64));
+        UInt32 data_crc = unalignedLoad<UInt32>(file_data + offset + 2 * sizeof(UInt64) + sizeof(UInt32));
+
+        if (offset + LogEntryHeader::HEADER_SIZE + data_length > file_size)
+        {
+            result.truncated = true;
+            break;
+        }
+
+        bool continuous = result.entries == 0 || index == result.last_index + 1;
+        if (!continuous || !verifyCRC32(file_data + offset + LogEntryHeader::HEADER_SIZE, data_length, data_crc))
+        {
+            result.corrupted_offset = offset;
+            return false;
+        }
+
+        if (result.entries == 0)
+            result.first_index = index;
+        result.last_index = index;
+        ++result.entries;
+        offset += LogEntryHeader::HEADER_SIZE + data_length;
+    }
+
+    return true;
+}
+
 //is_full=true, close full open log segment, rename to finish file name
 //is_full=false, close ofstream
 int NuRaftLogSegment::close(bool is_full)
@@ -30,6 +30,20 @@ struct VersionLogEntry
 
 static constexpr auto CURRENT_LOG_VERSION = LogVersion::V1;
 
+/// Result of NuRaftLogSegment::verifyFile
+struct LogSegmentVerifyResult
+{
+    LogVersion version = LogVersion::V0;
+    UInt64 entries = 0;
+    UInt64 first_index = 0;
+    UInt64 last_index = 0;
+    UInt64 file_size = 0;
+    /// The last entry is not completely written, which is expected for open segment
+    bool truncated = false;
+    /// Offset of the first entry whose CRC mismatches or index is not continuous, -1 if none
+    Int64 corrupted_offset = -1;
+};
+
 
 class NuRaftLogSegment
 {
@@ -104,6 +118,10 @@ public:
 
     std::string getFileName();
 
+    /// Verify CRC of all entries of segment file without modifying it, used by offline tools.
+    /// Return false if any entry is corrupted.
+    static bool verifyFile(const std::string & path, LogSegmentVerifyResult & result);
+
 public:
 #ifdef __APPLE__
     //log_startindex_endindex_createtime
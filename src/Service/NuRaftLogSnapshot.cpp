@@ -5,10 +5,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#if defined(__linux__)
+#    include <sys/syscall.h>
+#endif
+#include <IO/MMapReadBufferFromFile.h>
+#include <IO/ReadBufferFromMemory.h>
 #include <IO/WriteHelpers.h>
 #include <Service/KeeperCommon.h>
 #include <Service/NuRaftLogSnapshot.h>
-#include <Service/ReadBufferFromNuraftBuffer.h>
 #include <Service/WriteBufferFromNuraftBuffer.h>
 #include <sys/uio.h>
 #include <Poco/File.h>
@@ -16,6 +22,7 @@
 #include <Common/Exception.h>
 #include <Common/Stopwatch.h>
 #include <Common/ZooKeeper/ZooKeeperIO.h>
+#include <common/unaligned.h>
 
 #ifdef __clang__
 #    pragma clang diagnostic push
@@ -41,6 +48,9 @@ namespace ErrorCodes
     extern const int UNKNOWN_FORMAT_VERSION;
     extern const int CANNOT_CREATE_DIRECTORY;
     extern const int ILLEGAL_TYPE_OF_ARGUMENT;
+    extern const int CANNOT_COMPRESS;
+    extern const int CANNOT_DECOMPRESS;
+    extern const int UNKNOWN_COMPRESSION_METHOD;
 }
 
 using nuraft::cs_new;
@@ -50,6 +60,7 @@ const UInt32 KeeperSnapshotStore::MAX_OBJECT_NODE_SIZE;
 
 const String MAGIC_SNAPSHOT_TAIL = "SnapTail";
 const String MAGIC_SNAPSHOT_HEAD = "SnapHead";
+const String MAGIC_SNAPSHOT_INDEX = "SnapIndx";
 
 int openFileForWrite(const std::string & obj_path)
 {
@@ -74,6 +85,16 @@ bool isFileHeader(UInt64 magic)
     return magic == magic_num;
 }
 
+bool isFileIndex(UInt64 magic)
+{
+    union
+    {
+        uint64_t magic_num;
+        uint8_t magic_array[8] = {'S', 'n', 'a', 'p', 'I', 'n', 'd', 'x'};
+    };
+    return magic == magic_num;
+}
+
 bool isFileTail(UInt64 magic)
 {
     union
@@ -84,16 +105,125 @@ bool isFileTail(UInt64 magic)
     return magic == magic_num;
 }
 
-std::shared_ptr<WriteBufferFromFile> openFileAndWriteHeader(const String & path, const SnapshotVersion version)
+void SnapshotWriteLimiter::beginSnapshot()
+{
+    if (max_bytes_per_second)
+        throttler = std::make_unique<Throttler>(max_bytes_per_second);
+    snapshot_begin_bytes = written_bytes;
+    snapshot_watch.restart();
+}
+
+void SnapshotWriteLimiter::endSnapshot()
+{
+    UInt64 elapsed_ms = std::max<UInt64>(snapshot_watch.elapsedMilliseconds(), 1);
+    last_bytes_per_second = (written_bytes - snapshot_begin_bytes) * 1000 / elapsed_ms;
+}
+
+void SnapshotWriteLimiter::onWrite(size_t bytes)
+{
+    written_bytes += bytes;
+    if (!throttler)
+        return;
+
+    Stopwatch watch;
+    throttler->add(bytes);
+    stall_us += watch.elapsedMicroseconds();
+}
+
+void SnapshotObjectWriteBuffer::nextImpl()
+{
+    size_t bytes = offset();
+    WriteBufferFromFileDescriptor::nextImpl();
+    if (!limiter || bytes == 0)
+        return;
+
+    limiter->onWrite(bytes);
+    unsynced_bytes += bytes;
+    if (limiter->getSyncBytes() == 0 || unsynced_bytes < limiter->getSyncBytes())
+        return;
+
+    /// Write back dirty pages of the object little by little, instead of leaving them to the kernel
+    /// which may flush them all at once and stall the fsync of raft log.
+    Stopwatch watch;
+#if defined(__linux__)
+    int res = ::sync_file_range(
+        fd, unsynced_begin, unsynced_bytes, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+    int res = ::fsync(fd);
+#endif
+    if (res != 0)
+        throwFromErrnoWithPath("Cannot sync snapshot object " + getFileName(), getFileName(), ErrorCodes::CANNOT_FSYNC);
+    limiter->onSync(watch.elapsedMicroseconds());
+
+    unsynced_begin += unsynced_bytes;
+    unsynced_bytes = 0;
+}
+
+/// Lower IO priority of current thread to the lowest of best effort class while creating snapshot.
+/// It only takes effect with IO schedulers supporting priority, such as BFQ.
+class ScopedLowIOPriority
+{
+public:
+    explicit ScopedLowIOPriority(bool enable)
+    {
+#if defined(__linux__)
+        if (!enable)
+            return;
+        old_priority = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+        if (old_priority < 0 || syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, LOWEST_BE_PRIORITY) != 0)
+        {
+            LOG_WARNING(&Poco::Logger::get("KeeperSnapshotManager"), "Cannot lower IO priority, error:{}", strerror(errno));
+            old_priority = -1;
+        }
+#else
+        (void)enable;
+#endif
+    }
+
+    ~ScopedLowIOPriority()
+    {
+#if defined(__linux__)
+        if (old_priority >= 0)
+            syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, old_priority);
+#endif
+    }
+
+private:
+    /// See linux/ioprio.h, 0 for "who" means the calling thread.
+    static constexpr int IOPRIO_WHO_PROCESS = 1;
+    static constexpr int LOWEST_BE_PRIORITY = (2 << 13) | 7;
+
+    long old_priority = -1;
+};
+
+std::shared_ptr<SnapshotObjectWriteBuffer>
+openFileAndWriteHeader(const String & path, const SnapshotVersion version, SnapshotWriteLimiter * limiter)
 {
-    auto out = std::make_shared<WriteBufferFromFile>(path);
+    auto out = std::make_shared<SnapshotObjectWriteBuffer>(path, version, limiter);
     out->write(MAGIC_SNAPSHOT_HEAD.data(), MAGIC_SNAPSHOT_HEAD.size());
     writeIntBinary(static_cast<uint8_t>(version), *out);
     return out;
 }
 
-void writeTailAndClose(std::shared_ptr<WriteBufferFromFile> & out, UInt32 checksum)
+UInt32 updateCheckSum(UInt32 checksum, UInt32 data_crc);
+
+void writeTailAndClose(std::shared_ptr<SnapshotObjectWriteBuffer> & out, UInt32 checksum)
 {
+    if (out->version >= SnapshotVersion::V3)
+    {
+        UInt64 footer_offset = out->count();
+        String index_data;
+        out->index.SerializeToString(&index_data);
+        UInt32 index_crc = RK::getCRC32(index_data.data(), index_data.size());
+
+        out->write(MAGIC_SNAPSHOT_INDEX.data(), MAGIC_SNAPSHOT_INDEX.size());
+        writeIntBinary(static_cast<UInt32>(index_data.size()), *out);
+        writeIntBinary(index_crc, *out);
+        out->write(index_data.data(), index_data.size());
+        writeIntBinary(footer_offset, *out);
+        checksum = updateCheckSum(checksum, index_crc);
+    }
+
     out->write(MAGIC_SNAPSHOT_TAIL.data(), MAGIC_SNAPSHOT_TAIL.size());
     writeIntBinary(checksum, *out);
     out->close();
@@ -112,13 +242,137 @@ int openFileForRead(std::string & obj_path)
     return snap_fd;
 }
 
-std::pair<size_t, UInt32> saveBatch(std::shared_ptr<WriteBufferFromFile> & out, ptr<SnapshotBatchPB> & batch)
+/// Encode batch data in V2 format, see SnapshotCompressionCodec.
+/// Data which can not be made smaller is stored uncompressed.
+String compressBatchData(const String & data, UInt32 compression_level)
+{
+    static constexpr size_t compressed_header_size = sizeof(UInt8) + sizeof(UInt32);
+
+    if (compression_level == 0)
+    {
+        String res(sizeof(UInt8), static_cast<char>(SnapshotCompressionCodec::NONE));
+        res.append(data);
+        return res;
+    }
+
+    uLongf compressed_size = compressBound(data.size());
+    String res;
+    res.resize(compressed_header_size + compressed_size);
+
+    int ret = compress2(
+        reinterpret_cast<Bytef *>(res.data() + compressed_header_size),
+        &compressed_size,
+        reinterpret_cast<const Bytef *>(data.data()),
+        data.size(),
+        std::min(static_cast<int>(compression_level), Z_BEST_COMPRESSION));
+
+    if (ret != Z_OK)
+        throw Exception(ErrorCodes::CANNOT_COMPRESS, "Cannot compress snapshot batch, zlib error {}", ret);
+
+    if (compressed_size >= data.size())
+    {
+        res.resize(sizeof(UInt8));
+        res[0] = SnapshotCompressionCodec::NONE;
+        res.append(data);
+        return res;
+    }
+
+    res[0] = SnapshotCompressionCodec::ZLIB;
+    unalignedStore<UInt32>(res.data() + sizeof(UInt8), data.size());
+    res.resize(compressed_header_size + compressed_size);
+    return res;
+}
+
+/// Decode batch data in V2 format. Uncompressed batch is returned in place,
+/// otherwise it is decompressed into res.
+std::string_view decompressBatchData(const char * data, size_t size, String & res)
+{
+    if (size < sizeof(UInt8))
+        throw Exception(ErrorCodes::CANNOT_DECOMPRESS, "Snapshot batch is too small, size {}", size);
+
+    auto codec = static_cast<UInt8>(data[0]);
+    switch (codec)
+    {
+        case SnapshotCompressionCodec::NONE:
+            return {data + sizeof(UInt8), size - sizeof(UInt8)};
+        case SnapshotCompressionCodec::ZLIB: {
+            if (size < sizeof(UInt8) + sizeof(UInt32))
+                throw Exception(ErrorCodes::CANNOT_DECOMPRESS, "Compressed snapshot batch is too small, size {}", size);
+
+            auto uncompressed_size = unalignedLoad<UInt32>(data + sizeof(UInt8));
+            res.resize(uncompressed_size);
+
+            uLongf dest_size = uncompressed_size;
+            int ret = uncompress(
+                reinterpret_cast<Bytef *>(res.data()),
+                &dest_size,
+                reinterpret_cast<const Bytef *>(data + sizeof(UInt8) + sizeof(UInt32)),
+                size - sizeof(UInt8) - sizeof(UInt32));
+
+            if (ret != Z_OK || dest_size != uncompressed_size)
+                throw Exception(
+                    ErrorCodes::CANNOT_DECOMPRESS,
+                    "Cannot decompress snapshot batch, zlib error {}, expected size {}, got {}",
+                    ret,
+                    uncompressed_size,
+                    dest_size);
+            return res;
+        }
+        default:
+            throw Exception(ErrorCodes::UNKNOWN_COMPRESSION_METHOD, "Unknown snapshot batch codec {}", codec);
+    }
+}
+
+/// Path is the first field of items in DATA and DELETED_PATH batch.
+std::string_view getItemPath(const String & item_data)
+{
+    if (item_data.size() < sizeof(Int32))
+        return {};
+    auto length = static_cast<Int32>(__builtin_bswap32(unalignedLoad<UInt32>(item_data.data())));
+    if (length < 0 || static_cast<size_t>(length) > item_data.size() - sizeof(Int32))
+        return {};
+    return {item_data.data() + sizeof(Int32), static_cast<size_t>(length)};
+}
+
+void addBatchIndex(SnapshotObjectWriteBuffer & out, const SnapshotBatchPB & batch, UInt64 offset, UInt32 length)
+{
+    SnapshotBatchIndexPB * entry = out.index.add_batches();
+    entry->set_offset(offset);
+    entry->set_length(length);
+    entry->set_batch_type(batch.batch_type());
+    entry->set_item_count(batch.data_size());
+
+    if (batch.batch_type() != SnapshotTypePB::SNAPSHOT_TYPE_DATA && batch.batch_type() != SnapshotTypePB::SNAPSHOT_TYPE_DELETED_PATH)
+        return;
+
+    std::string_view min_key;
+    std::string_view max_key;
+    for (int i = 0; i < batch.data_size(); ++i)
+    {
+        auto path = getItemPath(batch.data(i).data());
+        if (i == 0 || path < min_key)
+            min_key = path;
+        if (i == 0 || path > max_key)
+            max_key = path;
+    }
+    entry->set_min_key(min_key.data(), min_key.size());
+    entry->set_max_key(max_key.data(), max_key.size());
+}
+
+/// Save batch into file. Since V2 batch data begins with compression codec.
+std::pair<size_t, UInt32>
+saveBatch(std::shared_ptr<SnapshotObjectWriteBuffer> & out, ptr<SnapshotBatchPB> & batch, UInt32 compression_level = 0)
 {
     if (!batch)
         batch = cs_new<SnapshotBatchPB>();
 
     std::string str_buf;
     batch->SerializeToString(&str_buf);
+    if (out->version >= SnapshotVersion::V2)
+        str_buf = compressBatchData(str_buf, compression_level);
+
+    if (out->version >= SnapshotVersion::V3)
+        addBatchIndex(*out, *batch, out->count(), str_buf.size());
 
     SnapshotBatchHeader header;
     header.data_length = str_buf.size();
@@ -145,10 +399,10 @@ UInt32 updateCheckSum(UInt32 checksum, UInt32 data_crc)
     return RK::getCRC32(reinterpret_cast<const char *>(&data), 8);
 }
 
-std::pair<size_t, UInt32>
-saveBatchAndUpdateCheckSum(std::shared_ptr<WriteBufferFromFile> & out, ptr<SnapshotBatchPB> & batch, UInt32 checksum)
+std::pair<size_t, UInt32> saveBatchAndUpdateCheckSum(
+    std::shared_ptr<SnapshotObjectWriteBuffer> & out, ptr<SnapshotBatchPB> & batch, UInt32 checksum, UInt32 compression_level)
 {
-    auto [save_size, data_crc] = saveBatch(out, batch);
+    auto [save_size, data_crc] = saveBatch(out, batch, compression_level);
     /// rebuild batch
     batch = cs_new<SnapshotBatchPB>();
     return {save_size, updateCheckSum(checksum, data_crc)};
@@ -175,14 +429,20 @@ saveBatchAndUpdateCheckSum(std::shared_ptr<WriteBufferFromFile> & out, ptr<Snaps
 //    return ret.str();
 //}
 
-void serializeAcls(ACLMap & acls, String path, UInt32 save_batch_size, SnapshotVersion version)
+void serializeAcls(
+    ACLMap & acls,
+    String path,
+    UInt32 save_batch_size,
+    SnapshotVersion version,
+    UInt32 compression_level,
+    SnapshotWriteLimiter * limiter)
 {
     Poco::Logger * log = &(Poco::Logger::get("KeeperSnapshotStore"));
 
     const auto & acl_map = acls.getMapping();
     LOG_INFO(log, "Begin create snapshot acl object, acl size {}, path {}", acl_map.size(), path);
 
-    auto out = openFileAndWriteHeader(path, version);
+    auto out = openFileAndWriteHeader(path, version, limiter);
     ptr<SnapshotBatchPB> batch;
 
     uint64_t index = 0;
@@ -197,7 +457,7 @@ void serializeAcls(ACLMap & acls, String path, UInt32 save_batch_size, SnapshotV
             if (index != 0)
             {
                 /// write data in batch to file
-                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum);
+                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum, compression_level);
                 checksum = new_checksum;
             }
             batch = cs_new<SnapshotBatchPB>();
@@ -218,7 +478,7 @@ void serializeAcls(ACLMap & acls, String path, UInt32 save_batch_size, SnapshotV
     }
 
     /// flush the last acl batch
-    auto [_, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum);
+    auto [_, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum, compression_level);
     checksum = new_checksum;
 
     writeTailAndClose(out, checksum);
@@ -239,7 +499,7 @@ void serializeAcls(ACLMap & acls, String path, UInt32 save_batch_size, SnapshotV
         return 0;
     }
 
-    auto out = cs_new<WriteBufferFromFile>(path);
+    auto out = cs_new<SnapshotObjectWriteBuffer>(path, SnapshotVersion::V0);
     uint64_t index = 0;
     for (auto & ephemeral_it : ephemerals)
     {
@@ -282,11 +542,17 @@ void serializeAcls(ACLMap & acls, String path, UInt32 save_batch_size, SnapshotV
 
 /** Serialize sessions and return the next_session_id before serialize
      */
-int64_t serializeSessions(KeeperStore & store, UInt32 save_batch_size, const SnapshotVersion version, std::string & path)
+int64_t serializeSessions(
+    KeeperStore & store,
+    UInt32 save_batch_size,
+    const SnapshotVersion version,
+    UInt32 compression_level,
+    SnapshotWriteLimiter * limiter,
+    std::string & path)
 {
     Poco::Logger * log = &(Poco::Logger::get("KeeperSnapshotStore"));
 
-    auto out = openFileAndWriteHeader(path, version);
+    auto out = openFileAndWriteHeader(path, version, limiter);
 
 
     LOG_INFO(log, "Begin create snapshot session object, session size {}, path {}", store.session_and_timeout.size(), path);
@@ -309,7 +575,7 @@ int64_t serializeSessions(KeeperStore & store, UInt32 save_batch_size, const Sna
             if (index != 0)
             {
                 /// write data in batch to file
-                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum);
+                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum, compression_level);
                 checksum = new_checksum;
             }
             batch = cs_new<SnapshotBatchPB>();
@@ -335,7 +601,7 @@ int64_t serializeSessions(KeeperStore & store, UInt32 save_batch_size, const Sna
     }
 
     /// flush the last batch
-    auto [_, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum);
+    auto [_, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum, compression_level);
     checksum = new_checksum;
     writeTailAndClose(out, checksum);
 
@@ -345,12 +611,18 @@ int64_t serializeSessions(KeeperStore & store, UInt32 save_batch_size, const Sna
 /**Save map<string, string> or map<string, uint64>
 */
 template <typename T>
-void serializeMap(T & snap_map, UInt32 save_batch_size, SnapshotVersion version, std::string & path)
+void serializeMap(
+    T & snap_map,
+    UInt32 save_batch_size,
+    SnapshotVersion version,
+    UInt32 compression_level,
+    SnapshotWriteLimiter * limiter,
+    std::string & path)
 {
     Poco::Logger * log = &(Poco::Logger::get("KeeperSnapshotStore"));
     LOG_INFO(log, "Begin create snapshot map object, map size {}, path {}", snap_map.size(), path);
 
-    auto out = openFileAndWriteHeader(path, version);
+    auto out = openFileAndWriteHeader(path, version, limiter);
     ptr<SnapshotBatchPB> batch;
 
     uint64_t index = 0;
@@ -365,7 +637,7 @@ void serializeMap(T & snap_map, UInt32 save_batch_size, SnapshotVersion version,
             if (index != 0)
             {
                 /// write data in batch to file
-                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum);
+                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum, compression_level);
                 checksum = new_checksum;
             }
 
@@ -392,7 +664,7 @@ void serializeMap(T & snap_map, UInt32 save_batch_size, SnapshotVersion version,
     }
 
     /// flush the last batch
-    auto [_, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum);
+    auto [_, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum, compression_level);
     checksum = new_checksum;
     writeTailAndClose(out, checksum);
 }
@@ -420,14 +692,14 @@ size_t KeeperSnapshotStore::getObjectIdx(const std::string & file_name)
 
 size_t KeeperSnapshotStore::serializeDataTree(KeeperStore & storage)
 {
-    std::shared_ptr<WriteBufferFromFile> out;
+    std::shared_ptr<SnapshotObjectWriteBuffer> out;
     ptr<SnapshotBatchPB> batch;
 
     uint64_t processed = 0;
     uint32_t checksum = 0;
 
     serializeNode(out, batch, storage, "/", processed, checksum);
-    auto [save_size, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum);
+    auto [save_size, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum, compression_level);
     checksum = new_checksum;
 
     writeTailAndClose(out, checksum);
@@ -437,7 +709,7 @@ size_t KeeperSnapshotStore::serializeDataTree(KeeperStore & storage)
 }
 
 void KeeperSnapshotStore::serializeNode(
-    ptr<WriteBufferFromFile> & out,
+    ptr<SnapshotObjectWriteBuffer> & out,
     ptr<SnapshotBatchPB> & batch,
     KeeperStore & store,
     const String & path,
@@ -464,7 +736,7 @@ void KeeperSnapshotStore::serializeNode(
         if (obj_id != 0)
         {
             /// flush last batch data
-            auto [save_size, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum);
+            auto [save_size, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum, compression_level);
             checksum = new_checksum;
 
             /// close current object file
@@ -477,7 +749,7 @@ void KeeperSnapshotStore::serializeNode(
         getObjectPath(obj_id + 4, new_obj_path);
 
         LOG_INFO(log, "Create new snapshot object {}, path {}", obj_id + 4, new_obj_path);
-        out = openFileAndWriteHeader(new_obj_path, version);
+        out = openFileAndWriteHeader(new_obj_path, version, write_limiter);
     }
 
     /// flush and rebuild batch
@@ -487,7 +759,7 @@ void KeeperSnapshotStore::serializeNode(
         if (processed != 0)
         {
             /// flush data in batch to file
-            auto [save_size, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum);
+            auto [save_size, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum, compression_level);
             checksum = new_checksum;
         }
         else
@@ -519,7 +791,7 @@ void KeeperSnapshotStore::appendNodeToBatch(
     SnapshotItemPB * entry = batch->add_data();
     WriteBufferFromNuraftBuffer buf;
     Coordination::write(path, buf);
-    Coordination::write(node->data, buf);
+    Coordination::write(node->getData(), buf);
     Coordination::write(node->acl_id, buf);
     Coordination::write(node->is_ephemeral, buf);
     Coordination::write(node->is_sequental, buf);
@@ -530,7 +802,103 @@ void KeeperSnapshotStore::appendNodeToBatch(
     entry->set_data(std::string(reinterpret_cast<char *>(data->data_begin()), data->size()));
 }
 
-size_t KeeperSnapshotStore::createObjects(KeeperStore & store, int64_t next_zxid, int64_t next_session_id)
+size_t KeeperSnapshotStore::serializeChangedNodes(KeeperStore & store, const ChangedPathsTracker::Paths & changed_paths)
+{
+    std::shared_ptr<SnapshotObjectWriteBuffer> out;
+    ptr<SnapshotBatchPB> batch = cs_new<SnapshotBatchPB>();
+
+    uint64_t processed = 0;
+    UInt32 checksum = 0;
+    /// for there are 3 objects before data objects
+    ulong obj_id = 4;
+
+    String obj_path;
+    getObjectPath(obj_id, obj_path);
+    out = openFileAndWriteHeader(obj_path, version, write_limiter);
+
+    std::vector<const String *> deleted_paths;
+    for (const auto & path : changed_paths)
+    {
+        auto node = store.container.get(path);
+        if (!node)
+        {
+            deleted_paths.push_back(&path);
+            continue;
+        }
+
+        std::shared_ptr<KeeperNode> node_copy;
+        {
+            std::shared_lock lock(node->mutex);
+            node_copy = node->clone();
+        }
+
+        if (processed != 0 && processed % max_object_node_size == 0)
+        {
+            auto [save_size, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum, compression_level);
+            writeTailAndClose(out, new_checksum);
+            checksum = 0;
+
+            getObjectPath(++obj_id, obj_path);
+            LOG_INFO(log, "Create new delta snapshot object {}, path {}", obj_id, obj_path);
+            out = openFileAndWriteHeader(obj_path, version, write_limiter);
+        }
+        else if (processed != 0 && processed % save_batch_size == 0)
+        {
+            auto [save_size, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum, compression_level);
+            checksum = new_checksum;
+        }
+
+        appendNodeToBatch(batch, path, node_copy);
+        processed++;
+    }
+
+    auto [save_size, new_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum, compression_level);
+    checksum = new_checksum;
+
+    /// Removed nodes are saved at the end of the last object, children before parent
+    for (size_t i = 0; i < deleted_paths.size(); ++i)
+    {
+        if (i % save_batch_size == 0)
+        {
+            if (i != 0)
+            {
+                auto [_, deleted_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum, compression_level);
+                checksum = deleted_checksum;
+            }
+            batch->set_batch_type(SnapshotTypePB::SNAPSHOT_TYPE_DELETED_PATH);
+        }
+
+        SnapshotItemPB * entry = batch->add_data();
+        WriteBufferFromNuraftBuffer buf;
+        Coordination::write(*deleted_paths[deleted_paths.size() - 1 - i], buf);
+
+        ptr<buffer> data = buf.getBuffer();
+        data->pos(0);
+        entry->set_data(std::string(reinterpret_cast<char *>(data->data_begin()), data->size()));
+    }
+    if (!deleted_paths.empty())
+    {
+        auto [_, deleted_checksum] = saveBatchAndUpdateCheckSum(out, batch, checksum, compression_level);
+        checksum = deleted_checksum;
+    }
+
+    writeTailAndClose(out, checksum);
+    LOG_INFO(
+        log,
+        "Creating delta snapshot processed changed nodes {}, removed nodes {}, current zxid {}",
+        processed,
+        deleted_paths.size(),
+        store.zxid);
+
+    return obj_id;
+}
+
+size_t KeeperSnapshotStore::createObjects(
+    KeeperStore & store,
+    int64_t next_zxid,
+    int64_t next_session_id,
+    UInt64 base_log_index_,
+    const ChangedPathsTracker::Paths * changed_paths)
 {
     if (snap_meta->size() == 0)
     {
@@ -559,22 +927,17 @@ size_t KeeperSnapshotStore::createObjects(KeeperStore & store, int64_t next_zxid
     std::this_thread::sleep_for(std::chrono::milliseconds(20));
 #endif
 
-    /// 1. Save uint map before nodes
-    IntMap int_map;
-    /// Next transaction id
-    int_map["ZXID"] = next_zxid;
-    /// Next session id
-    int_map["SESSIONID"] = next_session_id;
+    base_log_index = changed_paths ? base_log_index_ : 0;
+    if (base_log_index)
+        LOG_INFO(log, "Creating delta snapshot based on snapshot {}, changed nodes {}", base_log_index, changed_paths->size());
 
-    String map_path;
-    getObjectPath(1, map_path);
-    serializeMap(int_map, save_batch_size, version, map_path);
+    /// 1. Uint map is saved after nodes, for it contains the count of objects
 
     /// 2. Save sessions
     String session_path;
     /// object index should start from 1
     getObjectPath(2, session_path);
-    int64_t serialized_next_session_id = serializeSessions(store, save_batch_size, version, session_path);
+    int64_t serialized_next_session_id = serializeSessions(store, save_batch_size, version, compression_level, write_limiter, session_path);
     LOG_INFO(log,
              "Creating snapshot nex_session_id {}, serialized_next_session_id {}",
              toHexString(next_session_id),
@@ -584,10 +947,26 @@ size_t KeeperSnapshotStore::createObjects(KeeperStore & store, int64_t next_zxid
     String acl_path;
     /// object index should start from 1
     getObjectPath(3, acl_path);
-    serializeAcls(store.acl_map, acl_path, save_batch_size, version);
+    serializeAcls(store.acl_map, acl_path, save_batch_size, version, compression_level, write_limiter);
 
-    /// 4. Save data tree
-    size_t last_id = serializeDataTree(store);
+    /// 4. Save data tree or nodes changed after base snapshot
+    size_t last_id = base_log_index ? serializeChangedNodes(store, *changed_paths) : serializeDataTree(store);
+
+    /// 1. Save uint map
+    IntMap int_map;
+    /// Next transaction id
+    int_map["ZXID"] = next_zxid;
+    /// Next session id
+    int_map["SESSIONID"] = next_session_id;
+    int_map["OBJECT_COUNT"] = last_id;
+    if (base_log_index)
+        int_map["BASE_LOG_INDEX"] = base_log_index;
+    else
+        int_map["NODE_COUNT"] = store.container.size(); /// for reserving container when loading
+
+    String map_path;
+    getObjectPath(1, map_path);
+    serializeMap(int_map, save_batch_size, version, compression_level, write_limiter, map_path);
 
     total_obj_count = last_id;
     LOG_INFO(log, "Creating snapshot real data_object_count {}, total_obj_count {}", total_obj_count - 3, total_obj_count);
@@ -616,43 +995,202 @@ void KeeperSnapshotStore::init(std::string create_time = "")
     curr_time_t = BackendTimer::parseTime(curr_time);
 }
 
-bool KeeperSnapshotStore::loadHeader(ptr<std::fstream> fs, SnapshotBatchHeader & head)
+void readNode(ReadBuffer & in, SnapshotVersion version, String & key, KeeperNode & node, ACLMap & acl_map)
 {
-    head.reset();
-    errno = 0;
-    if (readUInt32(fs, head.data_length) != 0)
+    Coordination::read(key, in);
+    String data;
+    Coordination::read(data, in);
+    node.setData(std::move(data));
+    if (version >= SnapshotVersion::V1)
+    {
+        Coordination::read(node.acl_id, in);
+    }
+    else if (version == SnapshotVersion::V0)
+    {
+        /// Deserialize ACL
+        Coordination::ACLs acls;
+        Coordination::read(acls, in);
+        node.acl_id = acl_map.convertACLs(acls);
+    }
+
+    /// Some strange ACLID during deserialization from ZooKeeper
+    if (node.acl_id == std::numeric_limits<uint64_t>::max())
+        node.acl_id = 0;
+
+    Coordination::read(node.is_ephemeral, in);
+    Coordination::read(node.is_sequental, in);
+    Coordination::read(node.stat, in);
+}
+
+void decodeBatch(const char * body, size_t length, SnapshotVersion version, SnapshotBatchPB & batch_pb, String & decompressed)
+{
+    std::string_view batch_data(body, length);
+    if (version >= SnapshotVersion::V2)
+        batch_data = decompressBatchData(body, length, decompressed);
+    batch_pb.ParseFromArray(batch_data.data(), batch_data.size());
+}
+
+bool readObjectIndex(const char * file_data, size_t file_size, SnapshotVersion & version, SnapshotIndexPB & index)
+{
+    static constexpr size_t file_header_size = sizeof(UInt64) + sizeof(uint8_t);
+    if (file_size < file_header_size + SnapshotObjectFooter::SUFFIX_SIZE || !isFileHeader(unalignedLoad<UInt64>(file_data)))
+        return false;
+
+    version = static_cast<SnapshotVersion>(file_data[sizeof(UInt64)]);
+    if (version < SnapshotVersion::V3 || !isFileTail(unalignedLoad<UInt64>(file_data + file_size - sizeof(UInt64) - sizeof(UInt32))))
+        return false;
+
+    auto footer_offset = unalignedLoad<UInt64>(file_data + file_size - SnapshotObjectFooter::SUFFIX_SIZE);
+    if (footer_offset + sizeof(UInt64) + 2 * sizeof(UInt32) > file_size - SnapshotObjectFooter::SUFFIX_SIZE
+        || !isFileIndex(unalignedLoad<UInt64>(file_data + footer_offset)))
+        return false;
+
+    auto index_length = unalignedLoad<UInt32>(file_data + footer_offset + sizeof(UInt64));
+    auto index_crc = unalignedLoad<UInt32>(file_data + footer_offset + sizeof(UInt64) + sizeof(UInt32));
+    const char * index_data = file_data + footer_offset + sizeof(UInt64) + 2 * sizeof(UInt32);
+    if (index_data + index_length > file_data + file_size - SnapshotObjectFooter::SUFFIX_SIZE
+        || !verifyCRC32(index_data, index_length, index_crc))
+        return false;
+
+    return index.ParseFromArray(index_data, index_length);
+}
+
+bool KeeperSnapshotStore::loadObjectIndex(const String & obj_path, SnapshotIndexPB & index)
+{
+    MMapReadBufferFromFile mapped_file(obj_path, 0);
+    SnapshotVersion object_version;
+    return readObjectIndex(mapped_file.buffer().begin(), mapped_file.buffer().size(), object_version, index);
+}
+
+bool KeeperSnapshotStore::findNode(const String & path, std::shared_ptr<KeeperNode> & node)
+{
+    /// Only used to read ACLs of V0 objects
+    ACLMap acl_map;
+    SnapshotBatchPB batch_pb;
+    String decompressed;
+
+    /// Return true if the path is found in batch, node is nullptr if it is removed.
+    auto find_in_batch = [&](const SnapshotBatchPB & batch, SnapshotVersion object_version, std::shared_ptr<KeeperNode> & node)
     {
-        if (!fs->eof())
+        if (batch.batch_type() != SnapshotTypePB::SNAPSHOT_TYPE_DATA && batch.batch_type() != SnapshotTypePB::SNAPSHOT_TYPE_DELETED_PATH)
+            return false;
+
+        for (int data_idx = 0; data_idx < batch.data_size(); data_idx++)
         {
-            LOG_ERROR(log, "Cant read header data_length from snapshot file, error:{}.", strerror(errno));
+            const auto & data = batch.data(data_idx).data();
+            if (getItemPath(data) != path)
+                continue;
+
+            node = nullptr;
+            if (batch.batch_type() == SnapshotTypePB::SNAPSHOT_TYPE_DATA)
+            {
+                ReadBufferFromMemory in(data.data(), data.size());
+                String key;
+                node = cs_new<KeeperNode>();
+                readNode(in, object_version, key, *node, acl_map);
+            }
+            return true;
         }
         return false;
-    }
+    };
 
-    if (readUInt32(fs, head.data_crc) != 0)
+    /// The later object wins, for delta snapshot received from leader is stored after its base.
+    for (auto it = objects_path.rbegin(); it != objects_path.rend(); ++it)
     {
-        if (!fs->eof())
+        const auto & obj_path = it->second;
+        bool found = false;
+
+        MMapReadBufferFromFile mapped_file(obj_path, 0);
+        const char * file_data = mapped_file.buffer().begin();
+        size_t file_size = mapped_file.buffer().size();
+
+        SnapshotIndexPB index;
+        SnapshotVersion object_version;
+        if (readObjectIndex(file_data, file_size, object_version, index))
         {
-            LOG_ERROR(log, "Cant read header data_crc from snapshot file, error:{}.", strerror(errno));
+            for (const auto & entry : index.batches())
+            {
+                if (entry.batch_type() != SnapshotTypePB::SNAPSHOT_TYPE_DATA
+                    && entry.batch_type() != SnapshotTypePB::SNAPSHOT_TYPE_DELETED_PATH)
+                    continue;
+                if (path < entry.min_key() || path > entry.max_key())
+                    continue;
+
+                if (entry.offset() + SnapshotBatchHeader::HEADER_SIZE + entry.length() > file_size)
+                    throw Exception(ErrorCodes::CORRUPTED_DATA, "Batch index of snapshot {} is out of file", obj_path);
+
+                const char * body = file_data + entry.offset() + SnapshotBatchHeader::HEADER_SIZE;
+                auto data_crc = unalignedLoad<UInt32>(file_data + entry.offset() + sizeof(UInt32));
+                if (!verifyCRC32(body, entry.length(), data_crc))
+                    throw Exception(ErrorCodes::CORRUPTED_DATA, "Found corrupted data, file {}, offset {}", obj_path, entry.offset());
+
+                decodeBatch(body, entry.length(), object_version, batch_pb, decompressed);
+                if ((found = find_in_batch(batch_pb, object_version, node)))
+                    break;
+            }
         }
-        return false;
+        else
+        {
+            LOG_DEBUG(log, "Snapshot object {} has no batch index, scan it", obj_path);
+            readBatches(obj_path, [&](SnapshotBatchPB & batch, SnapshotVersion version_) {
+                if (!found)
+                    found = find_in_batch(batch, version_, node);
+            });
+        }
+
+        if (found)
+            return true;
     }
-    //LOG_INFO(log, "Offset {}, header data length {}, data crc {}", offset, head->data_length, head->data_crc);
-    return true;
+    node = nullptr;
+    return false;
 }
 
-bool KeeperSnapshotStore::parseOneObject(std::string obj_path, KeeperStore & store)
+bool KeeperSnapshotStore::scanObject(const String & obj_path, const NodeCallback & callback)
 {
-    ptr<std::fstream> snap_fs = cs_new<std::fstream>();
-    snap_fs->open(obj_path, std::ios::in | std::ios::binary);
-    if (snap_fs->fail())
+    /// Only used to read ACLs of V0 objects
+    ACLMap acl_map;
+    KeeperNode node;
+    String key;
+
+    return readBatches(obj_path, [&](SnapshotBatchPB & batch_pb, SnapshotVersion version_) {
+        if (batch_pb.batch_type() == SnapshotTypePB::SNAPSHOT_TYPE_DELETED_PATH)
+        {
+            for (int data_idx = 0; data_idx < batch_pb.data_size(); data_idx++)
+            {
+                ReadBufferFromMemory in(batch_pb.data(data_idx).data().data(), batch_pb.data(data_idx).data().size());
+                Coordination::read(key, in);
+                callback(key, nullptr);
+            }
+        }
+        else if (batch_pb.batch_type() == SnapshotTypePB::SNAPSHOT_TYPE_DATA)
+        {
+            for (int data_idx = 0; data_idx < batch_pb.data_size(); data_idx++)
+            {
+                ReadBufferFromMemory in(batch_pb.data(data_idx).data().data(), batch_pb.data(data_idx).data().size());
+                readNode(in, version_, key, node, acl_map);
+                callback(key, &node);
+            }
+        }
+    });
+}
+
+bool KeeperSnapshotStore::readBatches(const String & obj_path, const BatchCallback & callback)
+{
+    /// Batches are verified and parsed in place from the mapped file, only compressed batch is copied.
+    std::unique_ptr<MMapReadBufferFromFile> mapped_file;
+    try
     {
-        LOG_ERROR(log, "Open snapshot object {} for read failed, error:{}", obj_path, strerror(errno));
+        mapped_file = std::make_unique<MMapReadBufferFromFile>(obj_path, 0);
+    }
+    catch (Exception & e)
+    {
+        LOG_ERROR(log, "Open snapshot object {} for read failed, error:{}", obj_path, e.displayText());
         return false;
     }
-    snap_fs->seekg(0, snap_fs->end);
-    size_t file_size = snap_fs->tellg();
-    snap_fs->seekg(0, snap_fs->beg);
+    const char * file_data = mapped_file->buffer().begin();
+    size_t file_size = mapped_file->buffer().size();
+    if (file_size)
+        madvise(const_cast<char *>(file_data), file_size, MADV_SEQUENTIAL);
 
     LOG_INFO(log, "Open snapshot object {} for read,file size {}", obj_path, file_size);
 
@@ -660,119 +1198,159 @@ bool KeeperSnapshotStore::parseOneObject(std::string obj_path, KeeperStore & sto
     SnapshotBatchHeader header;
     UInt32 checksum = 0;
     SnapshotVersion version_ = SnapshotVersion::None;
-    while (!snap_fs->eof())
+    /// Reused by all batches, protobuf keeps the memory of cleared items
+    SnapshotBatchPB batch_pb;
+    String decompressed;
+    while (read_size < file_size)
     {
-        size_t cur_read_size = read_size;
-        UInt64 magic;
-        readUInt64(snap_fs, magic);
-        read_size += 8;
-        if (isFileHeader(magic))
+        UInt64 magic = 0;
+        if (read_size + sizeof(UInt64) <= file_size)
+            magic = unalignedLoad<UInt64>(file_data + read_size);
+
+        if (isFileHeader(magic) && read_size + sizeof(UInt64) + sizeof(uint8_t) <= file_size)
         {
-            char * buf = reinterpret_cast<char *>(&version_);
-            snap_fs->read(buf, sizeof(uint8_t));
-            read_size += 1;
+            version_ = static_cast<SnapshotVersion>(file_data[read_size + sizeof(UInt64)]);
+            read_size += sizeof(UInt64) + sizeof(uint8_t);
             LOG_INFO(log, "obj_path {}, read file header, version {}", obj_path, uint8_t(version_));
+            continue;
+        }
+        else if (isFileIndex(magic) && read_size + sizeof(UInt64) + 2 * sizeof(UInt32) <= file_size)
+        {
+            /// Batches are read sequentially, the index is only verified by the file checksum
+            auto index_length = unalignedLoad<UInt32>(file_data + read_size + sizeof(UInt64));
+            auto index_crc = unalignedLoad<UInt32>(file_data + read_size + sizeof(UInt64) + sizeof(UInt32));
+            checksum = updateCheckSum(checksum, index_crc);
+            read_size += sizeof(UInt64) + 2 * sizeof(UInt32) + index_length + sizeof(UInt64);
+            continue;
         }
-        else if (isFileTail(magic))
+        else if (isFileTail(magic) && read_size + sizeof(UInt64) + sizeof(UInt32) <= file_size)
         {
-            UInt32 file_checksum;
-            char * buf = reinterpret_cast<char *>(&file_checksum);
-            snap_fs->read(buf, sizeof(UInt32));
-            read_size += 4;
+            auto file_checksum = unalignedLoad<UInt32>(file_data + read_size + sizeof(UInt64));
             LOG_INFO(log, "obj_path {}, file_checksum {}, checksum {}.", obj_path, file_checksum, checksum);
             if (file_checksum != checksum)
                 throw Exception(ErrorCodes::CHECKSUM_DOESNT_MATCH, "snapshot {} checksum doesn't match", obj_path);
             break;
         }
-        else
+        else if (version_ == SnapshotVersion::None)
         {
-            if (version_ == SnapshotVersion::None)
-            {
-                version_ = SnapshotVersion::V0;
-                LOG_INFO(log, "obj_path {}, didn't read version, set to V0", obj_path);
-            }
-
-            LOG_INFO(log, "obj_path {}, didn't read the header and tail of the file", obj_path);
-            snap_fs->seekg(cur_read_size);
-            read_size = cur_read_size;
+            version_ = SnapshotVersion::V0;
+            LOG_INFO(log, "obj_path {}, didn't read the header and tail of the file, set version to V0", obj_path);
         }
-        if (!loadHeader(snap_fs, header))
-        {
+
+        if (read_size + SnapshotBatchHeader::HEADER_SIZE > file_size)
             throw Exception(ErrorCodes::CORRUPTED_DATA, "snapshot {} load header error", obj_path);
-        }
 
+        header.data_length = unalignedLoad<UInt32>(file_data + read_size);
+        header.data_crc = unalignedLoad<UInt32>(file_data + read_size + sizeof(UInt32));
+        read_size += SnapshotBatchHeader::HEADER_SIZE;
         checksum = updateCheckSum(checksum, header.data_crc);
-        char * body_buf = new char[header.data_length];
-        read_size += (SnapshotBatchHeader::HEADER_SIZE + header.data_length);
 
-        if (!snap_fs->read(body_buf, header.data_length))
+        if (read_size + header.data_length > file_size)
         {
-            LOG_ERROR(log, "Cant read snapshot object file {} size {}, only {} could be read", obj_path, header.data_length, snap_fs->gcount());
-            delete[] body_buf;
+            LOG_ERROR(
+                log,
+                "Cant read snapshot object file {} size {}, only {} could be read",
+                obj_path,
+                header.data_length,
+                file_size - read_size);
             return false;
         }
 
-        if (!verifyCRC32(body_buf, header.data_length, header.data_crc))
+        const char * body = file_data + read_size;
+        read_size += header.data_length;
+
+        if (!verifyCRC32(body, header.data_length, header.data_crc))
         {
             LOG_ERROR(log, "Found corrupted data, file {}", obj_path);
-            delete[] body_buf;
             return false;
         }
-        SnapshotBatchPB batch_pb;
-        batch_pb.ParseFromString(std::string(body_buf, header.data_length));
+
+        decodeBatch(body, header.data_length, version_, batch_pb, decompressed);
+        LOG_DEBUG(log, "Load batch size {}, end point {}", batch_pb.data_size(), read_size);
+        callback(batch_pb, version_);
+    }
+    return true;
+}
+
+void readIntMap(const SnapshotBatchPB & batch_pb, KeeperSnapshotStore::IntMap & int_map, const String & obj_path)
+{
+    Poco::Logger * log = &(Poco::Logger::get("KeeperSnapshotStore"));
+    for (int data_idx = 0; data_idx < batch_pb.data_size(); data_idx++)
+    {
+        const SnapshotItemPB & item_pb = batch_pb.data(data_idx);
+        const std::string & data = item_pb.data();
+        ReadBufferFromMemory in(data.data(), data.size());
+        std::string key;
+        int64_t value;
+        try
+        {
+            Coordination::read(key, in);
+            Coordination::read(value, in);
+        }
+        catch (Coordination::Exception & e)
+        {
+            LOG_WARNING(
+                log,
+                "Cant read uint map snapshot {}, data index {}, key {}, excepiton {}",
+                obj_path,
+                data_idx,
+                key,
+                e.displayText());
+            break;
+        }
+        int_map[key] = value;
+    }
+}
+
+bool KeeperSnapshotStore::loadIntMap(const String & obj_path, IntMap & int_map)
+{
+    return readBatches(obj_path, [&](SnapshotBatchPB & batch_pb, SnapshotVersion) {
+        if (batch_pb.batch_type() == SnapshotTypePB::SNAPSHOT_TYPE_UINTMAP)
+            readIntMap(batch_pb, int_map, obj_path);
+    });
+}
+
+bool KeeperSnapshotStore::parseOneObject(
+    const std::string & obj_path, KeeperStore & store, bool is_delta, KeeperStore::Ephemerals * ephemerals)
+{
+    return readBatches(obj_path, [&](SnapshotBatchPB & batch_pb, SnapshotVersion version_) {
         switch (batch_pb.batch_type())
         {
             case SnapshotTypePB::SNAPSHOT_TYPE_DATA: {
-                LOG_INFO(log, "Load batch size {}, end point {}", batch_pb.data_size(), read_size);
                 for (int data_idx = 0; data_idx < batch_pb.data_size(); data_idx++)
                 {
                     const SnapshotItemPB & item_pb = batch_pb.data(data_idx);
                     const std::string & data = item_pb.data();
-                    ptr<buffer> buf = buffer::alloc(data.size() + 1);
-                    //buf->put(data.data(), data.size());
-                    buf->put(data);
-                    buf->pos(0);
-                    ReadBufferFromNuraftBuffer in(buf);
+                    ReadBufferFromMemory in(data.data(), data.size());
                     ptr<KeeperNode> node = cs_new<KeeperNode>();
                     std::string key;
                     try
                     {
-                        Coordination::read(key, in);
-                        Coordination::read(node->data, in);
-                        if (version_ >= SnapshotVersion::V1)
-                        {
-                            Coordination::read(node->acl_id, in);
-                        }
-                        else if (version_ == SnapshotVersion::V0)
+                        readNode(in, version_, key, *node, store.acl_map);
+                        store.acl_map.addUsage(node->acl_id);
+                        LOG_TRACE(log, "Load snapshot read key {}, acl_id {}, node stat {}", key, node->acl_id, node->stat.toString());
+
+                        if (is_delta)
                         {
-                            /// Deserialize ACL
-                            Coordination::ACLs acls;
-                            Coordination::read(acls, in);
-                            node->acl_id = store.acl_map.convertACLs(acls);
-                            LOG_TRACE(log, "parseOneObject path {}, acl_id {}", key, node->acl_id);
+                            store.applyNodeFromDeltaSnapshot(key, std::move(node));
+                            continue;
                         }
 
-                        /// Some strange ACLID during deserialization from ZooKeeper
-                        if (node->acl_id == std::numeric_limits<uint64_t>::max())
-                            node->acl_id = 0;
-
-                        store.acl_map.addUsage(node->acl_id);
-                        LOG_TRACE(log, "parseOneObject path {}, acl_id {}", key, node->acl_id);
-
-                        Coordination::read(node->is_ephemeral, in);
-                        Coordination::read(node->is_sequental, in);
-                        Coordination::read(node->stat, in);
-                        auto ephemeral_owner = node->stat.ephemeralOwner;
-                        LOG_TRACE(log, "Load snapshot read key {}, node stat {}", key, node->stat.toString());
+                        auto ephemeral_owner = node->is_ephemeral ? node->stat.ephemeralOwner : 0;
                         store.container.emplace(key, std::move(node));
 
                         if (ephemeral_owner != 0)
                         {
-                            /// TODO LOG_INFO -> LOG_TRACE
-                            LOG_INFO(log, "Load snapshot find ephemeral node {} - {}", ephemeral_owner, key);
-                            std::lock_guard l(store.ephemerals_mutex);
-                            auto & ephemeral_nodes = store.ephemerals[ephemeral_owner];
-                            ephemeral_nodes.emplace(key);
+                            LOG_TRACE(log, "Load snapshot find ephemeral node {} - {}", ephemeral_owner, key);
+                            if (ephemerals)
+                            {
+                                (*ephemerals)[ephemeral_owner].emplace(std::move(key));
+                            }
+                            else
+                            {
+                                std::lock_guard l(store.ephemerals_mutex);
+                                store.ephemerals[ephemeral_owner].emplace(std::move(key));
+                            }
                         }
                     }
                     catch (Coordination::Exception & e)
@@ -789,6 +1367,18 @@ bool KeeperSnapshotStore::parseOneObject(std::string obj_path, KeeperStore & sto
                 }
             }
             break;
+            case SnapshotTypePB::SNAPSHOT_TYPE_DELETED_PATH: {
+                for (int data_idx = 0; data_idx < batch_pb.data_size(); data_idx++)
+                {
+                    const std::string & data = batch_pb.data(data_idx).data();
+                    ReadBufferFromMemory in(data.data(), data.size());
+                    std::string path;
+                    Coordination::read(path, in);
+                    LOG_TRACE(log, "Load delta snapshot remove node {}", path);
+                    store.removeNodeFromDeltaSnapshot(path);
+                }
+            }
+            break;
             case SnapshotTypePB::SNAPSHOT_TYPE_CONFIG:
                 break;
             case SnapshotTypePB::SNAPSHOT_TYPE_SERVER:
@@ -798,10 +1388,7 @@ bool KeeperSnapshotStore::parseOneObject(std::string obj_path, KeeperStore & sto
                 {
                     const SnapshotItemPB & item_pb = batch_pb.data(data_idx);
                     const std::string & data = item_pb.data();
-                    ptr<buffer> buf = buffer::alloc(data.size() + 1);
-                    buf->put(data);
-                    buf->pos(0);
-                    ReadBufferFromNuraftBuffer in(buf);
+                    ReadBufferFromMemory in(data.data(), data.size());
                     int64_t session_id;
                     int64_t timeout;
                     try
@@ -817,6 +1404,7 @@ bool KeeperSnapshotStore::parseOneObject(std::string obj_path, KeeperStore & sto
                                 {
                                     std::lock_guard lock(store.auth_mutex);
                                     store.session_and_auth[session_id] = ids;
+                                    store.permission_cache.invalidate(session_id);
                                 }
                             }
                         }
@@ -843,10 +1431,7 @@ bool KeeperSnapshotStore::parseOneObject(std::string obj_path, KeeperStore & sto
                     {
                         const SnapshotItemPB & item_pb = batch_pb.data(data_idx);
                         const std::string & data = item_pb.data();
-                        ptr<buffer> buf = buffer::alloc(data.size() + 1);
-                        buf->put(data);
-                        buf->pos(0);
-                        ReadBufferFromNuraftBuffer in(buf);
+                        ReadBufferFromMemory in(data.data(), data.size());
 
                         uint64_t acl_id;
                         Coordination::ACLs acls;
@@ -861,33 +1446,7 @@ bool KeeperSnapshotStore::parseOneObject(std::string obj_path, KeeperStore & sto
                 break;
             case SnapshotTypePB::SNAPSHOT_TYPE_UINTMAP: {
                 IntMap int_map;
-                for (int data_idx = 0; data_idx < batch_pb.data_size(); data_idx++)
-                {
-                    const SnapshotItemPB & item_pb = batch_pb.data(data_idx);
-                    const std::string & data = item_pb.data();
-                    ptr<buffer> buf = buffer::alloc(data.size() + 1);
-                    buf->put(data);
-                    buf->pos(0);
-                    ReadBufferFromNuraftBuffer in(buf);
-                    std::string key;
-                    int64_t value;
-                    try
-                    {
-                        Coordination::read(key, in);
-                        Coordination::read(value, in);
-                    }
-                    catch (Coordination::Exception & e)
-                    {
-                        LOG_WARNING(
-                            log,
-                            "Cant read uint map snapshot {}, data index {}, key {}, excepiton {}",
-                            obj_path,
-                            data_idx,
-                            e.displayText());
-                        break;
-                    }
-                    int_map[key] = value;
-                }
+                readIntMap(batch_pb, int_map, obj_path);
                 if (int_map.find("ZXID") != int_map.end())
                 {
                     store.zxid = int_map["ZXID"];
@@ -901,9 +1460,7 @@ bool KeeperSnapshotStore::parseOneObject(std::string obj_path, KeeperStore & sto
             default:
                 break;
         }
-        delete[] body_buf;
-    }
-    return true;
+    });
 }
 
 void KeeperSnapshotStore::parseObject(KeeperStore & store)
@@ -912,55 +1469,138 @@ void KeeperSnapshotStore::parseObject(KeeperStore & store)
     if (current_version > version)
         throw Exception(ErrorCodes::UNKNOWN_FORMAT_VERSION, "Unsupported snapshot version {}", version);
 
+    for (const auto & layer : getObjectLayers())
+    {
+        if (layer.is_delta)
+        {
+            parseDeltaObjects(layer.paths, store);
+        }
+        else
+        {
+            if (layer.node_count)
+                store.container.reserve(layer.node_count);
+            parseFullObjects(layer.paths, store);
+        }
+    }
+
+    auto node = store.container.get("/");
+    if (node != nullptr)
+    {
+        LOG_INFO(log, "Root path children count {}", node->children.size());
+    }
+    else
+    {
+        LOG_INFO(log, "Cant find root path");
+    }
+}
+
+std::vector<KeeperSnapshotStore::ObjectLayer> KeeperSnapshotStore::getObjectLayers()
+{
+    /// Each layer begins with an int map object telling its object count.
+    std::vector<ObjectLayer> layers;
+    auto it = objects_path.begin();
+    while (it != objects_path.end())
+    {
+        IntMap int_map;
+        loadIntMap(it->second, int_map);
+
+        size_t object_count = std::distance(it, objects_path.end());
+        if (int_map.contains("OBJECT_COUNT"))
+            object_count = std::min(object_count, static_cast<size_t>(int_map["OBJECT_COUNT"]));
+
+        auto & layer = layers.emplace_back();
+        layer.is_delta = int_map.contains("BASE_LOG_INDEX");
+        if (!layer.is_delta && int_map.contains("NODE_COUNT"))
+            layer.node_count = int_map["NODE_COUNT"];
+
+        for (size_t i = 0; i < object_count; ++i, ++it)
+            layer.paths.push_back(it->second);
+    }
+    return layers;
+}
+
+void KeeperSnapshotStore::parseFullObjects(const std::vector<String> & paths, KeeperStore & store)
+{
     ThreadPool object_thread_pool(SNAPSHOT_THREAD_NUM);
     for (UInt32 thread_idx = 0; thread_idx < SNAPSHOT_THREAD_NUM; thread_idx++)
     {
-        object_thread_pool.trySchedule([this, thread_idx, &store] {
+        object_thread_pool.trySchedule([this, thread_idx, &paths, &store] {
             Poco::Logger * thread_log = &(Poco::Logger::get("KeeperSnapshotStore.parseObjectThread"));
-            UInt32 obj_idx = 0;
-            for (auto it = this->objects_path.begin(); it != this->objects_path.end(); it++)
+            /// Collect ephemeral nodes without lock and merge them when the thread finishes
+            KeeperStore::Ephemerals thread_ephemerals;
+            for (UInt32 obj_idx = thread_idx; obj_idx < paths.size(); obj_idx += SNAPSHOT_THREAD_NUM)
             {
-                if (obj_idx % SNAPSHOT_THREAD_NUM == thread_idx)
+                LOG_INFO(
+                    thread_log,
+                    "Parse object, thread_idx {}, obj_index {}, path {}, obj size {}",
+                    thread_idx,
+                    obj_idx,
+                    paths[obj_idx],
+                    paths.size());
+                try
                 {
-                    LOG_INFO(
-                        thread_log,
-                        "Parse object, thread_idx {}, obj_index {}, path {}, obj size {}",
-                        thread_idx,
-                        it->first,
-                        it->second,
-                        this->objects_path.size());
-                    try
-                    {
-                        this->parseOneObject(it->second, store);
-                    }
-                    catch(Exception & e)
-                    {
-                        LOG_ERROR(log, "parseOneObject error {}, {}", it->second, getExceptionMessage(e, true));
-                    }
+                    this->parseOneObject(paths[obj_idx], store, false, &thread_ephemerals);
+                }
+                catch(Exception & e)
+                {
+                    LOG_ERROR(log, "parseOneObject error {}, {}", paths[obj_idx], getExceptionMessage(e, true));
                 }
-                obj_idx++;
             }
+
+            std::lock_guard lock(store.ephemerals_mutex);
+            for (auto & [session_id, ephemeral_paths] : thread_ephemerals)
+                store.ephemerals[session_id].merge(ephemeral_paths);
         });
     }
     object_thread_pool.wait();
 
     size_t ephemeral_nodes = 0;
-    for (auto & paths : store.ephemerals)
+    for (auto & ephemeral_paths : store.ephemerals)
     {
-        ephemeral_nodes += paths.second.size();
+        ephemeral_nodes += ephemeral_paths.second.size();
     }
     LOG_INFO(log, "Load snapshot done, ephemeral sessions {} nodes {}", store.ephemerals.size(), ephemeral_nodes);
 
     store.buildPathChildren();
+}
 
-    auto node = store.container.get("/");
-    if (node != nullptr)
+void KeeperSnapshotStore::parseDeltaObjects(const std::vector<String> & paths, KeeperStore & store)
+{
+    /// Delta snapshot contains all sessions
+    store.clearSessionsForDeltaSnapshot();
+
+    /// Objects are applied in order, parent node is always applied before its children.
+    for (const auto & path : paths)
     {
-        LOG_INFO(log, "Root path children count {}", node->children.size());
+        LOG_INFO(log, "Parse delta object, path {}, obj size {}", path, paths.size());
+        try
+        {
+            parseOneObject(path, store, /* is_delta = */ true);
+        }
+        catch (Exception & e)
+        {
+            LOG_ERROR(log, "parseOneObject error {}, {}", path, getExceptionMessage(e, true));
+        }
     }
-    else
+    LOG_INFO(log, "Load delta snapshot done, node count {}", store.container.size());
+}
+
+void KeeperSnapshotStore::loadBaseLogIndex()
+{
+    base_log_index = 0;
+    auto it = objects_path.find(1);
+    if (it == objects_path.end())
+        return;
+
+    IntMap int_map;
+    try
     {
-        LOG_INFO(log, "Cant find root path");
+        if (loadIntMap(it->second, int_map) && int_map.contains("BASE_LOG_INDEX"))
+            base_log_index = int_map["BASE_LOG_INDEX"];
+    }
+    catch (Exception & e)
+    {
+        LOG_ERROR(log, "Cant load uint map object {}, {}", it->second, getExceptionMessage(e, false));
     }
 }
 
@@ -985,9 +1625,14 @@ void KeeperSnapshotStore::loadObject(ulong obj_id, ptr<buffer> & buffer)
         return;
     }
 
-    ::lseek(snap_fd, 0, SEEK_SET);
-    size_t file_size = ::lseek(snap_fd, 0, SEEK_END);
-    ::lseek(snap_fd, 0, SEEK_SET);
+    off_t end_off = ::lseek(snap_fd, 0, SEEK_END);
+    if (end_off < 0)
+    {
+        LOG_ERROR(log, "Fail to lseek object {}, error:{}", obj_path, strerror(errno));
+        ::close(snap_fd);
+        return;
+    }
+    size_t file_size = end_off;
 
     buffer = buffer::alloc(file_size);
     size_t offset = 0;
@@ -1083,17 +1728,179 @@ void KeeperSnapshotStore::saveObject(ulong obj_id, buffer & buffer)
     LOG_INFO(log, "Save object path {}, file size {}, obj_id {}.", obj_path, buffer.size(), obj_id);
 }
 
+String KeeperSnapshotStore::getObjectFilePath(ulong obj_id) const
+{
+    auto it = objects_path.find(obj_id);
+    return it == objects_path.end() ? String{} : it->second;
+}
+
+bool KeeperSnapshotStore::readObjectChunk(const String & obj_path, ulong chunk_index, ptr<buffer> & chunk)
+{
+    Poco::Logger * log = &(Poco::Logger::get("KeeperSnapshotStore"));
+
+    std::string path = obj_path;
+    int snap_fd = openFileForRead(path);
+    if (snap_fd < 0)
+        return false;
+
+    off_t end_off = ::lseek(snap_fd, 0, SEEK_END);
+    if (end_off < 0)
+    {
+        LOG_ERROR(log, "Fail to lseek object {}, error:{}", obj_path, strerror(errno));
+        ::close(snap_fd);
+        return false;
+    }
+
+    size_t file_size = end_off;
+    size_t offset = chunk_index * SnapshotChunk::CHUNK_SIZE;
+    if (offset > file_size || (offset == file_size && chunk_index != 0))
+    {
+        LOG_ERROR(log, "Chunk {} is out of object {}, file size {}", chunk_index, obj_path, file_size);
+        ::close(snap_fd);
+        return false;
+    }
+
+    size_t length = std::min(SnapshotChunk::CHUNK_SIZE, file_size - offset);
+    chunk = buffer::alloc(SnapshotChunk::HEADER_SIZE + length);
+    char * data = reinterpret_cast<char *>(chunk->data_begin()) + SnapshotChunk::HEADER_SIZE;
+
+    /// Read directly into the chunk
+    size_t read_bytes = 0;
+    while (read_bytes < length)
+    {
+        errno = 0;
+        ssize_t ret = ::pread(snap_fd, data + read_bytes, length - read_bytes, offset + read_bytes);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+        {
+            LOG_ERROR(
+                log,
+                "Read object chunk failed, path {}, offset {}, length {}, ret {}, error:{}",
+                obj_path,
+                offset + read_bytes,
+                length - read_bytes,
+                ret,
+                strerror(errno));
+            ::close(snap_fd);
+            return false;
+        }
+        read_bytes += ret;
+    }
+    ::close(snap_fd);
+
+    UInt8 flags = offset + length >= file_size ? SnapshotChunk::LAST_CHUNK_OF_OBJECT : 0;
+    UInt32 crc = RK::getCRC32(data, length);
+    chunk->data_begin()[0] = flags;
+    memcpy(chunk->data_begin() + 1, &crc, sizeof(crc));
+    return true;
+}
+
+bool KeeperSnapshotStore::saveObjectChunk(ulong obj_id, ulong chunk_index, buffer & chunk, bool & last_chunk)
+{
+    chunk.pos(0);
+    if (chunk.size() < SnapshotChunk::HEADER_SIZE)
+    {
+        LOG_ERROR(log, "Snapshot object {} chunk {} is too small, size {}", obj_id, chunk_index, chunk.size());
+        return false;
+    }
+
+    const char * raw = reinterpret_cast<const char *>(chunk.data_begin());
+    UInt8 flags = raw[0];
+    UInt32 crc;
+    memcpy(&crc, raw + 1, sizeof(crc));
+    const char * data = raw + SnapshotChunk::HEADER_SIZE;
+    size_t length = chunk.size() - SnapshotChunk::HEADER_SIZE;
+
+    if (RK::getCRC32(data, length) != crc)
+    {
+        LOG_ERROR(log, "Checksum of snapshot object {} chunk {} doesn't match", obj_id, chunk_index);
+        return false;
+    }
+
+    if (Directory::createDir(snap_dir) != 0)
+    {
+        LOG_ERROR(log, "Fail to create snapshot directory {}", snap_dir);
+        return false;
+    }
+
+    std::string obj_path;
+    getObjectPath(obj_id, obj_path);
+
+    int snap_fd = openFileForWrite(obj_path);
+    if (snap_fd < 0)
+        return false;
+
+    /// Object may be left by an interrupted transfer
+    if (chunk_index == 0 && ::ftruncate(snap_fd, 0) != 0)
+    {
+        LOG_ERROR(log, "Truncate object failed, path {}, error:{}", obj_path, strerror(errno));
+        ::close(snap_fd);
+        return false;
+    }
+
+    size_t offset = chunk_index * SnapshotChunk::CHUNK_SIZE;
+    size_t written = 0;
+    while (written < length)
+    {
+        errno = 0;
+        ssize_t ret = ::pwrite(snap_fd, data + written, length - written, offset + written);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+        {
+            LOG_ERROR(
+                log,
+                "Write object chunk failed, path {}, offset {}, length {}, ret {}, error:{}",
+                obj_path,
+                offset + written,
+                length - written,
+                ret,
+                strerror(errno));
+            ::close(snap_fd);
+            return false;
+        }
+        written += ret;
+    }
+    ::close(snap_fd);
+
+    last_chunk = flags & SnapshotChunk::LAST_CHUNK_OF_OBJECT;
+    if (last_chunk)
+    {
+        objects_path[obj_id] = obj_path;
+        LOG_INFO(log, "Save object path {}, file size {}, obj_id {}.", obj_path, offset + length, obj_id);
+    }
+    return true;
+}
+
 void KeeperSnapshotStore::addObjectPath(ulong obj_id, std::string & path)
 {
     objects_path[obj_id] = path;
 }
 
-size_t KeeperSnapshotManager::createSnapshot(snapshot & meta, KeeperStore & storage, int64_t next_zxid, int64_t next_session_id)
+size_t KeeperSnapshotManager::createSnapshot(
+    snapshot & meta, KeeperStore & storage, int64_t next_zxid, int64_t next_session_id, const ChangedPathsTracker::PathsPtr & changed_paths)
 {
     size_t store_size = storage.container.size() + storage.ephemerals.size();
     meta.set_size(store_size);
-    ptr<KeeperSnapshotStore> snap_store = cs_new<KeeperSnapshotStore>(snap_dir, meta, object_node_size);
+
+    /// Create delta snapshot based on the last snapshot, until there are max_delta_snapshots deltas after a full snapshot.
+    UInt64 base_log_index = 0;
+    if (changed_paths && max_delta_snapshots > 0 && !snapshots.empty() && !force_full_snapshot)
+    {
+        auto last = snapshots.rbegin();
+        auto chain = getSnapshotChain(last->first);
+        if (last->first < meta.get_last_log_idx() && !chain.empty() && chain.size() <= max_delta_snapshots)
+            base_log_index = last->first;
+    }
+
+    ScopedLowIOPriority io_priority(low_io_priority);
+    write_limiter->beginSnapshot();
+
+    ptr<KeeperSnapshotStore> snap_store = cs_new<KeeperSnapshotStore>(
+        snap_dir, meta, object_node_size, KeeperSnapshotStore::SAVE_BATCH_SIZE, compression_level, with_batch_index);
     snap_store->init();
+    snap_store->setWriteLimiter(write_limiter.get());
     LOG_INFO(
         log,
         "Create snapshot last_log_term {}, last_log_idx {}, size {}, SM container size {}, SM ephemeral size {}",
@@ -1102,11 +1909,60 @@ size_t KeeperSnapshotManager::createSnapshot(snapshot & meta, KeeperStore & stor
         meta.size(),
         storage.container.size(),
         storage.ephemerals.size());
-    size_t obj_size = snap_store->createObjects(storage, next_zxid, next_session_id);
+    size_t obj_size;
+    try
+    {
+        obj_size = snap_store->createObjects(storage, next_zxid, next_session_id, base_log_index, changed_paths.get());
+    }
+    catch (...)
+    {
+        write_limiter->endSnapshot();
+        if (changed_paths)
+            LOG_WARNING(log, "Fail to create snapshot {}, {} changed paths are lost, next snapshot will be full", meta.get_last_log_idx(), changed_paths->size());
+        force_full_snapshot = true;
+        throw;
+    }
+    write_limiter->endSnapshot();
+    force_full_snapshot = false;
     snapshots[meta.get_last_log_idx()] = snap_store;
     return obj_size;
 }
 
+std::vector<ptr<KeeperSnapshotStore>> KeeperSnapshotManager::getSnapshotChain(ulong last_log_idx)
+{
+    std::vector<ptr<KeeperSnapshotStore>> chain;
+    auto it = snapshots.find(last_log_idx);
+    while (it != snapshots.end())
+    {
+        chain.push_back(it->second);
+        UInt64 base_log_index = it->second->getBaseLogIndex();
+        if (base_log_index == 0)
+        {
+            std::reverse(chain.begin(), chain.end());
+            return chain;
+        }
+        it = snapshots.find(base_log_index);
+    }
+
+    LOG_WARNING(log, "Snapshot chain of last log index {} is broken", last_log_idx);
+    return {};
+}
+
+bool KeeperSnapshotManager::resolveSnapshotObject(const snapshot & meta, ulong obj_id, ptr<KeeperSnapshotStore> & store, ulong & store_obj_id)
+{
+    store_obj_id = obj_id;
+    for (const auto & snapshot_store : getSnapshotChain(meta.get_last_log_idx()))
+    {
+        if (store_obj_id <= snapshot_store->getObjectCount())
+        {
+            store = snapshot_store;
+            return true;
+        }
+        store_obj_id -= snapshot_store->getObjectCount();
+    }
+    return false;
+}
+
 bool KeeperSnapshotManager::receiveSnapshot(snapshot & meta)
 {
     ptr<KeeperSnapshotStore> snap_store = cs_new<KeeperSnapshotStore>(snap_dir, meta, object_node_size);
@@ -1128,8 +1984,9 @@ bool KeeperSnapshotManager::existSnapshotObject(const snapshot & meta, ulong obj
         LOG_INFO(log, "Not exists snapshot last_log_idx {}", meta.get_last_log_idx());
         return false;
     }
-    ptr<KeeperSnapshotStore> store = it->second;
-    bool exist = store->existObject(obj_id);
+    ptr<KeeperSnapshotStore> store;
+    ulong store_obj_id;
+    bool exist = resolveSnapshotObject(meta, obj_id, store, store_obj_id) && store->existObject(store_obj_id);
     LOG_INFO(log, "Find object {} by last_log_idx {} and object id {}", exist, meta.get_last_log_idx(), obj_id);
     return exist;
 }
@@ -1142,8 +1999,11 @@ bool KeeperSnapshotManager::loadSnapshotObject(const snapshot & meta, ulong obj_
         LOG_WARNING(log, "Cant find snapshot, last log index {}", meta.get_last_log_idx());
         return false;
     }
-    ptr<KeeperSnapshotStore> store = it->second;
-    store->loadObject(obj_id, buffer);
+    ptr<KeeperSnapshotStore> store;
+    ulong store_obj_id;
+    if (!resolveSnapshotObject(meta, obj_id, store, store_obj_id))
+        return false;
+    store->loadObject(store_obj_id, buffer);
     return true;
 }
 
@@ -1166,6 +2026,40 @@ bool KeeperSnapshotManager::saveSnapshotObject(snapshot & meta, ulong obj_id, bu
     return true;
 }
 
+bool KeeperSnapshotManager::getSnapshotObjectPath(const snapshot & meta, ulong obj_id, String & obj_path)
+{
+    auto it = snapshots.find(meta.get_last_log_idx());
+    if (it == snapshots.end())
+    {
+        LOG_WARNING(log, "Cant find snapshot, last log index {}", meta.get_last_log_idx());
+        return false;
+    }
+    ptr<KeeperSnapshotStore> store;
+    ulong store_obj_id;
+    if (!resolveSnapshotObject(meta, obj_id, store, store_obj_id))
+        return false;
+    obj_path = store->getObjectFilePath(store_obj_id);
+    return !obj_path.empty();
+}
+
+bool KeeperSnapshotManager::saveSnapshotObjectChunk(snapshot & meta, ulong obj_id, ulong chunk_index, buffer & chunk, bool & last_chunk)
+{
+    auto it = snapshots.find(meta.get_last_log_idx());
+    ptr<KeeperSnapshotStore> store;
+    if (it == snapshots.end())
+    {
+        meta.set_size(0);
+        store = cs_new<KeeperSnapshotStore>(snap_dir, meta);
+        store->init();
+        snapshots[meta.get_last_log_idx()] = store;
+    }
+    else
+    {
+        store = it->second;
+    }
+    return store->saveObjectChunk(obj_id, chunk_index, chunk, last_chunk);
+}
+
 bool KeeperSnapshotManager::parseSnapshot(const snapshot & meta, KeeperStore & storage)
 {
     auto it = snapshots.find(meta.get_last_log_idx());
@@ -1174,8 +2068,11 @@ bool KeeperSnapshotManager::parseSnapshot(const snapshot & meta, KeeperStore & s
         LOG_WARNING(log, "Cant find snapshot, last log index {}", meta.get_last_log_idx());
         return false;
     }
-    ptr<KeeperSnapshotStore> store = it->second;
-    store->parseObject(storage);
+    auto chain = getSnapshotChain(meta.get_last_log_idx());
+    if (chain.empty())
+        return false;
+    for (const auto & store : chain)
+        store->parseObject(storage);
     LOG_INFO(
         log,
         "Finish parse snapshot, StateMachine container size {}, ephemeral size {}",
@@ -1217,6 +2114,8 @@ size_t KeeperSnapshotManager::loadSnapshotMetas()
         std::string full_path = snap_dir + "/" + file;
         snapshots[log_last_index]->addObjectPath(object_id, full_path);
     }
+    for (auto & [_, snap_store] : snapshots)
+        snap_store->loadBaseLogIndex();
     LOG_INFO(log, "Load snapshot metas {} from snapshot directory {}", snapshots.size(), snap_dir);
     return snapshots.size();
 }
@@ -1241,13 +2140,29 @@ time_t KeeperSnapshotManager::getLastCreateTime()
 size_t KeeperSnapshotManager::removeSnapshots()
 {
     Int64 remove_count = static_cast<Int64>(snapshots.size()) - static_cast<Int64>(keep_max_snapshot_count);
+    if (remove_count <= 0)
+        return snapshots.size();
+
+    /// Snapshots which the kept delta snapshots are based on can not be removed
+    std::unordered_set<ulong> needed;
+    UInt32 kept = 0;
+    for (auto it = snapshots.rbegin(); it != snapshots.rend() && kept < keep_max_snapshot_count; ++it, ++kept)
+    {
+        for (const auto & snap_store : getSnapshotChain(it->first))
+            needed.insert(snap_store->getSnapshot()->get_last_log_idx());
+        needed.insert(it->first);
+    }
+
+    std::vector<ulong> remove_log_indexes;
+    for (const auto & [log_index, _] : snapshots)
+        if (!needed.contains(log_index))
+            remove_log_indexes.push_back(log_index);
+
     char time_str[128];
     unsigned long log_last_index;
     unsigned long object_id;
-    while (remove_count > 0)
+    for (ulong remove_log_index : remove_log_indexes)
     {
-        auto it = snapshots.begin();
-        ulong remove_log_index = it->first;
         Poco::File dir_obj(snap_dir);
         if (dir_obj.exists())
         {
@@ -1266,19 +2181,15 @@ size_t KeeperSnapshotManager::removeSnapshots()
                     LOG_INFO(
                         log,
                         "remove_count {}, snapshot size {}, remove log index {}, file {}",
-                        remove_count,
+                        remove_log_indexes.size(),
                         snapshots.size(),
                         remove_log_index,
                         file);
                     Poco::File(snap_dir + "/" + file).remove();
-                    if (snapshots.find(remove_log_index) != snapshots.end())
-                    {
-                        snapshots.erase(it);
-                    }
                 }
             }
         }
-        remove_count--;
+        snapshots.erase(remove_log_index);
     }
     return snapshots.size();
 }
@@ -1,13 +1,16 @@
 #pragma once
 
+#include <functional>
 #include <map>
 #include <string>
 #include <IO/WriteBufferFromFile.h>
+#include <Service/ChangedPathsTracker.h>
 #include <Service/KeeperCommon.h>
 #include <Service/KeeperStore.h>
 #include <Service/LogEntry.h>
 #include <Service/proto/Log.pb.h>
 #include <libnuraft/nuraft.hxx>
+#include <Common/Throttler.h>
 #include <Common/ZooKeeper/IKeeper.h>
 
 
@@ -21,14 +24,24 @@ enum SnapshotVersion : uint8_t
 {
     V0 = 0,
     V1 = 1, /// with ACL map, and last_log_term for file name
+    V2 = 2, /// batch data begins with compression codec
+    V3 = 3, /// object ends with a footer indexing its batches
     None = 255,
 };
 
-static constexpr auto CURRENT_SNAPSHOT_VERSION = SnapshotVersion::V1;
+static constexpr auto CURRENT_SNAPSHOT_VERSION = SnapshotVersion::V3;
+
+/// Codec of one snapshot batch. Since V2 batch data is
+/// codec (UInt8) + [uncompressed length (UInt32) if compressed] + payload
+enum SnapshotCompressionCodec : uint8_t
+{
+    NONE = 0,
+    ZLIB = 1,
+};
 
 struct SnapshotBatchHeader
 {
-    // The length of the batch data (uncompressed)
+    // The length of the batch data as stored in file
     UInt32 data_length;
     // The CRC32C of the batch data.
     // If compression is enabled, this is the checksum of the compressed data.
@@ -41,6 +54,100 @@ struct SnapshotBatchHeader
     static const size_t HEADER_SIZE = 8;
 };
 
+/// Since V3 snapshot object ends with a footer indexing its batches, so that a batch
+/// can be located without scanning the object from the beginning.
+///
+/// Footer layout: "SnapIndx" + index length (UInt32) + index CRC32 (UInt32) + SnapshotIndexPB
+///                + offset of the footer (UInt64), followed by the file tail.
+struct SnapshotObjectFooter
+{
+    /// footer offset (UInt64) + "SnapTail" + checksum (UInt32)
+    static const size_t SUFFIX_SIZE = 20;
+};
+
+/// Limits disk writes of snapshot creation, so that the writeback of snapshot
+/// does not delay the fsync of raft log on the same disk. Written data is synced
+/// every sync_bytes to bound dirty pages in page cache.
+class SnapshotWriteLimiter
+{
+public:
+    SnapshotWriteLimiter(UInt64 max_bytes_per_second_, UInt64 sync_bytes_)
+        : max_bytes_per_second(max_bytes_per_second_), sync_bytes(sync_bytes_)
+    {
+    }
+
+    /// Reset the throttler, the speed is averaged from the beginning of a snapshot.
+    void beginSnapshot();
+    void endSnapshot();
+    /// Account bytes written, may sleep to keep the speed limit.
+    void onWrite(size_t bytes);
+    void onSync(UInt64 sync_us) { stall_us += sync_us; }
+    UInt64 getSyncBytes() const { return sync_bytes; }
+
+    UInt64 getWrittenBytes() const { return written_bytes; }
+    /// Write speed of the last snapshot
+    UInt64 getBytesPerSecond() const { return last_bytes_per_second; }
+    /// Time spent on waiting for throttler and syncing data
+    UInt64 getStallMicroseconds() const { return stall_us; }
+
+private:
+    UInt64 max_bytes_per_second;
+    UInt64 sync_bytes;
+    std::unique_ptr<Throttler> throttler;
+    Stopwatch snapshot_watch;
+    UInt64 snapshot_begin_bytes = 0;
+
+    std::atomic<UInt64> written_bytes{0};
+    std::atomic<UInt64> last_bytes_per_second{0};
+    std::atomic<UInt64> stall_us{0};
+};
+
+/// Snapshot object being written, collects the batch index since V3.
+class SnapshotObjectWriteBuffer : public WriteBufferFromFile
+{
+public:
+    SnapshotObjectWriteBuffer(const String & path, SnapshotVersion version_, SnapshotWriteLimiter * limiter_ = nullptr)
+        : WriteBufferFromFile(path), version(version_), limiter(limiter_)
+    {
+    }
+
+    SnapshotVersion version;
+    SnapshotIndexPB index;
+
+private:
+    void nextImpl() override;
+
+    SnapshotWriteLimiter * limiter;
+    /// Range of file written but not synced yet
+    size_t unsynced_begin = 0;
+    size_t unsynced_bytes = 0;
+};
+
+/// Snapshot objects are sent to followers in chunks of bounded size, so that
+/// neither side keeps a whole object in memory. NuRaft logical snapshot object
+/// id carries snapshot object id and chunk index, marked by CHUNKED_FLAG to
+/// distinguish it from the legacy transfer of whole objects.
+///
+/// Chunk layout: flags (UInt8) + CRC32 of data (UInt32) + data
+struct SnapshotChunk
+{
+    static constexpr ulong CHUNKED_FLAG = 1ul << 63;
+    static constexpr int CHUNK_INDEX_BITS = 24;
+    static constexpr ulong CHUNK_INDEX_MASK = (1ul << CHUNK_INDEX_BITS) - 1;
+
+    static constexpr size_t CHUNK_SIZE = 1 << 20; /// 1MB
+    static constexpr size_t HEADER_SIZE = 5;
+    static constexpr UInt8 LAST_CHUNK_OF_OBJECT = 1;
+
+    /// Leader puts it into the first dummy object to tell follower that chunks are supported.
+    static constexpr Int32 TRANSFER_VERSION = 1;
+
+    static bool isChunked(ulong id) { return id & CHUNKED_FLAG; }
+    static ulong makeId(ulong object_id, ulong chunk_index) { return CHUNKED_FLAG | (object_id << CHUNK_INDEX_BITS) | chunk_index; }
+    static ulong objectId(ulong id) { return (id & ~CHUNKED_FLAG) >> CHUNK_INDEX_BITS; }
+    static ulong chunkIndex(ulong id) { return id & CHUNK_INDEX_MASK; }
+};
+
 //Snapshot stored in disk, one snapshot object corresponds one file
 //SnapshotHeader + (SnapshotBatchHeader+LogEntryBody)[...]
 class KeeperSnapshotStore
@@ -50,12 +157,19 @@ public:
         const std::string & snap_dir_,
         snapshot & meta,
         UInt32 max_object_node_size_ = MAX_OBJECT_NODE_SIZE,
-        UInt32 save_batch_size_ = SAVE_BATCH_SIZE)
+        UInt32 save_batch_size_ = SAVE_BATCH_SIZE,
+        UInt32 compression_level_ = 0,
+        bool with_batch_index = false)
         : snap_dir(snap_dir_)
         , max_object_node_size(max_object_node_size_)
         , save_batch_size(save_batch_size_)
+        , compression_level(compression_level_)
         , log(&(Poco::Logger::get("KeeperSnapshotStore")))
     {
+        /// Keep writing objects in the oldest version having the features enabled,
+        /// so that they can be loaded by older versions.
+        if (!with_batch_index)
+            version = compression_level == 0 ? SnapshotVersion::V1 : SnapshotVersion::V2;
         //snap_header.entry_size = meta.size();
         last_log_index = meta.get_last_log_idx();
         last_log_term = meta.get_last_log_term();
@@ -72,16 +186,65 @@ public:
     /** Create snapshot object, return the size of objects
      *
      * @param next_zxid zxid corresponding to snapshot begin log id
+     * @param base_log_index_ last log index of the snapshot which delta snapshot is based on
+     * @param changed_paths nodes changed after base snapshot, create full snapshot if it is nullptr
      */
-    size_t createObjects(KeeperStore & store, int64_t next_zxid = 0, int64_t next_session_id = 0);
+    size_t createObjects(
+        KeeperStore & store,
+        int64_t next_zxid = 0,
+        int64_t next_session_id = 0,
+        UInt64 base_log_index_ = 0,
+        const ChangedPathsTracker::Paths * changed_paths = nullptr);
     // init snapshot store for receive snapshot object
     void init(std::string create_time);
+    /// Load snapshot into store. Delta snapshot should be parsed after the snapshot it is based on.
     void parseObject(KeeperStore & store);
 
+    /// Last log index of the snapshot which this delta snapshot is based on, 0 for full snapshot.
+    UInt64 getBaseLogIndex() const { return base_log_index; }
+    /// Read base log index from the uint map object of the snapshot on disk.
+    void loadBaseLogIndex();
+    size_t getObjectCount() const { return objects_path.size(); }
+
+    void setWriteLimiter(SnapshotWriteLimiter * write_limiter_) { write_limiter = write_limiter_; }
+
+    /// Load batch index of snapshot object, return false if it has no index (before V3).
+    bool loadObjectIndex(const String & obj_path, SnapshotIndexPB & index);
+
+    /// Find node in the snapshot without loading it, batches are located by index if objects have it.
+    /// Return false if the path is not in the snapshot, node is nullptr if it is removed by delta snapshot.
+    bool findNode(const String & path, std::shared_ptr<KeeperNode> & node);
+
+    /// node is nullptr for the path removed by delta snapshot
+    using NodeCallback = std::function<void(const String & path, const KeeperNode * node)>;
+    /// Read nodes of object one by one without loading them into store, used by offline tools.
+    /// Batches and the object checksum are verified, return false or throw if the object is corrupted.
+    bool scanObject(const String & obj_path, const NodeCallback & callback);
+
+    const std::map<ulong, std::string> & getObjectPaths() const { return objects_path; }
+
+    struct ObjectLayer
+    {
+        std::vector<String> paths;
+        bool is_delta = false;
+        /// Nodes of full snapshot, 0 if unknown
+        size_t node_count = 0;
+    };
+    /// Snapshot received from leader may be a full snapshot followed by delta snapshots, split its
+    /// objects into them. A path is in at most one object of a layer, layers must be applied in order.
+    std::vector<ObjectLayer> getObjectLayers();
+
     void loadObject(ulong obj_id, ptr<buffer> & buffer);
     bool existObject(ulong obj_id);
     void saveObject(ulong obj_id, buffer & buffer);
 
+    /// Path of object file, empty if object does not exist.
+    String getObjectFilePath(ulong obj_id) const;
+    /// Read one chunk of object file. Does not touch the store, so it can be invoked without snapshot lock.
+    static bool readObjectChunk(const String & obj_path, ulong chunk_index, ptr<buffer> & chunk);
+    /// Verify and write one chunk of object, the object is registered when its last chunk is written.
+    bool saveObjectChunk(ulong obj_id, ulong chunk_index, buffer & chunk, bool & last_chunk);
+
     void addObjectPath(ulong obj_id, std::string & path);
 
     ptr<snapshot> getSnapshot() { return snap_meta; }
@@ -120,10 +283,23 @@ public:
 
 private:
     void getObjectPath(ulong object_id, std::string & path);
-    bool parseOneObject(std::string obj_path, KeeperStore & store);
-    bool loadHeader(ptr<std::fstream> fs, SnapshotBatchHeader & head);
+
+    using BatchCallback = std::function<void(SnapshotBatchPB & batch, SnapshotVersion version)>;
+    /// Read and verify batches of object one by one.
+    bool readBatches(const String & obj_path, const BatchCallback & callback);
+    bool loadIntMap(const String & obj_path, IntMap & int_map);
+    /// Parse object into store. If ephemerals is not nullptr, ephemeral nodes are collected into it
+    /// instead of store.ephemerals, so that threads parsing objects don't contend for the lock.
+    bool parseOneObject(
+        const std::string & obj_path, KeeperStore & store, bool is_delta = false, KeeperStore::Ephemerals * ephemerals = nullptr);
+    /// Parse objects of full snapshot concurrently.
+    void parseFullObjects(const std::vector<String> & paths, KeeperStore & store);
+    /// Apply objects of delta snapshot one by one.
+    void parseDeltaObjects(const std::vector<String> & paths, KeeperStore & store);
 
     size_t serializeDataTree(KeeperStore & storage);
+    /// Serialize changed nodes in path order and removed nodes in reverse order, return the last object id.
+    size_t serializeChangedNodes(KeeperStore & store, const ChangedPathsTracker::Paths & changed_paths);
     /**
      * Serialize data tree by deep traversal.
      * @param out destination
@@ -133,7 +309,7 @@ private:
      * @param processed nodes processed
      */
     void serializeNode(
-        ptr<WriteBufferFromFile> & out,
+        ptr<SnapshotObjectWriteBuffer> & out,
         ptr<SnapshotBatchPB> & batch,
         KeeperStore & store,
         const String & path,
@@ -146,11 +322,16 @@ private:
     std::string snap_dir;
     UInt32 max_object_node_size;
     UInt32 save_batch_size;
+    UInt32 compression_level;
     Poco::Logger * log;
     //SnapshotHeader snap_header;
     ptr<snapshot> snap_meta;
     UInt64 last_log_index;
     UInt64 last_log_term;
+    UInt64 base_log_index = 0;
+
+    /// Not owned, nullptr means unlimited
+    SnapshotWriteLimiter * write_limiter = nullptr;
     std::map<ulong, std::string> objects_path;
     std::string curr_time;
     time_t curr_time_t;
@@ -163,27 +344,65 @@ using KeeperSnapshotStoreMap = std::map<uint64_t, ptr<KeeperSnapshotStore>>;
 class KeeperSnapshotManager
 {
 public:
-    KeeperSnapshotManager(const std::string & snap_dir_, UInt32 keep_max_snapshot_count_, UInt32 object_node_size_)
+    KeeperSnapshotManager(
+        const std::string & snap_dir_,
+        UInt32 keep_max_snapshot_count_,
+        UInt32 object_node_size_,
+        UInt32 compression_level_ = 0,
+        UInt32 max_delta_snapshots_ = 0,
+        bool with_batch_index_ = false)
         : snap_dir(snap_dir_)
         , keep_max_snapshot_count(keep_max_snapshot_count_)
         , object_node_size(object_node_size_)
+        , compression_level(compression_level_)
+        , max_delta_snapshots(max_delta_snapshots_)
+        , with_batch_index(with_batch_index_)
+        , write_limiter(std::make_unique<SnapshotWriteLimiter>(0, 0))
         , log(&(Poco::Logger::get("KeeperSnapshotManager")))
     {
     }
     ~KeeperSnapshotManager() { }
-    size_t createSnapshot(snapshot & meta, KeeperStore & storage, int64_t next_zxid = 0, int64_t next_session_id = 0);
+    /// Create delta snapshot if changed_paths is not nullptr and there are less than max_delta_snapshots
+    /// deltas after the last full snapshot, otherwise create full snapshot. If creating fails, changed
+    /// paths fetched for it are lost, so the next snapshot is a full one.
+    size_t createSnapshot(
+        snapshot & meta,
+        KeeperStore & storage,
+        int64_t next_zxid = 0,
+        int64_t next_session_id = 0,
+        const ChangedPathsTracker::PathsPtr & changed_paths = nullptr);
     bool receiveSnapshot(snapshot & meta);
     bool existSnapshot(const snapshot & meta);
     bool existSnapshotObject(const snapshot & meta, ulong obj_id);
     bool loadSnapshotObject(const snapshot & meta, ulong obj_id, ptr<buffer> & buffer);
     bool saveSnapshotObject(snapshot & meta, ulong obj_id, buffer & buffer);
+    bool getSnapshotObjectPath(const snapshot & meta, ulong obj_id, String & obj_path);
+    bool saveSnapshotObjectChunk(snapshot & meta, ulong obj_id, ulong chunk_index, buffer & chunk, bool & last_chunk);
     bool parseSnapshot(const snapshot & meta, KeeperStore & storage);
     ptr<snapshot> lastSnapshot();
     time_t getLastCreateTime();
     size_t loadSnapshotMetas();
     size_t removeSnapshots();
-    
+
+    /// Limit the speed of writing snapshot, sync written data every sync_bytes, 0 means unlimited.
+    void setWriteLimit(UInt64 max_bytes_per_second, UInt64 sync_bytes, bool low_io_priority_)
+    {
+        write_limiter = std::make_unique<SnapshotWriteLimiter>(max_bytes_per_second, sync_bytes);
+        low_io_priority = low_io_priority_;
+    }
+    const SnapshotWriteLimiter & getWriteLimiter() const { return *write_limiter; }
+
+    /// Snapshots needed to load the snapshot, beginning with a full snapshot. Empty if any of them is missing.
+    std::vector<ptr<KeeperSnapshotStore>> getSnapshotChain(ulong last_log_idx);
+
+    /// Snapshots loaded by loadSnapshotMetas or created, by last log index
+    const KeeperSnapshotStoreMap & getSnapshots() const { return snapshots; }
+
 private:
+    /// Delta snapshot is sent to followers as the objects of its chain one after another,
+    /// translate object id of the transfer to snapshot store and its object id.
+    bool resolveSnapshotObject(const snapshot & meta, ulong obj_id, ptr<KeeperSnapshotStore> & store, ulong & store_obj_id);
+
     std::string snap_dir;
 #ifdef __clang__
     [[maybe_unused]] UInt32 keep_max_snapshot_count;
@@ -193,6 +412,14 @@ private:
     std::atomic<uint64_t> last_committed_idx;
 #endif
     UInt32 object_node_size;
+    UInt32 compression_level;
+    UInt32 max_delta_snapshots;
+    bool with_batch_index;
+    /// Set when creating a snapshot failed
+    bool force_full_snapshot = false;
+
+    std::unique_ptr<SnapshotWriteLimiter> write_limiter;
+    bool low_io_priority = false;
 
     Poco::Logger * log;
     //std::mutex snap_mutex;
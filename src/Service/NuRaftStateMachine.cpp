@@ -12,6 +12,7 @@
 #include <Service/WriteBufferFromNuraftBuffer.h>
 #include <Service/proto/Log.pb.h>
 #include <Poco/File.h>
+#include <Common/Exception.h>
 #include <Common/Stopwatch.h>
 #include <Common/ZooKeeper/ZooKeeperIO.h>
 
@@ -83,7 +84,21 @@ NuRaftStateMachine::NuRaftStateMachine(
     ulong prev_last_committed_idx = 0;
     task_manager->getLastCommitted(prev_last_committed_idx);
 
-    snap_mgr = cs_new<KeeperSnapshotManager>(snapshot_dir, keep_max_snapshot_count, object_node_size);
+    snap_mgr = cs_new<KeeperSnapshotManager>(
+        snapshot_dir,
+        keep_max_snapshot_count,
+        object_node_size,
+        raft_settings->snapshot_compression_level,
+        raft_settings->max_delta_snapshots,
+        raft_settings->snapshot_with_batch_index);
+    snap_mgr->setWriteLimit(
+        raft_settings->snapshot_write_max_bytes_per_second,
+        raft_settings->snapshot_write_sync_bytes,
+        raft_settings->snapshot_write_low_io_priority);
+    if (raft_settings->max_delta_snapshots)
+        store.changed_paths.enable();
+    if (raft_settings->snapshot_transfer_max_bytes_per_second)
+        snapshot_transfer_throttler = std::make_shared<Throttler>(raft_settings->snapshot_transfer_max_bytes_per_second);
     //load snapshot meta from disk
     size_t meta_size = snap_mgr->loadSnapshotMetas();
     //get last snapshot
@@ -368,9 +383,18 @@ void NuRaftStateMachine::snapThread()
                 snap_task->s->get_last_log_term(),
                 snap_task->s->get_last_log_idx());
 
-            create_snapshot(*snap_task->s, snap_task->next_zxid, snap_task->next_session_id);
             ptr<std::exception> except(nullptr);
             bool ret = true;
+            try
+            {
+                create_snapshot(*snap_task->s, snap_task->next_zxid, snap_task->next_session_id, snap_task->changed_paths);
+            }
+            catch (...)
+            {
+                tryLogCurrentException(log, "Fail to create snapshot");
+                except = cs_new<std::runtime_error>(getCurrentExceptionMessage(false));
+                ret = false;
+            }
 
             snap_task->when_done(ret, except);
             snap_task = nullptr;
@@ -413,7 +437,7 @@ KeeperStore::RequestForSession NuRaftStateMachine::parseRequest(nuraft::buffer &
         request_for_session.create_time
             = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 
-    auto * log = &(Poco::Logger::get("NuRaftStateMachine"));
+    static auto * log = &(Poco::Logger::get("NuRaftStateMachine"));
     LOG_TRACE(
         log,
         "Parsed request session id {}, length {}, xid {}, opnum {}",
@@ -585,6 +609,16 @@ std::vector<int64_t> NuRaftStateMachine::getDeadSessions()
     return store.getDeadSessions();
 }
 
+std::vector<String> NuRaftStateMachine::getExpiredTTLNodes(int64_t now, size_t max_count)
+{
+    return store.getExpiredTTLNodes(now, max_count);
+}
+
+std::vector<String> NuRaftStateMachine::getEmptyContainers(size_t max_count)
+{
+    return store.getEmptyContainers(max_count);
+}
+
 int64_t NuRaftStateMachine::getLastProcessedZxid() const
 {
     return store.zxid.load();
@@ -615,6 +649,16 @@ uint64_t NuRaftStateMachine::getTotalEphemeralNodesCount() const
     return store.getTotalEphemeralNodesCount();
 }
 
+uint64_t NuRaftStateMachine::getTTLNodesCount() const
+{
+    return store.getTTLNodesCount();
+}
+
+uint64_t NuRaftStateMachine::getEmptyContainersCount() const
+{
+    return store.getEmptyContainersCount();
+}
+
 uint64_t NuRaftStateMachine::getSessionWithEphemeralNodesCount() const
 {
     return store.getSessionWithEphemeralNodesCount();
@@ -635,11 +679,21 @@ void NuRaftStateMachine::dumpSessionsAndEphemerals(WriteBufferFromOwnString & bu
     store.dumpSessionsAndEphemerals(buf);
 }
 
+void NuRaftStateMachine::dumpHeaviestSubtrees(WriteBufferFromOwnString & buf, size_t top_n) const
+{
+    store.dumpHeaviestSubtrees(buf, top_n);
+}
+
 uint64_t NuRaftStateMachine::getApproximateDataSize() const
 {
     return store.getApproximateDataSize();
 }
 
+std::vector<KeeperStore::QuotaUsage> NuRaftStateMachine::getQuotaUsages() const
+{
+    return store.getQuotaUsages();
+}
+
 bool NuRaftStateMachine::containsSession(int64_t session_id) const
 {
     return store.containsSession(session_id);
@@ -703,9 +757,18 @@ void NuRaftStateMachine::create_snapshot(snapshot & s, async_result<bool>::handl
 
         LOG_WARNING(log, "Create snapshot last_log_term {}, last_log_idx {}", s.get_last_log_term(), s.get_last_log_idx());
 
-        create_snapshot(s, store.zxid, store.session_id_counter);
         ptr<std::exception> except(nullptr);
         bool ret = true;
+        try
+        {
+            create_snapshot(s, store.zxid, store.session_id_counter, store.changed_paths.fetch());
+        }
+        catch (...)
+        {
+            tryLogCurrentException(log, "Fail to create snapshot");
+            except = cs_new<std::runtime_error>(getCurrentExceptionMessage(false));
+            ret = false;
+        }
         when_done(ret, except);
 
         stopwatch.stop();
@@ -724,16 +787,17 @@ void NuRaftStateMachine::create_snapshot(snapshot & s, async_result<bool>::handl
         auto t2 = Poco::Timestamp().epochMicroseconds();
         auto snap_copy = snapshot::deserialize(*snp_buf);
         auto t3 = Poco::Timestamp().epochMicroseconds();
-        snap_task = std::make_shared<SnapTask>(snap_copy, store.zxid, store.session_id_counter, when_done);
+        snap_task = std::make_shared<SnapTask>(snap_copy, store.zxid, store.session_id_counter, store.changed_paths.fetch(), when_done);
         auto t4 = Poco::Timestamp().epochMicroseconds();
         LOG_INFO(log, "Async create snapshot time cost {}us, {}us, {}us", (t2 - t1), (t3 - t2), (t4 - t3));
     }
 }
 
-void NuRaftStateMachine::create_snapshot(snapshot & s, int64_t next_zxid, int64_t next_session_id)
+void NuRaftStateMachine::create_snapshot(
+    snapshot & s, int64_t next_zxid, int64_t next_session_id, const ChangedPathsTracker::PathsPtr & changed_paths)
 {
     std::lock_guard<std::mutex> lock(snapshot_mutex);
-    snap_mgr->createSnapshot(s, store, next_zxid, next_session_id);
+    snap_mgr->createSnapshot(s, store, next_zxid, next_session_id, changed_paths);
     snap_mgr->removeSnapshots();
 }
 
@@ -762,6 +826,9 @@ int NuRaftStateMachine::read_snapshot_data(snapshot & s, const ulong offset, buf
 
 int NuRaftStateMachine::read_logical_snp_obj(snapshot & s, void *& user_snp_ctx, ulong obj_id, ptr<buffer> & data_out, bool & is_last_obj)
 {
+    if (SnapshotChunk::isChunked(obj_id))
+        return readSnapshotChunk(s, obj_id, data_out, is_last_obj);
+
     std::lock_guard<std::mutex> lock(snapshot_mutex);
     // Snapshot doesn't exist.
     if (!snap_mgr->existSnapshot(s))
@@ -775,10 +842,10 @@ int NuRaftStateMachine::read_logical_snp_obj(snapshot & s, void *& user_snp_ctx,
 
     if (obj_id == 0)
     {
-        // Object ID == 0: first object
+        // Object ID == 0: first object, tell follower that we can send objects in chunks
         data_out = buffer::alloc(sizeof(UInt32));
         buffer_serializer bs(data_out);
-        bs.put_i32(0);
+        bs.put_i32(SnapshotChunk::TRANSFER_VERSION);
         is_last_obj = false;
         LOG_INFO(log, "Read snapshot object, last_log_idx {}, object id {}, is_last {}", s.get_last_log_idx(), obj_id, false);
         return 0;
@@ -796,14 +863,110 @@ int NuRaftStateMachine::read_logical_snp_obj(snapshot & s, void *& user_snp_ctx,
     return 0;
 }
 
+int NuRaftStateMachine::readSnapshotChunk(snapshot & s, ulong obj_id, ptr<buffer> & data_out, bool & is_last_obj)
+{
+    ulong object_id = SnapshotChunk::objectId(obj_id);
+    ulong chunk_index = SnapshotChunk::chunkIndex(obj_id);
+
+    String obj_path;
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        if (!snap_mgr->getSnapshotObjectPath(s, object_id, obj_path))
+        {
+            LOG_WARNING(log, "Cant find snapshot object, last_log_idx {}, object id {}", s.get_last_log_idx(), object_id);
+            return -1;
+        }
+    }
+
+    /// Do IO without snapshot_mutex, the opened file stays readable even if the snapshot is removed meanwhile.
+    if (!KeeperSnapshotStore::readObjectChunk(obj_path, chunk_index, data_out))
+        return -1;
+
+    if (snapshot_transfer_throttler)
+        snapshot_transfer_throttler->add(data_out->size());
+
+    is_last_obj = false;
+    if (data_out->data_begin()[0] & SnapshotChunk::LAST_CHUNK_OF_OBJECT)
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        is_last_obj = !snap_mgr->existSnapshotObject(s, object_id + 1);
+    }
+
+    LOG_DEBUG(
+        log,
+        "Read snapshot object chunk, last_log_idx {}, object id {}, chunk {}, size {}, is_last {}",
+        s.get_last_log_idx(),
+        object_id,
+        chunk_index,
+        data_out->size(),
+        is_last_obj);
+    return 0;
+}
+
 void NuRaftStateMachine::save_logical_snp_obj(snapshot & s, ulong & obj_id, buffer & data, bool is_first_obj, bool is_last_obj)
 {
     if (obj_id == 0)
     {
         // Object ID == 0: it contains dummy value, create snapshot context.
         snap_mgr->receiveSnapshot(s);
+
+        /// Old leader puts 0, and can only send whole objects
+        Int32 transfer_version = 0;
+        if (data.size() >= sizeof(Int32))
+        {
+            data.pos(0);
+            buffer_serializer bs(data);
+            transfer_version = bs.get_i32();
+        }
+        LOG_INFO(log, "Save logical snapshot, object id 0, transfer version {}", transfer_version);
+
+        obj_id = transfer_version >= SnapshotChunk::TRANSFER_VERSION ? SnapshotChunk::makeId(1, 0) : 1;
+        return;
     }
-    else
+
+    if (SnapshotChunk::isChunked(obj_id))
+    {
+        ulong object_id = SnapshotChunk::objectId(obj_id);
+        ulong chunk_index = SnapshotChunk::chunkIndex(obj_id);
+        bool last_chunk = false;
+        bool saved;
+        {
+            std::lock_guard<std::mutex> lock(snapshot_mutex);
+            saved = snap_mgr->saveSnapshotObjectChunk(s, object_id, chunk_index, data, last_chunk);
+        }
+
+        if (!saved)
+        {
+            /// Keep obj_id, so the leader sends the same chunk again. No backoff here, NuRaft calls
+            /// it holding the raft server lock, and a sleep would block appends, heartbeats and votes.
+            chunk_save_failures = failed_chunk_id == obj_id ? chunk_save_failures + 1 : 1;
+            failed_chunk_id = obj_id;
+
+            if (chunk_save_failures >= MAX_CHUNK_SAVE_FAILURES)
+            {
+                /// A persistent failure such as full disk, start the transfer again from the dummy object.
+                LOG_ERROR(
+                    log,
+                    "Failed to save snapshot object {} chunk {} {} times in a row, abort the transfer and start it again",
+                    object_id,
+                    chunk_index,
+                    chunk_save_failures);
+                chunk_save_failures = 0;
+                failed_chunk_id = 0;
+                obj_id = 0;
+                return;
+            }
+
+            LOG_WARNING(log, "Failed to save snapshot object {} chunk {}, will request it again", object_id, chunk_index);
+            return;
+        }
+        chunk_save_failures = 0;
+
+        LOG_DEBUG(log, "Save logical snapshot, object id {}, chunk {}, is_last_obj {}", object_id, chunk_index, is_last_obj);
+        obj_id = last_chunk ? SnapshotChunk::makeId(object_id + 1, 0) : SnapshotChunk::makeId(object_id, chunk_index + 1);
+        return;
+    }
+
     {
         std::lock_guard<std::mutex> lock(snapshot_mutex);
         // Object ID > 0: actual snapshot value, save to local disk
@@ -816,6 +979,8 @@ void NuRaftStateMachine::save_logical_snp_obj(snapshot & s, ulong & obj_id, buff
 
 bool NuRaftStateMachine::exist_snapshot_object(snapshot & s, ulong obj_id)
 {
+    if (SnapshotChunk::isChunked(obj_id))
+        obj_id = SnapshotChunk::objectId(obj_id);
     return snap_mgr->existSnapshotObject(s, obj_id);
 }
 
@@ -824,6 +989,8 @@ bool NuRaftStateMachine::apply_snapshot(snapshot & s)
     //TODO: double buffer load or multi thread load
     LOG_INFO(log, "apply snapshot term {}, last log index {}, size {}", s.get_last_log_term(), s.get_last_log_idx(), s.size());
     std::lock_guard<std::mutex> lock(snapshot_mutex);
+    /// Changes before the snapshot are all in it
+    store.changed_paths.clear();
     return snap_mgr->parseSnapshot(s, store);
 }
 
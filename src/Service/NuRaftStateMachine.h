@@ -12,6 +12,7 @@
 #include <Service/Settings.h>
 #include <Service/ThreadSafeQueue.h>
 #include <libnuraft/nuraft.hxx>
+#include <Common/Throttler.h>
 #include <common/types.h>
 
 
@@ -21,7 +22,7 @@ using nuraft::async_result;
 using nuraft::buffer;
 using nuraft::cs_new;
 
-using KeeperResponsesQueue = ThreadSafeQueue<KeeperStore::ResponseForSession>;
+using KeeperResponsesQueue = KeeperStore::KeeperResponsesQueue;
 
 class RequestProcessor;
 
@@ -59,7 +60,8 @@ public:
     bool chk_create_snapshot(time_t curr_time);
     void create_snapshot(snapshot & s, async_result<bool>::handler_type & when_done) override;
     //sync create snapshot
-    void create_snapshot(snapshot & s, int64_t next_zxid = 0, int64_t next_session_id = 0);
+    void create_snapshot(
+        snapshot & s, int64_t next_zxid = 0, int64_t next_session_id = 0, const ChangedPathsTracker::PathsPtr & changed_paths = nullptr);
 
     //raw_binary(deprecated)
     int read_snapshot_data(snapshot & s, const ulong offset, buffer & data) override;
@@ -67,7 +69,10 @@ public:
 
     // logical_object
     int read_logical_snp_obj(snapshot & s, void *& user_snp_ctx, ulong obj_id, ptr<buffer> & data_out, bool & is_last_obj) override;
+    /// A chunk which failed to save is requested again, after MAX_CHUNK_SAVE_FAILURES
+    /// failures in a row the transfer is started again from object 0.
     void save_logical_snp_obj(snapshot & s, ulong & obj_id, buffer & data, bool is_first_obj, bool is_last_obj) override;
+    static constexpr size_t MAX_CHUNK_SAVE_FAILURES = 10;
     bool exist_snapshot_object(snapshot & s, ulong obj_id);
 
     bool apply_snapshot(snapshot & s) override;
@@ -95,6 +100,8 @@ public:
     void processReadRequest(const KeeperStore::RequestForSession & request_for_session);
 
     std::vector<int64_t> getDeadSessions();
+    std::vector<String> getExpiredTTLNodes(int64_t now, size_t max_count);
+    std::vector<String> getEmptyContainers(size_t max_count);
 
     /// Introspection functions for 4lw commands
     int64_t getLastProcessedZxid() const;
@@ -107,10 +114,14 @@ public:
     void dumpWatches(WriteBufferFromOwnString & buf) const;
     void dumpWatchesByPath(WriteBufferFromOwnString & buf) const;
     void dumpSessionsAndEphemerals(WriteBufferFromOwnString & buf) const;
+    void dumpHeaviestSubtrees(WriteBufferFromOwnString & buf, size_t top_n) const;
 
     uint64_t getSessionWithEphemeralNodesCount() const;
     uint64_t getTotalEphemeralNodesCount() const;
+    uint64_t getTTLNodesCount() const;
+    uint64_t getEmptyContainersCount() const;
     uint64_t getApproximateDataSize() const;
+    std::vector<KeeperStore::QuotaUsage> getQuotaUsages() const;
     bool containsSession(int64_t session_id) const;
 
     uint64_t getSnapshotCount() const
@@ -128,6 +139,11 @@ public:
         return in_snapshot;
     }
 
+    const SnapshotWriteLimiter & getSnapshotWriteLimiter() const
+    {
+        return snap_mgr->getWriteLimiter();
+    }
+
     void shutdown();
 
     static KeeperStore::RequestForSession parseRequest(nuraft::buffer & data);
@@ -137,6 +153,9 @@ private:
     ptr<KeeperStore::RequestForSession> createRequestSession(ptr<log_entry> & entry);
     void snapThread();
 
+    /// Read one chunk of snapshot object for sending to follower, see SnapshotChunk.
+    int readSnapshotChunk(snapshot & s, ulong obj_id, ptr<buffer> & data_out, bool & is_last_obj);
+
     /// Only contains session_id
     static bool isNewSessionRequest(nuraft::buffer & data);
     /// Contains session_id and timeout
@@ -160,6 +179,11 @@ private:
     std::string snapshot_dir;
     BackendTimer timer;
     ptr<KeeperSnapshotManager> snap_mgr;
+    /// Limit speed of sending snapshot to followers, nullptr if unlimited
+    std::shared_ptr<Throttler> snapshot_transfer_throttler;
+    /// Consecutive failures to save the same received snapshot chunk
+    ulong failed_chunk_id = 0;
+    size_t chunk_save_failures = 0;
     KeeperNode default_node;
 
     std::atomic_int64_t snap_count{0};
@@ -173,9 +197,15 @@ private:
         ptr<snapshot> s;
         int64_t next_zxid;
         int64_t next_session_id;
+        ChangedPathsTracker::PathsPtr changed_paths;
         async_result<bool>::handler_type when_done;
-        SnapTask(const ptr<snapshot> & s_, int64_t next_zxid_, int64_t next_session_id_, async_result<bool>::handler_type & when_done_)
-        : s(s_), next_zxid(next_zxid_), next_session_id(next_session_id_), when_done(when_done_)
+        SnapTask(
+            const ptr<snapshot> & s_,
+            int64_t next_zxid_,
+            int64_t next_session_id_,
+            const ChangedPathsTracker::PathsPtr & changed_paths_,
+            async_result<bool>::handler_type & when_done_)
+        : s(s_), next_zxid(next_zxid_), next_session_id(next_session_id_), changed_paths(changed_paths_), when_done(when_done_)
         {
         }
     };
@@ -0,0 +1,60 @@
+#include <Service/SessionPermissionCache.h>
+
+namespace RK
+{
+
+std::optional<bool> SessionPermissionCache::get(int64_t session_id, uint64_t acl_id, int32_t permission) const
+{
+    const auto & shard = shardFor(session_id);
+    std::shared_lock lock(shard.mutex);
+
+    auto session_it = shard.sessions.find(session_id);
+    if (session_it == shard.sessions.end())
+        return {};
+
+    auto it = session_it->second.find(makeKey(acl_id, permission));
+    if (it == session_it->second.end())
+        return {};
+
+    return it->second;
+}
+
+void SessionPermissionCache::set(int64_t session_id, uint64_t acl_id, int32_t permission, bool allowed)
+{
+    auto & shard = shardFor(session_id);
+    std::lock_guard lock(shard.mutex);
+    auto & decisions = shard.sessions[session_id];
+    if (decisions.size() >= MAX_DECISIONS_PER_SESSION)
+        decisions.clear();
+    decisions[makeKey(acl_id, permission)] = allowed;
+}
+
+void SessionPermissionCache::invalidate(int64_t session_id)
+{
+    auto & shard = shardFor(session_id);
+    std::lock_guard lock(shard.mutex);
+    shard.sessions.erase(session_id);
+}
+
+void SessionPermissionCache::clear()
+{
+    for (auto & shard : shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        shard.sessions.clear();
+    }
+}
+
+size_t SessionPermissionCache::size() const
+{
+    size_t result = 0;
+    for (const auto & shard : shards)
+    {
+        std::shared_lock lock(shard.mutex);
+        for (const auto & [_, decisions] : shard.sessions)
+            result += decisions.size();
+    }
+    return result;
+}
+
+}
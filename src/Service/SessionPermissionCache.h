@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <common/types.h>
+
+namespace RK
+{
+
+/// Caches results of ACL checks: (session, acl id, permission) -> allowed.
+///
+/// ACLs of an id never change (see ACLMap), so a decision only depends on the
+/// auth ids of the session and must be invalidated when they change. Sessions
+/// are split into shards, a lookup is one hash probe under a shared lock of
+/// one shard and does not allocate.
+///
+/// Decisions of a session are dropped when the session is closed or when it
+/// has more than MAX_DECISIONS_PER_SESSION of them.
+class SessionPermissionCache
+{
+public:
+    static constexpr size_t NUM_SHARDS = 16;
+    static constexpr size_t MAX_DECISIONS_PER_SESSION = 1024;
+
+    std::optional<bool> get(int64_t session_id, uint64_t acl_id, int32_t permission) const;
+    void set(int64_t session_id, uint64_t acl_id, int32_t permission, bool allowed);
+
+    /// Forget all decisions of session, should be called when its auth ids change or it is closed.
+    void invalidate(int64_t session_id);
+    void clear();
+
+    /// Number of cached decisions of all sessions
+    size_t size() const;
+
+private:
+    /// Key is acl id and permission bits packed together
+    using Decisions = std::unordered_map<uint64_t, bool>;
+
+    struct Shard
+    {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<int64_t, Decisions> sessions;
+    };
+
+    /// Permission is a mask of 5 bits (Coordination::ACL::All)
+    static uint64_t makeKey(uint64_t acl_id, int32_t permission) { return (acl_id << 5) | (static_cast<uint64_t>(permission) & 0x1f); }
+
+    Shard & shardFor(int64_t session_id) { return shards[static_cast<uint64_t>(session_id) % NUM_SHARDS]; }
+    const Shard & shardFor(int64_t session_id) const { return shards[static_cast<uint64_t>(session_id) % NUM_SHARDS]; }
+
+    std::array<Shard, NUM_SHARDS> shards;
+};
+
+}
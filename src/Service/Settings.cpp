@@ -55,6 +55,7 @@ void RaftSettings::loadFromConfig(const String & config_elem, const Poco::Util::
         session_timeout_ms = config.getUInt(get_key("session_timeout_ms"), Coordination::DEFAULT_SESSION_TIMEOUT_MS);
         operation_timeout_ms = config.getUInt(get_key("operation_timeout_ms"), Coordination::DEFAULT_OPERATION_TIMEOUT_MS);
         dead_session_check_period_ms = config.getUInt(get_key("dead_session_check_period_ms"), 100);
+        max_container_deletes_per_minute = config.getUInt(get_key("max_container_deletes_per_minute"), 10000);
         heart_beat_interval_ms = config.getUInt(get_key("heart_beat_interval_ms"), 500);
         election_timeout_lower_bound_ms = config.getUInt(get_key("election_timeout_lower_bound_ms"), 10000);
         election_timeout_upper_bound_ms = config.getUInt(get_key("election_timeout_upper_bound_ms"), 20000);
@@ -76,6 +77,13 @@ void RaftSettings::loadFromConfig(const String & config_elem, const Poco::Util::
         log_fsync_interval = config.getUInt(get_key("log_fsync_interval"), 1000);
         session_consistent = config.getBool(get_key("session_consistent"), true);
         async_snapshot = config.getBool(get_key("async_snapshot"), false);
+        snapshot_transfer_max_bytes_per_second = config.getUInt64(get_key("snapshot_transfer_max_bytes_per_second"), 0);
+        snapshot_compression_level = config.getUInt(get_key("snapshot_compression_level"), 0);
+        max_delta_snapshots = config.getUInt(get_key("max_delta_snapshots"), 0);
+        snapshot_with_batch_index = config.getBool(get_key("snapshot_with_batch_index"), false);
+        snapshot_write_max_bytes_per_second = config.getUInt64(get_key("snapshot_write_max_bytes_per_second"), 0);
+        snapshot_write_sync_bytes = config.getUInt64(get_key("snapshot_write_sync_bytes"), 0);
+        snapshot_write_low_io_priority = config.getBool(get_key("snapshot_write_low_io_priority"), false);
     }
     catch (Exception & e)
     {
@@ -91,6 +99,7 @@ RaftSettingsPtr RaftSettings::getDefault()
     settings->session_timeout_ms = Coordination::DEFAULT_SESSION_TIMEOUT_MS;
     settings->operation_timeout_ms = Coordination::DEFAULT_OPERATION_TIMEOUT_MS;
     settings->dead_session_check_period_ms =100;
+    settings->max_container_deletes_per_minute = 10000;
     settings->heart_beat_interval_ms = 500;
     settings->election_timeout_lower_bound_ms = 10000;
     settings->election_timeout_upper_bound_ms = 20000;
@@ -110,6 +119,13 @@ RaftSettingsPtr RaftSettings::getDefault()
     settings->log_fsync_mode = FsyncMode::FSYNC_PARALLEL;
     settings->session_consistent = true;
     settings->async_snapshot = false;
+    settings->snapshot_transfer_max_bytes_per_second = 0;
+    settings->snapshot_compression_level = 0;
+    settings->max_delta_snapshots = 0;
+    settings->snapshot_with_batch_index = false;
+    settings->snapshot_write_max_bytes_per_second = 0;
+    settings->snapshot_write_sync_bytes = 0;
+    settings->snapshot_write_low_io_priority = false;
 
     return settings;
 }
@@ -132,12 +148,12 @@ void Settings::dump(WriteBufferFromOwnString & buf) const
         buf.write('\n');
     };
 
-//    auto write_bool = [&buf](bool value)
-//    {
-//        String str_val = value ? "true" : "false";
-//        writeText(str_val, buf);
-//        buf.write('\n');
-//    };
+    auto write_bool = [&buf](bool value)
+    {
+        String str_val = value ? "true" : "false";
+        writeText(str_val, buf);
+        buf.write('\n');
+    };
 
     writeText("my_id=", buf);
     write_int(my_id);
@@ -187,6 +203,8 @@ void Settings::dump(WriteBufferFromOwnString & buf) const
     write_int(raft_settings->operation_timeout_ms);
     writeText("dead_session_check_period_ms=", buf);
     write_int(raft_settings->dead_session_check_period_ms);
+    writeText("max_container_deletes_per_minute=", buf);
+    write_int(raft_settings->max_container_deletes_per_minute);
 
     writeText("heart_beat_interval_ms=", buf);
     write_int(raft_settings->heart_beat_interval_ms);
@@ -201,6 +219,20 @@ void Settings::dump(WriteBufferFromOwnString & buf) const
     write_int(raft_settings->snapshot_distance);
     writeText("max_stored_snapshots=", buf);
     write_int(raft_settings->max_stored_snapshots);
+    writeText("snapshot_transfer_max_bytes_per_second=", buf);
+    write_int(raft_settings->snapshot_transfer_max_bytes_per_second);
+    writeText("snapshot_compression_level=", buf);
+    write_int(raft_settings->snapshot_compression_level);
+    writeText("max_delta_snapshots=", buf);
+    write_int(raft_settings->max_delta_snapshots);
+    writeText("snapshot_with_batch_index=", buf);
+    write_bool(raft_settings->snapshot_with_batch_index);
+    writeText("snapshot_write_max_bytes_per_second=", buf);
+    write_int(raft_settings->snapshot_write_max_bytes_per_second);
+    writeText("snapshot_write_sync_bytes=", buf);
+    write_int(raft_settings->snapshot_write_sync_bytes);
+    writeText("snapshot_write_low_io_priority=", buf);
+    write_bool(raft_settings->snapshot_write_low_io_priority);
 
     writeText("shutdown_timeout=", buf);
     write_int(raft_settings->shutdown_timeout);
@@ -80,6 +80,8 @@ struct RaftSettings
     UInt64 operation_timeout_ms;
     /// How often leader will check sessions to consider them dead and remove
     UInt64 dead_session_check_period_ms;
+    /// How many empty container nodes leader removes per minute at most
+    UInt64 max_container_deletes_per_minute;
     /// Heartbeat interval between quorum nodes
     UInt64 heart_beat_interval_ms;
     /// Lower bound of election timer (avoid too often leader elections)
@@ -116,6 +118,20 @@ struct RaftSettings
     bool session_consistent;
     /// Whether async snapshot
     bool async_snapshot;
+    /// Max speed of sending snapshot to followers in bytes per second, 0 means unlimited
+    UInt64 snapshot_transfer_max_bytes_per_second;
+    /// zlib level (1-9) of compressing snapshot batches, 0 means no compression
+    UInt32 snapshot_compression_level;
+    /// How many delta snapshots are created after a full snapshot, 0 means always creating full snapshot
+    UInt32 max_delta_snapshots;
+    /// Whether to write batch index at the end of snapshot objects (snapshot V3)
+    bool snapshot_with_batch_index;
+    /// Max speed of writing snapshot to disk, 0 means unlimited
+    UInt64 snapshot_write_max_bytes_per_second;
+    /// Sync snapshot data to disk every so many bytes written, 0 means leaving it to the kernel
+    UInt64 snapshot_write_sync_bytes;
+    /// Whether to create snapshot with the lowest IO priority of best effort class
+    bool snapshot_write_low_io_priority;
 
     void loadFromConfig(const String & config_elem, const Poco::Util::AbstractConfiguration & config);
 
@@ -0,0 +1,76 @@
+#include <Service/TTLExpiryQueue.h>
+
+namespace RK
+{
+
+void TTLExpiryQueue::addOrUpdate(const std::string & path, int64_t expiration_time)
+{
+    int64_t new_expiry_time = roundToNextInterval(expiration_time);
+
+    auto [path_it, inserted] = path_to_expiration_time.try_emplace(path, new_expiry_time);
+    if (!inserted)
+    {
+        int64_t prev_expiry_time = path_it->second;
+        /// Nothing changed, node stays in the same bucket
+        if (prev_expiry_time == new_expiry_time)
+            return;
+
+        path_it->second = new_expiry_time;
+        auto prev_set_it = expiry_to_paths.find(prev_expiry_time);
+        if (prev_set_it != expiry_to_paths.end())
+        {
+            prev_set_it->second.erase(path);
+            if (prev_set_it->second.empty())
+                expiry_to_paths.erase(prev_set_it);
+        }
+    }
+
+    expiry_to_paths[new_expiry_time].insert(path);
+}
+
+bool TTLExpiryQueue::remove(const std::string & path)
+{
+    auto path_it = path_to_expiration_time.find(path);
+    if (path_it == path_to_expiration_time.end())
+        return false;
+
+    auto set_it = expiry_to_paths.find(path_it->second);
+    if (set_it != expiry_to_paths.end())
+    {
+        set_it->second.erase(path);
+        /// No more nodes in this bucket
+        if (set_it->second.empty())
+            expiry_to_paths.erase(set_it);
+    }
+
+    path_to_expiration_time.erase(path_it);
+    return true;
+}
+
+std::vector<std::string> TTLExpiryQueue::getExpiredPaths(int64_t now, size_t max_count) const
+{
+    std::vector<std::string> result;
+
+    for (const auto & [expire_time, paths] : expiry_to_paths)
+    {
+        if (expire_time > now)
+            break;
+
+        for (const auto & path : paths)
+        {
+            if (result.size() >= max_count)
+                return result;
+            result.push_back(path);
+        }
+    }
+
+    return result;
+}
+
+void TTLExpiryQueue::clear()
+{
+    path_to_expiration_time.clear();
+    expiry_to_paths.clear();
+}
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace RK
+{
+
+/// Index of TTL nodes ordered by the time they may expire, which is mtime + ttl.
+/// Like SessionExpiryQueue, nodes are placed into buckets rounded up by expiry time,
+/// so finding expired nodes only visits the head buckets.
+/// [1630580418000] -> {/a/ttl_1, /b/ttl_2}
+/// [1630580418500] -> {/a/ttl_3}
+/// It is only a hint for the leader, whether a node is expired is checked again when
+/// the removal is applied.
+class TTLExpiryQueue
+{
+private:
+    /// Path -> expiry time
+    std::unordered_map<std::string, int64_t> path_to_expiration_time;
+
+    /// Expire time -> paths expire near this time
+    std::map<int64_t, std::unordered_set<std::string>> expiry_to_paths;
+
+    int64_t expiration_interval;
+
+    int64_t roundToNextInterval(int64_t time) const
+    {
+        return (time / expiration_interval + 1) * expiration_interval;
+    }
+
+public:
+    explicit TTLExpiryQueue(int64_t expiration_interval_)
+        : expiration_interval(expiration_interval_)
+    {
+    }
+
+    /// Add node or move it to the bucket of new expiration time
+    void addOrUpdate(const std::string & path, int64_t expiration_time);
+
+    /// Node was actually removed
+    bool remove(const std::string & path);
+
+    /// At most max_count nodes expired at time now, earliest first
+    std::vector<std::string> getExpiredPaths(int64_t now, size_t max_count) const;
+
+    size_t size() const { return path_to_expiration_time.size(); }
+
+    void clear();
+};
+
+}
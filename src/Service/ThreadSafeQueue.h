@@ -1,7 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
 #include <deque>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <vector>
 
 namespace RK
 {
@@ -26,6 +32,16 @@ public:
         cv.notify_one();
     }
 
+    /// Push all elements under one lock and with one notification.
+    void pushBatch(const std::vector<T> & responses)
+    {
+        if (responses.empty())
+            return;
+        std::lock_guard lock(queue_mutex);
+        queue.insert(queue.end(), responses.begin(), responses.end());
+        cv.notify_one();
+    }
+
     void pop()
     {
         std::unique_lock lock(queue_mutex);
@@ -44,6 +60,21 @@ public:
         return true;
     }
 
+    /// Wait for at least one element, then move up to max_size elements into `responses`.
+    bool tryPopBatch(std::vector<T> & responses, size_t max_size, int64_t timeout_ms = 0)
+    {
+        std::unique_lock lock(queue_mutex);
+        if (!cv.wait_for(lock,
+                         std::chrono::milliseconds(timeout_ms), [this] { return !queue.empty(); }))
+            return false;
+
+        size_t count = std::min(max_size, queue.size());
+        auto end = queue.begin() + count;
+        responses.insert(responses.end(), std::make_move_iterator(queue.begin()), std::make_move_iterator(end));
+        queue.erase(queue.begin(), end);
+        return true;
+    }
+
     bool peek(T & response)
     {
         std::unique_lock lock(queue_mutex);
@@ -85,4 +116,74 @@ public:
     }
 };
 
+/// ThreadSafeQueue split into shards by `session_id` of element, so that
+/// responses of one session are always kept in order in one shard and every
+/// shard can be consumed by its own thread without contention with others.
+template <typename T>
+class ShardedThreadSafeQueue
+{
+private:
+    std::vector<std::unique_ptr<ThreadSafeQueue<T>>> shards;
+
+    ThreadSafeQueue<T> & shardFor(const T & e) { return *shards[static_cast<uint64_t>(e.session_id) % shards.size()]; }
+
+public:
+    explicit ShardedThreadSafeQueue(size_t shard_count = 1)
+    {
+        shards.resize(std::max(1ul, shard_count));
+        for (auto & shard : shards)
+            shard = std::make_unique<ThreadSafeQueue<T>>();
+    }
+
+    size_t shardCount() const { return shards.size(); }
+
+    void push(const T & response) { shardFor(response).push(response); }
+
+    void pushBatch(const std::vector<T> & responses)
+    {
+        if (shards.size() == 1)
+        {
+            shards[0]->pushBatch(responses);
+            return;
+        }
+
+        std::vector<std::vector<T>> per_shard(shards.size());
+        for (const auto & response : responses)
+            per_shard[static_cast<uint64_t>(response.session_id) % shards.size()].push_back(response);
+
+        for (size_t i = 0; i < shards.size(); ++i)
+            shards[i]->pushBatch(per_shard[i]);
+    }
+
+    bool tryPopBatch(size_t shard_id, std::vector<T> & responses, size_t max_size, int64_t timeout_ms = 0)
+    {
+        assert(shard_id < shards.size());
+        return shards[shard_id]->tryPopBatch(responses, max_size, timeout_ms);
+    }
+
+    /// Pop from any shard without waiting.
+    bool tryPop(T & response)
+    {
+        for (auto & shard : shards)
+        {
+            if (shard->tryPop(response))
+                return true;
+        }
+        return false;
+    }
+
+    size_t size() const
+    {
+        size_t size{};
+        for (const auto & shard : shards)
+            size += shard->size();
+        return size;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+};
+
 }
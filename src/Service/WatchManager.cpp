@@ -0,0 +1,256 @@
+#include <Service/WatchManager.h>
+#include <Service/formatHex.h>
+#include <IO/Operators.h>
+
+namespace RK
+{
+
+bool WatchManager::addWatch(const String & path, int64_t session_id, WatchType type, const std::function<void()> & on_registered)
+{
+    auto & shard = pathShardFor(path);
+    std::lock_guard lock(shard.mutex);
+
+    bool created = shard.watchesOf(type)[path].emplace(session_id).second;
+    if (created)
+    {
+        if (type == WatchType::PERSISTENT_RECURSIVE)
+            ++recursive_watches_count;
+
+        auto & session_shard = sessionShardFor(session_id);
+        std::lock_guard session_lock(session_shard.mutex);
+        session_shard.sessions[session_id][path] |= static_cast<uint8_t>(type);
+    }
+
+    if (on_registered)
+        on_registered();
+
+    return created;
+}
+
+WatchManager::SessionIDs WatchManager::fetchAndRemoveWatches(const String & path, WatchType type)
+{
+    SessionIDs result;
+    auto & shard = pathShardFor(path);
+    std::lock_guard lock(shard.mutex);
+
+    auto & watches = shard.watchesOf(type);
+    auto it = watches.find(path);
+    if (it == watches.end())
+        return result;
+
+    result.reserve(it->second.size());
+    for (auto session_id : it->second)
+    {
+        result.push_back(session_id);
+        removeFromSessionIndex(path, session_id, type);
+    }
+    watches.erase(it);
+
+    return result;
+}
+
+void WatchManager::collectPersistentWatches(const String & path, SessionIDs & result) const
+{
+    const auto & shard = pathShardFor(path);
+    std::lock_guard lock(shard.mutex);
+
+    auto it = shard.persistent_watches.find(path);
+    if (it != shard.persistent_watches.end())
+        result.insert(result.end(), it->second.begin(), it->second.end());
+}
+
+void WatchManager::collectRecursiveWatches(const String & path, SessionIDs & result) const
+{
+    if (!hasRecursiveWatches())
+        return;
+
+    auto lookup = [&](const String & ancestor)
+    {
+        const auto & shard = pathShardFor(ancestor);
+        std::lock_guard lock(shard.mutex);
+
+        auto it = shard.recursive_watches.find(ancestor);
+        if (it != shard.recursive_watches.end())
+            result.insert(result.end(), it->second.begin(), it->second.end());
+    };
+
+    /// Walk from the path itself up to root: "/a/b/c", "/a/b", "/a", "/"
+    String ancestor = path;
+    while (ancestor.size() > 1)
+    {
+        lookup(ancestor);
+        ancestor.resize(ancestor.rfind('/'));
+    }
+    lookup("/");
+}
+
+bool WatchManager::removeWatch(const String & path, int64_t session_id, WatchType type)
+{
+    auto & shard = pathShardFor(path);
+    std::lock_guard lock(shard.mutex);
+
+    auto & watches = shard.watchesOf(type);
+    auto it = watches.find(path);
+    if (it == watches.end() || !it->second.erase(session_id))
+        return false;
+
+    if (it->second.empty())
+        watches.erase(it);
+    if (type == WatchType::PERSISTENT_RECURSIVE)
+        --recursive_watches_count;
+
+    removeFromSessionIndex(path, session_id, type);
+    return true;
+}
+
+bool WatchManager::hasWatches(const String & path, WatchType type) const
+{
+    const auto & shard = pathShardFor(path);
+    std::lock_guard lock(shard.mutex);
+    return shard.watchesOf(type).contains(path);
+}
+
+void WatchManager::removeFromSessionIndex(const String & path, int64_t session_id, WatchType type)
+{
+    auto & session_shard = sessionShardFor(session_id);
+    std::lock_guard session_lock(session_shard.mutex);
+
+    auto session_it = session_shard.sessions.find(session_id);
+    if (session_it == session_shard.sessions.end())
+        return;
+
+    auto & paths = session_it->second;
+    auto path_it = paths.find(path);
+    if (path_it == paths.end())
+        return;
+
+    path_it->second &= ~static_cast<uint8_t>(type);
+    if (path_it->second == 0)
+    {
+        paths.erase(path_it);
+        if (paths.empty())
+            session_shard.sessions.erase(session_it);
+    }
+}
+
+void WatchManager::removeSessionWatches(int64_t session_id)
+{
+    SessionWatchedPaths paths;
+    {
+        auto & session_shard = sessionShardFor(session_id);
+        std::lock_guard session_lock(session_shard.mutex);
+        auto it = session_shard.sessions.find(session_id);
+        if (it == session_shard.sessions.end())
+            return;
+        paths = std::move(it->second);
+        session_shard.sessions.erase(it);
+    }
+
+    for (const auto & [path, type_mask] : paths)
+    {
+        auto & shard = pathShardFor(path);
+        std::lock_guard lock(shard.mutex);
+
+        for (auto type : ALL_WATCH_TYPES)
+        {
+            if (!(type_mask & static_cast<uint8_t>(type)))
+                continue;
+
+            auto & watches = shard.watchesOf(type);
+            auto it = watches.find(path);
+            if (it != watches.end() && it->second.erase(session_id))
+            {
+                if (type == WatchType::PERSISTENT_RECURSIVE)
+                    --recursive_watches_count;
+                if (it->second.empty())
+                    watches.erase(it);
+            }
+        }
+    }
+}
+
+void WatchManager::clear()
+{
+    for (auto & shard : path_shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        for (auto type : ALL_WATCH_TYPES)
+            shard.watchesOf(type).clear();
+    }
+    for (auto & session_shard : session_shards)
+    {
+        std::lock_guard lock(session_shard.mutex);
+        session_shard.sessions.clear();
+    }
+    recursive_watches_count = 0;
+}
+
+uint64_t WatchManager::getTotalWatchesCount() const
+{
+    uint64_t ret = 0;
+    for (const auto & shard : path_shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        for (auto type : ALL_WATCH_TYPES)
+            for (const auto & [path, sessions] : shard.watchesOf(type))
+                ret += sessions.size();
+    }
+    return ret;
+}
+
+uint64_t WatchManager::getWatchedPathsCount() const
+{
+    uint64_t ret = 0;
+    for (const auto & shard : path_shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        for (auto type : ALL_WATCH_TYPES)
+            ret += shard.watchesOf(type).size();
+    }
+    return ret;
+}
+
+uint64_t WatchManager::getSessionsWithWatchesCount() const
+{
+    uint64_t ret = 0;
+    for (const auto & session_shard : session_shards)
+    {
+        std::lock_guard lock(session_shard.mutex);
+        ret += session_shard.sessions.size();
+    }
+    return ret;
+}
+
+void WatchManager::dumpWatches(WriteBufferFromOwnString & buf) const
+{
+    for (const auto & session_shard : session_shards)
+    {
+        std::lock_guard lock(session_shard.mutex);
+        for (const auto & [session_id, paths] : session_shard.sessions)
+        {
+            buf << toHexString(session_id) << "\n";
+            for (const auto & [path, _] : paths)
+                buf << "\t" << path << "\n";
+        }
+    }
+}
+
+void WatchManager::dumpWatchesByPath(WriteBufferFromOwnString & buf) const
+{
+    auto write_sessions = [&buf](const String & path, const Sessions & sessions)
+    {
+        buf << path << "\n";
+        for (int64_t session_id : sessions)
+            buf << "\t" << toHexString(session_id) << "\n";
+    };
+
+    for (const auto & shard : path_shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        for (auto type : ALL_WATCH_TYPES)
+            for (const auto & [path, sessions] : shard.watchesOf(type))
+                write_sessions(path, sessions);
+    }
+}
+
+}
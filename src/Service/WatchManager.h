@@ -0,0 +1,138 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <IO/WriteBufferFromString.h>
+#include <common/types.h>
+
+namespace RK
+{
+
+enum class WatchType : uint8_t
+{
+    /// Watches for 'get' and 'exists' requests
+    DATA = 1,
+    /// Watches for 'list' request (watches on children)
+    LIST = 2,
+    /// Watches added by AddWatch in PERSISTENT mode, not removed when triggered
+    PERSISTENT = 4,
+    /// Watches added by AddWatch in PERSISTENT_RECURSIVE mode, cover the whole subtree
+    PERSISTENT_RECURSIVE = 8,
+};
+
+static constexpr WatchType ALL_WATCH_TYPES[] = {WatchType::DATA, WatchType::LIST, WatchType::PERSISTENT, WatchType::PERSISTENT_RECURSIVE};
+
+/// Keeps all watches of the store.
+///
+/// Path index is sharded like KeeperStore::Container, see KeeperStore::MAP_BLOCK_NUM.
+/// A session registering the same watch twice is stored only once.
+///
+/// Persistent recursive watches are matched by looking up every ancestor of the
+/// changed path, which is O(depth) per mutation. The lookup is skipped entirely
+/// while nobody has a recursive watch.
+///
+/// Every shard also keeps a reverse index session -> watched paths for the
+/// sessions placed in it (sharded by session id), which makes removing the
+/// watches of a closed session proportional to the number of its watches.
+class WatchManager
+{
+public:
+    static constexpr size_t NUM_SHARDS = 16;
+
+    using SessionIDs = std::vector<int64_t>;
+
+    /// Register watch for session. Return false if the session already watches the path.
+    /// `on_registered` is invoked while holding the path lock. It is used to push read
+    /// response before any following trigger of the watch can be observed.
+    bool addWatch(const String & path, int64_t session_id, WatchType type, const std::function<void()> & on_registered = {});
+
+    /// Remove all one-shot (DATA or LIST) watches on the path and return their sessions.
+    SessionIDs fetchAndRemoveWatches(const String & path, WatchType type);
+
+    /// Append sessions having persistent watch on the path.
+    void collectPersistentWatches(const String & path, SessionIDs & result) const;
+
+    /// Append sessions having recursive watch on the path or any of its ancestors.
+    void collectRecursiveWatches(const String & path, SessionIDs & result) const;
+
+    bool hasRecursiveWatches() const { return recursive_watches_count.load(std::memory_order_relaxed) > 0; }
+
+    /// Remove watch of session, return false if there was no such watch.
+    bool removeWatch(const String & path, int64_t session_id, WatchType type);
+
+    bool hasWatches(const String & path, WatchType type) const;
+
+    /// Remove all watches of session.
+    void removeSessionWatches(int64_t session_id);
+
+    void clear();
+
+    uint64_t getTotalWatchesCount() const;
+    uint64_t getWatchedPathsCount() const;
+    uint64_t getSessionsWithWatchesCount() const;
+
+    void dumpWatches(WriteBufferFromOwnString & buf) const;
+    void dumpWatchesByPath(WriteBufferFromOwnString & buf) const;
+
+private:
+    using Sessions = std::unordered_set<int64_t>;
+    using PathWatches = std::unordered_map<String, Sessions>;
+    /// path -> mask of WatchType
+    using SessionWatchedPaths = std::unordered_map<String, uint8_t>;
+
+    struct PathShard
+    {
+        mutable std::mutex mutex;
+        PathWatches data_watches;
+        PathWatches list_watches;
+        PathWatches persistent_watches;
+        PathWatches recursive_watches;
+
+        PathWatches & watchesOf(WatchType type)
+        {
+            return const_cast<PathWatches &>(static_cast<const PathShard &>(*this).watchesOf(type));
+        }
+
+        const PathWatches & watchesOf(WatchType type) const
+        {
+            switch (type)
+            {
+                case WatchType::DATA:
+                    return data_watches;
+                case WatchType::LIST:
+                    return list_watches;
+                case WatchType::PERSISTENT:
+                    return persistent_watches;
+                case WatchType::PERSISTENT_RECURSIVE:
+                    return recursive_watches;
+            }
+            __builtin_unreachable();
+        }
+    };
+
+    struct SessionShard
+    {
+        mutable std::mutex mutex;
+        std::unordered_map<int64_t, SessionWatchedPaths> sessions;
+    };
+
+    PathShard & pathShardFor(const String & path) { return path_shards[hasher(path) % NUM_SHARDS]; }
+    const PathShard & pathShardFor(const String & path) const { return path_shards[hasher(path) % NUM_SHARDS]; }
+    SessionShard & sessionShardFor(int64_t session_id) { return session_shards[static_cast<uint64_t>(session_id) % NUM_SHARDS]; }
+
+    /// Should be called under lock of path shard.
+    void removeFromSessionIndex(const String & path, int64_t session_id, WatchType type);
+
+    std::array<PathShard, NUM_SHARDS> path_shards;
+    std::array<SessionShard, NUM_SHARDS> session_shards;
+    std::hash<String> hasher;
+
+    std::atomic<uint64_t> recursive_watches_count{0};
+};
+
+}
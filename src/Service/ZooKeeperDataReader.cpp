@@ -4,7 +4,14 @@
 #include <IO/ReadHelpers.h>
 #include <Common/ZooKeeper/ZooKeeperIO.h>
 #include <IO/ReadBufferFromFile.h>
+#include <IO/ReadBufferFromMemory.h>
+#include <Common/Stopwatch.h>
+#include <Common/ThreadPool.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <zlib.h>
 
 
 namespace RK
@@ -95,7 +102,9 @@ int64_t deserializeStorageData(KeeperStore & store, ReadBuffer & in, Poco::Logge
     while (path != "/")
     {
         std::shared_ptr<KeeperNode> node = std::make_shared<KeeperNode>();
-        Coordination::read(node->data, in);
+        String data;
+        Coordination::read(data, in);
+        node->setData(std::move(data));
         size_t acl_id;
         Coordination::read(acl_id, in);
 //        Coordination::read(node.acl_id, in);
@@ -117,10 +126,11 @@ int64_t deserializeStorageData(KeeperStore & store, ReadBuffer & in, Poco::Logge
         node->stat.numChildren = 0;
         if (!path.empty())
         {
-            node->stat.dataLength = node->data.length();
+            node->stat.dataLength = node->getData().length();
             store.container.emplace(path, node);
 
-            if (node->stat.ephemeralOwner != 0)
+            /// TTL and container nodes are marked in ephemeralOwner
+            if (Coordination::isSessionEphemeralOwner(node->stat.ephemeralOwner))
             {
                 node->is_ephemeral = true;
                 store.ephemerals[node->stat.ephemeralOwner].insert(path);
@@ -128,8 +138,8 @@ int64_t deserializeStorageData(KeeperStore & store, ReadBuffer & in, Poco::Logge
         }
         Coordination::read(path, in);
         count++;
-        if (count % 1000 == 0)
-            LOG_INFO(log, "Deserialized nodes from snapshot: {}", count);
+        if (count % 100000 == 0)
+            LOG_INFO(log, "Deserialized nodes from snapshot: {}, read {} bytes", count, in.count());
     }
 
     store.buildPathChildren(true);
@@ -295,6 +305,34 @@ Coordination::ZooKeeperRequestPtr deserializeCreateTxn(ReadBuffer & in)
     return result;
 }
 
+/// CreateContainerTxn has no ephemeral flag, node is marked by ephemeralOwner when it is created
+Coordination::ZooKeeperRequestPtr deserializeCreateContainerTxn(ReadBuffer & in)
+{
+    std::shared_ptr<Coordination::ZooKeeperCreateContainerRequest> result = std::make_shared<Coordination::ZooKeeperCreateContainerRequest>();
+    Coordination::read(result->path, in);
+    Coordination::read(result->data, in);
+    Coordination::read(result->acls, in);
+    Coordination::read(result->parent_cversion, in);
+    result->is_container = true;
+
+    result->restored_from_zookeeper_log = true;
+    return result;
+}
+
+Coordination::ZooKeeperRequestPtr deserializeCreateTTLTxn(ReadBuffer & in)
+{
+    std::shared_ptr<Coordination::ZooKeeperCreateTTLRequest> result = std::make_shared<Coordination::ZooKeeperCreateTTLRequest>();
+    Coordination::read(result->path, in);
+    Coordination::read(result->data, in);
+    Coordination::read(result->acls, in);
+    Coordination::read(result->parent_cversion, in);
+    Coordination::read(result->ttl, in);
+    result->is_ttl = true;
+
+    result->restored_from_zookeeper_log = true;
+    return result;
+}
+
 Coordination::ZooKeeperRequestPtr deserializeDeleteTxn(ReadBuffer & in)
 {
     std::shared_ptr<Coordination::ZooKeeperRemoveRequest> result = std::make_shared<Coordination::ZooKeeperRemoveRequest>();
@@ -303,6 +341,15 @@ Coordination::ZooKeeperRequestPtr deserializeDeleteTxn(ReadBuffer & in)
     return result;
 }
 
+/// Written by ZooKeeper leader for expired TTL nodes and empty containers as a DeleteTxn
+Coordination::ZooKeeperRequestPtr deserializeDeleteContainerTxn(ReadBuffer & in)
+{
+    std::shared_ptr<Coordination::ZooKeeperDeleteContainerRequest> result = std::make_shared<Coordination::ZooKeeperDeleteContainerRequest>();
+    Coordination::read(result->path, in);
+    result->restored_from_zookeeper_log = true;
+    return result;
+}
+
 Coordination::ZooKeeperRequestPtr deserializeSetTxn(ReadBuffer & in)
 {
     std::shared_ptr<Coordination::ZooKeeperSetRequest> result = std::make_shared<Coordination::ZooKeeperSetRequest>();
@@ -410,6 +457,19 @@ Coordination::ZooKeeperRequestPtr deserializeTxnImpl(ReadBuffer & in, bool subtx
         case 14:
             result = deserializeMultiTxn(in, log);
             break;
+        case 15:
+            /// Create2 differs from Create only in response
+            result = deserializeCreateTxn(in);
+            break;
+        case 19:
+            result = deserializeCreateContainerTxn(in);
+            break;
+        case 20:
+            result = deserializeDeleteContainerTxn(in);
+            break;
+        case 21:
+            result = deserializeCreateTTLTxn(in);
+            break;
         case -10:
             result = deserializeCreateSession(in);
             break;
@@ -472,17 +532,87 @@ bool hasErrorsInMultiRequest(Coordination::ZooKeeperRequestPtr request)
 
 }
 
-bool deserializeTxn(KeeperStore & store, ReadBuffer & in, Poco::Logger * log)
+namespace
+{
+
+/// One transaction decoded from ZooKeeper log, ready to be applied to store.
+struct ZooKeeperLogTxn
+{
+    Coordination::ZooKeeperRequestPtr request;
+    int64_t session_id;
+    int64_t zxid;
+    int64_t time;
+};
+
+using ZooKeeperLogTxns = std::vector<ZooKeeperLogTxn>;
+
+enum class TxnRecordStatus
+{
+    OK,
+    /// Zero padding or end of file
+    END,
+    /// Record is cut by end of file or its tail is still zero, it is not completely written yet
+    INCOMPLETE,
+    /// Record is completely written but its length, end marker or checksum is wrong
+    CORRUPTED,
+};
+
+/// Checksum (8 bytes) + txn length (4 bytes) + 0x42 (1 byte)
+static constexpr size_t TXN_RECORD_OVERHEAD = 13;
+/// "ZKLG" + 4 byte version + 8 byte dbid
+static constexpr size_t LOG_HEADER_SIZE = 16;
+
+/// Read the whole record of one transaction and verify its Adler32 checksum, which is
+/// calculated by ZooKeeper over txn bytes. `available` is the number of bytes left in file.
+///
+/// ZooKeeper writes a record at once after preallocated zeros, so a record being written
+/// is a prefix of it followed by zeros or end of file. Its end marker 0x42 is written last,
+/// a record with the marker or any other non-zero byte there is complete and must be valid.
+TxnRecordStatus readTxnRecord(ReadBuffer & in, size_t available, std::string & txn_bytes)
 {
+    if (available == 0)
+        return TxnRecordStatus::END;
+    if (available < TXN_RECORD_OVERHEAD)
+        return TxnRecordStatus::INCOMPLETE;
+
     int64_t checksum;
     Coordination::read(checksum, in);
     /// Zero padding is possible until file end
     if (checksum == 0)
-        return false;
+        return TxnRecordStatus::END;
 
     int32_t txn_len;
     Coordination::read(txn_len, in);
-    int64_t count_before = in.count();
+    if (txn_len == 0)
+        return TxnRecordStatus::INCOMPLETE;
+    if (txn_len < 0)
+        return TxnRecordStatus::CORRUPTED;
+    if (available < TXN_RECORD_OVERHEAD + txn_len)
+        return TxnRecordStatus::INCOMPLETE;
+
+    txn_bytes.resize(txn_len);
+    in.readStrict(txn_bytes.data(), txn_len);
+
+    int8_t forty_two;
+    Coordination::read(forty_two, in);
+    if (forty_two == 0)
+        return TxnRecordStatus::INCOMPLETE;
+    if (forty_two != 0x42)
+        return TxnRecordStatus::CORRUPTED;
+
+    auto expected = adler32(adler32(0L, Z_NULL, 0), reinterpret_cast<const Bytef *>(txn_bytes.data()), txn_len);
+    if (static_cast<uint64_t>(checksum) != expected)
+        return TxnRecordStatus::CORRUPTED;
+
+    return TxnRecordStatus::OK;
+}
+
+/// Decode one transaction from its record bytes.
+/// Error requests and failed multi requests are skipped, they are never applied.
+void deserializeTxn(const std::string & txn_bytes, ZooKeeperLogTxns & txns, Poco::Logger * log)
+{
+    ReadBufferFromMemory in(txn_bytes.data(), txn_bytes.size());
+
     int64_t session_id;
     Coordination::read(session_id, in);
     int32_t xid;
@@ -492,68 +622,129 @@ bool deserializeTxn(KeeperStore & store, ReadBuffer & in, Poco::Logger * log)
     int64_t time;
     Coordination::read(time, in);
 
-    Coordination::ZooKeeperRequestPtr request = deserializeTxnImpl(in, false, txn_len, log);
-
-    /// Skip all other bytes
-    int64_t bytes_read = in.count() - count_before;
-    if (bytes_read < txn_len)
-        in.ignore(txn_len - bytes_read);
-
-//    LOG_INFO(log, "txn_len is {}, count_before {}, bytes_read {}", txn_len, count_before, bytes_read);
+    /// All other bytes (digest of data tree since 3.6) are ignored
+    Coordination::ZooKeeperRequestPtr request = deserializeTxnImpl(in, false, txn_bytes.size(), log);
 
     /// We don't need to apply error requests
     if (isErrorRequest(request))
-        return true;
+        return;
+
+    /// Skip failed multirequests
+    if (request->getOpNum() == Coordination::OpNum::Multi && hasErrorsInMultiRequest(request))
+        return;
 
     request->xid = xid;
+    txns.push_back({std::move(request), session_id, zxid, time});
+}
+
+/// Decode transactions of the log starting from `offset`, only the ones with zxid greater than
+/// min_zxid are kept. Return the offset right after the last complete record.
+///
+/// If `log_complete` is false the log is being written by ZooKeeper, and a record which is not
+/// completely written yet stops decoding. Otherwise such a record means the log is corrupted.
+/// A completely written record with wrong checksum is always corrupted.
+/// Does not touch store, so several logs can be decoded concurrently.
+size_t deserializeLog(
+    const std::string & log_path, size_t offset, int64_t min_zxid, bool log_complete, ZooKeeperLogTxns & txns, Poco::Logger * log)
+{
+    size_t file_size = std::filesystem::file_size(log_path);
+    ReadBufferFromFile reader(log_path);
+
+    if (offset == 0)
+    {
+        /// Header is not written yet
+        if (!log_complete && file_size < LOG_HEADER_SIZE)
+            return 0;
+        deserializeLogMagic(reader);
+        offset = LOG_HEADER_SIZE;
+    }
+    else
+    {
+        reader.seek(offset, SEEK_SET);
+    }
+
+    std::string txn_bytes;
+    while (true)
+    {
+        auto status = readTxnRecord(reader, file_size > offset ? file_size - offset : 0, txn_bytes);
+        if (status == TxnRecordStatus::END)
+            break;
+
+        if (status == TxnRecordStatus::CORRUPTED)
+            throw Exception(ErrorCodes::CORRUPTED_DATA, "Transaction record at offset {} of log {} is corrupted", offset, log_path);
+
+        if (status == TxnRecordStatus::INCOMPLETE)
+        {
+            if (!log_complete)
+                break;
+            throw Exception(ErrorCodes::CORRUPTED_DATA, "Transaction record at offset {} of log {} is truncated", offset, log_path);
+        }
 
-    if (zxid > store.zxid)
+        offset += TXN_RECORD_OVERHEAD + txn_bytes.size();
+        deserializeTxn(txn_bytes, txns, log);
+        if (!txns.empty() && txns.back().zxid <= min_zxid)
+            txns.pop_back();
+    }
+
+    return offset;
+}
+
+ZooKeeperLogTxns deserializeLog(const std::string & log_path, int64_t min_zxid, bool log_complete, Poco::Logger * log)
+{
+    LOG_INFO(log, "Deserializing log {}", log_path);
+
+    ZooKeeperLogTxns txns;
+    deserializeLog(log_path, 0, min_zxid, log_complete, txns, log);
+
+    LOG_INFO(log, "Finished {} deserialization, {} records to apply", log_path, txns.size());
+    return txns;
+}
+
+/// Apply decoded transactions in zxid order. All of them share one responses queue
+/// and no response is created, because nobody will read them.
+void applyLogTxns(KeeperStore & store, ZooKeeperLogTxns & txns)
+{
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    for (auto & txn : txns)
     {
+        if (txn.zxid <= store.zxid)
+            continue;
+
         /// Separate processing of session id requests
-        if (request->getOpNum() == Coordination::OpNum::SessionID)
+        if (txn.request->getOpNum() == Coordination::OpNum::SessionID)
         {
-            const Coordination::ZooKeeperSessionIDRequest & session_id_request = dynamic_cast<const Coordination::ZooKeeperSessionIDRequest &>(*request);
+            const Coordination::ZooKeeperSessionIDRequest & session_id_request
+                = dynamic_cast<const Coordination::ZooKeeperSessionIDRequest &>(*txn.request);
             store.getSessionID(session_id_request.session_timeout_ms);
         }
         else
         {
-            /// Skip failed multirequests
-            if (request->getOpNum() == Coordination::OpNum::Multi && hasErrorsInMultiRequest(request))
-                return true;
-
-            KeeperStore::KeeperResponsesQueue responses_queue;
-            store.processRequest(responses_queue, request, session_id, time, zxid, /* check_acl = */ false, /*ignore_response*/true);
+            store.processRequest(
+                responses_queue, txn.request, txn.session_id, txn.time, txn.zxid, /* check_acl = */ false, /*ignore_response*/ true);
         }
+
+        /// Release request as soon as it is applied
+        txn.request.reset();
     }
+}
 
-    return true;
 }
 
 void deserializeLogAndApplyToStore(KeeperStore & store, const std::string & log_path, Poco::Logger * log)
 {
-    ReadBufferFromFile reader(log_path);
-
-    LOG_INFO(log, "Deserializing log {}", log_path);
-    deserializeLogMagic(reader);
-    LOG_INFO(log, "Header looks OK");
-
-    size_t counter = 0;
-    while (!reader.eof() && deserializeTxn(store, reader, log))
-    {
-        counter++;
-        if (counter % 1000 == 0)
-            LOG_INFO(log, "Deserialized txns log: {}", counter);
-
-        int8_t forty_two;
-        Coordination::read(forty_two, reader);
-        if (forty_two != 0x42)
-            throw Exception(ErrorCodes::NOT_IMPLEMENTED, "Forty two check byte ({}) is not equal 0x42", forty_two);
-    }
+    auto txns = deserializeLog(log_path, store.zxid, true, log);
+    applyLogTxns(store, txns);
+}
 
-    LOG_INFO(log, "Finished {} deserialization, totally read {} records", log_path, counter);
+size_t deserializeLogAndApplyToStore(KeeperStore & store, const std::string & log_path, size_t offset, bool log_complete, Poco::Logger * log)
+{
+    ZooKeeperLogTxns txns;
+    offset = deserializeLog(log_path, offset, store.zxid, log_complete, txns, log);
+    applyLogTxns(store, txns);
+    return offset;
 }
 
-void deserializeLogsAndApplyToStore(KeeperStore & store, const std::string & path, Poco::Logger * log)
+void deserializeLogsAndApplyToStore(KeeperStore & store, const std::string & path, Poco::Logger * log, size_t threads)
 {
     namespace fs = std::filesystem;
     std::map<int64_t, std::string> existing_logs;
@@ -582,12 +773,101 @@ void deserializeLogsAndApplyToStore(KeeperStore & store, const std::string & pat
             break;
         }
     }
+    std::reverse(stored_files.begin(), stored_files.end());
+
+    size_t total_bytes = 0;
+    for (const auto & file : stored_files)
+        total_bytes += fs::file_size(file);
+
+    threads = std::max(threads, size_t(1));
+    LOG_INFO(log, "Will apply {} logs, {} bytes, decoding with {} threads", stored_files.size(), total_bytes, threads);
+
+    /// Logs are decoded by the pool and applied here one by one in zxid order.
+    /// At most `threads` decoded logs are kept in memory.
+    struct DecodedLog
+    {
+        bool ready = false;
+        ZooKeeperLogTxns txns;
+        std::exception_ptr exception;
+    };
+
+    const int64_t min_zxid = store.zxid;
+    std::vector<DecodedLog> decoded_logs(stored_files.size());
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    /// Jobs reference the state declared above. The pool is declared after it, so it is
+    /// destroyed and joined first, also when applying a log throws.
+    ThreadPool pool(threads);
+
+    /// Called only by this thread, jobs never use it.
+    auto schedule = [&](size_t i)
+    {
+        pool.scheduleOrThrowOnError([&stored_files, &decoded_logs, &mutex, &cv, log, min_zxid, i]
+        {
+            DecodedLog result;
+            try
+            {
+                /// The newest log may end with a record being written or cut by crash
+                result.txns = deserializeLog(stored_files[i], min_zxid, i + 1 < stored_files.size(), log);
+            }
+            catch (...)
+            {
+                result.exception = std::current_exception();
+            }
+            result.ready = true;
+
+            {
+                std::lock_guard lock(mutex);
+                decoded_logs[i] = std::move(result);
+            }
+            cv.notify_all();
+        });
+    };
+
+    size_t next_to_schedule = 0;
+    for (; next_to_schedule < std::min(threads, stored_files.size()); ++next_to_schedule)
+        schedule(next_to_schedule);
+
+    Stopwatch watch;
+    size_t applied_bytes = 0;
+    size_t applied_txns = 0;
 
-    for (auto it = stored_files.rbegin(); it != stored_files.rend(); ++it)
+    for (size_t i = 0; i < stored_files.size(); ++i)
     {
-        deserializeLogAndApplyToStore(store, *it, log);
+        DecodedLog current;
+        {
+            std::unique_lock lock(mutex);
+            cv.wait(lock, [&] { return decoded_logs[i].ready; });
+            current = std::move(decoded_logs[i]);
+        }
+
+        if (current.exception)
+            std::rethrow_exception(current.exception);
+
+        if (next_to_schedule < stored_files.size())
+            schedule(next_to_schedule++);
+
+        applyLogTxns(store, current.txns);
+
+        applied_bytes += fs::file_size(stored_files[i]);
+        applied_txns += current.txns.size();
+        double seconds = std::max(watch.elapsedSeconds(), 0.001);
+        LOG_INFO(
+            log,
+            "Applied {}/{} logs, {}/{} bytes ({:.1f}%), {} txns, {:.1f} MB/s, {:.0f} txns/s, last zxid {}",
+            i + 1,
+            stored_files.size(),
+            applied_bytes,
+            total_bytes,
+            total_bytes ? 100.0 * applied_bytes / total_bytes : 100.0,
+            applied_txns,
+            applied_bytes / seconds / 1024 / 1024,
+            applied_txns / seconds,
+            store.zxid);
     }
 
+    pool.wait();
 }
 
 }
@@ -6,10 +6,18 @@
 namespace RK
 {
 
+/// ZooKeeper snapshots and logs are named by the first zxid in hex, e.g. log.1a2b
+int64_t getZxidFromName(const std::string & filename);
+
 void deserializeKeeperStoreFromSnapshot(KeeperStore & store, const std::string & snapshot_path, Poco::Logger * log);
 void deserializeKeeperStoreFromSnapshotsDir(KeeperStore & store, const std::string & path, Poco::Logger * log);
 
 void deserializeLogAndApplyToStore(KeeperStore & store, const std::string & log_path, Poco::Logger * log);
-void deserializeLogsAndApplyToStore(KeeperStore & store, const std::string & path, Poco::Logger * log);
+/// Apply complete transactions of the log starting from `offset` and return the offset after the last one,
+/// so that a log which is still being written by ZooKeeper can be applied again from there later.
+/// If `log_complete` ZooKeeper has already rolled to the next log, so a truncated record means corruption.
+size_t deserializeLogAndApplyToStore(KeeperStore & store, const std::string & log_path, size_t offset, bool log_complete, Poco::Logger * log);
+/// Logs are decoded by `threads` threads concurrently and applied to store in zxid order.
+void deserializeLogsAndApplyToStore(KeeperStore & store, const std::string & path, Poco::Logger * log, size_t threads = 1);
 
 }
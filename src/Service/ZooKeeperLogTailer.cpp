@@ -0,0 +1,84 @@
+#include <filesystem>
+#include <thread>
+#include <Service/ZooKeeperDataReader.h>
+#include <Service/ZooKeeperLogTailer.h>
+#include <Common/Stopwatch.h>
+#include <Common/StringUtils/StringUtils.h>
+
+namespace RK
+{
+
+ZooKeeperLogTailer::ZooKeeperLogTailer(KeeperStore & store_, const String & logs_dir_, Poco::Logger * log_)
+    : store(store_), logs_dir(logs_dir_), log(log_)
+{
+}
+
+std::map<int64_t, String> ZooKeeperLogTailer::listLogs() const
+{
+    std::map<int64_t, String> logs;
+    for (const auto & p : std::filesystem::directory_iterator(logs_dir))
+    {
+        const auto & log_path = p.path();
+        if (!log_path.has_filename() || !startsWith(log_path.filename(), "log."))
+            continue;
+        logs[getZxidFromName(log_path)] = log_path;
+    }
+    return logs;
+}
+
+int64_t ZooKeeperLogTailer::catchUp(bool final_pass)
+{
+    auto logs = listLogs();
+
+    if (current_log.empty())
+    {
+        if (logs.empty())
+            return store.zxid;
+
+        /// Start from the last log beginning not after the store zxid, earlier records of it are skipped
+        auto it = logs.upper_bound(store.zxid);
+        if (it != logs.begin())
+            --it;
+        current_log_zxid = it->first;
+        current_log = it->second;
+        current_offset = 0;
+        LOG_INFO(log, "Start tailing ZooKeeper log {} from zxid {}", current_log, store.zxid);
+    }
+
+    while (true)
+    {
+        auto next = logs.upper_bound(current_log_zxid);
+        bool log_complete = next != logs.end();
+
+        current_offset = deserializeLogAndApplyToStore(store, current_log, current_offset, log_complete || final_pass, log);
+        if (!log_complete)
+            break;
+
+        LOG_INFO(log, "ZooKeeper rolled log {}, continue with {}", current_log, next->second);
+        current_log_zxid = next->first;
+        current_log = next->second;
+        current_offset = 0;
+    }
+
+    return store.zxid;
+}
+
+void ZooKeeperLogTailer::run(const std::function<bool()> & should_stop, UInt64 poll_interval_ms)
+{
+    while (!should_stop())
+    {
+        Stopwatch watch;
+        int64_t zxid_before = store.zxid;
+        int64_t zxid = catchUp();
+        if (zxid != zxid_before)
+            LOG_INFO(log, "Caught up to zxid {} at {}:{} in {} ms", zxid, current_log, current_offset, watch.elapsedMilliseconds());
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(poll_interval_ms));
+    }
+
+    Stopwatch watch;
+    int64_t zxid = catchUp(/* final_pass */ true);
+    LOG_INFO(log, "Final catch up to zxid {} at {}:{} in {} ms", zxid, current_log, current_offset, watch.elapsedMilliseconds());
+}
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <Service/KeeperStore.h>
+#include <common/logger_useful.h>
+
+namespace RK
+{
+
+/// Keeps store up to date with a live ZooKeeper data directory by applying its
+/// txn logs while they are being written, used for migration with a short write freeze.
+///
+/// ZooKeeper only appends to its newest log. Once a newer log shows up the current
+/// one is complete, so it is applied to the end and tailing goes on with the next
+/// log from its beginning.
+class ZooKeeperLogTailer
+{
+public:
+    /// Store should be already loaded from ZooKeeper snapshot.
+    ZooKeeperLogTailer(KeeperStore & store_, const String & logs_dir_, Poco::Logger * log_);
+
+    /// Apply all transactions written since the last call, return the last applied zxid.
+    /// In the final pass ZooKeeper does not write anymore, and a record left incomplete
+    /// at the end of the newest log means the log is corrupted.
+    int64_t catchUp(bool final_pass = false);
+
+    /// Catch up every poll_interval_ms until should_stop returns true, then do the final catch up.
+    void run(const std::function<bool()> & should_stop, UInt64 poll_interval_ms);
+
+    const String & getCurrentLog() const { return current_log; }
+    size_t getCurrentOffset() const { return current_offset; }
+
+private:
+    /// first zxid -> log path
+    std::map<int64_t, String> listLogs() const;
+
+    KeeperStore & store;
+    String logs_dir;
+    Poco::Logger * log;
+
+    int64_t current_log_zxid = -1;
+    String current_log;
+    size_t current_offset = 0;
+};
+
+}
@@ -0,0 +1,85 @@
+#include <Service/ACLMap.h>
+#include <Service/KeeperStore.h>
+#include <Service/SessionPermissionCache.h>
+#include <gtest/gtest.h>
+
+using namespace Coordination;
+using namespace RK;
+
+namespace
+{
+
+ACLs digestACLs(const String & user)
+{
+    ACL acl;
+    acl.permissions = ACL::All;
+    acl.scheme = "digest";
+    acl.id = user;
+    return {acl};
+}
+
+}
+
+TEST(ACLMap, publishChanges)
+{
+    ACLMap acl_map;
+
+    auto first_id = acl_map.convertACLs(digestACLs("u0"));
+    auto first = acl_map.getACLs(first_id);
+    ASSERT_EQ(*first, digestACLs("u0"));
+
+    /// known ids keep their objects when others are added
+    for (int i = 1; i < 100; ++i)
+    {
+        auto id = acl_map.convertACLs(digestACLs("u" + std::to_string(i)));
+        ASSERT_EQ(*acl_map.getACLs(id), digestACLs("u" + std::to_string(i)));
+        ASSERT_EQ(acl_map.getACLs(first_id), first);
+    }
+
+    acl_map.addUsage(first_id);
+    acl_map.removeUsage(first_id);
+    ASSERT_THROW(acl_map.getACLs(first_id), Exception);
+
+    /// loading snapshot drops the table, it is rebuilt on read
+    acl_map.addMapping(1000, digestACLs("loaded"));
+    ASSERT_EQ(*acl_map.getACLs(1000), digestACLs("loaded"));
+    ASSERT_EQ(*acl_map.getACLs(first_id + 1), digestACLs("u1"));
+}
+
+TEST(SessionPermissionCache, bounded)
+{
+    SessionPermissionCache cache;
+
+    for (size_t i = 0; i < SessionPermissionCache::MAX_DECISIONS_PER_SESSION * 3; ++i)
+        cache.set(1, i + 1, ACL::Read, true);
+    ASSERT_LE(cache.size(), SessionPermissionCache::MAX_DECISIONS_PER_SESSION);
+
+    cache.set(2, 1, ACL::Write, false);
+    ASSERT_EQ(cache.get(2, 1, ACL::Write), std::optional<bool>(false));
+    ASSERT_FALSE(cache.get(2, 1, ACL::Read));
+
+    cache.invalidate(1);
+    cache.invalidate(2);
+    ASSERT_EQ(cache.size(), 0);
+}
+
+TEST(SessionPermissionCache, unknownSession)
+{
+    KeeperStore store(500);
+    auto acl_id = store.acl_map.convertACLs(digestACLs("u0"));
+    store.acl_map.addUsage(acl_id);
+
+    /// session 1
+    auto session_id = store.getSessionID(30000);
+    ASSERT_FALSE(store.checkPermission(session_id, acl_id, ACL::Read));
+    ASSERT_EQ(store.permission_cache.size(), 1);
+
+    /// closed session or a check racing with close leaves nothing behind
+    auto close_request = std::make_shared<ZooKeeperCloseRequest>();
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    store.processRequest(responses_queue, close_request, session_id, 0, {}, /* check_acl = */ false, /* ignore_response = */ true);
+    ASSERT_EQ(store.permission_cache.size(), 0);
+    ASSERT_FALSE(store.checkPermission(session_id, acl_id, ACL::Read));
+    ASSERT_FALSE(store.checkPermission(session_id + 1, acl_id, ACL::Read));
+    ASSERT_EQ(store.permission_cache.size(), 0);
+}
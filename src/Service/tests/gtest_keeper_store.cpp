@@ -0,0 +1,807 @@
+#include <algorithm>
+#include <tuple>
+#include <IO/ReadBufferFromString.h>
+#include <IO/WriteBufferFromString.h>
+#include <Service/KeeperStore.h>
+#include <gtest/gtest.h>
+
+using namespace Coordination;
+using namespace RK;
+
+namespace
+{
+
+ACLs worldACLs()
+{
+    ACL acl;
+    acl.permissions = ACL::All;
+    acl.scheme = "world";
+    acl.id = "anyone";
+    return {acl};
+}
+
+/// (session, path, event type) of triggered watches
+using WatchEvents = std::vector<std::tuple<int64_t, String, int32_t>>;
+
+/// Process request and return its response, triggered watches are appended to events in sorted order.
+ZooKeeperResponsePtr processRequest(KeeperStore & store, const ZooKeeperRequestPtr & request, WatchEvents & events, int64_t session_id = 1, int64_t time = 0)
+{
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    store.processRequest(responses_queue, request, session_id, time, {}, /* check_acl = */ false);
+
+    ZooKeeperResponsePtr result;
+    WatchEvents new_events;
+    KeeperStore::ResponsesForSessions batch;
+    while (responses_queue.tryPopBatch(0, batch, 1024))
+    {
+        for (const auto & [response_session_id, response] : batch)
+        {
+            if (response->xid == WATCH_XID)
+            {
+                const auto & watch_response = dynamic_cast<const ZooKeeperWatchResponse &>(*response);
+                new_events.emplace_back(response_session_id, watch_response.path, watch_response.type);
+            }
+            else if (response_session_id == session_id && response->xid == request->xid)
+                result = response;
+        }
+        batch.clear();
+    }
+    std::sort(new_events.begin(), new_events.end());
+    events.insert(events.end(), new_events.begin(), new_events.end());
+    return result;
+}
+
+ZooKeeperResponsePtr processRequest(KeeperStore & store, const ZooKeeperRequestPtr & request, int64_t session_id = 1, int64_t time = 0)
+{
+    WatchEvents events;
+    return processRequest(store, request, events, session_id, time);
+}
+
+}
+
+TEST(KeeperStore, getSharesNodeData)
+{
+    KeeperStore store(500);
+    /// session 1
+    store.getSessionID(30000);
+
+    auto create_request = std::make_shared<ZooKeeperCreateRequest>();
+    create_request->path = "/config";
+    create_request->data = String(100000, 'a');
+    create_request->acls = worldACLs();
+    processRequest(store, create_request);
+
+    auto get_request = std::make_shared<ZooKeeperGetRequest>();
+    get_request->path = "/config";
+    get_request->xid = 1;
+    auto response = std::dynamic_pointer_cast<ZooKeeperGetResponse>(processRequest(store, get_request));
+    ASSERT_TRUE(response);
+    ASSERT_EQ(response->error, Error::ZOK);
+
+    /// response references the node payload instead of copying it
+    auto node = store.container.get("/config");
+    ASSERT_EQ(response->shared_data, node->data);
+    ASSERT_TRUE(response->data.empty());
+    ASSERT_EQ(response->getData(), String(100000, 'a'));
+
+    /// serialized in the same way as a copied payload
+    ZooKeeperGetResponse copied;
+    copied.xid = response->xid;
+    copied.zxid = response->zxid;
+    copied.stat = response->stat;
+    copied.data = response->getData();
+    WriteBufferFromOwnString shared_buf;
+    WriteBufferFromOwnString copied_buf;
+    response->write(shared_buf);
+    copied.write(copied_buf);
+    ASSERT_EQ(shared_buf.str(), copied_buf.str());
+
+    /// connection sends the payload between head and tail
+    WriteBufferFromOwnString head;
+    WriteBufferFromOwnString tail;
+    response->writeAroundData(head, tail);
+    ASSERT_EQ(head.str() + *response->shared_data + tail.str(), shared_buf.str());
+
+    /// set replaces the buffer, the response keeps the old payload
+    auto set_request = std::make_shared<ZooKeeperSetRequest>();
+    set_request->path = "/config";
+    set_request->data = "b";
+    set_request->version = -1;
+    set_request->xid = 2;
+    processRequest(store, set_request);
+
+    ASSERT_EQ(node->getData(), "b");
+    ASSERT_NE(response->shared_data, node->data);
+    ASSERT_EQ(response->getData(), String(100000, 'a'));
+}
+
+TEST(KeeperStore, listChildrenSorted)
+{
+    KeeperStore store(500);
+    /// session 1
+    store.getSessionID(30000);
+
+    auto create = [&](const String & path)
+    {
+        auto request = std::make_shared<ZooKeeperCreateRequest>();
+        request->path = path;
+        request->acls = worldACLs();
+        processRequest(store, request);
+    };
+
+    create("/queue");
+    for (const auto * name : {"c", "a", "d", "b", "aa"})
+        create(String("/queue/") + name);
+
+    auto remove_request = std::make_shared<ZooKeeperRemoveRequest>();
+    remove_request->path = "/queue/a";
+    remove_request->version = -1;
+    processRequest(store, remove_request);
+
+    auto list_request = std::make_shared<ZooKeeperListRequest>();
+    list_request->path = "/queue";
+    list_request->xid = 1;
+    auto response = std::dynamic_pointer_cast<ZooKeeperListResponse>(processRequest(store, list_request));
+    ASSERT_TRUE(response);
+    ASSERT_EQ(response->error, Error::ZOK);
+    ASSERT_EQ(response->names, std::vector<String>({"aa", "b", "c", "d"}));
+    ASSERT_EQ(response->stat.numChildren, 4);
+}
+
+TEST(KeeperStore, pagedList)
+{
+    KeeperStore store(500);
+    /// session 1
+    store.getSessionID(30000);
+
+    auto create = [&](const String & path)
+    {
+        auto request = std::make_shared<ZooKeeperCreateRequest>();
+        request->path = path;
+        request->acls = worldACLs();
+        processRequest(store, request);
+    };
+
+    create("/dir");
+    for (int i = 0; i < 25; ++i)
+        create("/dir/task_" + std::to_string(100 + i));
+    create("/dir/lock");
+
+    auto list_page = [&](const String & start_after, int32_t max_count, const String & prefix)
+    {
+        auto request = std::make_shared<ZooKeeperPagedListRequest>();
+        request->path = "/dir";
+        request->start_after = start_after;
+        request->max_count = max_count;
+        request->prefix = prefix;
+        request->xid = 1;
+        return std::dynamic_pointer_cast<ZooKeeperPagedListResponse>(processRequest(store, request));
+    };
+
+    /// page through tasks
+    std::vector<String> names;
+    String cursor;
+    size_t pages = 0;
+    do
+    {
+        auto response = list_page(cursor, 10, "task_");
+        ASSERT_TRUE(response);
+        ASSERT_EQ(response->error, Error::ZOK);
+        ASSERT_EQ(response->stat.numChildren, 26);
+        names.insert(names.end(), response->names.begin(), response->names.end());
+        cursor = response->continuation;
+        ++pages;
+    } while (!cursor.empty());
+
+    ASSERT_EQ(pages, 3);
+    ASSERT_EQ(names.size(), 25);
+    ASSERT_EQ(names.front(), "task_100");
+    ASSERT_EQ(names.back(), "task_124");
+    ASSERT_TRUE(std::is_sorted(names.begin(), names.end()));
+
+    /// whole directory without prefix fits one page
+    auto response = list_page("", 100, "");
+    ASSERT_EQ(response->names.size(), 26);
+    ASSERT_EQ(response->names.front(), "lock");
+    ASSERT_TRUE(response->continuation.empty());
+
+    /// cursor in the middle
+    response = list_page("task_119", 100, "task_");
+    ASSERT_EQ(response->names, std::vector<String>({"task_120", "task_121", "task_122", "task_123", "task_124"}));
+
+    ASSERT_EQ(list_page("", 0, "")->error, Error::ZBADARGUMENTS);
+}
+
+TEST(KeeperStore, subtreeStats)
+{
+    KeeperStore store(500);
+    /// session 1
+    store.getSessionID(30000);
+
+    auto create = [&](const String & path, const String & data)
+    {
+        auto request = std::make_shared<ZooKeeperCreateRequest>();
+        request->path = path;
+        request->data = data;
+        request->acls = worldACLs();
+        processRequest(store, request);
+    };
+
+    auto all_children_number = [&](const String & path)
+    {
+        auto request = std::make_shared<ZooKeeperGetAllChildrenNumberRequest>();
+        request->path = path;
+        request->xid = 1;
+        return std::dynamic_pointer_cast<ZooKeeperGetAllChildrenNumberResponse>(processRequest(store, request));
+    };
+
+    create("/app", "12345");
+    create("/app/a", "abc");
+    create("/app/a/x", "0123456789");
+    create("/app/b", "");
+
+    auto app = store.container.get("/app");
+    auto root = store.container.get("/");
+    ASSERT_EQ(app->descendants, 3);
+    ASSERT_EQ(app->subtree_bytes, 18);
+    ASSERT_EQ(root->descendants, 4);
+    ASSERT_EQ(root->subtree_bytes, 18);
+
+    auto response = all_children_number("/app");
+    ASSERT_TRUE(response);
+    ASSERT_EQ(response->error, Error::ZOK);
+    ASSERT_EQ(response->total_number, 3);
+    ASSERT_EQ(all_children_number("/app/b")->total_number, 0);
+    ASSERT_EQ(all_children_number("/missing")->error, Error::ZNONODE);
+
+    auto set_request = std::make_shared<ZooKeeperSetRequest>();
+    set_request->path = "/app/a/x";
+    set_request->data = "01";
+    set_request->version = -1;
+    processRequest(store, set_request);
+    ASSERT_EQ(store.container.get("/app/a")->subtree_bytes, 5);
+    ASSERT_EQ(app->subtree_bytes, 10);
+
+    auto remove_request = std::make_shared<ZooKeeperRemoveRequest>();
+    remove_request->path = "/app/a/x";
+    remove_request->version = -1;
+    processRequest(store, remove_request);
+    ASSERT_EQ(app->descendants, 2);
+    ASSERT_EQ(app->subtree_bytes, 8);
+    ASSERT_EQ(root->descendants, 3);
+
+    /// counters rebuilt from children are the same as maintained ones
+    app->descendants = 0;
+    app->subtree_bytes = 0;
+    store.buildPathChildren();
+    ASSERT_EQ(app->descendants, 2);
+    ASSERT_EQ(app->subtree_bytes, 8);
+
+    WriteBufferFromOwnString buf;
+    store.dumpHeaviestSubtrees(buf, 1);
+    ASSERT_EQ(buf.str(), "Heaviest subtrees (1):\n/app\t8\t3\n");
+}
+
+/// Fuzzy delta snapshot may remove a parent whose children are removed in an earlier one,
+/// children left from the base snapshot go with it.
+TEST(KeeperStore, removeSubtreeFromDeltaSnapshot)
+{
+    KeeperStore store(500);
+    /// session 1
+    store.getSessionID(30000);
+
+    auto create = [&](const String & path, bool is_ephemeral)
+    {
+        auto request = std::make_shared<ZooKeeperCreateRequest>();
+        request->path = path;
+        request->data = "data";
+        request->is_ephemeral = is_ephemeral;
+        request->acls = worldACLs();
+        processRequest(store, request);
+    };
+
+    create("/app", false);
+    create("/app/a", false);
+    create("/app/a/x", true);
+    create("/app/b", false);
+    create("/other", false);
+
+    auto ttl_request = std::make_shared<ZooKeeperCreateTTLRequest>();
+    ttl_request->path = "/app/a/t";
+    ttl_request->acls = worldACLs();
+    ttl_request->is_ttl = true;
+    ttl_request->ttl = 1000;
+    processRequest(store, ttl_request);
+
+    ASSERT_EQ(store.getTotalEphemeralNodesCount(), 1);
+    ASSERT_EQ(store.getTTLNodesCount(), 1);
+    auto nodes_count = store.getNodesCount();
+    auto root = store.container.get("/");
+    int64_t root_descendants = root->descendants;
+
+    store.removeNodeFromDeltaSnapshot("/app");
+
+    for (const auto * path : {"/app", "/app/a", "/app/a/x", "/app/a/t", "/app/b"})
+        ASSERT_FALSE(store.container.get(path)) << path;
+    ASSERT_EQ(store.getNodesCount(), nodes_count - 5);
+    ASSERT_EQ(store.getTotalEphemeralNodesCount(), 0);
+    ASSERT_EQ(store.getTTLNodesCount(), 0);
+
+    ASSERT_FALSE(root->children.contains("app"));
+    ASSERT_EQ(root->descendants, root_descendants - 5);
+    ASSERT_EQ(root->subtree_bytes, 4);
+}
+
+TEST(KeeperStore, quota)
+{
+    KeeperStore store(500);
+    /// session 1
+    store.getSessionID(30000);
+
+    auto create = [&](const String & path, const String & data)
+    {
+        auto request = std::make_shared<ZooKeeperCreateRequest>();
+        request->path = path;
+        request->data = data;
+        request->acls = worldACLs();
+        request->xid = 1;
+        return processRequest(store, request)->error;
+    };
+
+    /// quota is set like zkCli setquota -N 3 -B 10 /limited does, soft limits are not enforced
+    ASSERT_EQ(create("/zookeeper", ""), Error::ZOK);
+    ASSERT_EQ(create("/zookeeper/quota", ""), Error::ZOK);
+    ASSERT_EQ(create("/zookeeper/quota/limited", ""), Error::ZOK);
+    ASSERT_EQ(create("/zookeeper/quota/limited/zookeeper_limits", "count=1,bytes=1,countHardLimit=3,byteHardLimit=10"), Error::ZOK);
+
+    ASSERT_EQ(create("/limited", "ab"), Error::ZOK);
+    ASSERT_EQ(create("/limited/a", "cd"), Error::ZOK);
+    ASSERT_EQ(create("/limited/b", ""), Error::ZOK);
+    /// count quota includes the quota node itself
+    ASSERT_EQ(create("/limited/c", ""), Error::ZQUOTAEXCEEDED);
+    ASSERT_EQ(create("/limited/a/c", ""), Error::ZQUOTAEXCEEDED);
+    /// sibling path with the same prefix is not limited
+    ASSERT_EQ(create("/limited_other", String(100, 'x')), Error::ZOK);
+
+    auto set = [&](const String & path, const String & data)
+    {
+        auto request = std::make_shared<ZooKeeperSetRequest>();
+        request->path = path;
+        request->data = data;
+        request->version = -1;
+        request->xid = 1;
+        return processRequest(store, request)->error;
+    };
+
+    ASSERT_EQ(set("/limited/b", "123456"), Error::ZOK);
+    ASSERT_EQ(set("/limited/b", "1234567"), Error::ZQUOTAEXCEEDED);
+    /// shrinking is always allowed
+    ASSERT_EQ(set("/limited/a", ""), Error::ZOK);
+    ASSERT_EQ(set("/limited/b", "12345678"), Error::ZOK);
+
+    auto usages = store.getQuotaUsages();
+    ASSERT_EQ(usages.size(), 1);
+    ASSERT_EQ(usages[0].path, "/limited");
+    ASSERT_EQ(usages[0].nodes, 3);
+    ASSERT_EQ(usages[0].bytes, 10);
+
+    /// a multi request over quota is rolled back as a whole
+    auto remove_request = std::make_shared<ZooKeeperRemoveRequest>();
+    remove_request->path = "/limited/a";
+    remove_request->version = -1;
+    auto create_request = std::make_shared<ZooKeeperCreateRequest>();
+    create_request->path = "/limited/c";
+    create_request->data = "123";
+    create_request->acls = worldACLs();
+    auto multi_request = std::make_shared<ZooKeeperMultiRequest>(Requests{remove_request, create_request}, worldACLs());
+    multi_request->xid = 2;
+    auto multi_response = std::dynamic_pointer_cast<ZooKeeperMultiResponse>(processRequest(store, multi_request));
+    ASSERT_TRUE(multi_response);
+    ASSERT_EQ(multi_response->responses[1]->error, Error::ZQUOTAEXCEEDED);
+    ASSERT_TRUE(store.container.get("/limited/a"));
+    ASSERT_EQ(store.getQuotaUsages()[0].nodes, 3);
+
+    /// quota is changed by a replicated request
+    ASSERT_EQ(set("/zookeeper/quota/limited/zookeeper_limits", "countHardLimit=-1,byteHardLimit=-1"), Error::ZOK);
+    ASSERT_EQ(create("/limited/c", "123"), Error::ZOK);
+    ASSERT_EQ(store.getQuotaUsages()[0].quota.max_nodes, 0);
+}
+
+TEST(KeeperStore, parseQuota)
+{
+    auto quota = KeeperStore::parseQuota("count=5,bytes=100,countHardLimit=10,byteHardLimit=1000");
+    ASSERT_EQ(quota.max_nodes, 10);
+    ASSERT_EQ(quota.max_bytes, 1000);
+
+    /// soft limits only, and -1 which means unlimited
+    quota = KeeperStore::parseQuota("count=5,bytes=-1");
+    ASSERT_EQ(quota.max_nodes, 0);
+    ASSERT_EQ(quota.max_bytes, 0);
+    quota = KeeperStore::parseQuota("countHardLimit=-1,byteHardLimit=7");
+    ASSERT_EQ(quota.max_nodes, 0);
+    ASSERT_EQ(quota.max_bytes, 7);
+
+    quota = KeeperStore::parseQuota("");
+    ASSERT_EQ(quota.max_nodes, 0);
+}
+
+TEST(KeeperStore, ttlNode)
+{
+    KeeperStore store(500);
+    /// session 1
+    store.getSessionID(30000);
+
+    auto create_ttl = [&](const String & path, int64_t ttl, int64_t time)
+    {
+        auto request = std::make_shared<ZooKeeperCreateTTLRequest>();
+        request->path = path;
+        request->acls = worldACLs();
+        request->is_ttl = true;
+        request->ttl = ttl;
+        request->xid = 1;
+        return processRequest(store, request, 1, time);
+    };
+
+    auto response = std::dynamic_pointer_cast<ZooKeeperCreate2Response>(create_ttl("/ttl", 1000, 10000));
+    ASSERT_TRUE(response);
+    ASSERT_EQ(response->error, Error::ZOK);
+    ASSERT_TRUE(isTTLEphemeralOwner(response->stat.ephemeralOwner));
+    ASSERT_EQ(ttlFromEphemeralOwner(response->stat.ephemeralOwner), 1000);
+    ASSERT_FALSE(store.container.get("/ttl")->is_ephemeral);
+    ASSERT_EQ(store.getTTLNodesCount(), 1);
+    ASSERT_EQ(store.getTotalEphemeralNodesCount(), 0);
+
+    /// ttl is required by CreateTTL and only accepted by it
+    ASSERT_EQ(create_ttl("/bad", 0, 10000)->error, Error::ZBADARGUMENTS);
+    auto create_request = std::make_shared<ZooKeeperCreateRequest>();
+    create_request->path = "/bad";
+    create_request->acls = worldACLs();
+    create_request->is_ttl = true;
+    create_request->ttl = 1000;
+    create_request->xid = 1;
+    ASSERT_EQ(processRequest(store, create_request)->error, Error::ZBADARGUMENTS);
+
+    /// node with children does not expire
+    create_request = std::make_shared<ZooKeeperCreateRequest>();
+    create_request->path = "/ttl/child";
+    create_request->acls = worldACLs();
+    processRequest(store, create_request, 1, 10000);
+    ASSERT_TRUE(store.getExpiredTTLNodes(10500, 10).empty());
+    ASSERT_TRUE(store.getExpiredTTLNodes(20000, 10).empty());
+
+    auto remove_request = std::make_shared<ZooKeeperRemoveRequest>();
+    remove_request->path = "/ttl/child";
+    remove_request->version = -1;
+    processRequest(store, remove_request);
+    ASSERT_EQ(store.getExpiredTTLNodes(30000, 10), std::vector<String>({"/ttl"}));
+    /// proposed node is not returned again soon
+    ASSERT_TRUE(store.getExpiredTTLNodes(30000, 10).empty());
+
+    auto delete_container = [&](int64_t time)
+    {
+        auto request = std::make_shared<ZooKeeperDeleteContainerRequest>();
+        request->path = "/ttl";
+        request->xid = 1;
+        return processRequest(store, request, 0, time)->error;
+    };
+
+    /// modified after it was found expired, ttl counts from the new mtime
+    auto set_request = std::make_shared<ZooKeeperSetRequest>();
+    set_request->path = "/ttl";
+    set_request->data = "v";
+    set_request->version = -1;
+    processRequest(store, set_request, 1, 30000);
+    ASSERT_EQ(delete_container(30500), Error::ZBADVERSION);
+    ASSERT_TRUE(store.container.get("/ttl"));
+
+    ASSERT_EQ(delete_container(31500), Error::ZOK);
+    ASSERT_FALSE(store.container.get("/ttl"));
+    ASSERT_EQ(store.getTTLNodesCount(), 0);
+    ASSERT_EQ(store.container.get("/")->stat.numChildren, 0);
+}
+
+TEST(KeeperStore, containerNode)
+{
+    KeeperStore store(500);
+    /// session 1 and 2
+    store.getSessionID(30000);
+    store.getSessionID(30000);
+
+    auto create = [&](const String & path, bool is_container, bool is_ephemeral, int64_t session_id)
+    {
+        ZooKeeperRequestPtr request;
+        if (is_container)
+        {
+            auto create_request = std::make_shared<ZooKeeperCreateContainerRequest>();
+            create_request->path = path;
+            create_request->acls = worldACLs();
+            create_request->is_container = true;
+            request = create_request;
+        }
+        else
+        {
+            auto create_request = std::make_shared<ZooKeeperCreateRequest>();
+            create_request->path = path;
+            create_request->acls = worldACLs();
+            create_request->is_ephemeral = is_ephemeral;
+            request = create_request;
+        }
+        request->xid = 1;
+        return processRequest(store, request, session_id);
+    };
+
+    auto delete_container = [&](const String & path)
+    {
+        auto request = std::make_shared<ZooKeeperDeleteContainerRequest>();
+        request->path = path;
+        request->xid = 1;
+        return processRequest(store, request, 0)->error;
+    };
+
+    auto response = std::dynamic_pointer_cast<ZooKeeperCreate2Response>(create("/locks", true, false, 1));
+    ASSERT_TRUE(response);
+    ASSERT_EQ(response->error, Error::ZOK);
+    ASSERT_EQ(response->stat.ephemeralOwner, CONTAINER_EPHEMERAL_OWNER);
+
+    /// container which never had children is kept
+    ASSERT_TRUE(store.getEmptyContainers(10).empty());
+    ASSERT_EQ(delete_container("/locks"), Error::ZBADVERSION);
+
+    /// the last child is removed by closing its session
+    ASSERT_EQ(create("/locks/lock", false, true, 2)->error, Error::ZOK);
+    ASSERT_EQ(store.getTotalEphemeralNodesCount(), 1);
+    auto close_request = std::make_shared<ZooKeeperCloseRequest>();
+    close_request->xid = CLOSE_XID;
+    processRequest(store, close_request, 2);
+    ASSERT_EQ(store.getEmptyContainersCount(), 1);
+    ASSERT_EQ(store.getEmptyContainers(10), std::vector<String>({"/locks"}));
+    ASSERT_EQ(store.getEmptyContainersCount(), 0);
+
+    /// only the leader deletes containers, not a client session
+    auto client_delete = std::make_shared<ZooKeeperDeleteContainerRequest>();
+    client_delete->path = "/locks";
+    client_delete->xid = 1;
+    ASSERT_EQ(processRequest(store, client_delete, 1)->error, Error::ZBADARGUMENTS);
+    auto multi_delete = std::make_shared<ZooKeeperMultiRequest>();
+    multi_delete->requests.push_back(client_delete);
+    multi_delete->xid = 2;
+    processRequest(store, multi_delete, 1);
+    ASSERT_TRUE(store.container.get("/locks"));
+    /// and is not accepted from the wire
+    WriteBufferFromOwnString multi_buf;
+    multi_delete->writeImpl(multi_buf);
+    ReadBufferFromString multi_in(multi_buf.str());
+    ASSERT_ANY_THROW(ZooKeeperMultiRequest().readImpl(multi_in));
+
+    ASSERT_EQ(delete_container("/locks"), Error::ZOK);
+    ASSERT_FALSE(store.container.get("/locks"));
+
+    /// container which got a child again is not returned
+    create("/queue", true, false, 1);
+    create("/queue/a", false, false, 1);
+    auto remove_request = std::make_shared<ZooKeeperRemoveRequest>();
+    remove_request->path = "/queue/a";
+    remove_request->version = -1;
+    processRequest(store, remove_request);
+    ASSERT_EQ(store.getEmptyContainersCount(), 1);
+    create("/queue/b", false, false, 1);
+    /// not tracked any more without asking for empty containers, as on followers
+    ASSERT_EQ(store.getEmptyContainersCount(), 0);
+    ASSERT_TRUE(store.getEmptyContainers(10).empty());
+    ASSERT_EQ(delete_container("/queue"), Error::ZNOTEMPTY);
+
+    /// empty container removed by client is not tracked either
+    create("/tmp", true, false, 1);
+    create("/tmp/a", false, false, 1);
+    for (const auto * path : {"/tmp/a", "/tmp"})
+    {
+        auto request = std::make_shared<ZooKeeperRemoveRequest>();
+        request->path = path;
+        request->version = -1;
+        processRequest(store, request);
+    }
+    ASSERT_FALSE(store.container.get("/tmp"));
+    ASSERT_EQ(store.getEmptyContainersCount(), 0);
+
+    /// empty containers are found again after loading
+    remove_request = std::make_shared<ZooKeeperRemoveRequest>();
+    remove_request->path = "/queue/b";
+    remove_request->version = -1;
+    processRequest(store, remove_request);
+    store.buildPathChildren();
+    ASSERT_EQ(store.getEmptyContainers(10), std::vector<String>({"/queue"}));
+
+    /// container flag is only accepted by CreateContainer
+    auto create_request = std::make_shared<ZooKeeperCreateRequest>();
+    create_request->path = "/bad";
+    create_request->acls = worldACLs();
+    create_request->is_container = true;
+    create_request->xid = 1;
+    ASSERT_EQ(processRequest(store, create_request)->error, Error::ZBADARGUMENTS);
+}
+
+TEST(KeeperStore, multiRead)
+{
+    KeeperStore store(500);
+    /// session 1
+    store.getSessionID(30000);
+
+    for (const auto & [path, data] : std::vector<std::pair<String, String>>{{"/cfg", ""}, {"/cfg/a", "1"}, {"/cfg/b", "2"}})
+    {
+        auto request = std::make_shared<ZooKeeperCreateRequest>();
+        request->path = path;
+        request->data = data;
+        request->acls = worldACLs();
+        processRequest(store, request);
+    }
+
+    auto get_request = std::make_shared<ZooKeeperGetRequest>();
+    get_request->path = "/cfg/a";
+    auto missing_request = std::make_shared<ZooKeeperGetRequest>();
+    missing_request->path = "/missing";
+    auto list_request = std::make_shared<ZooKeeperListRequest>();
+    list_request->path = "/cfg";
+    list_request->has_watch = true;
+    auto exists_request = std::make_shared<ZooKeeperExistsRequest>();
+    exists_request->path = "/cfg/b";
+
+    auto multi_read_request = std::make_shared<ZooKeeperMultiReadRequest>();
+    multi_read_request->requests = {get_request, missing_request, list_request, exists_request};
+    multi_read_request->xid = 1;
+    ASSERT_TRUE(multi_read_request->isReadRequest());
+
+    auto last_zxid = store.zxid.load();
+    auto response = std::dynamic_pointer_cast<ZooKeeperMultiReadResponse>(processRequest(store, multi_read_request));
+    ASSERT_TRUE(response);
+    ASSERT_EQ(response->error, Error::ZOK);
+    ASSERT_EQ(store.zxid.load(), last_zxid);
+
+    /// failure of one sub-request does not affect others
+    ASSERT_EQ(std::dynamic_pointer_cast<ZooKeeperGetResponse>(response->responses[0])->getData(), "1");
+    ASSERT_EQ(response->responses[1]->error, Error::ZNONODE);
+    ASSERT_EQ(std::dynamic_pointer_cast<ZooKeeperListResponse>(response->responses[2])->names, std::vector<String>({"a", "b"}));
+    ASSERT_EQ(std::dynamic_pointer_cast<ZooKeeperExistsResponse>(response->responses[3])->stat.dataLength, 1);
+    ASSERT_EQ(store.getTotalWatchesCount(), 1);
+
+    /// failed sub-request is serialized as an error result
+    WriteBufferFromOwnString out;
+    response->writeImpl(out);
+    ZooKeeperMultiReadResponse read_response(multi_read_request->requests);
+    ReadBufferFromString in(out.str());
+    read_response.readImpl(in);
+    ASSERT_EQ(read_response.error, Error::ZNONODE);
+    ASSERT_EQ(read_response.responses[1]->error, Error::ZNONODE);
+    ASSERT_EQ(std::dynamic_pointer_cast<ZooKeeperGetResponse>(read_response.responses[0])->getData(), "1");
+}
+
+TEST(KeeperStore, addAndRemoveWatches)
+{
+    KeeperStore store(500);
+    /// session 1, 2 and 3
+    for (int i = 0; i < 3; ++i)
+        store.getSessionID(30000);
+
+    auto create = [&](const String & path)
+    {
+        auto request = std::make_shared<ZooKeeperCreateRequest>();
+        request->path = path;
+        request->acls = worldACLs();
+        WatchEvents events;
+        processRequest(store, request, events, 3);
+        return events;
+    };
+    auto set = [&](const String & path)
+    {
+        auto request = std::make_shared<ZooKeeperSetRequest>();
+        request->path = path;
+        request->data = "v";
+        WatchEvents events;
+        processRequest(store, request, events, 3);
+        return events;
+    };
+    auto add_watch = [&](const String & path, AddWatchMode mode, int64_t session_id)
+    {
+        auto request = std::make_shared<ZooKeeperAddWatchRequest>();
+        request->path = path;
+        request->mode = static_cast<int32_t>(mode);
+        return processRequest(store, request, session_id)->error;
+    };
+    auto remove_watches = [&](const String & path, WatcherType type, int64_t session_id)
+    {
+        auto request = std::make_shared<ZooKeeperRemoveWatchesRequest>();
+        request->path = path;
+        request->type = static_cast<int32_t>(type);
+        return processRequest(store, request, session_id)->error;
+    };
+
+    create("/a");
+    ASSERT_EQ(add_watch("/a", AddWatchMode::PERSISTENT, 1), Error::ZOK);
+    ASSERT_EQ(add_watch("/a", AddWatchMode::PERSISTENT_RECURSIVE, 2), Error::ZOK);
+    ASSERT_EQ(add_watch("/a", static_cast<AddWatchMode>(5), 3), Error::ZBADARGUMENTS);
+    ASSERT_EQ(store.getTotalWatchesCount(), 2);
+
+    /// persistent watches are kept after triggering
+    for (int i = 0; i < 2; ++i)
+        ASSERT_EQ(set("/a"), WatchEvents({{1, "/a", Event::CHANGED}, {2, "/a", Event::CHANGED}}));
+
+    /// persistent watch gets children events of the path, recursive one gets events of the subtree
+    ASSERT_EQ(create("/a/b"), WatchEvents({{1, "/a", Event::CHILD}, {2, "/a/b", Event::CREATED}}));
+    ASSERT_EQ(set("/a/b"), WatchEvents({{2, "/a/b", Event::CHANGED}}));
+
+    ASSERT_EQ(remove_watches("/a", WatcherType::CHILDREN, 1), Error::ZOK);
+    ASSERT_EQ(remove_watches("/a", WatcherType::ANY, 1), Error::ZNOWATCHER);
+    ASSERT_EQ(set("/a"), WatchEvents({{2, "/a", Event::CHANGED}}));
+
+    ASSERT_EQ(remove_watches("/a", WatcherType::DATA, 2), Error::ZOK);
+    ASSERT_TRUE(set("/a/b").empty());
+    ASSERT_EQ(store.getTotalWatchesCount(), 0);
+}
+
+TEST(KeeperStore, setWatches2)
+{
+    KeeperStore store(500);
+    /// session 1 and 2
+    store.getSessionID(30000);
+    store.getSessionID(30000);
+
+    auto create = [&](const String & path)
+    {
+        auto request = std::make_shared<ZooKeeperCreateRequest>();
+        request->path = path;
+        request->acls = worldACLs();
+        WatchEvents events;
+        processRequest(store, request, events, 2);
+        return events;
+    };
+
+    create("/a");
+    create("/a/b");
+
+    /// client of session 1 reconnects and restores its watches
+    auto request = std::make_shared<ZooKeeperSetWatches2Request>();
+    request->relative_zxid = store.zxid.load();
+    request->data_watches = {"/a/b"};
+    request->persistent_watches = {"/a"};
+    request->persistent_recursive_watches = {"/a"};
+
+    WriteBufferFromOwnString out;
+    request->writeImpl(out);
+    auto read_request = std::dynamic_pointer_cast<ZooKeeperSetWatches2Request>(ZooKeeperRequestFactory::instance().get(OpNum::SetWatches2));
+    ASSERT_TRUE(read_request);
+    ReadBufferFromString in(out.str());
+    read_request->readImpl(in);
+    ASSERT_EQ(read_request->persistent_recursive_watches, std::vector<String>({"/a"}));
+
+    WatchEvents events;
+    auto last_zxid = store.zxid.load();
+    ASSERT_EQ(processRequest(store, read_request, events)->error, Error::ZOK);
+    /// nothing changed since relative zxid
+    ASSERT_TRUE(events.empty());
+    ASSERT_EQ(store.zxid.load(), last_zxid);
+    ASSERT_EQ(store.getTotalWatchesCount(), 3);
+
+    auto set_request = std::make_shared<ZooKeeperSetRequest>();
+    set_request->path = "/a/b";
+    set_request->data = "v";
+    /// data and recursive watch of the same session deliver one event
+    processRequest(store, set_request, events, 2);
+    ASSERT_EQ(events, WatchEvents({{1, "/a/b", Event::CHANGED}}));
+
+    ASSERT_EQ(create("/a/c"), WatchEvents({{1, "/a", Event::CHILD}, {1, "/a/c", Event::CREATED}}));
+    ASSERT_EQ(store.getTotalWatchesCount(), 2);
+
+    /// missed event is sent to the reconnecting session only, watches of others are kept
+    auto get_request = std::make_shared<ZooKeeperGetRequest>();
+    get_request->path = "/a/c";
+    get_request->has_watch = true;
+    processRequest(store, get_request, 2);
+    ASSERT_EQ(store.getTotalWatchesCount(), 3);
+
+    request = std::make_shared<ZooKeeperSetWatches2Request>();
+    request->relative_zxid = 0;
+    request->data_watches = {"/a/c"};
+    events.clear();
+    processRequest(store, request, events);
+    ASSERT_EQ(events, WatchEvents({{1, "/a/c", Event::CHANGED}}));
+    ASSERT_EQ(store.getTotalWatchesCount(), 3);
+}
@@ -628,6 +628,55 @@ TEST(RaftLog, getEntries)
     cleanDirectory(log_dir);
 }
 
+TEST(RaftLog, verifySegmentFile)
+{
+    std::string log_dir(LOG_DIR + "/11");
+    cleanDirectory(log_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_EQ(log_store->init(250, 3), 0);
+    for (int i = 0; i < 8; i++)
+    {
+        UInt64 term = 1;
+        std::string key("/ck/table/table1");
+        std::string data("CREATE TABLE table1;");
+        LogOpTypePB op = OP_TYPE_CREATE;
+        ASSERT_EQ(appendEntry(log_store, term, op, key, data), i + 1);
+    }
+    log_store->close();
+
+    std::vector<std::string> files;
+    Poco::File(log_dir).list(files);
+    ASSERT_GT(files.size(), 1);
+
+    UInt64 total_entries = 0;
+    std::string path;
+    for (const auto & file : files)
+    {
+        LogSegmentVerifyResult result;
+        ASSERT_TRUE(NuRaftLogSegment::verifyFile(log_dir + "/" + file, result));
+        ASSERT_FALSE(result.truncated);
+        ASSERT_EQ(result.version, CURRENT_LOG_VERSION);
+        total_entries += result.entries;
+        if (result.entries)
+            path = log_dir + "/" + file;
+    }
+    ASSERT_EQ(total_entries, 8);
+
+    /// flip the last byte of data of the last entry
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(-1, std::ios::end);
+        char last = file.get();
+        file.seekp(-1, std::ios::end);
+        file.put(~last);
+    }
+    LogSegmentVerifyResult result;
+    ASSERT_FALSE(NuRaftLogSegment::verifyFile(path, result));
+    ASSERT_GT(result.corrupted_offset, 0);
+
+    cleanDirectory(log_dir);
+}
+
 //#define ASSERT_EQ_LOG(log, v1, v2) \ -
 //    { \ -
 //        if (v1 != v2) \ -
@@ -1,3 +1,5 @@
+#include <filesystem>
+#include <fstream>
 #include <string>
 #include <unordered_map>
 #include <Service/ACLMap.h>
@@ -10,6 +12,8 @@
 #include <Service/tests/raft_test_common.h>
 #include <gtest/gtest.h>
 #include <libnuraft/nuraft.hxx>
+#include <Poco/File.h>
+#include <Common/Stopwatch.h>
 
 using namespace nuraft;
 using namespace RK;
@@ -275,7 +279,7 @@ void assertStateMachineEquals(KeeperStore & storage, KeeperStore & ano_storage)
             /// TODO only compare data
             const auto * l = dynamic_cast<const KeeperNode *>(value.get());
             const auto * r = dynamic_cast<const KeeperNode *>(ano_map.get(key).get());
-            ASSERT_EQ(l->data, r->data);
+            ASSERT_EQ(l->getData(), r->getData());
 //            ASSERT_EQ(*l, *r);
         });
     }
@@ -428,11 +432,89 @@ TEST(RaftSnapshot, readAndSaveSnapshot)
     cleanDirectory(snap_save_dir);
 }
 
+TEST(RaftSnapshot, readAndSaveSnapshotInChunks)
+{
+    std::string snap_read_dir(SNAP_DIR + "/31");
+    std::string snap_save_dir(SNAP_DIR + "/41");
+    cleanDirectory(snap_read_dir);
+    cleanDirectory(snap_save_dir);
+
+    UInt32 last_index = 1024;
+    UInt32 term = 1;
+    KeeperSnapshotManager snap_mgr_read(snap_read_dir, 3, 100);
+    KeeperSnapshotManager snap_mgr_save(snap_save_dir, 3, 100);
+
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+
+    for (int i = 0; i < last_index; i++)
+    {
+        std::string key = std::to_string(i + 1);
+        std::string value = "table_" + key;
+        setNode(store, key, value);
+    }
+    /// object larger than a chunk
+    setNode(store, "large", String(SnapshotChunk::CHUNK_SIZE * 5 / 2, 'x'));
+    snapshot meta(last_index, term, config);
+    snap_mgr_read.createSnapshot(meta, store);
+
+    snap_mgr_save.receiveSnapshot(meta);
+    ulong obj_id = SnapshotChunk::makeId(1, 0);
+    ulong max_chunk_index = 0;
+    while (true)
+    {
+        ulong object_id = SnapshotChunk::objectId(obj_id);
+        String obj_path;
+        if (!snap_mgr_read.getSnapshotObjectPath(meta, object_id, obj_path))
+            break;
+
+        ptr<buffer> chunk;
+        ASSERT_TRUE(KeeperSnapshotStore::readObjectChunk(obj_path, SnapshotChunk::chunkIndex(obj_id), chunk));
+        ASSERT_LE(chunk->size(), SnapshotChunk::HEADER_SIZE + SnapshotChunk::CHUNK_SIZE);
+        max_chunk_index = std::max(max_chunk_index, SnapshotChunk::chunkIndex(obj_id));
+
+        /// corrupted chunk is rejected
+        if (chunk->size() > SnapshotChunk::HEADER_SIZE)
+        {
+            bool last_chunk = false;
+            auto corrupted = buffer::copy(*chunk);
+            corrupted->data_begin()[SnapshotChunk::HEADER_SIZE] ^= 0xff;
+            ASSERT_FALSE(snap_mgr_save.saveSnapshotObjectChunk(meta, object_id, SnapshotChunk::chunkIndex(obj_id), *corrupted, last_chunk));
+        }
+
+        bool last_chunk = false;
+        ASSERT_TRUE(snap_mgr_save.saveSnapshotObjectChunk(meta, object_id, SnapshotChunk::chunkIndex(obj_id), *chunk, last_chunk));
+        obj_id = last_chunk ? SnapshotChunk::makeId(object_id + 1, 0) : SnapshotChunk::makeId(object_id, SnapshotChunk::chunkIndex(obj_id) + 1);
+    }
+
+    for (ulong i = 1; i < SnapshotChunk::objectId(obj_id); i++)
+    {
+        ASSERT_TRUE(snap_mgr_save.existSnapshotObject(meta, i));
+        String read_path;
+        String save_path;
+        ASSERT_TRUE(snap_mgr_read.getSnapshotObjectPath(meta, i, read_path));
+        ASSERT_TRUE(snap_mgr_save.getSnapshotObjectPath(meta, i, save_path));
+        ASSERT_EQ(Poco::File(read_path).getSize(), Poco::File(save_path).getSize());
+
+        std::ifstream read_file(read_path, std::ios::binary);
+        std::ifstream save_file(save_path, std::ios::binary);
+        ASSERT_TRUE(std::equal(
+            std::istreambuf_iterator<char>(read_file), std::istreambuf_iterator<char>(), std::istreambuf_iterator<char>(save_file)));
+    }
+    /// the large object was sent in 3 chunks
+    ASSERT_EQ(max_chunk_index, 2);
+    cleanDirectory(snap_read_dir);
+    cleanDirectory(snap_save_dir);
+}
+
 void parseSnapshot(const SnapshotVersion create_version, const SnapshotVersion parse_version)
 {
     std::string snap_dir(SNAP_DIR + "/5");
     cleanDirectory(snap_dir);
-    KeeperSnapshotManager snap_mgr(snap_dir, 3, 100);
+    /// V2 snapshot is written only when compression is enabled, V3 only when batch index is enabled
+    KeeperSnapshotManager snap_mgr(snap_dir, 3, 100, create_version >= V2 ? 6 : 0, 0, create_version >= V3);
     ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
 
     RaftSettingsPtr raft_settings(RaftSettings::getDefault());
@@ -530,7 +612,7 @@ void parseSnapshot(const SnapshotVersion create_version, const SnapshotVersion p
         {
             auto new_node = new_storage.container.get(it->first);
             ASSERT_TRUE(new_node != nullptr);
-            ASSERT_EQ(new_node->data, it->second->data);
+            ASSERT_EQ(new_node->getData(), it->second->getData());
             if (create_version >= V1 && parse_version >= V1)
             {
                 ASSERT_EQ(new_node->acl_id, it->second->acl_id);
@@ -542,7 +624,7 @@ void parseSnapshot(const SnapshotVersion create_version, const SnapshotVersion p
             ASSERT_EQ(new_node->children, it->second->children);
         }
     }
-    ASSERT_EQ(new_storage.container.get("/1020/test112")->data, "test211");
+    ASSERT_EQ(new_storage.container.get("/1020/test112")->getData(), "test211");
 
     ASSERT_TRUE(true) << "compare container.";
 
@@ -646,6 +728,337 @@ TEST(RaftSnapshot, parseSnapshot)
     parseSnapshot(V0, V0);
     sleep(1); /// snapshot_create_interval minest is 1
     parseSnapshot(V1, V1);
+    sleep(1); /// snapshot_create_interval minest is 1
+    parseSnapshot(V2, V2);
+    sleep(1); /// snapshot_create_interval minest is 1
+    parseSnapshot(V3, V3);
+}
+
+TEST(RaftSnapshot, findNodeInSnapshot)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    for (int i = 1; i <= 1024; i++)
+        setNode(store, std::to_string(i), "table_" + std::to_string(i));
+
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+    snapshot meta(1024, 1, config);
+
+    for (bool with_batch_index : {false, true})
+    {
+        std::string snap_dir(SNAP_DIR + "/36");
+        cleanDirectory(snap_dir);
+        KeeperSnapshotManager snap_mgr(snap_dir, 3, 100, 0, 0, with_batch_index);
+        snap_mgr.createSnapshot(meta, store);
+
+        auto snap_store = snap_mgr.getSnapshotChain(1024).back();
+
+        /// object 4 is the first data object
+        String obj_path;
+        ASSERT_TRUE(snap_mgr.getSnapshotObjectPath(meta, 4, obj_path));
+        SnapshotIndexPB index;
+        ASSERT_EQ(snap_store->loadObjectIndex(obj_path, index), with_batch_index);
+        if (with_batch_index)
+        {
+            ASSERT_GT(index.batches_size(), 0);
+            for (const auto & entry : index.batches())
+            {
+                ASSERT_EQ(entry.batch_type(), SnapshotTypePB::SNAPSHOT_TYPE_DATA);
+                ASSERT_LE(entry.min_key(), entry.max_key());
+            }
+        }
+
+        std::shared_ptr<KeeperNode> node;
+        ASSERT_TRUE(snap_store->findNode("/512", node));
+        ASSERT_TRUE(node != nullptr);
+        ASSERT_EQ(node->getData(), "table_512");
+        ASSERT_EQ(node->stat, store.container.get("/512")->stat);
+        ASSERT_FALSE(snap_store->findNode("/not_exist", node));
+        ASSERT_TRUE(node == nullptr);
+
+        /// objects with index can also be loaded sequentially
+        KeeperStore new_store(raft_settings->dead_session_check_period_ms);
+        ASSERT_TRUE(snap_mgr.parseSnapshot(meta, new_store));
+        ASSERT_EQ(new_store.container.size(), store.container.size());
+        cleanDirectory(snap_dir);
+    }
+}
+
+/// Offline tools read nodes of snapshot objects without loading them into store.
+TEST(RaftSnapshot, scanSnapshotObjects)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    for (int i = 1; i <= 1024; i++)
+        setNode(store, std::to_string(i), "table_" + std::to_string(i), i % 2 == 0, i % 4 + 1);
+
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+    snapshot meta(1024, 1, config);
+
+    std::string snap_dir(SNAP_DIR + "/40");
+    cleanDirectory(snap_dir);
+    KeeperSnapshotManager snap_mgr(snap_dir, 3, 100);
+    snap_mgr.createSnapshot(meta, store);
+
+    KeeperSnapshotManager loaded_mgr(snap_dir, 3, 100);
+    ASSERT_EQ(loaded_mgr.loadSnapshotMetas(), 1);
+    auto snap_store = loaded_mgr.getSnapshots().at(1024);
+
+    size_t nodes = 0;
+    size_t ephemeral_nodes = 0;
+    for (const auto & [_, obj_path] : snap_store->getObjectPaths())
+    {
+        ASSERT_TRUE(snap_store->scanObject(obj_path, [&](const String & path, const KeeperNode * node) {
+            ASSERT_TRUE(node != nullptr);
+            ASSERT_EQ(node->getData(), store.container.get(path)->getData());
+            ++nodes;
+            if (node->stat.ephemeralOwner != 0)
+                ++ephemeral_nodes;
+        }));
+    }
+    ASSERT_EQ(nodes, store.container.size());
+    ASSERT_EQ(ephemeral_nodes, 512);
+    cleanDirectory(snap_dir);
+}
+
+/// Full snapshot followed by two delta snapshots, loading the last one should restore the store.
+TEST(RaftSnapshot, createAndParseDeltaSnapshot)
+{
+    std::string snap_dir(SNAP_DIR + "/33");
+    cleanDirectory(snap_dir);
+    KeeperSnapshotManager snap_mgr(snap_dir, 1, 100, 0, 3);
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    store.changed_paths.enable();
+
+    store.getSessionID(3000);
+    for (int i = 1; i <= 1024; i++)
+        setNode(store, std::to_string(i), "table_" + std::to_string(i));
+
+    snapshot meta1(1024, 1, config);
+    snap_mgr.createSnapshot(meta1, store, store.zxid, store.session_id_counter, store.changed_paths.fetch());
+    ASSERT_EQ(snap_mgr.getSnapshotChain(1024).size(), 1);
+
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    auto process = [&](const Coordination::ZooKeeperRequestPtr & request)
+    {
+        request->xid = 1;
+        store.processRequest(responses_queue, request, 1, 0, {}, /* check_acl = */ false, /* ignore_response = */ true);
+    };
+
+    for (int i = 1; i <= 10; i++)
+    {
+        auto set_request = cs_new<ZooKeeperSetRequest>();
+        set_request->path = "/" + std::to_string(i);
+        set_request->data = "new_table_" + std::to_string(i);
+        process(set_request);
+
+        auto remove_request = cs_new<ZooKeeperRemoveRequest>();
+        remove_request->path = "/" + std::to_string(1024 - i);
+        process(remove_request);
+    }
+    setEphemeralNode(store, "/1/ephemeral", "ephemeral");
+
+    sleep(1); /// snapshot_create_interval minest is 1
+    snapshot meta2(2048, 1, config);
+    snap_mgr.createSnapshot(meta2, store, store.zxid, store.session_id_counter, store.changed_paths.fetch());
+    ASSERT_EQ(snap_mgr.getSnapshotChain(2048).size(), 2);
+
+    /// remove a node created after the full snapshot and its parent
+    auto remove_request = cs_new<ZooKeeperRemoveRequest>();
+    remove_request->path = "/1/ephemeral";
+    process(remove_request);
+    setNode(store, "1/persistent", "persistent");
+    remove_request = cs_new<ZooKeeperRemoveRequest>();
+    remove_request->path = "/2";
+    process(remove_request);
+
+    sleep(1); /// snapshot_create_interval minest is 1
+    snapshot meta3(3072, 1, config);
+    snap_mgr.createSnapshot(meta3, store, store.zxid, store.session_id_counter, store.changed_paths.fetch());
+    ASSERT_EQ(snap_mgr.getSnapshotChain(3072).size(), 3);
+
+    KeeperSnapshotManager new_snap_mgr(snap_dir, 1, 100, 0, 3);
+    ASSERT_EQ(new_snap_mgr.loadSnapshotMetas(), 3);
+    /// base snapshots of the last snapshot are kept
+    ASSERT_EQ(new_snap_mgr.removeSnapshots(), 3);
+
+    KeeperStore new_store(raft_settings->dead_session_check_period_ms);
+    ASSERT_TRUE(new_snap_mgr.parseSnapshot(meta3, new_store));
+
+    assertStateMachineEquals(store, new_store);
+    ASSERT_EQ(new_store.container.get("/1")->getData(), "new_table_1");
+    ASSERT_EQ(new_store.container.get("/1")->children, store.container.get("/1")->children);
+    ASSERT_EQ(new_store.container.get("/")->children, store.container.get("/")->children);
+    ASSERT_TRUE(new_store.container.get("/1014") == nullptr);
+    ASSERT_TRUE(new_store.container.get("/2") == nullptr);
+    ASSERT_TRUE(new_store.container.get("/1/persistent") != nullptr);
+    ASSERT_TRUE(new_store.ephemerals.empty());
+
+    cleanDirectory(snap_dir);
+}
+
+/// Changed paths fetched for a failed delta snapshot are lost, the next snapshot must be a full one.
+TEST(RaftSnapshot, fullSnapshotAfterFailedDelta)
+{
+    std::string snap_dir(SNAP_DIR + "/34");
+    cleanDirectory(snap_dir);
+    KeeperSnapshotManager snap_mgr(snap_dir, 1, 100, 0, 3);
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    store.changed_paths.enable();
+
+    store.getSessionID(3000);
+    for (int i = 1; i <= 128; i++)
+        setNode(store, std::to_string(i), "table_" + std::to_string(i));
+
+    snapshot meta1(1024, 1, config);
+    snap_mgr.createSnapshot(meta1, store, store.zxid, store.session_id_counter, store.changed_paths.fetch());
+
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    auto set = [&](const String & path, const String & data)
+    {
+        auto set_request = cs_new<ZooKeeperSetRequest>();
+        set_request->xid = 1;
+        set_request->path = path;
+        set_request->data = data;
+        store.processRequest(responses_queue, set_request, 1, 0, {}, /* check_acl = */ false, /* ignore_response = */ true);
+    };
+
+    set("/1", "delta_1");
+    sleep(1); /// snapshot_create_interval minest is 1
+    snapshot meta2(2048, 1, config);
+    snap_mgr.createSnapshot(meta2, store, store.zxid, store.session_id_counter, store.changed_paths.fetch());
+    ASSERT_EQ(snap_mgr.getSnapshotChain(2048).size(), 2);
+
+    /// Writing the next delta fails: snapshot directory is replaced by a file
+    set("/2", "lost_in_failed_delta");
+    std::filesystem::rename(snap_dir, snap_dir + ".bak");
+    std::ofstream(snap_dir).put('x');
+    sleep(1);
+    snapshot meta3(3072, 1, config);
+    ASSERT_THROW(snap_mgr.createSnapshot(meta3, store, store.zxid, store.session_id_counter, store.changed_paths.fetch()), Exception);
+    std::filesystem::remove(snap_dir);
+    std::filesystem::rename(snap_dir + ".bak", snap_dir);
+
+    set("/3", "delta_3");
+    sleep(1);
+    snapshot meta4(4096, 1, config);
+    snap_mgr.createSnapshot(meta4, store, store.zxid, store.session_id_counter, store.changed_paths.fetch());
+    ASSERT_EQ(snap_mgr.getSnapshotChain(4096).size(), 1);
+
+    KeeperSnapshotManager new_snap_mgr(snap_dir, 1, 100, 0, 3);
+    new_snap_mgr.loadSnapshotMetas();
+    KeeperStore new_store(raft_settings->dead_session_check_period_ms);
+    ASSERT_TRUE(new_snap_mgr.parseSnapshot(meta4, new_store));
+
+    assertStateMachineEquals(store, new_store);
+    ASSERT_EQ(new_store.container.get("/2")->getData(), "lost_in_failed_delta");
+
+    cleanDirectory(snap_dir);
+}
+
+size_t getDirectorySize(const std::string & dir)
+{
+    size_t size = 0;
+    for (const auto & entry : std::filesystem::directory_iterator(dir))
+        size += entry.file_size();
+    return size;
+}
+
+/// Report size, create time and load time of snapshot under different compression levels.
+TEST(RaftSnapshot, compressedSnapshotSizeAndSpeed)
+{
+    auto * log = &(Poco::Logger::get("Test_RaftSnapshot"));
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+
+    for (int i = 0; i < 100000; i++)
+    {
+        std::string key = std::to_string(i + 1);
+        std::string value = "value_of_node_" + key + "_with_some_repeated_payload_" + std::string(64, 'x');
+        setNode(store, key, value);
+    }
+
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+    snapshot meta(100000, 1, config);
+
+    size_t uncompressed_size = 0;
+    for (UInt32 level : {0, 1, 6, 9})
+    {
+        std::string snap_dir(SNAP_DIR + "/32_" + std::to_string(level));
+        cleanDirectory(snap_dir);
+        KeeperSnapshotManager snap_mgr(snap_dir, 3, 10000, level);
+
+        Stopwatch create_watch;
+        snap_mgr.createSnapshot(meta, store);
+        create_watch.stop();
+
+        size_t size = getDirectorySize(snap_dir);
+        if (level == 0)
+            uncompressed_size = size;
+        else
+            ASSERT_LT(size, uncompressed_size);
+
+        KeeperStore new_store(raft_settings->dead_session_check_period_ms);
+        Stopwatch load_watch;
+        ASSERT_TRUE(snap_mgr.parseSnapshot(meta, new_store));
+        load_watch.stop();
+
+        ASSERT_EQ(new_store.container.size(), store.container.size());
+        ASSERT_EQ(new_store.container.get("/100000")->getData(), store.container.get("/100000")->getData());
+
+        LOG_INFO(
+            log,
+            "Snapshot compression level {}, size {} bytes, create {} ms, load {} ms",
+            level,
+            size,
+            create_watch.elapsedMilliseconds(),
+            load_watch.elapsedMilliseconds());
+        cleanDirectory(snap_dir);
+    }
+}
+
+TEST(RaftSnapshot, throttledSnapshotWrite)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    for (int i = 1; i <= 1024; i++)
+        setNode(store, std::to_string(i), "table_" + std::to_string(i) + std::string(256, 'x'));
+
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+    snapshot meta(1024, 1, config);
+    std::string snap_dir(SNAP_DIR + "/37");
+
+    cleanDirectory(snap_dir);
+    KeeperSnapshotManager snap_mgr(snap_dir, 3, 100);
+    snap_mgr.createSnapshot(meta, store);
+    size_t snapshot_size = getDirectorySize(snap_dir);
+    /// all data goes through the limiter
+    ASSERT_EQ(snap_mgr.getWriteLimiter().getWrittenBytes(), snapshot_size);
+
+    /// takes about 1s with speed limit of half snapshot size per second
+    cleanDirectory(snap_dir);
+    KeeperSnapshotManager throttled_snap_mgr(snap_dir, 3, 100);
+    throttled_snap_mgr.setWriteLimit(snapshot_size / 2, 4096, true);
+    Stopwatch watch;
+    throttled_snap_mgr.createSnapshot(meta, store);
+    watch.stop();
+
+    const auto & limiter = throttled_snap_mgr.getWriteLimiter();
+    ASSERT_EQ(limiter.getWrittenBytes(), snapshot_size);
+    ASSERT_GE(watch.elapsedMilliseconds(), 500);
+    ASSERT_GT(limiter.getStallMicroseconds(), 0);
+    ASSERT_LE(limiter.getBytesPerSecond(), snapshot_size);
+
+    KeeperStore new_store(raft_settings->dead_session_check_period_ms);
+    ASSERT_TRUE(throttled_snap_mgr.parseSnapshot(meta, new_store));
+    ASSERT_EQ(new_store.container.size(), store.container.size());
+    cleanDirectory(snap_dir);
 }
 
 TEST(RaftSnapshot, createSnapshotWithFuzzyLog)
@@ -208,7 +208,7 @@ TEST(RaftStateMachine, appendEntry)
     std::string data("CREATE TABLE table1;");
     createZNode(machine, key, data);
     KeeperNode & node = machine.getNode(key);
-    ASSERT_EQ(node.data, data);
+    ASSERT_EQ(node.getData(), data);
 
     machine.shutdown();
     cleanDirectory(snap_dir);
@@ -231,20 +231,20 @@ TEST(RaftStateMachine, modifyEntry)
     //LogOpTypePB op = OP_TYPE_CREATE;
     createZNode(machine, key, data1);
     KeeperNode & node1 = machine.getNode(key);
-    ASSERT_EQ(node1.data, data1);
+    ASSERT_EQ(node1.getData(), data1);
 
     std::string data2("CREATE TABLE table2;");
     //op = OP_TYPE_SET;
     setZNode(machine, key, data2);
 
     KeeperNode & node2 = machine.getNode(key);
-    ASSERT_EQ(node2.data, data2);
+    ASSERT_EQ(node2.getData(), data2);
 
     removeZNode(machine, key);
     removeZNode(machine, key);
     removeZNode(machine, key);
     KeeperNode & node3 = machine.getNode(key);
-    ASSERT_TRUE(node3.data.empty());
+    ASSERT_TRUE(node3.getData().empty());
 
     machine.shutdown();
     cleanDirectory(snap_dir);
@@ -342,6 +342,90 @@ TEST(RaftStateMachine, syncSnapshot)
     cleanDirectory(snap_dir_2);
 }
 
+TEST(RaftStateMachine, syncSnapshotChunkSaveFailure)
+{
+    std::string snap_dir_1(SNAP_DIR + "/42");
+    std::string snap_dir_2(SNAP_DIR + "/43");
+    cleanDirectory(snap_dir_1);
+    cleanDirectory(snap_dir_2);
+
+    KeeperResponsesQueue queue;
+    RaftSettingsPtr setting_ptr = RaftSettings::getDefault();
+
+    std::mutex new_session_id_callback_mutex;
+    std::unordered_map<int64_t, ptr<std::condition_variable>> new_session_id_callback;
+
+    NuRaftStateMachine machine_source(queue, setting_ptr, snap_dir_1, 0, 3600, 10, 3, new_session_id_callback_mutex, new_session_id_callback);
+    NuRaftStateMachine machine_target(queue, setting_ptr, snap_dir_2, 0, 3600, 10, 3, new_session_id_callback_mutex, new_session_id_callback);
+
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+    UInt64 term = 1;
+    UInt32 last_index = 16;
+    for (auto i = 0; i < last_index; i++)
+    {
+        std::string key = "/" + std::to_string(i + 1);
+        /// every object is larger than a chunk
+        std::string data(SnapshotChunk::CHUNK_SIZE / 4, 'x');
+        createZNode(machine_source, key, data);
+    }
+    snapshot meta(last_index, term, config);
+    machine_source.create_snapshot(meta);
+
+    ptr<buffer> data_out;
+    void * user_snp_ctx;
+    bool is_last_obj = false;
+    ulong obj_id = 0;
+    bool aborted = false;
+    bool retried = false;
+    while (!is_last_obj)
+    {
+        ASSERT_EQ(machine_source.read_logical_snp_obj(meta, user_snp_ctx, obj_id, data_out, is_last_obj), 0);
+
+        if (SnapshotChunk::isChunked(obj_id) && SnapshotChunk::chunkIndex(obj_id) == 1 && !retried)
+        {
+            auto corrupted = buffer::copy(*data_out);
+            corrupted->data_begin()[SnapshotChunk::HEADER_SIZE] ^= 0xff;
+
+            /// First transfer keeps failing and is started again from the dummy object,
+            /// in the second one the chunk is saved when requested again.
+            size_t failures = aborted ? 1 : NuRaftStateMachine::MAX_CHUNK_SAVE_FAILURES;
+            ulong failed_obj_id = obj_id;
+            for (size_t i = 1; i < failures; ++i)
+            {
+                machine_target.save_logical_snp_obj(meta, failed_obj_id, *corrupted, false, is_last_obj);
+                ASSERT_EQ(failed_obj_id, obj_id);
+            }
+
+            if (aborted)
+            {
+                machine_target.save_logical_snp_obj(meta, failed_obj_id, *corrupted, false, is_last_obj);
+                ASSERT_EQ(failed_obj_id, obj_id);
+                retried = true;
+            }
+            else
+            {
+                machine_target.save_logical_snp_obj(meta, failed_obj_id, *corrupted, false, is_last_obj);
+                ASSERT_EQ(failed_obj_id, 0);
+                aborted = true;
+                obj_id = 0;
+                is_last_obj = false;
+                continue;
+            }
+        }
+
+        bool is_first = (obj_id == 0);
+        machine_target.save_logical_snp_obj(meta, obj_id, *(data_out.get()), is_first, is_last_obj);
+    }
+    ASSERT_TRUE(retried);
+    machine_target.apply_snapshot(meta);
+    ASSERT_EQ(machine_target.getStore().container.size(), last_index + 1);
+
+    machine_source.shutdown();
+    machine_target.shutdown();
+    cleanDirectory(snap_dir_1);
+    cleanDirectory(snap_dir_2);
+}
+
 TEST(RaftStateMachine, initStateMachine)
 {
     auto *log = &(Poco::Logger::get("Test_RaftStateMachine"));
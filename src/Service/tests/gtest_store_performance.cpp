@@ -0,0 +1,374 @@
+#include <set>
+#include <thread>
+#include <unordered_set>
+#include <Service/KeeperStore.h>
+#include <boost/container/flat_set.hpp>
+#include <gtest/gtest.h>
+#include <Common/CurrentMemoryTracker.h>
+#include <Common/PooledAllocator.h>
+#include <Common/Stopwatch.h>
+#include <common/logger_useful.h>
+
+using namespace Coordination;
+using namespace RK;
+
+static const int NODE_COUNT = 100000;
+static const int ALLOCATION_NODE_COUNT = 10000;
+
+/// Allocations are counted in debug builds only, and not by operator new if it is not replaced,
+/// e.g. in gcc sanitizer builds.
+static bool allocationsCounted()
+{
+    static void * volatile sink;
+    UInt64 before = CurrentMemoryTracker::getThreadAllocations();
+    sink = ::operator new(64);
+    ::operator delete(sink);
+    return CurrentMemoryTracker::getThreadAllocations() != before;
+}
+
+/// Measure ns/op of every opcode processed by KeeperStore, ACL check included.
+TEST(StorePerformance, perOpcode)
+{
+    Poco::Logger * log = &(Poco::Logger::get("StorePerformance"));
+    KeeperStore store(500);
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    /// session 1
+    store.getSessionID(30000);
+
+    ACL acl;
+    acl.permissions = ACL::All;
+    acl.scheme = "world";
+    acl.id = "anyone";
+
+    std::vector<String> paths;
+    paths.reserve(NODE_COUNT);
+    for (int i = 0; i < NODE_COUNT; ++i)
+        paths.push_back("/bench/node_" + std::to_string(i));
+
+    auto bench = [&](OpNum op_num, const std::function<ZooKeeperRequestPtr(const String &)> & make_request)
+    {
+        std::vector<ZooKeeperRequestPtr> requests;
+        requests.reserve(NODE_COUNT);
+        for (const auto & path : paths)
+            requests.push_back(make_request(path));
+
+        Stopwatch watch;
+        for (const auto & request : requests)
+            store.processRequest(responses_queue, request, 1, 0, {}, /* check_acl = */ true, /* ignore_response = */ true);
+        watch.stop();
+
+        LOG_INFO(log, "{}: {} ns/op", Coordination::toString(op_num), watch.elapsedNanoseconds() / NODE_COUNT);
+    };
+
+    auto create_parent = std::make_shared<ZooKeeperCreateRequest>();
+    create_parent->path = "/bench";
+    create_parent->acls = {acl};
+    store.processRequest(responses_queue, create_parent, 1, 0, {}, /* check_acl = */ false, /* ignore_response = */ true);
+
+    bench(OpNum::Create, [&](const String & path)
+    {
+        auto request = std::make_shared<ZooKeeperCreateRequest>();
+        request->path = path;
+        request->data = "value";
+        request->acls = {acl};
+        return request;
+    });
+    ASSERT_EQ(store.getNodesCount(), NODE_COUNT + 2);
+
+    bench(OpNum::Get, [](const String & path)
+    {
+        auto request = std::make_shared<ZooKeeperGetRequest>();
+        request->path = path;
+        return request;
+    });
+
+    bench(OpNum::Exists, [](const String & path)
+    {
+        auto request = std::make_shared<ZooKeeperExistsRequest>();
+        request->path = path;
+        return request;
+    });
+
+    bench(OpNum::List, [](const String & path)
+    {
+        auto request = std::make_shared<ZooKeeperListRequest>();
+        request->path = path;
+        return request;
+    });
+
+    bench(OpNum::Set, [](const String & path)
+    {
+        auto request = std::make_shared<ZooKeeperSetRequest>();
+        request->path = path;
+        request->data = "new_value";
+        request->version = -1;
+        return request;
+    });
+
+    bench(OpNum::Check, [](const String & path)
+    {
+        auto request = std::make_shared<ZooKeeperCheckRequest>();
+        request->path = path;
+        request->version = 1;
+        return request;
+    });
+
+    bench(OpNum::Remove, [](const String & path)
+    {
+        auto request = std::make_shared<ZooKeeperRemoveRequest>();
+        request->path = path;
+        request->version = -1;
+        return request;
+    });
+    ASSERT_EQ(store.getNodesCount(), 2);
+}
+
+/// Count heap allocations per op of every opcode, from creating the request by
+/// ZooKeeperRequestFactory as the connection handler does to dropping the response.
+TEST(StorePerformance, allocationsPerOpcode)
+{
+    if (!allocationsCounted())
+        GTEST_SKIP() << "allocations are not counted";
+
+    Poco::Logger * log = &(Poco::Logger::get("StorePerformance"));
+    KeeperStore store(500);
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    /// session 1
+    store.getSessionID(30000);
+
+    ACL acl;
+    acl.permissions = ACL::All;
+    acl.scheme = "world";
+    acl.id = "anyone";
+
+    std::vector<String> paths;
+    paths.reserve(ALLOCATION_NODE_COUNT);
+    for (int i = 0; i < ALLOCATION_NODE_COUNT; ++i)
+        paths.push_back("/bench/node_" + std::to_string(i));
+
+    auto bench = [&](OpNum op_num, const std::function<void(ZooKeeperRequest &, const String &)> & fill_request)
+    {
+        UInt64 before = CurrentMemoryTracker::getThreadAllocations();
+        for (const auto & path : paths)
+        {
+            auto request = ZooKeeperRequestFactory::instance().get(op_num);
+            fill_request(*request, path);
+            store.processRequest(responses_queue, request, 1, 0, {}, /* check_acl = */ true, /* ignore_response = */ true);
+        }
+        UInt64 allocations = CurrentMemoryTracker::getThreadAllocations() - before;
+
+        LOG_INFO(log, "{}: {:.2f} allocations/op", Coordination::toString(op_num), static_cast<double>(allocations) / ALLOCATION_NODE_COUNT);
+    };
+
+    auto create_parent = std::make_shared<ZooKeeperCreateRequest>();
+    create_parent->path = "/bench";
+    create_parent->acls = {acl};
+    store.processRequest(responses_queue, create_parent, 1, 0, {}, /* check_acl = */ false, /* ignore_response = */ true);
+
+    bench(OpNum::Create, [&](ZooKeeperRequest & request, const String & path)
+    {
+        auto & create = dynamic_cast<ZooKeeperCreateRequest &>(request);
+        create.path = path;
+        create.data = "value";
+        create.acls = {acl};
+    });
+    ASSERT_EQ(store.getNodesCount(), ALLOCATION_NODE_COUNT + 2);
+
+    bench(OpNum::Get, [](ZooKeeperRequest & request, const String & path) { dynamic_cast<ZooKeeperGetRequest &>(request).path = path; });
+    bench(OpNum::Exists, [](ZooKeeperRequest & request, const String & path) { dynamic_cast<ZooKeeperExistsRequest &>(request).path = path; });
+    bench(OpNum::List, [](ZooKeeperRequest & request, const String & path) { dynamic_cast<ZooKeeperListRequest &>(request).path = path; });
+
+    bench(OpNum::Set, [](ZooKeeperRequest & request, const String & path)
+    {
+        auto & set = dynamic_cast<ZooKeeperSetRequest &>(request);
+        set.path = path;
+        set.data = "new_value";
+        set.version = -1;
+    });
+
+    bench(OpNum::Check, [](ZooKeeperRequest & request, const String & path)
+    {
+        auto & check = dynamic_cast<ZooKeeperCheckRequest &>(request);
+        check.path = path;
+        check.version = 1;
+    });
+
+    bench(OpNum::Remove, [](ZooKeeperRequest & request, const String & path)
+    {
+        auto & remove = dynamic_cast<ZooKeeperRemoveRequest &>(request);
+        remove.path = path;
+        remove.version = -1;
+    });
+    ASSERT_EQ(store.getNodesCount(), 2);
+
+    /// Pools are warmed up, requests and responses never reach the heap any more.
+    const std::vector<OpNum> op_nums = {OpNum::Create, OpNum::Get, OpNum::Exists, OpNum::List, OpNum::Set, OpNum::Check, OpNum::Remove};
+    UInt64 before = CurrentMemoryTracker::getThreadAllocations();
+    for (auto op_num : op_nums)
+    {
+        for (int i = 0; i < ALLOCATION_NODE_COUNT; ++i)
+        {
+            auto request = ZooKeeperRequestFactory::instance().get(op_num);
+            auto response = request->makeResponse();
+        }
+    }
+    ASSERT_EQ(CurrentMemoryTracker::getThreadAllocations() - before, 0);
+}
+
+namespace
+{
+
+struct AllocatedBytes
+{
+    UInt64 bytes = 0;
+    UInt64 allocations = 0;
+};
+
+/// Count bytes requested by a container, allocator overhead of every allocation is not included.
+template <typename T>
+struct CountingAllocator
+{
+    using value_type = T;
+
+    explicit CountingAllocator(AllocatedBytes * counter_) : counter(counter_) { }
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U> & other) : counter(other.counter) { } /// NOLINT
+
+    T * allocate(size_t n)
+    {
+        counter->bytes += n * sizeof(T);
+        ++counter->allocations;
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T * ptr, size_t n)
+    {
+        counter->bytes -= n * sizeof(T);
+        --counter->allocations;
+        ::operator delete(ptr);
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U> & other) const { return counter == other.counter; }
+
+    template <typename U>
+    bool operator!=(const CountingAllocator<U> & other) const { return counter != other.counter; }
+
+    AllocatedBytes * counter;
+};
+
+/// Memory per child and cost of queue-like use: remove the first child and add a new last one
+template <typename Set>
+void benchChildrenSet(Poco::Logger * log, const String & name, size_t children)
+{
+    AllocatedBytes counter;
+    {
+        Set set{typename Set::allocator_type(&counter)};
+        /// Sequential node names, they fit into the string without heap allocation
+        for (size_t i = 0; i < children; ++i)
+            set.insert("node_" + std::to_string(1000000000 + i));
+
+        double bytes_per_child = static_cast<double>(counter.bytes) / children;
+        double allocations_per_child = static_cast<double>(counter.allocations) / children;
+
+        size_t ops = std::min(children, size_t(10000));
+        Stopwatch watch;
+        for (size_t i = 0; i < ops; ++i)
+        {
+            set.erase(set.begin());
+            set.insert("node_" + std::to_string(2000000000 + i));
+        }
+        watch.stop();
+
+        LOG_INFO(
+            log,
+            "{} of {} children: {:.1f} bytes/child, {:.2f} allocations/child, queue pop and push {} ns/op",
+            name,
+            children,
+            bytes_per_child,
+            allocations_per_child,
+            watch.elapsedNanoseconds() / ops);
+    }
+    ASSERT_EQ(counter.bytes, 0);
+}
+
+}
+
+/// ChildrenSet compared with the hash set it replaced and a sorted flat container.
+TEST(StorePerformance, childrenSetMemory)
+{
+    Poco::Logger * log = &(Poco::Logger::get("StorePerformance"));
+
+    static_assert(std::is_same_v<ChildrenSet, std::set<String, std::less<>>>, "Update the benchmark along with ChildrenSet");
+    using Set = std::set<String, std::less<>, CountingAllocator<String>>;
+    using HashSet = std::unordered_set<String, std::hash<String>, std::equal_to<>, CountingAllocator<String>>;
+    using FlatSet = boost::container::flat_set<String, std::less<>, CountingAllocator<String>>;
+
+    for (size_t children : {10, 1000, 100000})
+    {
+        benchChildrenSet<Set>(log, "std::set", children);
+        benchChildrenSet<HashSet>(log, "std::unordered_set", children);
+        benchChildrenSet<FlatSet>(log, "flat_set", children);
+    }
+}
+
+/// makePooled compared with std::make_shared it replaced, every thread allocating
+/// responses in batches. A part of them is freed by the next thread, as responses
+/// created by the request processor are freed by the response sender.
+TEST(StorePerformance, pooledAllocation)
+{
+    Poco::Logger * log = &(Poco::Logger::get("StorePerformance"));
+    static const size_t OBJECTS_PER_THREAD = 1000000;
+    static const size_t WINDOW = 256;
+
+    auto bench = [&](const String & name, size_t threads_num, auto && make)
+    {
+        std::vector<std::vector<ZooKeeperResponsePtr>> handed_over(threads_num);
+        std::vector<std::mutex> mutexes(threads_num);
+
+        Stopwatch watch;
+        std::vector<std::thread> threads;
+        for (size_t thread = 0; thread < threads_num; ++thread)
+        {
+            threads.emplace_back([&, thread]
+            {
+                std::vector<ZooKeeperResponsePtr> window;
+                window.reserve(WINDOW);
+                for (size_t i = 0; i < OBJECTS_PER_THREAD; ++i)
+                {
+                    window.push_back(make());
+                    if (window.size() < WINDOW)
+                        continue;
+
+                    std::vector<ZooKeeperResponsePtr> to_free;
+                    {
+                        std::lock_guard lock(mutexes[thread]);
+                        to_free.swap(handed_over[thread]);
+                    }
+                    to_free.clear();
+
+                    /// Hand over a quarter of the window to the next thread.
+                    size_t next = (thread + 1) % threads_num;
+                    {
+                        std::lock_guard lock(mutexes[next]);
+                        handed_over[next].insert(handed_over[next].end(), window.end() - WINDOW / 4, window.end());
+                    }
+                    window.clear();
+                }
+            });
+        }
+        for (auto & thread : threads)
+            thread.join();
+        watch.stop();
+
+        /// Threads run concurrently, so it is the time of an op in one thread.
+        LOG_INFO(log, "{} threads {}: {} ns/op", name, threads_num, watch.elapsedNanoseconds() / OBJECTS_PER_THREAD);
+    };
+
+    for (size_t threads_num : {1, 4, 16})
+    {
+        bench("std::make_shared", threads_num, [] { return std::make_shared<ZooKeeperGetResponse>(); });
+        bench("makePooled", threads_num, [] { return makePooled<ZooKeeperGetResponse>(); });
+    }
+}
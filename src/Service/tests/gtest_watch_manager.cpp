@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <Service/WatchManager.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(WatchManager, addAndTrigger)
+{
+    WatchManager watch_manager;
+
+    ASSERT_TRUE(watch_manager.addWatch("/a", 1, WatchType::DATA));
+    ASSERT_TRUE(watch_manager.addWatch("/a", 2, WatchType::DATA));
+    /// duplicated registration costs nothing
+    ASSERT_FALSE(watch_manager.addWatch("/a", 1, WatchType::DATA));
+    ASSERT_TRUE(watch_manager.addWatch("/a", 1, WatchType::LIST));
+
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 3);
+    ASSERT_EQ(watch_manager.getWatchedPathsCount(), 2);
+    ASSERT_EQ(watch_manager.getSessionsWithWatchesCount(), 2);
+
+    auto sessions = watch_manager.fetchAndRemoveWatches("/a", WatchType::DATA);
+    std::sort(sessions.begin(), sessions.end());
+    ASSERT_EQ(sessions, WatchManager::SessionIDs({1, 2}));
+
+    ASSERT_FALSE(watch_manager.hasWatches("/a", WatchType::DATA));
+    ASSERT_TRUE(watch_manager.hasWatches("/a", WatchType::LIST));
+
+    /// session 2 has no watches any more
+    ASSERT_EQ(watch_manager.getSessionsWithWatchesCount(), 1);
+    ASSERT_TRUE(watch_manager.fetchAndRemoveWatches("/a", WatchType::DATA).empty());
+}
+
+TEST(WatchManager, removeSessionWatches)
+{
+    WatchManager watch_manager;
+
+    for (int i = 0; i < 100; ++i)
+    {
+        watch_manager.addWatch("/node_" + std::to_string(i), 1, WatchType::DATA);
+        watch_manager.addWatch("/node_" + std::to_string(i), 2, WatchType::LIST);
+    }
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 200);
+
+    watch_manager.removeSessionWatches(1);
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 100);
+    ASSERT_EQ(watch_manager.getWatchedPathsCount(), 100);
+    ASSERT_EQ(watch_manager.getSessionsWithWatchesCount(), 1);
+
+    watch_manager.removeSessionWatches(2);
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 0);
+    ASSERT_EQ(watch_manager.getWatchedPathsCount(), 0);
+    ASSERT_EQ(watch_manager.getSessionsWithWatchesCount(), 0);
+}
+
+TEST(WatchManager, persistentAndRecursiveWatches)
+{
+    WatchManager watch_manager;
+    ASSERT_FALSE(watch_manager.hasRecursiveWatches());
+
+    watch_manager.addWatch("/", 1, WatchType::PERSISTENT_RECURSIVE);
+    watch_manager.addWatch("/a/b", 2, WatchType::PERSISTENT_RECURSIVE);
+    watch_manager.addWatch("/a/b", 3, WatchType::PERSISTENT);
+    ASSERT_TRUE(watch_manager.hasRecursiveWatches());
+
+    WatchManager::SessionIDs sessions;
+    watch_manager.collectRecursiveWatches("/a/b/c", sessions);
+    std::sort(sessions.begin(), sessions.end());
+    ASSERT_EQ(sessions, WatchManager::SessionIDs({1, 2}));
+
+    sessions.clear();
+    watch_manager.collectRecursiveWatches("/a/bc", sessions);
+    ASSERT_EQ(sessions, WatchManager::SessionIDs({1}));
+
+    /// persistent watch is kept after triggering
+    sessions.clear();
+    watch_manager.collectPersistentWatches("/a/b", sessions);
+    watch_manager.collectPersistentWatches("/a/b", sessions);
+    ASSERT_EQ(sessions, WatchManager::SessionIDs({3, 3}));
+
+    ASSERT_TRUE(watch_manager.removeWatch("/a/b", 2, WatchType::PERSISTENT_RECURSIVE));
+    ASSERT_FALSE(watch_manager.removeWatch("/a/b", 2, WatchType::PERSISTENT_RECURSIVE));
+
+    watch_manager.removeSessionWatches(1);
+    ASSERT_FALSE(watch_manager.hasRecursiveWatches());
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 1);
+}
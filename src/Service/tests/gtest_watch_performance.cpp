@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <unordered_set>
+#include <IO/WriteBufferFromString.h>
+#include <Service/KeeperDispatcher.h>
+#include <Service/KeeperStore.h>
+#include <gtest/gtest.h>
+#include <Common/Stopwatch.h>
+#include <common/logger_useful.h>
+
+using namespace Coordination;
+using namespace RK;
+
+static const int WATCHER_COUNT = 10000;
+
+/// Fan out one event to 10K data watchers of a path and deliver it through
+/// KeeperDispatcher response path. Sessions are registered with callbacks which
+/// queue responses like ConnectionHandler::sendResponse does.
+TEST(WatchPerformance, fanOutToManyWatchers)
+{
+    Poco::Logger * log = &(Poco::Logger::get("WatchPerformance"));
+    KeeperStore store(500);
+    auto dispatcher = std::make_shared<KeeperDispatcher>();
+    auto & responses_queue = dispatcher->getResponsesQueue();
+
+    size_t watch_events = 0;
+    std::unordered_set<const String *> serialized_responses;
+    std::vector<std::pair<ZooKeeperResponsePtr, std::shared_ptr<const String>>> pending_responses;
+    pending_responses.reserve(WATCHER_COUNT);
+
+    /// sessions 1 to WATCHER_COUNT, requests of unknown sessions are ignored
+    for (int i = 0; i < WATCHER_COUNT; ++i)
+    {
+        auto session_id = store.getSessionID(30000);
+        dispatcher->registerSession(session_id, [&](const ZooKeeperResponsePtr & response, const std::shared_ptr<const String> & serialized)
+        {
+            if (response->xid == WATCH_XID)
+            {
+                ++watch_events;
+                serialized_responses.insert(serialized.get());
+            }
+            pending_responses.emplace_back(response, serialized);
+            return static_cast<SocketReactor *>(nullptr);
+        });
+    }
+
+    ACL acl;
+    acl.permissions = ACL::All;
+    acl.scheme = "world";
+    acl.id = "anyone";
+
+    auto create_request = std::make_shared<ZooKeeperCreateRequest>();
+    create_request->path = "/watched";
+    create_request->data = "v";
+    create_request->acls = {acl};
+    store.processRequest(responses_queue, create_request, 1, 0, {}, /* check_acl = */ false, /* ignore_response = */ true);
+
+    for (int64_t session_id = 1; session_id <= WATCHER_COUNT; ++session_id)
+    {
+        auto get_request = std::make_shared<ZooKeeperGetRequest>();
+        get_request->path = "/watched";
+        get_request->has_watch = true;
+        store.processRequest(responses_queue, get_request, session_id, 0, {}, /* check_acl = */ false, /* ignore_response = */ true);
+    }
+    ASSERT_EQ(store.getTotalWatchesCount(), WATCHER_COUNT);
+
+    Stopwatch watch;
+    watch.start();
+
+    auto set_request = std::make_shared<ZooKeeperSetRequest>();
+    set_request->path = "/watched";
+    set_request->data = "new_value";
+    set_request->xid = 1;
+    store.processRequest(responses_queue, set_request, 1, 0, {}, /* check_acl = */ false);
+    auto trigger_ms = watch.elapsedMilliseconds();
+
+    KeeperStore::ResponsesForSessions batch;
+    for (size_t shard_id = 0; shard_id < responses_queue.shardCount(); ++shard_id)
+        while (dispatcher->deliverResponses(shard_id, batch, 0))
+            ;
+    watch.stop();
+
+    ASSERT_EQ(watch_events, WATCHER_COUNT);
+    /// all watchers share one serialized event
+    ASSERT_EQ(serialized_responses.size(), 1);
+    ASSERT_NE(*serialized_responses.begin(), nullptr);
+    ASSERT_EQ(store.getTotalWatchesCount(), 0);
+
+    auto it = std::find_if(pending_responses.begin(), pending_responses.end(), [](const auto & pending) { return pending.first->xid == WATCH_XID; });
+    const auto & [watch_response, serialized] = *it;
+    WriteBufferFromOwnString buf;
+    watch_response->write(buf);
+    ASSERT_EQ(buf.str(), *serialized);
+
+    LOG_INFO(
+        log,
+        "Fan out to {} watchers: trigger {} ms, deliver total {} ms, serialized {} bytes",
+        WATCHER_COUNT,
+        trigger_ms,
+        watch.elapsedMilliseconds(),
+        serialized->size());
+}
@@ -0,0 +1,243 @@
+#include <fstream>
+#include <functional>
+#include <IO/WriteBufferFromString.h>
+#include <Service/ZooKeeperDataReader.h>
+#include <Service/ZooKeeperLogTailer.h>
+#include <Service/tests/raft_test_common.h>
+#include <gtest/gtest.h>
+#include <Poco/File.h>
+#include <Common/ZooKeeper/ZooKeeperIO.h>
+#include <zlib.h>
+
+using namespace RK;
+using namespace Coordination;
+
+namespace RK::ErrorCodes
+{
+    extern const int CORRUPTED_DATA;
+}
+
+namespace
+{
+
+const std::string ZK_LOG_DIR = "./test_zookeeper_logs";
+
+void writeLogHeader(WriteBuffer & out)
+{
+    Coordination::write(int32_t(1514884167), out); /// "ZKLG"
+    Coordination::write(int32_t(2), out);
+    Coordination::write(int64_t(0), out);
+}
+
+/// Serialize txn record the same way as ZooKeeper FileTxnLog does, body is written after txn type
+std::string txnRecord(int64_t zxid, int64_t session_id, int32_t type, const std::function<void(WriteBuffer &)> & write_body)
+{
+    WriteBufferFromOwnString txn;
+    Coordination::write(session_id, txn);
+    Coordination::write(int32_t(1), txn); /// xid
+    Coordination::write(zxid, txn);
+    Coordination::write(int64_t(0), txn); /// time
+    Coordination::write(type, txn);
+    write_body(txn);
+    const auto & bytes = txn.str();
+
+    WriteBufferFromOwnString record;
+    auto checksum = adler32(adler32(0L, Z_NULL, 0), reinterpret_cast<const Bytef *>(bytes.data()), bytes.size());
+    Coordination::write(int64_t(checksum), record);
+    Coordination::write(int32_t(bytes.size()), record);
+    record.write(bytes.data(), bytes.size());
+    Coordination::write(int8_t(0x42), record);
+    return record.str();
+}
+
+/// CreateTxn, CreateContainerTxn and CreateTTLTxn start with the same fields
+void writeCreateBody(WriteBuffer & out, const std::string & path)
+{
+    Coordination::write(path, out);
+    Coordination::write(std::string("data"), out);
+    Coordination::write(ACLs{ACL{ACL::All, "world", "anyone"}}, out);
+}
+
+std::string createTxnRecord(int64_t zxid, const std::string & path)
+{
+    return txnRecord(zxid, 1, 1, [&](WriteBuffer & out)
+    {
+        writeCreateBody(out, path);
+        Coordination::write(false, out); /// ephemeral
+        Coordination::write(int32_t(0), out); /// parent cversion
+    });
+}
+
+void writeFile(const std::string & path, const std::string & content)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(content.data(), content.size());
+}
+
+int catchUpErrorCode(ZooKeeperLogTailer & tailer, bool final_pass)
+{
+    try
+    {
+        tailer.catchUp(final_pass);
+    }
+    catch (const Exception & e)
+    {
+        return e.code();
+    }
+    return 0;
+}
+
+}
+
+TEST(ZooKeeperDataReader, tailLogs)
+{
+    Poco::Logger * log = &(Poco::Logger::get("ZooKeeperDataReader"));
+    cleanDirectory(ZK_LOG_DIR);
+    Poco::File(ZK_LOG_DIR).createDirectories();
+
+    WriteBufferFromOwnString header;
+    writeLogHeader(header);
+
+    std::string first_log = header.str() + createTxnRecord(1, "/a") + createTxnRecord(2, "/b");
+    auto third = createTxnRecord(3, "/c");
+
+    /// third record is being written, followed by preallocated zeros
+    writeFile(ZK_LOG_DIR + "/log.1", first_log + third.substr(0, third.size() / 2) + std::string(64, '\0'));
+
+    KeeperStore store(500);
+    ZooKeeperLogTailer tailer(store, ZK_LOG_DIR, log);
+
+    ASSERT_EQ(tailer.catchUp(), 2);
+    ASSERT_TRUE(store.container.get("/b"));
+    ASSERT_FALSE(store.container.get("/c"));
+    ASSERT_EQ(tailer.getCurrentOffset(), first_log.size());
+
+    /// nothing new
+    ASSERT_EQ(tailer.catchUp(), 2);
+
+    first_log += third;
+    writeFile(ZK_LOG_DIR + "/log.1", first_log + std::string(64, '\0'));
+    ASSERT_EQ(tailer.catchUp(), 3);
+    ASSERT_TRUE(store.container.get("/c"));
+
+    /// ZooKeeper rolls to the next log
+    writeFile(ZK_LOG_DIR + "/log.4", header.str() + createTxnRecord(4, "/d"));
+    ASSERT_EQ(tailer.catchUp(), 4);
+    ASSERT_TRUE(store.container.get("/d"));
+    ASSERT_EQ(tailer.getCurrentLog(), ZK_LOG_DIR + "/log.4");
+
+    /// completed log with a truncated record is corrupted
+    KeeperStore another_store(500);
+    writeFile(ZK_LOG_DIR + "/log.1", first_log + third.substr(0, third.size() / 2));
+    ASSERT_ANY_THROW(deserializeLogAndApplyToStore(another_store, ZK_LOG_DIR + "/log.1", 0, true, log));
+
+    cleanDirectory(ZK_LOG_DIR);
+}
+
+TEST(ZooKeeperDataReader, tailCorruptedLog)
+{
+    Poco::Logger * log = &(Poco::Logger::get("ZooKeeperDataReader"));
+    cleanDirectory(ZK_LOG_DIR);
+    Poco::File(ZK_LOG_DIR).createDirectories();
+
+    WriteBufferFromOwnString header;
+    writeLogHeader(header);
+    std::string first_log = header.str() + createTxnRecord(1, "/a");
+    auto second = createTxnRecord(2, "/b");
+
+    /// complete record with wrong checksum is not taken for the one being written
+    auto corrupted = second;
+    /// first txn byte after checksum and length
+    corrupted[12] ^= 0x1;
+    writeFile(ZK_LOG_DIR + "/log.1", first_log + corrupted + std::string(64, '\0'));
+    {
+        KeeperStore store(500);
+        ZooKeeperLogTailer tailer(store, ZK_LOG_DIR, log);
+        ASSERT_EQ(catchUpErrorCode(tailer, false), ErrorCodes::CORRUPTED_DATA);
+        ASSERT_TRUE(store.container.get("/a"));
+        ASSERT_FALSE(store.container.get("/b"));
+    }
+
+    /// record without end marker is being written, but not after ZooKeeper stopped
+    auto truncated = second.substr(0, second.size() - 1);
+    writeFile(ZK_LOG_DIR + "/log.1", first_log + truncated + std::string(64, '\0'));
+    {
+        KeeperStore store(500);
+        ZooKeeperLogTailer tailer(store, ZK_LOG_DIR, log);
+        ASSERT_EQ(catchUpErrorCode(tailer, false), 0);
+        ASSERT_EQ(store.zxid, 1);
+        ASSERT_EQ(catchUpErrorCode(tailer, true), ErrorCodes::CORRUPTED_DATA);
+    }
+
+    /// zero padding after the last record is fine in the final pass
+    writeFile(ZK_LOG_DIR + "/log.1", first_log + second + std::string(64, '\0'));
+    {
+        KeeperStore store(500);
+        ZooKeeperLogTailer tailer(store, ZK_LOG_DIR, log);
+        ASSERT_EQ(catchUpErrorCode(tailer, true), 0);
+        ASSERT_EQ(store.zxid, 2);
+        ASSERT_TRUE(store.container.get("/b"));
+    }
+
+    cleanDirectory(ZK_LOG_DIR);
+}
+
+TEST(ZooKeeperDataReader, containerAndTTLTxns)
+{
+    Poco::Logger * log = &(Poco::Logger::get("ZooKeeperDataReader"));
+    cleanDirectory(ZK_LOG_DIR);
+    Poco::File(ZK_LOG_DIR).createDirectories();
+
+    WriteBufferFromOwnString header;
+    writeLogHeader(header);
+
+    auto create_container = [](int64_t zxid, const std::string & path)
+    {
+        return txnRecord(zxid, 1, 19, [&](WriteBuffer & out)
+        {
+            writeCreateBody(out, path);
+            Coordination::write(int32_t(0), out); /// parent cversion
+        });
+    };
+    auto create_ttl = [](int64_t zxid, const std::string & path, int64_t ttl)
+    {
+        return txnRecord(zxid, 1, 21, [&](WriteBuffer & out)
+        {
+            writeCreateBody(out, path);
+            Coordination::write(int32_t(0), out); /// parent cversion
+            Coordination::write(ttl, out);
+        });
+    };
+    /// Issued by ZooKeeper leader without session
+    auto delete_container = [](int64_t zxid, const std::string & path)
+    {
+        return txnRecord(zxid, 0, 20, [&](WriteBuffer & out) { Coordination::write(path, out); });
+    };
+
+    std::string log_data = header.str() + create_container(1, "/locks") + create_container(2, "/queue") + createTxnRecord(3, "/queue/a")
+        + create_ttl(4, "/ttl", 5000) + create_ttl(5, "/expired_ttl", 1000) + delete_container(6, "/locks")
+        + delete_container(7, "/expired_ttl");
+    writeFile(ZK_LOG_DIR + "/log.1", log_data);
+
+    KeeperStore store(500);
+    deserializeLogAndApplyToStore(store, ZK_LOG_DIR + "/log.1", log);
+    ASSERT_EQ(store.zxid, 7);
+
+    /// ZooKeeper decided to delete them, even though the container never had a child and TTL is not expired here
+    ASSERT_FALSE(store.container.get("/locks"));
+    ASSERT_FALSE(store.container.get("/expired_ttl"));
+
+    auto queue = store.container.get("/queue");
+    ASSERT_TRUE(queue);
+    ASSERT_EQ(queue->stat.ephemeralOwner, CONTAINER_EPHEMERAL_OWNER);
+    ASSERT_TRUE(queue->isContainer());
+    ASSERT_EQ(queue->getData(), "data");
+
+    auto ttl = store.container.get("/ttl");
+    ASSERT_TRUE(ttl);
+    ASSERT_EQ(ttl->stat.ephemeralOwner, ttlToEphemeralOwner(5000));
+    ASSERT_TRUE(ttl->isTTL());
+    ASSERT_EQ(store.getTotalEphemeralNodesCount(), 0);
+
+    cleanDirectory(ZK_LOG_DIR);
+}
@@ -416,6 +416,55 @@ void snapshotVolume(int last_index)
     cleanDirectory(snap_dir);
 }
 
+/// Load the same snapshot several times and report the load speed, ephemeral nodes are spread
+/// over many sessions to exercise building of ephemeral index.
+void snapshotLoad(int node_count)
+{
+    Poco::Logger * log = &(Poco::Logger::get("RaftSnapshot"));
+    std::string snap_dir(SNAP_DIR + "/101");
+    cleanDirectory(snap_dir);
+    KeeperSnapshotManager snap_mgr(snap_dir, 1000000, KeeperSnapshotStore::MAX_OBJECT_NODE_SIZE);
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore storage(raft_settings->dead_session_check_period_ms);
+
+    std::string data(100, 'v');
+    for (int i = 0; i < node_count; i++)
+    {
+        bool is_ephemeral = i % 10 == 0;
+        setNode(storage, std::to_string(i + 1), data, is_ephemeral, is_ephemeral ? i % 1000 + 1 : 0);
+    }
+
+    snapshot meta(node_count, 1, config);
+    snap_mgr.createSnapshot(meta, storage);
+
+    const int rounds = 3;
+    UInt64 total_ms = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        KeeperStore new_storage(raft_settings->dead_session_check_period_ms);
+        auto mem1 = GetProcessMemory();
+        Stopwatch watch;
+        snap_mgr.parseSnapshot(meta, new_storage);
+        watch.stop();
+        auto mem2 = GetProcessMemory();
+
+        total_ms += watch.elapsedMilliseconds();
+        LOG_INFO(
+            log,
+            "Load snapshot round {} : count {}, ephemeral sessions {}, milli second {}, TPS {}, physicalMem {} M",
+            round,
+            new_storage.container.size(),
+            new_storage.ephemerals.size(),
+            watch.elapsedMilliseconds(),
+            1.0 * node_count / std::max<UInt64>(watch.elapsedMilliseconds(), 1) * 1000,
+            1.0 * (mem2.physicalMem - mem1.physicalMem) / 1000000);
+    }
+    LOG_INFO(log, "Load snapshot : count {}, average milli second {}", node_count, total_ms / rounds);
+    cleanDirectory(snap_dir);
+}
+
 int main(int argc, char ** argv)
 {
     if (argc < 2)
@@ -436,5 +485,10 @@ int main(int argc, char ** argv)
         int node_size = atoi(argv[3]);
         snapshotVolume(node_size);
     }
+    else if (strcmp(tag, "snapshotLoad") == 0)
+    {
+        int node_size = atoi(argv[3]);
+        snapshotLoad(node_size);
+    }
     return 0;
 }